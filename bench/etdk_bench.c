@@ -0,0 +1,435 @@
+/*
+ * ETDK - Encrypt-then-Delete-Key
+ * etdk-bench - cipher and end-to-end throughput benchmark
+ *
+ * Output is tab-separated, one result per line, so runs of different
+ * builds or hosts can be compared with diff, join or a spreadsheet:
+ *
+ *   # etdk-bench <version> cpus=<n> openssl=<version> size=<bytes> dir=<path>
+ *   kind  name  chunk  threads  bytes  seconds  mb_s  mb_s_per_core
+ */
+
+#include "etdk.h"
+// cppcheck-suppress-begin missingIncludeSystem
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+// cppcheck-suppress-end missingIncludeSystem
+
+/**
+ * @brief Benchmark settings
+ */
+typedef struct {
+    uint64_t size;        /**< Bytes per file/device test */
+    double seconds;       /**< Minimum run time per cipher test */
+    unsigned int threads; /**< Worker threads for parallel tests */
+    const char *dir;      /**< Directory for the scratch file */
+    const char *only;     /**< Run only this kind (cipher, file, device), or NULL */
+} bench_config_t;
+
+/**
+ * @brief Monotonic time in seconds
+ */
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Print one result line
+ *
+ * @param kind cipher, file or device
+ * @param name Test name
+ * @param chunk Chunk size in bytes (0 if not applicable)
+ * @param threads Threads used
+ * @param bytes Bytes processed
+ * @param seconds Elapsed time
+ */
+static void report(const char *kind, const char *name, size_t chunk, unsigned int threads, uint64_t bytes,
+                   double seconds) {
+    double mb_s = seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0.0;
+    printf("%s\t%s\t%zu\t%u\t%llu\t%.3f\t%.1f\t%.1f\n", kind, name, chunk, threads, (unsigned long long)bytes,
+           seconds, mb_s, mb_s / threads);
+    fflush(stdout);
+}
+
+/**
+ * @brief Measure raw cipher throughput on one core
+ *
+ * Encrypts the same buffer repeatedly for at least cfg->seconds with the
+ * EVP cipher that crypto.c uses for the mode, so the numbers bound what
+ * any I/O engine can reach per worker. XTS is re-tweaked every
+ * ETDK_XTS_DATA_UNIT bytes, as crypto.c does.
+ *
+ * @param cfg Settings
+ * @param name Mode name
+ * @param cipher EVP cipher
+ * @param chunk Bytes per EVP_EncryptUpdate() call
+ * @return 0 on success, -1 on failure
+ */
+static int bench_cipher(const bench_config_t *cfg, const char *name, const EVP_CIPHER *cipher, size_t chunk) {
+    unsigned char key[ETDK_MAX_KEY_SIZE], iv[AES_BLOCK_SIZE];
+    size_t unit = (EVP_CIPHER_mode(cipher) == EVP_CIPH_XTS_MODE) ? ETDK_XTS_DATA_UNIT : chunk;
+    unsigned char *buf = malloc(chunk + EVP_MAX_BLOCK_LENGTH);
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    int status = -1;
+
+    if (!buf || !ctx || RAND_bytes(key, sizeof(key)) != 1 || RAND_bytes(iv, sizeof(iv)) != 1 ||
+        EVP_EncryptInit_ex(ctx, cipher, NULL, key, iv) != 1) {
+        goto out;
+    }
+    memset(buf, 0xA5, chunk);
+
+    uint64_t bytes = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        // Check the clock every 64 MB to keep timing overhead out of the loop
+        for (uint64_t n = 0; n < 64ULL * 1024 * 1024; n += chunk) {
+            for (size_t pos = 0; pos < chunk; pos += unit) {
+                int outlen;
+                if ((unit != chunk && EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv) != 1) ||
+                    EVP_EncryptUpdate(ctx, buf + pos, &outlen, buf + pos, (int)unit) != 1)
+                    goto out;
+            }
+            bytes += chunk;
+        }
+        elapsed = now_seconds() - start;
+    } while (elapsed < cfg->seconds);
+
+    report("cipher", name, chunk, 1, bytes, elapsed);
+    status = 0;
+
+out:
+    OPENSSL_cleanse(key, sizeof(key));
+    EVP_CIPHER_CTX_free(ctx);
+    free(buf);
+    return status;
+}
+
+/**
+ * @brief Measure the kernel crypto engine (AF_ALG) on one core
+ *
+ * Same loop as bench_cipher() through kcrypto_encrypt(), so the rows
+ * compare the kernel's implementation plus the socket round trips with
+ * OpenSSL for the same chunk size.
+ *
+ * @param cfg Settings
+ * @param name Test name
+ * @param mode ETDK_CIPHER_CBC or ETDK_CIPHER_CTR
+ * @param chunk Bytes per kcrypto_encrypt() call
+ * @return 0 on success, -1 on failure
+ */
+static int bench_kernel_cipher(const bench_config_t *cfg, const char *name, etdk_cipher_t mode, size_t chunk) {
+    unsigned char key[AES_KEY_SIZE], iv[AES_BLOCK_SIZE];
+    unsigned char *in = malloc(chunk), *out = malloc(chunk);
+    kcrypto_t *k = NULL;
+    int status = -1;
+
+    if (!in || !out || RAND_bytes(key, sizeof(key)) != 1 || RAND_bytes(iv, sizeof(iv)) != 1 ||
+        kcrypto_open(&k, key, mode, iv) != ETDK_SUCCESS) {
+        goto out;
+    }
+    memset(in, 0xA5, chunk);
+
+    uint64_t bytes = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        for (uint64_t n = 0; n < 64ULL * 1024 * 1024; n += chunk) {
+            if (kcrypto_encrypt(k, in, out, chunk) != ETDK_SUCCESS)
+                goto out;
+            bytes += chunk;
+        }
+        elapsed = now_seconds() - start;
+    } while (elapsed < cfg->seconds);
+
+    report("cipher", name, chunk, 1, bytes, elapsed);
+    status = 0;
+
+out:
+    OPENSSL_cleanse(key, sizeof(key));
+    kcrypto_close(k);
+    free(in);
+    free(out);
+    return status;
+}
+
+/**
+ * @brief Check whether the kernel crypto engine can run here
+ *
+ * Prints a comment line with the reason if not, so the kernel rows are
+ * skipped instead of failing the run.
+ *
+ * @return Non-zero if AF_ALG "cbc(aes)" and "ctr(aes)" can be opened
+ */
+static int kernel_available(void) {
+    unsigned char key[AES_KEY_SIZE] = {0}, iv[AES_BLOCK_SIZE] = {0};
+    const etdk_cipher_t modes[] = {ETDK_CIPHER_CBC, ETDK_CIPHER_CTR};
+
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        kcrypto_t *k = NULL;
+        if (kcrypto_open(&k, key, modes[i], iv) != ETDK_SUCCESS) {
+            printf("# kernel crypto engine unavailable: %s\n", strerror(errno));
+            return 0;
+        }
+        kcrypto_close(k);
+    }
+    return 1;
+}
+
+/**
+ * @brief Fill a scratch file with random data
+ *
+ * @param path File path
+ * @param size Size in bytes
+ * @return 0 on success, -1 on failure
+ */
+static int make_scratch(const char *path, uint64_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+        return -1;
+
+    unsigned char *buf = malloc(ETDK_DEVICE_CHUNK_SIZE);
+    int status = buf ? 0 : -1;
+    for (uint64_t off = 0; status == 0 && off < size; off += ETDK_DEVICE_CHUNK_SIZE) {
+        size_t len = size - off < ETDK_DEVICE_CHUNK_SIZE ? (size_t)(size - off) : ETDK_DEVICE_CHUNK_SIZE;
+        if (RAND_bytes(buf, (int)len) != 1 || platform_pwrite_full(fd, buf, len, off) != ETDK_SUCCESS)
+            status = -1;
+    }
+
+    free(buf);
+    if (fsync(fd) != 0)
+        status = -1;
+    close(fd);
+    return status;
+}
+
+/**
+ * @brief Silence or restore stdout around library calls
+ *
+ * The crypto functions print progress and I/O details to stdout, which
+ * would break the tab-separated output; they are sent to /dev/null.
+ *
+ * @param saved In: -1 to silence, Out: saved descriptor; restores if >= 0
+ */
+static void quiet_stdout(int *saved) {
+    fflush(stdout);
+    if (*saved < 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        *saved = dup(STDOUT_FILENO);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+        }
+    } else {
+        dup2(*saved, STDOUT_FILENO);
+        close(*saved);
+        *saved = -1;
+    }
+}
+
+/**
+ * @brief Kind of end-to-end test
+ */
+typedef enum { RUN_FILE_COPY, RUN_FILE_INPLACE, RUN_DEVICE } run_kind_t;
+
+/**
+ * @brief Run one end-to-end test against the scratch file
+ *
+ * @param cfg Settings
+ * @param path Scratch file (treated as a device image for RUN_DEVICE)
+ * @param kind Test kind
+ * @param name Test name for the report
+ * @param options Engine options
+ * @param threads Threads to report
+ * @return 0 on success, -1 on failure
+ */
+static int bench_run(const bench_config_t *cfg, const char *path, run_kind_t kind, const char *name,
+                     const etdk_options_t *options, unsigned int threads) {
+    crypto_context_t *ctx = malloc(sizeof(crypto_context_t));
+    char out_path[4096];
+    int saved = -1, result;
+
+    if (!ctx || crypto_init(ctx) != ETDK_SUCCESS) {
+        free(ctx);
+        return -1;
+    }
+    ctx->options = *options;
+    snprintf(out_path, sizeof(out_path), "%s.enc", path);
+
+    // Start from a cold page cache for the input where the kernel allows it
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+
+    quiet_stdout(&saved);
+    double start = now_seconds();
+    if (kind == RUN_FILE_COPY)
+        result = crypto_encrypt_file(path, out_path, ctx);
+    else if (kind == RUN_FILE_INPLACE)
+        result = crypto_encrypt_file_inplace(path, ctx);
+    else
+        result = crypto_encrypt_device(path, ctx);
+    double elapsed = now_seconds() - start;
+    quiet_stdout(&saved);
+
+    unlink(out_path);
+    crypto_cleanup(ctx);
+    free(ctx);
+
+    if (result != ETDK_SUCCESS) {
+        fprintf(stderr, "etdk-bench: %s test failed\n", name);
+        return -1;
+    }
+
+    size_t chunk = options->mmap_io ? ETDK_MMAP_WINDOW_SIZE : ETDK_DEVICE_CHUNK_SIZE;
+    report(kind == RUN_DEVICE ? "device" : "file", name, chunk, threads, cfg->size, elapsed);
+    return 0;
+}
+
+/**
+ * @brief Print usage
+ */
+static void print_usage(const char *program_name) {
+    printf("Usage: %s [options]\n\n", program_name);
+    printf("Options:\n");
+    printf("  --size MB       Scratch file size for file/device tests (default: 256)\n");
+    printf("  --seconds S     Minimum time per cipher test (default: 1)\n");
+    printf("  --threads N     Threads for parallel tests (default: online CPUs)\n");
+    printf("  --dir PATH      Directory for the scratch file (default: /dev/shm, else /tmp)\n");
+    printf("  --only KIND     Run only cipher, file or device tests\n");
+    printf("  -h, --help      Show this help message\n\n");
+    printf("Output: tab-separated columns\n");
+    printf("  kind name chunk threads bytes seconds mb_s mb_s_per_core\n");
+}
+
+/**
+ * @brief Parse the command line
+ * @return 0 on success, 1 if help was requested, -1 on invalid usage
+ */
+static int parse_arguments(int argc, char *argv[], bench_config_t *cfg) {
+    for (int i = 1; i < argc; i++) {
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            return 1;
+        } else if (strcmp(argv[i], "--size") == 0 && value) {
+            cfg->size = strtoull(value, NULL, 10) * 1024 * 1024;
+        } else if (strcmp(argv[i], "--seconds") == 0 && value) {
+            cfg->seconds = strtod(value, NULL);
+        } else if (strcmp(argv[i], "--threads") == 0 && value) {
+            cfg->threads = (unsigned int)strtoul(value, NULL, 10);
+        } else if (strcmp(argv[i], "--dir") == 0 && value) {
+            cfg->dir = value;
+        } else if (strcmp(argv[i], "--only") == 0 && value) {
+            cfg->only = value;
+        } else {
+            fprintf(stderr, "etdk-bench: invalid argument %s\n", argv[i]);
+            return -1;
+        }
+        i++;
+    }
+
+    if (cfg->size == 0 || cfg->seconds <= 0 || cfg->threads == 0 || cfg->threads > ETDK_MAX_THREADS) {
+        fprintf(stderr, "etdk-bench: --size, --seconds and --threads must be positive\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Main entry point for etdk-bench
+ */
+int main(int argc, char *argv[]) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    struct stat st;
+    bench_config_t cfg = {256ULL * 1024 * 1024, 1.0, cpus > 0 ? (unsigned int)cpus : 1,
+                          stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode) ? "/dev/shm" : "/tmp", NULL};
+
+    int parsed = parse_arguments(argc, argv, &cfg);
+    if (parsed != 0) {
+        print_usage(argv[0]);
+        return parsed > 0 ? 0 : 1;
+    }
+
+    printf("# etdk-bench %s cpus=%ld openssl=%s size=%llu dir=%s\n", ETDK_VERSION, cpus,
+           OpenSSL_version(OPENSSL_VERSION), (unsigned long long)cfg.size, cfg.dir);
+    int kernel = kernel_available();
+    printf("kind\tname\tchunk\tthreads\tbytes\tseconds\tmb_s\tmb_s_per_core\n");
+
+    int failed = 0;
+
+    if (!cfg.only || strcmp(cfg.only, "cipher") == 0) {
+        const size_t chunks[] = {4096, ETDK_DEVICE_CHUNK_SIZE};
+        for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+            failed |= bench_cipher(&cfg, "aes-256-cbc", EVP_aes_256_cbc(), chunks[c]);
+            failed |= bench_cipher(&cfg, "aes-256-ctr", EVP_aes_256_ctr(), chunks[c]);
+            failed |= bench_cipher(&cfg, "aes-256-xts", EVP_aes_256_xts(), chunks[c]);
+            failed |= bench_cipher(&cfg, "aes-256-gcm", EVP_aes_256_gcm(), chunks[c]);
+            if (kernel) {
+                failed |= bench_kernel_cipher(&cfg, "kernel-aes-256-cbc", ETDK_CIPHER_CBC, chunks[c]);
+                failed |= bench_kernel_cipher(&cfg, "kernel-aes-256-ctr", ETDK_CIPHER_CTR, chunks[c]);
+            }
+        }
+    }
+
+    int want_file = !cfg.only || strcmp(cfg.only, "file") == 0;
+    int want_device = !cfg.only || strcmp(cfg.only, "device") == 0;
+    if (want_file || want_device) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/etdk-bench.%ld", cfg.dir, (long)getpid());
+
+        if (make_scratch(path, cfg.size) != 0) {
+            fprintf(stderr, "etdk-bench: cannot create scratch file %s\n", path);
+            unlink(path);
+            return 1;
+        }
+
+        etdk_options_t opts;
+        if (want_file) {
+            memset(&opts, 0, sizeof(opts));
+            failed |= bench_run(&cfg, path, RUN_FILE_COPY, "copy", &opts, 1);
+            if (kernel) {
+                opts.crypto_engine = ETDK_CRYPTO_KERNEL;
+                failed |= bench_run(&cfg, path, RUN_FILE_COPY, "copy-kernel", &opts, 1);
+                memset(&opts, 0, sizeof(opts));
+            }
+            opts.mmap_io = 1;
+            failed |= bench_run(&cfg, path, RUN_FILE_COPY, "copy-mmap", &opts, 1);
+            memset(&opts, 0, sizeof(opts));
+            opts.queue_depth = ETDK_DEFAULT_QUEUE_DEPTH;
+            failed |= bench_run(&cfg, path, RUN_FILE_COPY, "copy-pipeline", &opts, 1);
+            memset(&opts, 0, sizeof(opts));
+            failed |= bench_run(&cfg, path, RUN_FILE_INPLACE, "inplace", &opts, 1);
+        }
+        if (want_device) {
+            // The scratch file stands in for a device image, as a loop device would
+            memset(&opts, 0, sizeof(opts));
+            failed |= bench_run(&cfg, path, RUN_DEVICE, "sequential", &opts, 1);
+            if (kernel) {
+                opts.crypto_engine = ETDK_CRYPTO_KERNEL;
+                failed |= bench_run(&cfg, path, RUN_DEVICE, "sequential-kernel", &opts, 1);
+                memset(&opts, 0, sizeof(opts));
+            }
+            opts.queue_depth = ETDK_DEFAULT_QUEUE_DEPTH;
+            failed |= bench_run(&cfg, path, RUN_DEVICE, "pipeline", &opts, 1);
+            memset(&opts, 0, sizeof(opts));
+            opts.threads = cfg.threads;
+            failed |= bench_run(&cfg, path, RUN_DEVICE, "threads", &opts, cfg.threads);
+        }
+
+        unlink(path);
+    }
+
+    return failed ? 1 : 0;
+}
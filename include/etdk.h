@@ -3,9 +3,10 @@
  * @brief ETDK - Encrypt-then-Delete-Key (Secure Data Deletion Tool)
  * @details Makes data powerless
  *
- * This header defines the public API for ETDK, a BSI-compliant
+ * This header defines the internal API for ETDK, a BSI-compliant
  * secure data deletion tool that uses the "Encrypt-then-Delete-Key"
- * method to make data permanently irrecoverable.
+ * method to make data permanently irrecoverable. It is not installed;
+ * the exported part of libetdk is etdk_stream.h.
  *
  * @version 1.0.0
  * @author ETDK Contributors
@@ -17,8 +18,15 @@
 // cppcheck-suppress-begin missingIncludeSystem
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 // cppcheck-suppress-end missingIncludeSystem
 
+#include "etdk_stream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /** @brief Version string for ETDK */
 #define ETDK_VERSION "1.0.0"
 
@@ -28,43 +36,284 @@
 /** @brief AES block size in bytes (128 bits) */
 #define AES_BLOCK_SIZE 16
 
+/** @brief Key material held per context: two AES-256 keys for XTS (512 bits) */
+#define ETDK_MAX_KEY_SIZE 64
+
+/** @brief XTS data unit in bytes; the tweak is the unit number (dm-crypt plain64, 4096-byte sectors) */
+#define ETDK_XTS_DATA_UNIT 4096
+
+/** @brief GCM nonce size in bytes (first 12 bytes of the IV) */
+#define ETDK_GCM_NONCE_SIZE 12
+
+/** @brief GCM authentication tag size in bytes (appended to the ciphertext) */
+#define ETDK_GCM_TAG_SIZE 16
+
+/** @brief Default chunk/extent size in bytes (1 MB), see crypto_tune_io() */
+#define ETDK_DEVICE_CHUNK_SIZE (1024 * 1024)
+
+/** @brief Limits for --chunk-size; chunks are multiples of ETDK_CHUNK_ALIGN */
+#define ETDK_MIN_CHUNK_SIZE (64 * 1024)
+#define ETDK_MAX_CHUNK_SIZE (64 * 1024 * 1024)
+#define ETDK_CHUNK_ALIGN 4096
+
+/** @brief Window size for memory-mapped file encryption (64 MB, multiple of the page size) */
+#define ETDK_MMAP_WINDOW_SIZE (64 * 1024 * 1024)
+
+/** @brief Write-out window of buffered output (16 MB), see platform_writeback_advance() */
+#define ETDK_WRITEBACK_WINDOW (16ULL * 1024 * 1024)
+
+/** @brief Files up to this size (256 KB) are encrypted with one read and one write, see crypto_encrypt_small() */
+#define ETDK_SMALL_FILE_SIZE (256 * 1024)
+
+/** @brief Upper limit for --threads */
+#define ETDK_MAX_THREADS 256
+
+/** @brief Page-sized slots of the process-wide key slab, see crypto_secure_alloc() */
+#define ETDK_KEY_SLAB_SLOTS 64
+
+/** @brief Number of cipher modes */
+#define ETDK_CIPHER_COUNT 4
+
+/** @brief Bit for a mode in etdk_options_t.ciphers */
+#define ETDK_CIPHER_BIT(mode) (1u << (mode))
+
 /**
- * @defgroup ReturnCodes Return Codes
- * @brief Status codes returned by ETDK functions
- * @{
+ * @enum etdk_target_t
+ * @brief Kind of target a cipher is selected for (see crypto_select_cipher())
+ */
+typedef enum {
+    ETDK_TARGET_FILE = 0, /**< Regular file encrypted into a new file */
+    ETDK_TARGET_INPLACE,  /**< Regular file overwritten in place */
+    ETDK_TARGET_DEVICE    /**< Block device overwritten in place */
+} etdk_target_t;
+
+/**
+ * @enum etdk_io_engine_t
+ * @brief Engine used by the asynchronous pipeline (see pipeline_run())
+ */
+typedef enum {
+    ETDK_IO_AUTO = 0, /**< io_uring if available, thread engine otherwise */
+    ETDK_IO_URING,    /**< Request io_uring (falls back to threads if unavailable) */
+    ETDK_IO_THREADS   /**< Reader/writer thread engine */
+} etdk_io_engine_t;
+
+/**
+ * @enum etdk_crypto_engine_t
+ * @brief Implementation of AES used by the sequential engines (--crypto-engine)
+ */
+typedef enum {
+    ETDK_CRYPTO_OPENSSL = 0, /**< OpenSSL EVP in user space (default) */
+    ETDK_CRYPTO_KERNEL       /**< Linux kernel crypto API through AF_ALG (CBC and CTR, see kcrypto_open()) */
+} etdk_crypto_engine_t;
+
+/** @brief Default pipeline queue depth when only --io-engine is given */
+#define ETDK_DEFAULT_QUEUE_DEPTH 8
+
+/** @brief Upper limit for --queue-depth */
+#define ETDK_MAX_QUEUE_DEPTH 256
+
+/**
+ * @enum etdk_discard_mode_t
+ * @brief Optional discard stage of the device workflow (--discard)
+ */
+typedef enum {
+    ETDK_DISCARD_OFF = 0, /**< No discard (default) */
+    ETDK_DISCARD_AFTER,   /**< Encrypt the whole device, then discard it */
+    ETDK_DISCARD_HYBRID   /**< Encrypt head/tail metadata regions only, then discard the whole device */
+} etdk_discard_mode_t;
+
+/** @brief Size of the head and tail regions encrypted by --discard=hybrid (64 MB each) */
+#define ETDK_HYBRID_REGION_SIZE (64ULL * 1024 * 1024)
+
+/** @brief Head and tail of the device and of every partition encrypted first by --priority (1 MB each) */
+#define ETDK_PRIORITY_EDGE_SIZE (1024ULL * 1024)
+
+/** @brief Most regions in a priority list (the list is stored in the key file) */
+#define ETDK_PRIORITY_MAX_RANGES 1024
+
+/** @brief Most OFFSET:LENGTH ranges given with --priority */
+#define ETDK_PRIORITY_MAX_USER 16
+
+/**
+ * @enum etdk_verify_mode_t
+ * @brief Read-back check after a device run (--verify)
+ */
+typedef enum {
+    ETDK_VERIFY_OFF = 0, /**< No read-back (default) */
+    ETDK_VERIFY_SAMPLE,  /**< Random sample of blocks: fingerprint and entropy test */
+    ETDK_VERIFY_FULL     /**< Sample, then every block of the encrypted ranges: entropy test */
+} etdk_verify_mode_t;
+
+/**
+ * @enum etdk_progress_format_t
+ * @brief Format of the progress event stream (--progress-format)
+ */
+typedef enum {
+    ETDK_PROGRESS_NONE = 0, /**< No event stream (default) */
+    ETDK_PROGRESS_TEXT,     /**< One line of space-separated fields per event */
+    ETDK_PROGRESS_JSON      /**< One JSON object per line (NDJSON) */
+} etdk_progress_format_t;
+
+/**
+ * @enum platform_discard_t
+ * @brief Discard primitive accepted by the device
  */
+typedef enum {
+    PLATFORM_DISCARD_NONE = 0, /**< Nothing issued */
+    PLATFORM_DISCARD_SECURE,   /**< BLKSECDISCARD */
+    PLATFORM_DISCARD_UNMAP,    /**< BLKDISCARD */
+    PLATFORM_DISCARD_ZEROOUT   /**< BLKZEROOUT */
+} platform_discard_t;
 
-/** @brief Operation completed successfully */
-#define ETDK_SUCCESS 0
+/**
+ * @struct device_range_t
+ * @brief Byte range of a device
+ */
+typedef struct {
+    uint64_t offset; /**< First byte */
+    uint64_t length; /**< Number of bytes */
+} device_range_t;
 
-/** @brief I/O error (file/device access failed) */
-#define ETDK_ERROR_IO -1
+/**
+ * @struct etdk_options_t
+ * @brief Runtime options selected on the command line
+ *
+ * All fields default to 0, which selects the built-in behaviour.
+ */
+typedef struct {
+    unsigned int threads; /**< Worker threads for device encryption (0 = sequential CBC) */
+    int buffered;         /**< Non-zero disables direct I/O for devices */
+    unsigned int queue_depth;   /**< Chunks in flight in the async pipeline (0 = synchronous loop) */
+    etdk_io_engine_t io_engine; /**< Engine for the async pipeline */
+    int in_place;               /**< Non-zero encrypts files in place (AES-256-CTR, no temp file) */
+    int mmap_io;                /**< Non-zero encrypts files through memory-mapped windows */
+    int assume_yes;             /**< Non-zero skips the YES confirmation prompt */
+    etdk_discard_mode_t discard; /**< Discard stage for devices */
+    const char *key_file;        /**< Checkpoint journal holding the key for resumable device runs (NULL = none) */
+    int resume;                  /**< Non-zero continues the run recorded in key_file */
+    unsigned int ciphers;        /**< Modes allowed by --cipher (ETDK_CIPHER_BIT() set, 0 = built-in default) */
+    size_t chunk_size;           /**< Bytes per read/encrypt/write step (0 = ETDK_DEVICE_CHUNK_SIZE) */
+    int tune_queue_depth;        /**< Non-zero lets crypto_tune_io() choose queue_depth */
+    etdk_verify_mode_t verify;   /**< Read-back check for devices */
+    int progress_fd;                        /**< Descriptor receiving progress events (with progress_format) */
+    etdk_progress_format_t progress_format; /**< Event stream format (ETDK_PROGRESS_NONE = no stream) */
+    const char *metrics_file;               /**< JSON stage metrics summary (NULL = none) */
+    const char *metrics_prom;               /**< Prometheus textfile with the same metrics (NULL = none) */
+    int decrypt;             /**< Non-zero recovers plaintext (--decrypt) instead of encrypting */
+    const char *decrypt_key; /**< --key: key in hex as displayed by the run (key-encryption key for containers) */
+    const char *decrypt_iv;  /**< --iv: IV in hex at offset 0, for CBC at decrypt_offset (NULL = chain) */
+    uint64_t decrypt_offset; /**< --offset: first ciphertext byte to recover */
+    uint64_t decrypt_length; /**< --length: bytes to recover (0 = to the end) */
+    int container;           /**< Non-zero writes files as ETDK containers (--container) */
+    int destroy;             /**< Non-zero crypto-erases ETDK containers (--destroy) */
+    etdk_crypto_engine_t crypto_engine; /**< AES implementation of the sequential engines */
+    int overwrite; /**< Non-zero overwrites devices with a keystream, reading nothing (--mode=overwrite) */
+    int priority;  /**< Non-zero encrypts metadata regions before the rest of the device (--priority) */
+    int priority_detect;                   /**< Non-zero adds the regions found by priority_build() */
+    const device_range_t *priority_ranges; /**< Regions given with --priority=OFFSET:LENGTH (caller-owned) */
+    size_t priority_range_count;           /**< Number of priority_ranges */
+} etdk_options_t;
 
-/** @brief Cryptographic operation failed */
-#define ETDK_ERROR_CRYPTO -2
+/**
+ * @struct platform_io_hints_t
+ * @brief I/O geometry of a device or file (0 = unknown)
+ */
+typedef struct {
+    uint32_t logical_block_size; /**< Smallest addressable unit */
+    uint32_t minimum_io_size;    /**< Preferred minimum request (RAID chunk, physical sector) */
+    uint32_t optimal_io_size;    /**< Preferred request size (RAID stripe width, st_blksize for files) */
+    uint32_t max_transfer;       /**< Largest single request (max_sectors_kb) */
+    int rotational;              /**< 1 for spinning disks, 0 for flash, -1 if unknown */
+} platform_io_hints_t;
 
-/** @brief Memory allocation or locking failed */
-#define ETDK_ERROR_MEMORY -3
+/**
+ * @brief Locked buffer arena (opaque, see platform_arena_create())
+ */
+typedef struct platform_arena platform_arena_t;
 
-/** @brief Platform-specific operation failed */
-#define ETDK_ERROR_PLATFORM -4
+/**
+ * @brief Stage metrics of a run (opaque, see metrics_create())
+ */
+typedef struct metrics metrics_t;
 
-/** @} */ // end of ReturnCodes
+/** @brief Upper limit for the data buffer arena of a run (crypto_buffers_create()) */
+#define ETDK_ARENA_MAX_BYTES (256ULL * 1024 * 1024)
 
 /**
  * @struct crypto_context_t
  * @brief Encryption context containing key, IV, and cipher state
  *
  * This structure holds all cryptographic material needed for
- * AES-256-CBC encryption. It MUST be securely wiped after use
+ * AES-256 encryption. It MUST be securely wiped after use
  * using crypto_secure_wipe_key() to prevent key recovery.
  */
 typedef struct {
-    uint8_t key[AES_KEY_SIZE];  /**< 256-bit AES encryption key */
-    uint8_t iv[AES_BLOCK_SIZE]; /**< 128-bit initialization vector */
-    void *cipher_ctx;           /**< OpenSSL cipher context (internal) */
+    uint8_t key[ETDK_MAX_KEY_SIZE]; /**< Key material (AES_KEY_SIZE bytes used, all of it for XTS) */
+    uint8_t iv[AES_BLOCK_SIZE];     /**< 128-bit initialization vector */
+    void *cipher_ctx;               /**< OpenSSL context kept by crypto_encrypt_small() (internal, NULL = none) */
+    etdk_cipher_t mode;             /**< Cipher mode (see crypto_select_cipher()) */
+    etdk_options_t options;         /**< Runtime options (zeroed by crypto_init()) */
+    platform_arena_t *arena;        /**< Chunk buffers shared by all workers (NULL = allocate per run) */
+    crypto_progress_fn progress;    /**< Device progress sink (NULL = engines print progress and status) */
+    void *progress_arg;             /**< Passed to progress */
+    metrics_t *metrics;             /**< Stage timers of the device engines (NULL = off) */
+    uint64_t written;               /**< End of the furthest write to the target of an in-place or device run */
 } crypto_context_t;
 
+/**
+ * @struct platform_io_t
+ * @brief Open device/file handle used by the positional I/O backend
+ *
+ * Direct I/O (O_DIRECT on Linux, F_NOCACHE on macOS) bypasses the page
+ * cache; buffers and lengths must then be multiples of block_size and
+ * should come from platform_alloc_aligned().
+ */
+typedef struct {
+    int fd;              /**< File descriptor opened read/write */
+    int direct;          /**< 1 if direct I/O was enabled at open time */
+    uint32_t block_size; /**< Logical block size in bytes (512 if unknown) */
+} platform_io_t;
+
+/**
+ * @struct platform_writeback_t
+ * @brief Write-out state of one sequentially written output
+ *
+ * Tracks the write cursor in ETDK_WRITEBACK_WINDOW steps: the window just
+ * written is submitted for write-out, the one before it is waited for and
+ * dropped from the page cache (see platform_writeback_advance()).
+ */
+typedef struct {
+    int fd;           /**< Output descriptor, -1 = disabled */
+    int source;       /**< Input descriptor whose pages are dropped too, -1 = none */
+    uint64_t started; /**< Write-out submitted for [0, started) */
+    uint64_t dropped; /**< Written back and dropped for [0, dropped) */
+    int failed;       /**< Non-zero if a write-out reported an error */
+} platform_writeback_t;
+
+/**
+ * @struct pipeline_job_t
+ * @brief Description of one asynchronous read/encrypt/write run
+ *
+ * Chunks of in are read ahead, passed to transform strictly in offset
+ * order from a single thread, and written to out at the same offset.
+ * The transform encrypts in place and may return fewer bytes than it
+ * was given (CBC holding back a partial block); buffers have room for
+ * AES_BLOCK_SIZE extra bytes.
+ */
+typedef struct {
+    const platform_io_t *in;  /**< Source handle (NULL = write-only: the transform fills each chunk) */
+    const platform_io_t *out; /**< Destination handle (may equal in) */
+    uint64_t length;          /**< Bytes to process starting at offset 0 */
+    size_t chunk_size;        /**< Bytes per chunk (multiple of AES_BLOCK_SIZE) */
+    size_t alignment;         /**< Buffer alignment (block size for direct I/O) */
+    unsigned int queue_depth; /**< Chunks in flight */
+    int (*transform)(void *arg, unsigned char *buf, size_t len, uint64_t offset, size_t *outlen);
+    void (*progress)(void *arg, uint64_t processed); /**< Optional, called after each write */
+    void *arg;                                       /**< Passed to transform and progress */
+    platform_arena_t *arena;                         /**< Slot buffers come from here (NULL = heap) */
+    metrics_t *metrics;                              /**< Stage timers and queue occupancy (NULL = off) */
+} pipeline_job_t;
+
 /**
  * @defgroup Crypto Cryptographic Functions
  * @brief AES-256 encryption and secure key management
@@ -81,7 +330,7 @@ int crypto_init(crypto_context_t *ctx);
 /**
  * @brief Generate cryptographically secure random key
  * @param key Buffer to store generated key
- * @param key_size Size of key in bytes (must be AES_KEY_SIZE)
+ * @param key_size Size of key in bytes (1..ETDK_MAX_KEY_SIZE)
  * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
  */
 int crypto_generate_key(uint8_t *key, size_t key_size);
@@ -96,13 +345,221 @@ int crypto_generate_key(uint8_t *key, size_t key_size);
 int crypto_encrypt_file(const char *input_path, const char *output_path, crypto_context_t *ctx);
 
 /**
- * @brief Encrypt block device using AES-256-CBC
- * @param device_path Path to block device (e.g., /dev/sdb)
+ * @brief Encrypt regular file in place using AES-256-CTR
+ *
+ * Overwrites the file's own blocks with pread()/pwrite(). The cipher is
+ * length-preserving, so no temporary file or free space is needed and
+ * the file size does not change. Sets ctx->mode to ETDK_CIPHER_CTR.
+ *
+ * @param path Path to the file
  * @param ctx Initialized crypto context
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO, ETDK_ERROR_MEMORY, or ETDK_ERROR_CRYPTO
+ */
+int crypto_encrypt_file_inplace(const char *path, crypto_context_t *ctx);
+
+/**
+ * @brief Encrypt a small file with one read, one encryption and one write
+ *
+ * Same output as crypto_encrypt_file() for a dense file, without stdio,
+ * chunking or a per-file cipher context: the context is kept in
+ * ctx->cipher_ctx and only re-keyed with the IV of the next file. Nothing
+ * is synced. ctx->mode must not change between calls with the same ctx.
+ *
+ * @param in_fd Input opened for reading
+ * @param out_fd Empty output opened for writing
+ * @param length Input size, at most ETDK_SMALL_FILE_SIZE
+ * @param ctx Crypto context (key, IV, mode; cipher_ctx is set)
+ * @param buf Buffer of ETDK_SMALL_FILE_SIZE + ETDK_CHUNK_ALIGN bytes
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO or ETDK_ERROR_CRYPTO
+ */
+int crypto_encrypt_small(int in_fd, int out_fd, uint64_t length, crypto_context_t *ctx, unsigned char *buf);
+
+/** @brief Magic at the start of an ETDK container */
+#define ETDK_CONTAINER_MAGIC "ETDKCON1"
+
+/** @brief Size of the container header; the payload starts here */
+#define ETDK_CONTAINER_HEADER_SIZE 4096
+
+/** @brief Size of a wrapped 256-bit data key (AES key wrap adds 8 bytes) */
+#define ETDK_CONTAINER_WRAPPED_SIZE 40
+
+/**
+ * @struct etdk_container_header_t
+ * @brief Key slot at the start of an ETDK container (stored with a checksum)
+ *
+ * The payload is encrypted with a random data key that exists only in
+ * wrapped form here. Overwriting this header destroys the payload, no
+ * matter how large it is.
+ */
+typedef struct {
+    char magic[8];                                    /**< ETDK_CONTAINER_MAGIC */
+    uint32_t header_size;                             /**< Payload offset (ETDK_CONTAINER_HEADER_SIZE) */
+    uint32_t mode;                                    /**< etdk_cipher_t of the payload (ETDK_CIPHER_CTR) */
+    uint64_t payload_length;                          /**< Payload bytes (CTR keeps the plaintext length) */
+    uint8_t iv[AES_BLOCK_SIZE];                       /**< Initial counter block of the payload */
+    uint8_t wrapped_key[ETDK_CONTAINER_WRAPPED_SIZE]; /**< Data key wrapped with the key-encryption key */
+    uint8_t digest[32];                               /**< SHA-256 over the fields above */
+} etdk_container_header_t;
+
+/**
+ * @brief Encrypt a file into an ETDK container
+ *
+ * The payload is encrypted with AES-256-CTR under a fresh random data key,
+ * which is stored wrapped (RFC 3394) with ctx->key as the key-encryption key.
+ *
+ * @param input_path Path to input file
+ * @param output_path Path of the container to write
+ * @param ctx Crypto context; its key is the key-encryption key
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO, ETDK_ERROR_MEMORY, or ETDK_ERROR_CRYPTO
+ */
+int crypto_encrypt_container(const char *input_path, const char *output_path, crypto_context_t *ctx);
+
+/**
+ * @brief Check whether a file starts with a valid container header
+ * @param path File path
+ * @return 1 for an ETDK container, 0 otherwise
+ */
+int crypto_container_probe(const char *path);
+
+/**
+ * @brief Read a container header and unwrap its data key
+ *
+ * Replaces the key-encryption key in ctx->key with the data key and sets
+ * ctx->iv and ctx->mode for the payload.
+ *
+ * @param fd Container opened for reading
+ * @param ctx Crypto context holding the key-encryption key
+ * @param header Receives the header
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO (not a container), or ETDK_ERROR_CRYPTO (wrong key)
+ */
+int crypto_container_open(int fd, crypto_context_t *ctx, etdk_container_header_t *header);
+
+/**
+ * @brief Crypto-erase a container: overwrite and discard its header, then delete it
+ *
+ * Takes the same time for any payload size; the payload is never rewritten.
+ *
+ * @param path Container path (refused unless it carries a valid header)
  * @return ETDK_SUCCESS, ETDK_ERROR_IO, or ETDK_ERROR_CRYPTO
  */
+int crypto_destroy_container(const char *path);
+
+/**
+ * @brief Encrypt block device in place
+ *
+ * Uses sequential AES-256-CBC by default. With ctx->options.threads >= 1
+ * the device is split into extents that are encrypted concurrently with
+ * AES-256-CTR; the result does not depend on the number of threads.
+ * With ctx->options.overwrite the device is not read: AES-256-CTR
+ * keystream is written over it and the data is unrecoverable.
+ *
+ * @param device_path Path to block device (e.g., /dev/sdb)
+ * @param ctx Initialized crypto context
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO, ETDK_ERROR_MEMORY, or ETDK_ERROR_CRYPTO
+ */
 int crypto_encrypt_device(const char *device_path, crypto_context_t *ctx);
 
+/**
+ * @brief Get human-readable name of the cipher in use
+ * @param ctx Crypto context
+ * @return Static string such as "AES-256-CBC"
+ */
+const char *crypto_cipher_name(const crypto_context_t *ctx);
+
+/**
+ * @brief Number of key bytes the cipher in use needs (32, or 64 for XTS)
+ * @param ctx Crypto context
+ * @return Key size in bytes
+ */
+size_t crypto_key_size(const crypto_context_t *ctx);
+
+/**
+ * @brief Parse a --cipher list ("cbc", "ctr,xts", "auto", ...) into ETDK_CIPHER_BIT() flags
+ * @param list Comma-separated mode names
+ * @param ciphers Receives the allowed modes
+ * @return ETDK_SUCCESS, or ETDK_ERROR_CRYPTO for an unknown name
+ */
+int crypto_parse_ciphers(const char *list, unsigned int *ciphers);
+
+/**
+ * @brief Choose ctx->mode for a target
+ *
+ * Without --cipher the built-in defaults apply (CBC for files and devices,
+ * CTR for in-place files and --threads/--discard=hybrid devices). With
+ * --cipher, the allowed modes that suit the target are measured on this
+ * CPU and the fastest one is used; the choice is printed. With
+ * --crypto-engine kernel, a mode the kernel engine cannot run (or a
+ * kernel without AF_ALG) switches options.crypto_engine back to OpenSSL.
+ *
+ * @param ctx Crypto context (options.ciphers, options.threads, options.discard, options.crypto_engine)
+ * @param target Kind of target
+ * @return ETDK_SUCCESS, or ETDK_ERROR_CRYPTO if no allowed mode suits the target
+ */
+int crypto_select_cipher(crypto_context_t *ctx, etdk_target_t target);
+
+/**
+ * @brief Choose chunk size and queue depth for a target from its I/O geometry
+ *
+ * Fills options.chunk_size unless --chunk-size set it, and options.queue_depth
+ * if options.tune_queue_depth is set; prints the values chosen.
+ *
+ * @param ctx Crypto context (options updated)
+ * @param path Device or file (for batch runs, one of the files)
+ */
+void crypto_tune_io(crypto_context_t *ctx, const char *path);
+
+/**
+ * @brief Preallocate the chunk buffers of a run in one locked arena (ctx->arena)
+ *
+ * Call after crypto_tune_io(). Sized for max(queue_depth, 2) buffers per
+ * worker; prints the arena chosen unless ctx->progress is set. Failure
+ * leaves ctx->arena NULL and buffers are then allocated per run.
+ *
+ * @param ctx Crypto context
+ * @param workers Number of threads that encrypt concurrently
+ */
+void crypto_buffers_create(crypto_context_t *ctx, unsigned int workers);
+
+/**
+ * @brief Wipe and release ctx->arena (also done by crypto_cleanup())
+ * @param ctx Crypto context
+ */
+void crypto_buffers_destroy(crypto_context_t *ctx);
+
+/**
+ * @brief Derive a per-target IV: first 16 bytes of SHA-256(ctx->iv || label)
+ * @param ctx Crypto context holding the base IV
+ * @param label Target identifier (file path as given)
+ * @param iv_out Buffer of AES_BLOCK_SIZE bytes for the derived IV
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+int crypto_derive_iv(const crypto_context_t *ctx, const char *label, uint8_t *iv_out);
+
+/**
+ * @brief Decode a key or IV given in hex
+ * @param hex Hex digits without separators
+ * @param out Receives the bytes
+ * @param size Expected number of bytes
+ * @return ETDK_SUCCESS, or ETDK_ERROR_CRYPTO if hex is not exactly size bytes of hex
+ */
+int crypto_parse_hex(const char *hex, uint8_t *out, size_t size);
+
+/**
+ * @brief Decrypt one extent of ciphertext in place, independently of all others
+ *
+ * No padding is removed and a GCM tag is not checked. CBC needs offset and
+ * len in whole AES blocks, XTS an offset in whole data units.
+ *
+ * @param ctx Crypto context (key, IV, mode)
+ * @param buf Ciphertext in, plaintext out
+ * @param len Length
+ * @param offset Byte offset of buf[0] in the ciphertext
+ * @param chain CBC: the ciphertext block before offset, or NULL to use ctx->iv
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+int crypto_decrypt_extent(const crypto_context_t *ctx, unsigned char *buf, size_t len, uint64_t offset,
+                          const uint8_t *chain);
+
 /**
  * @brief Display encryption key in hexadecimal (ONE TIME ONLY)
  * @param ctx Crypto context containing key to display
@@ -122,6 +579,27 @@ int crypto_secure_wipe_key(crypto_context_t *ctx);
  */
 void crypto_cleanup(crypto_context_t *ctx);
 
+/**
+ * @brief Allocate zeroed, locked memory for an object holding key material (thread-safe)
+ *
+ * Objects up to a page come from one process-wide slab that is locked
+ * once (ETDK_KEY_SLAB_SLOTS slots); larger ones, or all once the slab is
+ * full, get pages of their own that are locked individually. No locked
+ * page is ever shared with other memory, so releasing one object never
+ * unlocks another object's key.
+ *
+ * @param len Bytes needed
+ * @return Memory, or NULL on failure
+ */
+void *crypto_secure_alloc(size_t len);
+
+/**
+ * @brief Wipe and release memory from crypto_secure_alloc()
+ * @param ptr Memory (may be NULL)
+ * @param len Length passed to crypto_secure_alloc()
+ */
+void crypto_secure_free(void *ptr, size_t len);
+
 /** @} */ // end of Crypto
 
 /**
@@ -138,6 +616,32 @@ void crypto_cleanup(crypto_context_t *ctx);
  */
 int platform_get_device_size(const char *device_path, uint64_t *size);
 
+/**
+ * @brief Read a block queue limit from /sys/dev/block/<maj>:<min>/queue (Linux)
+ * @param device_path Path to block device (partitions use the parent disk's queue)
+ * @param attr Attribute name, e.g. "discard_granularity"
+ * @param value Pointer to store the value
+ * @return ETDK_SUCCESS or ETDK_ERROR_PLATFORM if unavailable
+ */
+int platform_get_queue_limit(const char *device_path, const char *attr, uint64_t *value);
+
+/**
+ * @brief Discard a device range with BLKSECDISCARD, BLKDISCARD or BLKZEROOUT
+ * @param device_path Path to block device
+ * @param offset First byte
+ * @param length Number of bytes
+ * @param used Receives the primitive the device accepted
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO, or ETDK_ERROR_PLATFORM if none is supported
+ */
+int platform_discard_device(const char *device_path, uint64_t offset, uint64_t length, platform_discard_t *used);
+
+/**
+ * @brief Get human-readable name of a discard primitive
+ * @param method Primitive
+ * @return Static string
+ */
+const char *platform_discard_name(platform_discard_t method);
+
 /**
  * @brief Check if path points to a block device
  * @param path Path to check
@@ -145,6 +649,13 @@ int platform_get_device_size(const char *device_path, uint64_t *size);
  */
 int platform_is_device(const char *path);
 
+/**
+ * @brief Check if path points to a directory (symlinks not followed)
+ * @param path Path to check
+ * @return 1 if directory, 0 otherwise
+ */
+int platform_is_directory(const char *path);
+
 /**
  * @brief Lock memory pages to prevent swapping to disk
  * @param addr Starting address of memory region
@@ -161,6 +672,896 @@ int platform_lock_memory(void *addr, size_t len);
  */
 int platform_unlock_memory(void *addr, size_t len);
 
-/** @} */ // end of Platform
+/**
+ * @brief Read exactly len bytes at offset (retries short reads and EINTR)
+ * @param fd Open file descriptor
+ * @param buf Destination buffer
+ * @param len Number of bytes to read
+ * @param offset Absolute byte offset
+ * @return Bytes read (less than len only at end of file), or -1 on error
+ */
+int64_t platform_pread_full(int fd, void *buf, size_t len, uint64_t offset);
+
+/**
+ * @brief Write exactly len bytes at offset (retries short writes and EINTR)
+ * @param fd Open file descriptor
+ * @param buf Source buffer
+ * @param len Number of bytes to write
+ * @param offset Absolute byte offset
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+int platform_pwrite_full(int fd, const void *buf, size_t len, uint64_t offset);
+
+/**
+ * @brief Get the number of bytes a file occupies on disk (st_blocks * 512)
+ * @param fd Open file descriptor
+ * @param bytes Receives the allocated size
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+int platform_allocated_size(int fd, uint64_t *bytes);
+
+/**
+ * @brief Check whether a file has holes (SEEK_HOLE before its end)
+ * @param fd Open file descriptor (its file offset is preserved)
+ * @param length Apparent file size
+ * @return Non-zero if a hole starts before length, 0 otherwise or without hole support
+ */
+int platform_has_holes(int fd, uint64_t length);
+
+/**
+ * @brief Find the next data range of a sparse file (SEEK_DATA/SEEK_HOLE)
+ * @param fd Open file descriptor
+ * @param from Offset to search from
+ * @param length Apparent file size
+ * @param start Receives the range start
+ * @param end Receives the range end (exclusive)
+ * @return 1 if found, 0 if no data remains, -1 on error
+ */
+int platform_next_data(int fd, uint64_t from, uint64_t length, uint64_t *start, uint64_t *end);
+
+/**
+ * @brief Get logical block size of a device
+ * @param device_path Path to device
+ * @param block_size Pointer to store block size (512 for regular files)
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+int platform_get_block_size(const char *device_path, uint32_t *block_size);
+
+/**
+ * @brief Read the I/O geometry of a device (sysfs queue limits) or file (st_blksize)
+ * @param path Path to device or file
+ * @param hints Receives the geometry; unknown fields are 0 (rotational -1)
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO if path cannot be examined
+ */
+int platform_get_io_hints(const char *path, platform_io_hints_t *hints);
+
+/**
+ * @brief Open a device or file for positional read/write I/O
+ * @param io Handle to initialize
+ * @param path Path to device or file
+ * @param direct Non-zero to request direct I/O (falls back to buffered I/O)
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+int platform_io_open(platform_io_t *io, const char *path, int direct);
+
+/**
+ * @brief Read from an I/O handle, dropping to buffered I/O if direct I/O is rejected
+ * @param io Open handle
+ * @param buf Destination buffer
+ * @param len Number of bytes to read
+ * @param offset Absolute byte offset
+ * @return Bytes read (short only at end of device), or -1 on error
+ */
+int64_t platform_io_read(const platform_io_t *io, void *buf, size_t len, uint64_t offset);
+
+/**
+ * @brief Write to an I/O handle, dropping to buffered I/O if direct I/O is rejected
+ * @param io Open handle
+ * @param buf Source buffer
+ * @param len Number of bytes to write
+ * @param offset Absolute byte offset
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+int platform_io_write(const platform_io_t *io, const void *buf, size_t len, uint64_t offset);
+
+/**
+ * @brief Flush written data to stable storage and close the handle
+ * @param io Open handle
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO if the flush failed
+ */
+int platform_io_close(platform_io_t *io);
+
+/**
+ * @brief Start tracking the write-out of an output
+ * @param wb State to initialize
+ * @param fd Output descriptor, or -1 to disable (direct I/O needs no write-out control)
+ * @param source Input descriptor read in step with the output, or -1
+ */
+void platform_writeback_init(platform_writeback_t *wb, int fd, int source);
+
+/**
+ * @brief Advance the write cursor, writing back and dropping completed windows
+ *
+ * Bytes before cursor must have been handed to the kernel. Only does work
+ * once per ETDK_WRITEBACK_WINDOW; a no-op where sync_file_range() is not
+ * available.
+ *
+ * @param wb Write-out state
+ * @param cursor Bytes written so far from offset 0
+ */
+void platform_writeback_advance(platform_writeback_t *wb, uint64_t cursor);
+
+/**
+ * @brief Make the output durable with one fdatasync() and drop the rest of its cache
+ * @param wb Write-out state
+ * @return ETDK_SUCCESS, or ETDK_ERROR_IO if the sync or an earlier write-out failed
+ */
+int platform_writeback_finish(platform_writeback_t *wb);
+
+/**
+ * @brief fsync() the directory containing path, making a rename() or new entry durable
+ * @param path Path of a file in the directory
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO or ETDK_ERROR_MEMORY
+ */
+int platform_sync_directory(const char *path);
+
+/**
+ * @brief Create an unnamed file in the directory of path (Linux O_TMPFILE)
+ * @param path Path of a file in the directory
+ * @return Descriptor open for writing, or -1 (errno set; EOPNOTSUPP where unsupported)
+ */
+int platform_open_tmpfile(const char *path);
+
+/**
+ * @brief Give a file from platform_open_tmpfile() a name
+ * @param fd Descriptor from platform_open_tmpfile()
+ * @param path New name; must not exist
+ * @return ETDK_SUCCESS, or ETDK_ERROR_IO with errno set
+ */
+int platform_link_tmpfile(int fd, const char *path);
+
+/**
+ * @brief Release the blocks of a file range (hole punching), discarding them on SSDs
+ * @param fd File opened for writing
+ * @param offset Range start
+ * @param len Range length in bytes
+ * @return ETDK_SUCCESS, or ETDK_ERROR_PLATFORM if the filesystem cannot punch holes
+ */
+int platform_punch_hole(int fd, uint64_t offset, uint64_t len);
+
+/**
+ * @brief Allocate a buffer suitable for direct I/O
+ * @param len Size in bytes
+ * @param alignment Required alignment (rounded up to the page size)
+ * @return Pointer to buffer, or NULL on failure
+ */
+void *platform_alloc_aligned(size_t len, size_t alignment);
+
+/**
+ * @brief Free a buffer from platform_alloc_aligned()
+ * @param ptr Buffer to free (may be NULL)
+ */
+void platform_free_aligned(void *ptr);
+
+/**
+ * @brief Create an arena of count equal, page-aligned buffers in one locked mapping
+ *
+ * Backed by hugetlbfs pages if available, otherwise by transparent huge
+ * pages where supported; mlock()ed and excluded from core dumps.
+ *
+ * @param buffer_size Bytes per buffer (rounded up to the page size)
+ * @param count Number of buffers
+ * @return Arena, or NULL on failure
+ */
+platform_arena_t *platform_arena_create(size_t buffer_size, unsigned int count);
+
+/**
+ * @brief Take a buffer from an arena (thread-safe)
+ *
+ * Falls back to platform_alloc_aligned() if arena is NULL, exhausted, or
+ * its buffers are too small or insufficiently aligned.
+ *
+ * @param arena Arena, or NULL
+ * @param len Bytes needed
+ * @param alignment Required alignment
+ * @return Buffer, or NULL on failure
+ */
+void *platform_arena_alloc(platform_arena_t *arena, size_t len, size_t alignment);
+
+/**
+ * @brief Return a buffer from platform_arena_alloc() (thread-safe)
+ * @param arena Arena passed to platform_arena_alloc()
+ * @param ptr Buffer (may be NULL)
+ */
+void platform_arena_free(platform_arena_t *arena, void *ptr);
+
+/**
+ * @brief Check whether a buffer lies in an arena whose mapping is locked
+ * @param arena Arena, or NULL
+ * @param ptr Buffer from platform_arena_alloc()
+ * @return Non-zero if ptr is a slot of arena and arena is locked
+ */
+int platform_arena_locked(const platform_arena_t *arena, const void *ptr);
+
+/**
+ * @brief Describe an arena for output ("4 x 1028 KB, locked, hugetlb pages")
+ * @param arena Arena
+ * @param buf Output buffer
+ * @param len Buffer size
+ */
+void platform_arena_describe(const platform_arena_t *arena, char *buf, size_t len);
+
+/**
+ * @brief NUMA node of the controller a block device is attached to
+ * @param device_path Path to the block device (partitions use their disk)
+ * @return Node number, or -1 if unknown or the system has no NUMA topology
+ */
+int platform_get_numa_node(const char *device_path);
+
+/**
+ * @brief Restrict the calling thread to the CPUs of a NUMA node
+ *
+ * Threads it creates afterwards inherit the mask.
+ *
+ * @param node Node number from platform_get_numa_node()
+ * @return ETDK_SUCCESS, or ETDK_ERROR_PLATFORM if unsupported or the node has no CPUs
+ */
+int platform_pin_to_numa_node(int node);
+
+/**
+ * @brief Wipe, unlock and unmap an arena
+ * @param arena Arena (may be NULL); no buffer may still be in use
+ */
+void platform_arena_destroy(platform_arena_t *arena);
+
+/**
+ * @brief Map a window of a file (MAP_SHARED, pre-faulted, sequential advice)
+ * @param fd Open file descriptor
+ * @param offset Window start, multiple of the page size
+ * @param len Window length in bytes
+ * @param writable Non-zero for a read/write mapping
+ * @return Mapped address, or NULL on failure
+ */
+void *platform_map_window(int fd, uint64_t offset, size_t len, int writable);
+
+/**
+ * @brief Unmap a window from platform_map_window()
+ * @param addr Mapped address
+ * @param len Window length in bytes
+ * @return ETDK_SUCCESS or ETDK_ERROR_PLATFORM
+ */
+int platform_unmap_window(void *addr, size_t len);
+
+/** @brief CPU has AES round instructions (x86 AES-NI, ARMv8 AES) */
+#define PLATFORM_CPU_AES 0x1
+
+/** @brief CPU has carry-less multiply (x86 PCLMULQDQ, ARMv8 PMULL), used by GCM */
+#define PLATFORM_CPU_CLMUL 0x2
+
+/** @brief CPU has vector AES (x86 VAES) */
+#define PLATFORM_CPU_VAES 0x4
+
+/** @brief CPU has AVX-512 (wide VAES/VPCLMULQDQ code paths in OpenSSL) */
+#define PLATFORM_CPU_AVX512 0x8
+
+/**
+ * @brief Detect crypto-relevant CPU features
+ * @return PLATFORM_CPU_* flags
+ */
+unsigned int platform_cpu_features(void);
+
+/**
+ * @brief Describe CPU features for output ("aes clmul vaes", or "software AES")
+ * @param features PLATFORM_CPU_* flags
+ * @param buf Output buffer
+ * @param len Buffer size
+ */
+void platform_cpu_describe(unsigned int features, char *buf, size_t len);
+
+/** @} */ // end of Platform
+
+/**
+ * @defgroup Batch Batch Mode
+ * @brief Encrypting many files in one run
+ * @{
+ */
+
+/**
+ * @struct batch_entry_t
+ * @brief One file of a batch run
+ */
+typedef struct {
+    char *path;    /**< Path as given or found by the directory walk */
+    uint64_t size; /**< Size in bytes (scheduling weight) */
+    int status;    /**< Result after batch_run() */
+} batch_entry_t;
+
+/**
+ * @struct batch_list_t
+ * @brief Growable list of files to encrypt
+ *
+ * Zero-initialize before use and release with batch_free().
+ */
+typedef struct {
+    batch_entry_t *entries; /**< File entries */
+    size_t count;           /**< Number of entries */
+    size_t capacity;        /**< Allocated entries */
+    uint64_t total_bytes;   /**< Sum of all sizes */
+    size_t skipped;         /**< Paths that could not be added */
+} batch_list_t;
+
+/**
+ * @brief Encrypt one regular file (in place, via an unnamed file for small files, or via temp file and rename)
+ * @param path Path to the file
+ * @param ctx Crypto context
+ * @return ETDK_SUCCESS or error code
+ */
+int batch_encrypt_file(const char *path, crypto_context_t *ctx);
+
+/**
+ * @brief Add a file, or every regular file below a directory
+ * @param list Batch list
+ * @param path File or directory path
+ * @return ETDK_SUCCESS or ETDK_ERROR_MEMORY
+ */
+int batch_add_path(batch_list_t *list, const char *path);
+
+/**
+ * @brief Add paths read from a stream
+ * @param list Batch list
+ * @param stream Input stream
+ * @param separator Record separator ('\n' or '\0')
+ * @return ETDK_SUCCESS or ETDK_ERROR_MEMORY
+ */
+int batch_read_list(batch_list_t *list, FILE *stream, int separator);
+
+/**
+ * @brief Encrypt all files on a worker pool, largest first
+ * @param list Batch list (sorted in place, entry status filled in)
+ * @param ctx Crypto context; each file uses crypto_derive_iv(ctx, path)
+ * @return ETDK_SUCCESS if all files succeeded, ETDK_ERROR_IO otherwise
+ */
+int batch_run(batch_list_t *list, crypto_context_t *ctx);
+
+/**
+ * @brief Free all entries of a batch list
+ * @param list Batch list
+ */
+void batch_free(batch_list_t *list);
+
+/**
+ * @brief Number of worker threads batch_run() will start
+ * @param ctx Crypto context (options.threads, 0 = online CPUs)
+ * @param files Number of files
+ * @return Worker count
+ */
+unsigned int batch_worker_count(const crypto_context_t *ctx, size_t files);
+
+/** @} */ // end of Batch
+
+/**
+ * @defgroup Priority Priority Regions
+ * @brief Encrypt the metadata of a device before its bulk (--priority)
+ * @{
+ */
+
+/**
+ * @struct priority_list_t
+ * @brief Regions a device run encrypts first, in processing order
+ *
+ * Critical regions (partition tables, LUKS/LVM headers, superblocks, the
+ * head and tail of the device and of every partition) come first, then
+ * metadata regions (inode tables, MFT, FATs, XFS log). The list is kept
+ * in the key file, so a resumed run uses the same order without probing
+ * the partly encrypted device again.
+ */
+typedef struct {
+    device_range_t ranges[ETDK_PRIORITY_MAX_RANGES]; /**< Disjoint regions aligned to ETDK_CHUNK_ALIGN */
+    uint32_t count;                                  /**< Used entries of ranges */
+    uint32_t critical;                               /**< Leading entries that are critical regions */
+} priority_list_t;
+
+/**
+ * @brief Collect the priority regions of a device
+ * @param list List to fill
+ * @param device_path Device path
+ * @param device_size Device size in bytes
+ * @param ctx Crypto context (options.priority_detect, options.priority_ranges, progress)
+ * @return ETDK_SUCCESS, or error code if the device cannot be read or no region remains
+ */
+int priority_build(priority_list_t *list, const char *device_path, uint64_t device_size,
+                   const crypto_context_t *ctx);
+
+/**
+ * @brief Processing order of a run: the priority regions, then the rest of base
+ * @param list Priority regions
+ * @param base Ranges the run covers otherwise, sorted and disjoint
+ * @param base_count Number of base ranges
+ * @param order Receives the ranges in processing order (free() it)
+ * @param order_count Receives the number of ranges
+ * @return ETDK_SUCCESS or ETDK_ERROR_MEMORY
+ */
+int priority_schedule(const priority_list_t *list, const device_range_t *base, size_t base_count,
+                      device_range_t **order, size_t *order_count);
+
+/** @} */ // end of Priority
+
+/**
+ * @defgroup Journal Checkpoint Journal
+ * @brief Key file with durable progress for resumable device runs
+ * @{
+ */
+
+/** Upper limit of the bytes encrypted between two durable checkpoints */
+#define ETDK_CHECKPOINT_INTERVAL (1024ULL * 1024 * 1024)
+
+/** Smaller runs checkpoint every 1/ETDK_CHECKPOINT_DIVISOR of their size, see journal_interval() */
+#define ETDK_CHECKPOINT_DIVISOR 64
+
+/** Maximum number of resumed segments recorded in a journal */
+#define ETDK_JOURNAL_MAX_SEGMENTS 16
+
+/**
+ * @struct journal_segment_t
+ * @brief Part of a run encrypted with one IV
+ *
+ * Every (re)start of a run opens a new segment with a fresh IV, so data
+ * that was already encrypted just before a crash is never processed twice
+ * with the same keystream (which would turn CTR ciphertext back into
+ * plaintext).
+ */
+typedef struct {
+    uint64_t start;             /**< First byte, in processing order */
+    uint8_t iv[AES_BLOCK_SIZE]; /**< IV of this segment */
+} journal_segment_t;
+
+/**
+ * @struct journal_state_t
+ * @brief Journal contents (stored twice in the key file, with a checksum)
+ */
+typedef struct {
+    char magic[8];                                         /**< "ETDKJRN1" */
+    uint64_t sequence;                                     /**< Incremented on every write */
+    uint8_t key[ETDK_MAX_KEY_SIZE];                        /**< Encryption key material of the run */
+    uint32_t mode;                                         /**< etdk_cipher_t */
+    uint32_t segment_count;                                /**< Used entries of segments */
+    uint64_t device_size;                                  /**< Device size when the run started */
+    uint64_t total;                                        /**< Bytes the run encrypts */
+    uint64_t done;                                         /**< Bytes durably encrypted, in processing order */
+    uint64_t chunk_size;                                   /**< Chunk size of the run (checkpoints fall on chunks) */
+    journal_segment_t segments[ETDK_JOURNAL_MAX_SEGMENTS]; /**< Segments, oldest first */
+    char device[256];                                      /**< Device path as given */
+    priority_list_t priority;                              /**< Regions processed first (count 0 = none) */
+} journal_state_t;
+
+/**
+ * @struct journal_t
+ * @brief Open checkpoint journal
+ */
+typedef struct {
+    int fd;                /**< Locked key file */
+    const char *path;      /**< Key file path */
+    journal_state_t state; /**< Current contents */
+} journal_t;
+
+/**
+ * @brief Create a new key file for a run (fails if it exists)
+ * @param journal Journal to initialize
+ * @param path Key file path
+ * @param ctx Context with key, IV and mode of the run
+ * @param device Device path
+ * @param device_size Device size in bytes
+ * @param total Bytes the run will encrypt
+ * @param priority Regions processed first, or NULL
+ * @return ETDK_SUCCESS or error code
+ */
+int journal_create(journal_t *journal, const char *path, const crypto_context_t *ctx, const char *device,
+                   uint64_t device_size, uint64_t total, const priority_list_t *priority);
+
+/**
+ * @brief Open an existing key file and load key and mode into ctx
+ * @param journal Journal to initialize
+ * @param path Key file path
+ * @param ctx Context receiving key and mode
+ * @param device Device path (must match the journal)
+ * @param device_size Device size in bytes (must match the journal)
+ * @return ETDK_SUCCESS or error code
+ */
+int journal_open(journal_t *journal, const char *path, crypto_context_t *ctx, const char *device,
+                 uint64_t device_size);
+
+/**
+ * @brief Start a new segment at the current checkpoint
+ * @param journal Open journal
+ * @param iv_out Receives the IV of the new segment
+ * @return ETDK_SUCCESS or error code
+ */
+int journal_begin_segment(journal_t *journal, uint8_t *iv_out);
+
+/**
+ * @brief Durably record progress (caller has synced the device first)
+ * @param journal Open journal
+ * @param done Bytes encrypted, in processing order
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+int journal_checkpoint(journal_t *journal, uint64_t done);
+
+/**
+ * @brief Bytes between two checkpoints of the run
+ * @param journal Open journal
+ * @return Interval in bytes, a whole number of chunks
+ */
+uint64_t journal_interval(const journal_t *journal);
+
+/**
+ * @brief Close the key file, keeping it for --resume
+ * @param journal Open journal
+ */
+void journal_close(journal_t *journal);
+
+/**
+ * @brief Overwrite, sync and delete the key file after a completed run
+ * @param journal Open journal
+ * @return ETDK_SUCCESS, ETDK_ERROR_CRYPTO if the random pass failed, or ETDK_ERROR_IO
+ */
+int journal_destroy(journal_t *journal);
+
+/** @} */ // end of Journal
+
+/**
+ * @defgroup Verify Read-back Verification
+ * @brief Confirm that a device run actually rewrote the device
+ * @{
+ */
+
+/** Bytes per verified block (one XTS data unit, aligned for direct I/O) */
+#define ETDK_VERIFY_BLOCK 4096
+
+/** Blocks read back by --verify=sample (and before --verify=full) */
+#define ETDK_VERIFY_SAMPLES 4096
+
+/**
+ * @struct verify_sample_t
+ * @brief One randomly chosen block and its plaintext fingerprint
+ */
+typedef struct {
+    uint64_t offset;      /**< Device byte offset (multiple of ETDK_VERIFY_BLOCK) */
+    uint64_t fingerprint; /**< Truncated SHA-256 of the block before encryption */
+    int fingerprinted;    /**< Zero if the block was already encrypted (resumed run) */
+} verify_sample_t;
+
+/**
+ * @struct verify_plan_t
+ * @brief Blocks to check after the run, chosen before it
+ */
+typedef struct {
+    const device_range_t *ranges; /**< Encrypted ranges, in processing order (caller-owned) */
+    size_t range_count;           /**< Number of ranges */
+    verify_sample_t *samples;     /**< Sampled blocks */
+    size_t sample_count;          /**< Used entries of samples */
+    uint64_t block_count;         /**< Whole blocks in the ranges */
+} verify_plan_t;
+
+/**
+ * @brief Pick random blocks of the ranges and fingerprint their plaintext
+ *
+ * Must run before the device is encrypted. Blocks before done (already
+ * encrypted by an interrupted run) get no fingerprint.
+ *
+ * @param plan Plan to initialize
+ * @param device_path Device path
+ * @param ranges Ranges the run encrypts, in processing order (must outlive the plan)
+ * @param range_count Number of ranges
+ * @param done Bytes already encrypted, in processing order
+ * @return ETDK_SUCCESS or error code
+ */
+int verify_prepare(verify_plan_t *plan, const char *device_path, const device_range_t *ranges, size_t range_count,
+                   uint64_t done);
+
+/**
+ * @brief Read the device back and check that it was rewritten
+ *
+ * Must run after the device was synced and before any discard.
+ *
+ * @param plan Plan from verify_prepare()
+ * @param device_path Device path
+ * @param ctx Crypto context (options.verify, options.threads, chunk size, arena)
+ * @return ETDK_SUCCESS, or ETDK_ERROR_IO if a block was not rewritten or unreadable
+ */
+int verify_run(const verify_plan_t *plan, const char *device_path, const crypto_context_t *ctx);
+
+/**
+ * @brief Release a plan
+ * @param plan Plan from verify_prepare()
+ */
+void verify_free(verify_plan_t *plan);
+
+/** @} */ // end of Verify
+
+/**
+ * @defgroup Multi Multi-device Mode
+ * @brief Several block devices wiped concurrently with one key and one progress table
+ * @{
+ */
+
+/** Seconds between two progress tables of a multi-device run */
+#define ETDK_MULTI_REPORT_INTERVAL 10
+
+/**
+ * @brief Encrypt several block devices concurrently
+ *
+ * Each device runs the engine selected by ctx->options on its own thread,
+ * pinned to the CPUs of the device's NUMA node, with a per-device IV from
+ * crypto_derive_iv() over the device path. Progress is printed as one
+ * table every ETDK_MULTI_REPORT_INTERVAL seconds.
+ *
+ * @param paths Device paths
+ * @param count Number of devices
+ * @param ctx Crypto context with key, base IV, mode and options (mode updated to the one the devices used)
+ * @return ETDK_SUCCESS if every device was encrypted, ETDK_ERROR_IO otherwise
+ */
+int multi_run(char *const *paths, size_t count, crypto_context_t *ctx);
+
+/** @} */ // end of Multi
+
+/**
+ * @defgroup Decrypt Decrypt Mode
+ * @brief Parallel, random-access recovery with the displayed key (--decrypt)
+ * @{
+ */
+
+/**
+ * @brief Decrypt a range of an encrypted file or device into a new file or device
+ *
+ * Extents of the range are decrypted concurrently on options.threads
+ * workers (0 = online CPUs); nothing before the range is read except one
+ * block per extent for CBC. CBC padding is removed and a GCM tag skipped
+ * for regular-file sources.
+ *
+ * @param source Encrypted file or block device (opened read-only)
+ * @param dest Output file (created or truncated) or block device
+ * @param ctx Crypto context with key, IV, mode and the decrypt options (chunk size from crypto_tune_io())
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO, ETDK_ERROR_MEMORY, or ETDK_ERROR_CRYPTO
+ */
+int decrypt_run(const char *source, const char *dest, crypto_context_t *ctx);
+
+/** @} */ // end of Decrypt
+
+/**
+ * @defgroup Progress Progress Reporting
+ * @brief Rate-limited progress line and event stream of device runs
+ * @{
+ */
+
+/** Milliseconds between two progress reports */
+#define ETDK_PROGRESS_INTERVAL_MS 250
+
+/**
+ * @enum progress_phase_t
+ * @brief What a progress reporter counts
+ */
+typedef enum {
+    PROGRESS_ENCRYPT = 0, /**< Bytes encrypted */
+    PROGRESS_VERIFY,      /**< Bytes read back by --verify=full */
+    PROGRESS_DECRYPT      /**< Bytes decrypted by --decrypt */
+} progress_phase_t;
+
+/**
+ * @brief Progress reporter of one engine run (opaque, see progress_start())
+ */
+typedef struct progress progress_t;
+
+/**
+ * @brief Start reporting the progress of an engine run
+ *
+ * A reporter thread computes a moving-average rate and ETA every
+ * ETDK_PROGRESS_INTERVAL_MS and draws the progress line, calls
+ * ctx->progress instead if set, and writes "start", "progress" and "end"
+ * events to options.progress_fd in options.progress_format.
+ *
+ * @param ctx Crypto context (progress hook and stream options)
+ * @param phase What is being counted
+ * @param target Device path
+ * @param total Bytes of the run
+ * @param done Bytes already done (resumed runs)
+ * @return Reporter, or NULL if none could be started (the other functions accept NULL)
+ */
+progress_t *progress_start(const crypto_context_t *ctx, progress_phase_t phase, const char *target, uint64_t total,
+                           uint64_t done);
+
+/**
+ * @brief Record the bytes done so far (one relaxed atomic store, safe from any thread)
+ * @param p Reporter, or NULL
+ * @param done Bytes done
+ */
+void progress_update(progress_t *p, uint64_t done);
+
+/**
+ * @brief Report a milestone as an event named event (e.g. "critical"), safe from any thread
+ * @param p Reporter, or NULL
+ * @param event Event name
+ */
+void progress_event(progress_t *p, const char *event);
+
+/**
+ * @brief Stop the reporter and report the final state (the terminal line is left unterminated)
+ * @param p Reporter, or NULL
+ * @param status Result of the run
+ */
+void progress_finish(progress_t *p, int status);
+
+/** @} */ // end of Progress
+
+/**
+ * @defgroup Metrics Stage Metrics
+ * @brief Latency histograms of the device engines (--metrics, --metrics-prom)
+ * @{
+ */
+
+/**
+ * @enum metric_stage_t
+ * @brief Instrumented stage of an engine
+ */
+typedef enum {
+    METRIC_READ = 0,   /**< One chunk read from the device (ns) */
+    METRIC_ENCRYPT,    /**< EVP_EncryptUpdate() over one chunk (ns) */
+    METRIC_WRITE,      /**< One chunk written to the device (ns) */
+    METRIC_SYNC,       /**< fdatasync()/fsync() of the device (ns) */
+    METRIC_QUEUE,      /**< Pipeline chunks in flight, sampled once per chunk */
+    METRIC_STAGE_COUNT /**< Number of stages */
+} metric_stage_t;
+
+/**
+ * @brief Create an empty metrics set
+ * @return Metrics, or NULL on allocation failure
+ */
+metrics_t *metrics_create(void);
+
+/**
+ * @brief Free a metrics set
+ * @param m Metrics, or NULL
+ */
+void metrics_destroy(metrics_t *m);
+
+/**
+ * @brief Timestamp for a stage timer (0 without reading the clock if m is NULL)
+ * @param m Metrics, or NULL
+ * @return Monotonic time in ns
+ */
+uint64_t metrics_now(const metrics_t *m);
+
+/**
+ * @brief Record one value into a stage histogram (thread-safe, no-op if m is NULL)
+ * @param m Metrics, or NULL
+ * @param stage Stage
+ * @param value Duration in ns, or a count for METRIC_QUEUE
+ */
+void metrics_record(metrics_t *m, metric_stage_t stage, uint64_t value);
+
+/**
+ * @brief Record the duration of an operation since start (thread-safe, no-op if m is NULL)
+ * @param m Metrics, or NULL
+ * @param stage Timed stage
+ * @param start metrics_now() before the operation
+ * @param bytes Bytes the operation moved
+ */
+void metrics_stage(metrics_t *m, metric_stage_t stage, uint64_t start, size_t bytes);
+
+/**
+ * @brief Write the summary as JSON (per stage: count, sum, min, mean, quantiles, max, bytes, busy rate)
+ * @param m Metrics
+ * @param path Output file (replaced atomically)
+ * @param target Description of what was encrypted
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+int metrics_write_json(const metrics_t *m, const char *path, const char *target);
+
+/**
+ * @brief Write the summary in the Prometheus text format for node_exporter's textfile collector
+ * @param m Metrics
+ * @param path Output file (replaced atomically)
+ * @param target Description of what was encrypted (label "target")
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+int metrics_write_prometheus(const metrics_t *m, const char *path, const char *target);
+
+/** @} */ // end of Metrics
+
+/**
+ * @defgroup KernelCrypto Kernel Crypto Engine
+ * @brief AES through an AF_ALG skcipher socket (Linux, --crypto-engine kernel)
+ * @{
+ */
+
+/**
+ * @brief Kernel cipher stream (opaque, see kcrypto_open())
+ */
+typedef struct kcrypto kcrypto_t;
+
+/**
+ * @brief Open a kernel cipher stream
+ *
+ * Binds an AF_ALG socket to the kernel's "cbc(aes)" or "ctr(aes)" and
+ * sets the key; the kernel picks its fastest implementation (AES-NI,
+ * ARMv8 CE, an offload engine, or generic C). Like an EVP context, the
+ * stream continues the CBC chain or CTR counter across calls.
+ *
+ * @param k Receives the stream
+ * @param key 256-bit key
+ * @param mode ETDK_CIPHER_CBC or ETDK_CIPHER_CTR
+ * @param iv IV, or the counter block of the first byte for CTR
+ * @return ETDK_SUCCESS, or ETDK_ERROR_PLATFORM with errno set (EOPNOTSUPP for other modes or platforms)
+ */
+int kcrypto_open(kcrypto_t **k, const uint8_t *key, etdk_cipher_t mode, const uint8_t *iv);
+
+/**
+ * @brief Encrypt a buffer; the pages are handed to the kernel with vmsplice()
+ *
+ * @param k Stream
+ * @param in Plaintext
+ * @param out Ciphertext buffer of len bytes (must not overlap in)
+ * @param len Bytes (multiple of AES_BLOCK_SIZE, except the last call of a CTR stream)
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+int kcrypto_encrypt(kcrypto_t *k, const unsigned char *in, unsigned char *out, size_t len);
+
+/**
+ * @brief Encrypt bytes of a file; the page cache pages are spliced to the kernel cipher
+ *
+ * The plaintext never passes through a user-space buffer; only the
+ * ciphertext is read back into out.
+ *
+ * @param k Stream
+ * @param in_fd File to read
+ * @param in_offset Offset of the first byte in in_fd
+ * @param out Ciphertext buffer of len bytes
+ * @param len Bytes (as for kcrypto_encrypt())
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO (read error or end of file) or ETDK_ERROR_CRYPTO
+ */
+int kcrypto_encrypt_fd(kcrypto_t *k, int in_fd, uint64_t in_offset, unsigned char *out, size_t len);
+
+/**
+ * @brief Close a kernel cipher stream (the kernel frees its copy of the key)
+ * @param k Stream, or NULL
+ */
+void kcrypto_close(kcrypto_t *k);
+
+/**
+ * @brief Kernel driver that serves a mode, from /proc/crypto
+ * @param mode ETDK_CIPHER_CBC or ETDK_CIPHER_CTR
+ * @param out Buffer for the driver name, e.g. "ctr(aes-aesni)"
+ * @param size Size of out
+ * @return ETDK_SUCCESS, or ETDK_ERROR_PLATFORM if unknown
+ */
+int kcrypto_driver(etdk_cipher_t mode, char *out, size_t size);
+
+/** @} */ // end of KernelCrypto
+
+/**
+ * @defgroup Pipeline Asynchronous I/O Pipeline
+ * @brief Overlapping read, encrypt and write stages
+ * @{
+ */
+
+/**
+ * @brief Run an asynchronous read/encrypt/write pipeline
+ * @param job Pipeline description
+ * @param engine io_uring, thread engine, or automatic choice
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO, ETDK_ERROR_CRYPTO, or ETDK_ERROR_MEMORY
+ */
+int pipeline_run(const pipeline_job_t *job, etdk_io_engine_t engine);
+
+/**
+ * @brief Name of the engine that pipeline_run() will use
+ * @param engine Requested engine
+ * @return "io_uring" or "threads"
+ */
+const char *pipeline_engine_name(etdk_io_engine_t engine);
+
+/** @} */ // end of Pipeline
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif // ETDK_H
@@ -0,0 +1,178 @@
+/**
+ * @file etdk_stream.h
+ * @brief ETDK streaming encryption (libetdk public API)
+ * @details Makes data powerless
+ *
+ * The only header installed with libetdk. It declares the crypto_stream_*
+ * functions, the return codes and the cipher modes they use; every other
+ * libetdk symbol is hidden (internal API in etdk.h).
+ *
+ * @version 1.0.0
+ * @author ETDK Contributors
+ */
+
+#ifndef ETDK_STREAM_H
+#define ETDK_STREAM_H
+
+// cppcheck-suppress-begin missingIncludeSystem
+#include <stddef.h>
+#include <stdint.h>
+// cppcheck-suppress-end missingIncludeSystem
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Marks a function exported from libetdk (the library is built with -fvisibility=hidden) */
+#if defined(__GNUC__)
+#define ETDK_API __attribute__((visibility("default")))
+#else
+#define ETDK_API
+#endif
+
+/**
+ * @defgroup ReturnCodes Return Codes
+ * @brief Status codes returned by ETDK functions
+ * @{
+ */
+
+/** @brief Operation completed successfully */
+#define ETDK_SUCCESS 0
+
+/** @brief I/O error (file/device access failed) */
+#define ETDK_ERROR_IO -1
+
+/** @brief Cryptographic operation failed */
+#define ETDK_ERROR_CRYPTO -2
+
+/** @brief Memory allocation or locking failed */
+#define ETDK_ERROR_MEMORY -3
+
+/** @brief Platform-specific operation failed */
+#define ETDK_ERROR_PLATFORM -4
+
+/** @} */ // end of ReturnCodes
+
+/**
+ * @enum etdk_cipher_t
+ * @brief Cipher mode used for encryption
+ */
+typedef enum {
+    ETDK_CIPHER_CBC = 0, /**< AES-256-CBC, sequential (default, PKCS#7 padded for files) */
+    ETDK_CIPHER_CTR = 1, /**< AES-256-CTR, seekable: counter = IV + (byte offset / 16) */
+    ETDK_CIPHER_XTS = 2, /**< AES-256-XTS, seekable, 512-bit key, tweak = offset / ETDK_XTS_DATA_UNIT (devices) */
+    ETDK_CIPHER_GCM = 3  /**< AES-256-GCM, authenticated, tag appended (file copies) */
+} etdk_cipher_t;
+
+/**
+ * @brief Receives progress of a run or stream
+ *
+ * @param arg Caller argument (crypto_stream_config_t.arg for streams)
+ * @param processed Bytes encrypted so far
+ * @param total Bytes expected in total (0 = unknown)
+ */
+typedef void (*crypto_progress_fn)(void *arg, uint64_t processed, uint64_t total);
+
+/**
+ * @defgroup Stream Streaming Encryption
+ * @brief In-process encryption of many objects over caller buffers or file descriptors (libetdk)
+ *
+ * Each stream has its own fresh key and IV; streams share no state, so
+ * any number may run concurrently on different threads. A single stream
+ * must not be used by two threads at once. Nothing is printed: failures
+ * are reported through the return codes only.
+ * @{
+ */
+
+/** @brief Bytes read per step by crypto_stream_fd() */
+#define ETDK_STREAM_CHUNK_SIZE (256 * 1024)
+
+/** @brief Largest trailer crypto_stream_finish() writes (CBC padding block or GCM tag) */
+#define ETDK_STREAM_TRAILER_MAX 32
+
+/** @brief IV length passed to crypto_key_fn (128 bits) */
+#define ETDK_STREAM_IV_SIZE 16
+
+/**
+ * @brief Receives key, IV and mode of a finished stream before they are wiped
+ *
+ * Copy what is needed (e.g. escrow the key) or do nothing to destroy it.
+ * key and iv are only valid during the call.
+ *
+ * @param arg crypto_stream_config_t.arg
+ * @param key AES-256 key
+ * @param key_len Key length in bytes (32)
+ * @param iv IV of ETDK_STREAM_IV_SIZE bytes
+ * @param mode Cipher mode of the stream
+ */
+typedef void (*crypto_key_fn)(void *arg, const uint8_t *key, size_t key_len, const uint8_t *iv,
+                              etdk_cipher_t mode);
+
+/**
+ * @struct crypto_stream_config_t
+ * @brief Mode and callbacks of a stream
+ */
+typedef struct {
+    etdk_cipher_t mode;          /**< ETDK_CIPHER_CBC, ETDK_CIPHER_CTR or ETDK_CIPHER_GCM */
+    uint64_t total;              /**< Expected plaintext length passed to progress (0 = unknown) */
+    crypto_progress_fn progress; /**< Called after every update (NULL = none) */
+    crypto_key_fn key_handoff;   /**< Called by crypto_stream_finish() before the key is wiped (NULL = none) */
+    void *arg;                   /**< Passed to progress and key_handoff */
+} crypto_stream_config_t;
+
+/**
+ * @brief Streaming encryption of one object (opaque, see crypto_stream_begin())
+ */
+typedef struct crypto_stream crypto_stream_t;
+
+/**
+ * @brief Start encrypting one object with a fresh random key and IV
+ * @param stream Receives the stream
+ * @param config Mode and callbacks (copied)
+ * @return ETDK_SUCCESS, ETDK_ERROR_MEMORY, or ETDK_ERROR_CRYPTO
+ */
+ETDK_API int crypto_stream_begin(crypto_stream_t **stream, const crypto_stream_config_t *config);
+
+/**
+ * @brief Encrypt the next piece of an object
+ * @param s Stream
+ * @param in Plaintext
+ * @param len Plaintext length
+ * @param out Ciphertext buffer of len + 16 bytes (may equal in for CTR and GCM only)
+ * @param outlen Receives the ciphertext length
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+ETDK_API int crypto_stream_update(crypto_stream_t *s, const unsigned char *in, size_t len, unsigned char *out,
+                                  size_t *outlen);
+
+/**
+ * @brief Write the trailer, call key_handoff, wipe the key and free the stream (also on failure)
+ * @param s Stream
+ * @param out Buffer of ETDK_STREAM_TRAILER_MAX bytes
+ * @param outlen Receives the trailer length
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+ETDK_API int crypto_stream_finish(crypto_stream_t *s, unsigned char *out, size_t *outlen);
+
+/**
+ * @brief Wipe the key and free a stream without calling key_handoff
+ * @param s Stream, or NULL
+ */
+ETDK_API void crypto_stream_abort(crypto_stream_t *s);
+
+/**
+ * @brief Encrypt everything readable from in_fd (file, pipe or socket) into out_fd
+ * @param in_fd Plaintext source, read until end of file
+ * @param out_fd Ciphertext destination, written sequentially
+ * @param config Mode and callbacks
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO, ETDK_ERROR_MEMORY, or ETDK_ERROR_CRYPTO
+ */
+ETDK_API int crypto_stream_fd(int in_fd, int out_fd, const crypto_stream_config_t *config);
+
+/** @} */ // end of Stream
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ETDK_STREAM_H
@@ -0,0 +1,600 @@
+/*
+ * ETDK - Encrypt-then-Delete-Key
+ * Batch mode - directory trees, multiple paths and file lists on a worker pool
+ */
+
+#include "etdk.h"
+// cppcheck-suppress-begin missingIncludeSystem
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// cppcheck-suppress-end missingIncludeSystem
+
+/** Suffix of the temporary name of an encrypted copy */
+#define BATCH_TEMP_SUFFIX ".tmp_encrypted"
+
+/** Small files a worker keeps open before one commit makes them all durable */
+#define BATCH_GROUP_SIZE 32
+
+/**
+ * @brief A small file encrypted into an unnamed file, waiting for its commit
+ */
+typedef struct {
+    batch_entry_t *entry; /**< List entry (NULL for batch_encrypt_file()) */
+    const char *path;     /**< File to replace */
+    int fd;               /**< Encrypted copy from platform_open_tmpfile() */
+    int status;           /**< Result of the commit */
+} small_file_t;
+
+/**
+ * @brief Encrypt a small file into an unnamed file next to it
+ *
+ * Files up to ETDK_SMALL_FILE_SIZE take one read, one encryption and one
+ * write (crypto_encrypt_small()) into an O_TMPFILE file, which gets its
+ * name only in small_files_commit(). Sparse files, --in-place,
+ * --container and --crypto-engine kernel keep the regular path, as do
+ * filesystems without O_TMPFILE.
+ *
+ * @param file Receives the pending file
+ * @param path File to encrypt
+ * @param ctx Crypto context (its cipher context is reused)
+ * @param buf Buffer of ETDK_SMALL_FILE_SIZE + ETDK_CHUNK_ALIGN bytes, allocated on first use (NULL = none yet)
+ * @return ETDK_SUCCESS, ETDK_ERROR_PLATFORM if the file takes the regular path, or error code
+ */
+static int small_file_encrypt(small_file_t *file, const char *path, crypto_context_t *ctx, unsigned char **buf) {
+    if (ctx->options.in_place || ctx->options.container || ctx->options.crypto_engine == ETDK_CRYPTO_KERNEL)
+        return ETDK_ERROR_PLATFORM;
+
+    int in_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (in_fd < 0)
+        return ETDK_ERROR_PLATFORM; // The regular path reports the error
+
+    struct stat st;
+    if (fstat(in_fd, &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size > ETDK_SMALL_FILE_SIZE ||
+        platform_has_holes(in_fd, (uint64_t)st.st_size)) {
+        close(in_fd);
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    int out_fd = platform_open_tmpfile(path);
+    if (out_fd < 0) {
+        close(in_fd);
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    if (!*buf)
+        *buf = platform_arena_alloc(ctx->arena, ETDK_SMALL_FILE_SIZE + ETDK_CHUNK_ALIGN, ETDK_CHUNK_ALIGN);
+    int result = *buf ? crypto_encrypt_small(in_fd, out_fd, (uint64_t)st.st_size, ctx, *buf) : ETDK_ERROR_MEMORY;
+    close(in_fd);
+    if (result != ETDK_SUCCESS) {
+        close(out_fd); // Unnamed: nothing to clean up
+        return result;
+    }
+
+    file->path = path;
+    file->fd = out_fd;
+    file->status = ETDK_SUCCESS;
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Length of the directory part of a path, including its last '/' (0 = current directory)
+ */
+static size_t directory_length(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? (size_t)(slash - path) + 1 : 0;
+}
+
+/**
+ * @brief Make a group of small files durable and let each replace its original
+ *
+ * Each file's data is synced with fdatasync(), the file is linked under a
+ * temporary name and renamed over its original (atomic: the path always
+ * holds either version), and each directory of the group is fsync()ed
+ * once to make the renames durable. Only the run's own files and
+ * directories are synced, never the whole filesystem, so dirty data of
+ * other processes is left alone and every writeback error is reported
+ * against the file it belongs to.
+ *
+ * @param files Pending files (status set, descriptors closed)
+ * @param count Number of files
+ */
+static void small_files_commit(small_file_t *files, size_t count) {
+    platform_writeback_t wb;
+
+    for (size_t i = 0; i < count; i++) {
+        small_file_t *f = &files[i];
+        platform_writeback_init(&wb, f->fd, -1);
+        if (platform_writeback_finish(&wb) != ETDK_SUCCESS) {
+            perror("Error syncing output file");
+            f->status = ETDK_ERROR_IO;
+        }
+
+        size_t len = strlen(f->path);
+        char *temp_path = f->status == ETDK_SUCCESS ? malloc(len + sizeof(BATCH_TEMP_SUFFIX)) : NULL;
+        if (temp_path) {
+            memcpy(temp_path, f->path, len);
+            memcpy(temp_path + len, BATCH_TEMP_SUFFIX, sizeof(BATCH_TEMP_SUFFIX));
+
+            // A leftover of an interrupted regular-path run is replaced like the regular path would
+            int linked = platform_link_tmpfile(f->fd, temp_path) == ETDK_SUCCESS ||
+                         (errno == EEXIST && remove(temp_path) == 0 &&
+                          platform_link_tmpfile(f->fd, temp_path) == ETDK_SUCCESS);
+            if (!linked || rename(temp_path, f->path) != 0) {
+                fprintf(stderr, "Failed to replace original file with encrypted version: %s\n", f->path);
+                if (linked)
+                    remove(temp_path);
+                f->status = ETDK_ERROR_IO;
+            }
+            free(temp_path);
+        } else if (f->status == ETDK_SUCCESS) {
+            f->status = ETDK_ERROR_MEMORY;
+        }
+        close(f->fd);
+        f->fd = -1;
+    }
+
+    // The renames are only durable once their directories are on disk; sync each directory once
+    for (size_t i = 0; i < count; i++) {
+        if (files[i].status != ETDK_SUCCESS)
+            continue;
+        size_t dir_len = directory_length(files[i].path);
+        size_t j = 0;
+        while (j < i && (files[j].status != ETDK_SUCCESS || directory_length(files[j].path) != dir_len ||
+                         strncmp(files[j].path, files[i].path, dir_len) != 0))
+            j++;
+        if (j < i)
+            continue;
+        if (platform_sync_directory(files[i].path) != ETDK_SUCCESS) {
+            fprintf(stderr, "Failed to sync directory of %s\n", files[i].path);
+            files[i].status = ETDK_ERROR_IO;
+        }
+    }
+}
+
+/**
+ * @brief Encrypt one regular file via "<path>.tmp_encrypted", or in place
+ *
+ * @param path Path to the regular file
+ * @param ctx Crypto context (key, IV and options)
+ * @return ETDK_SUCCESS or error code
+ */
+static int replace_file(const char *path, crypto_context_t *ctx) {
+    if (ctx->options.in_place) {
+        return crypto_encrypt_file_inplace(path, ctx);
+    }
+
+    size_t len = strlen(path);
+    char *temp_path = malloc(len + sizeof(BATCH_TEMP_SUFFIX));
+    if (!temp_path) {
+        return ETDK_ERROR_MEMORY;
+    }
+    memcpy(temp_path, path, len);
+    memcpy(temp_path + len, BATCH_TEMP_SUFFIX, sizeof(BATCH_TEMP_SUFFIX));
+
+    int result = ctx->options.container ? crypto_encrypt_container(path, temp_path, ctx)
+                                        : crypto_encrypt_file(path, temp_path, ctx);
+    if (result != ETDK_SUCCESS) {
+        remove(temp_path);
+        free(temp_path);
+        return result;
+    }
+
+    // Rename temp file to original name (overwrites original); the engines synced its data
+    if (remove(path) != 0 || rename(temp_path, path) != 0) {
+        fprintf(stderr, "Failed to replace original file with encrypted version: %s\n", path);
+        remove(temp_path);
+        result = ETDK_ERROR_IO;
+    } else if (platform_sync_directory(path) != ETDK_SUCCESS) {
+        // The rename is only durable once the directory entry is on disk
+        fprintf(stderr, "Failed to sync directory of %s\n", path);
+        result = ETDK_ERROR_IO;
+    }
+
+    free(temp_path);
+    return result;
+}
+
+/**
+ * @brief Encrypt one regular file according to the selected options
+ *
+ * With --in-place the file is overwritten directly. Files up to
+ * ETDK_SMALL_FILE_SIZE are encrypted into an unnamed file that atomically
+ * replaces the original (see small_files_commit()). Otherwise the file is
+ * encrypted (as an ETDK container with --container) into
+ * "<path>.tmp_encrypted", which is synced and then replaces the original,
+ * followed by a sync of the directory.
+ *
+ * @param path Path to the regular file
+ * @param ctx Crypto context (key, IV and options)
+ * @return ETDK_SUCCESS or error code
+ */
+int batch_encrypt_file(const char *path, crypto_context_t *ctx) {
+    if (!path || !ctx) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    small_file_t file;
+    unsigned char *buf = NULL;
+    int result = small_file_encrypt(&file, path, ctx, &buf);
+    platform_arena_free(ctx->arena, buf);
+    if (result == ETDK_ERROR_PLATFORM)
+        return replace_file(path, ctx);
+    if (result != ETDK_SUCCESS)
+        return result;
+
+    small_files_commit(&file, 1);
+    return file.status;
+}
+
+/**
+ * @brief Append one file to the list
+ *
+ * @param list Batch list
+ * @param path Path (copied)
+ * @param size File size in bytes
+ * @return ETDK_SUCCESS or ETDK_ERROR_MEMORY
+ */
+static int list_push(batch_list_t *list, const char *path, uint64_t size) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        batch_entry_t *entries = realloc(list->entries, capacity * sizeof(batch_entry_t));
+        if (!entries)
+            return ETDK_ERROR_MEMORY;
+        list->entries = entries;
+        list->capacity = capacity;
+    }
+
+    char *copy = strdup(path);
+    if (!copy)
+        return ETDK_ERROR_MEMORY;
+
+    list->entries[list->count].path = copy;
+    list->entries[list->count].size = size;
+    list->entries[list->count].status = ETDK_SUCCESS;
+    list->count++;
+    list->total_bytes += size;
+
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Recursively add all regular files below a directory
+ *
+ * Symbolic links are not followed, so the walk cannot leave the tree or
+ * encrypt a file twice through different names.
+ *
+ * @param list Batch list
+ * @param dir Directory path
+ * @return ETDK_SUCCESS, or ETDK_ERROR_MEMORY (unreadable entries are skipped with a message)
+ */
+static int add_directory(batch_list_t *list, const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "Cannot open directory %s: %s\n", dir, strerror(errno));
+        list->skipped++;
+        return ETDK_SUCCESS;
+    }
+
+    int result = ETDK_SUCCESS;
+    size_t dir_len = strlen(dir);
+    struct dirent *de;
+
+    while (result == ETDK_SUCCESS && (de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+
+        size_t name_len = strlen(de->d_name);
+        char *child = malloc(dir_len + name_len + 2);
+        if (!child) {
+            result = ETDK_ERROR_MEMORY;
+            break;
+        }
+        memcpy(child, dir, dir_len);
+        size_t pos = dir_len;
+        if (pos == 0 || child[pos - 1] != '/')
+            child[pos++] = '/';
+        memcpy(child + pos, de->d_name, name_len + 1);
+
+        result = batch_add_path(list, child);
+        free(child);
+    }
+
+    closedir(d);
+    return result;
+}
+
+/**
+ * @brief Add a path to the batch list
+ *
+ * Regular files are added, directories are walked recursively, anything
+ * else (symlinks, devices, sockets, ...) is skipped with a message.
+ *
+ * @param list Batch list
+ * @param path File or directory
+ * @return ETDK_SUCCESS or ETDK_ERROR_MEMORY
+ */
+int batch_add_path(batch_list_t *list, const char *path) {
+    if (!list || !path) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        fprintf(stderr, "Cannot access %s: %s\n", path, strerror(errno));
+        list->skipped++;
+        return ETDK_SUCCESS;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        return add_directory(list, path);
+    }
+    if (!S_ISREG(st.st_mode)) {
+        fprintf(stderr, "Skipping %s: not a regular file\n", path);
+        list->skipped++;
+        return ETDK_SUCCESS;
+    }
+
+    return list_push(list, path, (uint64_t)st.st_size);
+}
+
+/**
+ * @brief Add paths read from a stream, one per record
+ *
+ * @param list Batch list
+ * @param stream Input stream (e.g. stdin)
+ * @param separator '\n' for line lists, '\0' for find -print0 style lists
+ * @return ETDK_SUCCESS or ETDK_ERROR_MEMORY
+ */
+int batch_read_list(batch_list_t *list, FILE *stream, int separator) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+    int result = ETDK_SUCCESS;
+
+    while (result == ETDK_SUCCESS && (n = getdelim(&line, &cap, separator, stream)) > 0) {
+        if (line[n - 1] == (char)separator)
+            line[--n] = '\0';
+        if (n == 0)
+            continue;
+        result = batch_add_path(list, line);
+    }
+
+    free(line);
+    return result;
+}
+
+/**
+ * @brief Free all entries of a batch list
+ *
+ * @param list Batch list
+ */
+void batch_free(batch_list_t *list) {
+    if (!list)
+        return;
+    for (size_t i = 0; i < list->count; i++)
+        free(list->entries[i].path);
+    free(list->entries);
+    memset(list, 0, sizeof(*list));
+}
+
+/**
+ * @brief qsort() comparator: largest file first
+ */
+static int compare_size_desc(const void *a, const void *b) {
+    const batch_entry_t *x = a;
+    const batch_entry_t *y = b;
+    if (x->size == y->size)
+        return strcmp(x->path, y->path);
+    return (x->size < y->size) ? 1 : -1;
+}
+
+/**
+ * @brief Shared state of a batch run
+ */
+typedef struct {
+    batch_list_t *list;          /**< Files, sorted largest first */
+    const crypto_context_t *ctx; /**< Master key, IV and options */
+    platform_arena_t *keys;      /**< Locked slab with one context per worker (NULL = lock per worker) */
+    size_t group_size;           /**< Small files per commit (1..BATCH_GROUP_SIZE, bounded by RLIMIT_NOFILE) */
+    size_t next;                 /**< Next unclaimed entry */
+    size_t done;                 /**< Entries finished */
+    size_t failed;               /**< Entries that failed */
+    pthread_mutex_t lock;        /**< Protects next, done, failed and output */
+} batch_job_t;
+
+/**
+ * @brief Record the result of a file and update the progress line
+ *
+ * @param job Batch job
+ * @param entry Finished entry
+ * @param result Its result
+ */
+static void job_entry_done(batch_job_t *job, batch_entry_t *entry, int result) {
+    entry->status = result;
+
+    pthread_mutex_lock(&job->lock);
+    job->done++;
+    if (result != ETDK_SUCCESS) {
+        job->failed++;
+        fprintf(stderr, "\nFAILED: %s\n", entry->path);
+    }
+    if (job->done % 256 == 0 || job->done == job->list->count) {
+        printf("\rProgress: %zu / %zu files (%zu failed)  ", job->done, job->list->count, job->failed);
+        fflush(stdout);
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+/**
+ * @brief Commit a worker's pending small files and record their results
+ *
+ * @param job Batch job
+ * @param files Pending files
+ * @param count Number of files (reset to 0)
+ */
+static void job_commit(batch_job_t *job, small_file_t *files, size_t *count) {
+    small_files_commit(files, *count);
+    for (size_t i = 0; i < *count; i++)
+        job_entry_done(job, files[i].entry, files[i].status);
+    *count = 0;
+}
+
+/**
+ * @brief Batch worker: claims files in list order and encrypts them
+ *
+ * Each worker owns one copy of the context in the locked key slab; only
+ * the per-file IV changes between files, so key material is copied once
+ * per worker and locked once per run rather than once per file. The copy
+ * shares the master context's buffer arena.
+ *
+ * Small files are encrypted into unnamed files and committed in groups
+ * of job->group_size (see small_files_commit()); the worker keeps one
+ * buffer and one cipher context for all of them.
+ *
+ * @param arg Pointer to batch_job_t
+ * @return NULL
+ */
+static void *batch_worker(void *arg) {
+    batch_job_t *job = arg;
+
+    crypto_context_t *wctx = platform_arena_alloc(job->keys, sizeof(crypto_context_t), sizeof(void *));
+    if (!wctx) {
+        return NULL;
+    }
+    memcpy(wctx, job->ctx, sizeof(crypto_context_t));
+    wctx->cipher_ctx = NULL; // Each worker sets up its own
+    if (!job->keys)
+        platform_lock_memory(wctx, sizeof(crypto_context_t));
+
+    small_file_t pending[BATCH_GROUP_SIZE];
+    size_t pending_count = 0;
+    unsigned char *buf = NULL;
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        if (job->next >= job->list->count) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        batch_entry_t *entry = &job->list->entries[job->next++];
+        pthread_mutex_unlock(&job->lock);
+
+        // The regular path switches sparse files to CTR; every file starts from the run's mode
+        wctx->mode = job->ctx->mode;
+        int result = crypto_derive_iv(job->ctx, entry->path, wctx->iv);
+        if (result == ETDK_SUCCESS)
+            result = small_file_encrypt(&pending[pending_count], entry->path, wctx, &buf);
+        if (result == ETDK_SUCCESS) {
+            pending[pending_count++].entry = entry;
+            if (pending_count == job->group_size)
+                job_commit(job, pending, &pending_count);
+            continue;
+        }
+
+        if (result == ETDK_ERROR_PLATFORM)
+            result = replace_file(entry->path, wctx);
+        job_entry_done(job, entry, result);
+    }
+    job_commit(job, pending, &pending_count);
+
+    platform_arena_free(job->ctx->arena, buf);
+    wctx->arena = NULL; // Owned by the master context
+    crypto_cleanup(wctx);
+    if (!job->keys)
+        platform_unlock_memory(wctx, sizeof(crypto_context_t));
+    platform_arena_free(job->keys, wctx);
+    return NULL;
+}
+
+/**
+ * @brief Encrypt all files of a batch list on a worker pool
+ *
+ * Files are sorted by size, largest first, and handed out in that order:
+ * big files start early and small files fill the gaps at the end, which
+ * keeps all workers busy until the last file (longest-processing-time
+ * scheduling). A failing file is reported and the run continues.
+ *
+ * @param list Batch list (sorted in place)
+ * @param ctx Crypto context, mode chosen with crypto_select_cipher(); ctx->options.threads selects the
+ *            worker count (0 = online CPUs)
+ * @return ETDK_SUCCESS if every file was encrypted, ETDK_ERROR_IO otherwise
+ */
+int batch_run(batch_list_t *list, crypto_context_t *ctx) {
+    if (!list || !ctx) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    qsort(list->entries, list->count, sizeof(batch_entry_t), compare_size_desc);
+
+    unsigned int threads = batch_worker_count(ctx, list->count);
+
+    batch_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.list = list;
+    job.ctx = ctx;
+    job.keys = platform_arena_create(sizeof(crypto_context_t), threads);
+    pthread_mutex_init(&job.lock, NULL);
+
+    // Pending small files hold a descriptor each; leave half of the limit to everything else
+    struct rlimit files;
+    job.group_size = BATCH_GROUP_SIZE;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur != RLIM_INFINITY &&
+        files.rlim_cur / 2 / threads < job.group_size)
+        job.group_size = files.rlim_cur / 2 / threads > 0 ? (size_t)(files.rlim_cur / 2 / threads) : 1;
+
+    pthread_t *workers = calloc(threads, sizeof(pthread_t));
+    if (!workers) {
+        platform_arena_destroy(job.keys);
+        pthread_mutex_destroy(&job.lock);
+        return ETDK_ERROR_MEMORY;
+    }
+
+    unsigned int started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, batch_worker, &job) != 0)
+            break;
+    }
+    if (started == 0) {
+        // No thread could be created: process the list on the calling thread
+        batch_worker(&job);
+    }
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    printf("\n\n");
+
+    size_t failed = job.failed + (list->count - job.done);
+    free(workers);
+    platform_arena_destroy(job.keys);
+    pthread_mutex_destroy(&job.lock);
+
+    return failed == 0 ? ETDK_SUCCESS : ETDK_ERROR_IO;
+}
+
+/**
+ * @brief Number of workers a batch run will use
+ *
+ * @param ctx Crypto context (ctx->options.threads, 0 = online CPUs)
+ * @param files Number of files in the batch
+ * @return Worker count, at least 1 and at most files
+ */
+unsigned int batch_worker_count(const crypto_context_t *ctx, size_t files) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int threads = ctx->options.threads ? ctx->options.threads : (unsigned int)(cpus > 0 ? cpus : 1);
+
+    if (threads > ETDK_MAX_THREADS)
+        threads = ETDK_MAX_THREADS;
+    if (files > 0 && threads > files)
+        threads = (unsigned int)files;
+
+    return threads ? threads : 1;
+}
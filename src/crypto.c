@@ -8,37 +8,619 @@
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h> // for sleep()
 // cppcheck-suppress-end missingIncludeSystem
 
 /**
- * @brief Helper function to initialize EVP cipher context for encryption
+ * @brief Derive the CTR counter block for an absolute byte offset
+ *
+ * Treats the IV as a 128-bit big-endian counter (as OpenSSL's CTR mode
+ * does) and adds the number of whole AES blocks preceding offset. Any
+ * extent can therefore be encrypted independently and the result is
+ * identical to one sequential pass from offset 0.
+ *
+ * @param iv Base IV from the crypto context
+ * @param offset Absolute byte offset
+ * @param out Counter block for the AES block containing offset
+ */
+static void ctr_iv_for_offset(const uint8_t *iv, uint64_t offset, uint8_t *out) {
+    uint64_t add = offset / AES_BLOCK_SIZE;
+    unsigned int carry = 0;
+
+    for (int i = AES_BLOCK_SIZE - 1; i >= 0; i--) {
+        unsigned int sum = iv[i] + (unsigned int)(add & 0xFF) + carry;
+        out[i] = (uint8_t)sum;
+        carry = sum >> 8;
+        add >>= 8;
+    }
+}
+
+/**
+ * @brief Static properties of a cipher mode
+ */
+typedef struct {
+    const char *name;     /**< Display name, also printed as "Mode:" */
+    const char *option;   /**< Name for --cipher */
+    size_t key_size;      /**< Key bytes used */
+    unsigned int targets; /**< Suitable targets, bit per etdk_target_t */
+    int seekable;         /**< Can start at any block-aligned offset (parallel engines) */
+} cipher_info_t;
+
+/** Target bit for cipher_info_t.targets */
+#define TARGET_BIT(target) (1u << (target))
+
+/**
+ * Cipher modes. CBC and GCM are sequential; GCM adds a tag, so it only
+ * fits new files. XTS needs whole 16-byte blocks per data unit, which raw
+ * devices guarantee but arbitrary file lengths do not.
+ */
+static const cipher_info_t cipher_table[ETDK_CIPHER_COUNT] = {
+    {"AES-256-CBC", "cbc", AES_KEY_SIZE, TARGET_BIT(ETDK_TARGET_FILE) | TARGET_BIT(ETDK_TARGET_DEVICE), 0},
+    {"AES-256-CTR", "ctr", AES_KEY_SIZE,
+     TARGET_BIT(ETDK_TARGET_FILE) | TARGET_BIT(ETDK_TARGET_INPLACE) | TARGET_BIT(ETDK_TARGET_DEVICE), 1},
+    {"AES-256-XTS", "xts", 2 * AES_KEY_SIZE, TARGET_BIT(ETDK_TARGET_DEVICE), 1},
+    {"AES-256-GCM", "gcm", AES_KEY_SIZE, TARGET_BIT(ETDK_TARGET_FILE), 0},
+};
+
+/**
+ * @brief Look up the properties of a mode
  *
- * Creates and initializes an EVP cipher context with AES-256-CBC.
- * This reduces code duplication between file and device encryption.
+ * @param mode Cipher mode
+ * @return Table entry (CBC for unknown values)
+ */
+static const cipher_info_t *cipher_info(etdk_cipher_t mode) {
+    return ((unsigned int)mode < ETDK_CIPHER_COUNT) ? &cipher_table[mode] : &cipher_table[ETDK_CIPHER_CBC];
+}
+
+/**
+ * @brief Build the XTS tweak for the data unit containing offset
+ *
+ * dm-crypt "plain64" layout: little-endian unit number, zero padded.
+ *
+ * @param offset Byte offset (multiple of ETDK_XTS_DATA_UNIT)
+ * @param tweak Receives the 16-byte tweak
+ */
+static void xts_tweak_for_offset(uint64_t offset, uint8_t *tweak) {
+    uint64_t unit = offset / ETDK_XTS_DATA_UNIT;
+
+    memset(tweak, 0, AES_BLOCK_SIZE);
+    for (int i = 0; i < 8; i++) {
+        tweak[i] = (uint8_t)(unit >> (8 * i));
+    }
+}
+
+/**
+ * @brief Create an EVP cipher context for encryption without reporting errors
+ *
+ * Creates and initializes an EVP cipher context for the mode selected in
+ * ctx->mode. Prints nothing, so libetdk streams can use it; the OpenSSL
+ * error queue is left for the caller (see init_cipher_context()).
+ *
+ * For CTR mode the counter is positioned at the given byte offset; XTS
+ * derives its tweak per data unit in cipher_update(). For CBC and GCM the
+ * offset must be 0 since the chain cannot be entered mid-stream.
  *
  * @param ctx Pointer to crypto_context_t containing key and IV
+ * @param offset Absolute byte offset the first processed byte corresponds to
  * @return Pointer to initialized EVP_CIPHER_CTX, or NULL on failure
  */
-static EVP_CIPHER_CTX *init_cipher_context(const crypto_context_t *ctx) {
+static EVP_CIPHER_CTX *cipher_context_new(const crypto_context_t *ctx, uint64_t offset) {
     EVP_CIPHER_CTX *cipher_ctx = EVP_CIPHER_CTX_new();
     if (!cipher_ctx) {
-        fprintf(stderr, "Error creating cipher context\n");
         return NULL;
     }
 
-    if (EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, ctx->key, ctx->iv) != 1) {
-        fprintf(stderr, "Error initializing encryption: %s\n", ERR_error_string(ERR_get_error(), NULL));
+    int ok;
+    if (ctx->mode == ETDK_CIPHER_CTR) {
+        uint8_t counter[AES_BLOCK_SIZE];
+        ctr_iv_for_offset(ctx->iv, offset, counter);
+        ok = EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_ctr(), NULL, ctx->key, counter) == 1;
+
+        // Consume the keystream bytes before offset inside the first block
+        unsigned char skip[AES_BLOCK_SIZE] = {0};
+        int skiplen;
+        if (ok && offset % AES_BLOCK_SIZE != 0)
+            ok = EVP_EncryptUpdate(cipher_ctx, skip, &skiplen, skip, (int)(offset % AES_BLOCK_SIZE)) == 1;
+    } else if (ctx->mode == ETDK_CIPHER_XTS) {
+        uint8_t tweak[AES_BLOCK_SIZE];
+        xts_tweak_for_offset(offset, tweak);
+        ok = offset % ETDK_XTS_DATA_UNIT == 0 &&
+             EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_xts(), NULL, ctx->key, tweak) == 1;
+    } else if (ctx->mode == ETDK_CIPHER_GCM) {
+        // 96-bit nonce (the GCM default IV length): first bytes of the IV
+        ok = offset == 0 && EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_gcm(), NULL, NULL, NULL) == 1 &&
+             EVP_CIPHER_CTX_ctrl(cipher_ctx, EVP_CTRL_GCM_SET_IVLEN, ETDK_GCM_NONCE_SIZE, NULL) == 1 &&
+             EVP_EncryptInit_ex(cipher_ctx, NULL, NULL, ctx->key, ctx->iv) == 1;
+    } else {
+        ok = offset == 0 && EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, ctx->key, ctx->iv) == 1;
+    }
+
+    if (!ok) {
         EVP_CIPHER_CTX_free(cipher_ctx);
         return NULL;
     }
+    return cipher_ctx;
+}
 
+/**
+ * @brief Helper function to initialize EVP cipher context for encryption
+ *
+ * cipher_context_new() with an error message, for the engines of the
+ * command line tool.
+ *
+ * @param ctx Pointer to crypto_context_t containing key and IV
+ * @param offset Absolute byte offset the first processed byte corresponds to
+ * @return Pointer to initialized EVP_CIPHER_CTX, or NULL on failure
+ */
+static EVP_CIPHER_CTX *init_cipher_context(const crypto_context_t *ctx, uint64_t offset) {
+    EVP_CIPHER_CTX *cipher_ctx = cipher_context_new(ctx, offset);
+    if (!cipher_ctx) {
+        char err[256];
+        ERR_error_string_n(ERR_get_error(), err, sizeof(err));
+        fprintf(stderr, "Error initializing encryption: %s\n", err);
+    }
     return cipher_ctx;
 }
 
+/**
+ * @brief Kernel counterpart of init_cipher_context() (--crypto-engine kernel)
+ *
+ * Positions the CTR counter at offset like init_cipher_context(); CBC
+ * starts at offset 0. crypto_select_cipher() has already checked that the
+ * kernel runs ctx->mode.
+ *
+ * @param ctx Pointer to crypto_context_t containing key and IV
+ * @param offset Absolute byte offset (multiple of AES_BLOCK_SIZE for CTR)
+ * @return Kernel cipher stream, or NULL on failure
+ */
+static kcrypto_t *init_kernel_cipher(const crypto_context_t *ctx, uint64_t offset) {
+    uint8_t iv[AES_BLOCK_SIZE];
+    kcrypto_t *k = NULL;
+
+    if (ctx->mode == ETDK_CIPHER_CTR && offset % AES_BLOCK_SIZE == 0)
+        ctr_iv_for_offset(ctx->iv, offset, iv);
+    else if (offset == 0)
+        memcpy(iv, ctx->iv, AES_BLOCK_SIZE);
+    else
+        return NULL;
+
+    if (kcrypto_open(&k, ctx->key, ctx->mode, iv) != ETDK_SUCCESS) {
+        fprintf(stderr, "Error opening kernel cipher %s: %s\n", cipher_info(ctx->mode)->name, strerror(errno));
+        return NULL;
+    }
+    return k;
+}
+
+/**
+ * @brief Encrypt the next piece of data with a context from init_cipher_context()
+ *
+ * CBC, CTR and GCM simply continue their stream. XTS encrypts every
+ * ETDK_XTS_DATA_UNIT separately under the tweak of its absolute offset,
+ * so offset must be a multiple of the data unit and a trailing partial
+ * unit must be at least one AES block long.
+ *
+ * @param cipher_ctx Cipher context
+ * @param ctx Crypto context (mode)
+ * @param out Output buffer (may equal in)
+ * @param in Input buffer
+ * @param len Input length
+ * @param offset Absolute byte offset of in[0]
+ * @param outlen Receives the output length
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+static int cipher_update(EVP_CIPHER_CTX *cipher_ctx, const crypto_context_t *ctx, unsigned char *out,
+                         const unsigned char *in, size_t len, uint64_t offset, size_t *outlen) {
+    int n;
+
+    if (ctx->mode != ETDK_CIPHER_XTS) {
+        if (EVP_EncryptUpdate(cipher_ctx, out, &n, in, (int)len) != 1)
+            goto fail;
+        *outlen = (size_t)n;
+        return ETDK_SUCCESS;
+    }
+
+    for (size_t pos = 0; pos < len; pos += ETDK_XTS_DATA_UNIT) {
+        size_t unit = (len - pos < ETDK_XTS_DATA_UNIT) ? len - pos : ETDK_XTS_DATA_UNIT;
+        uint8_t tweak[AES_BLOCK_SIZE];
+
+        xts_tweak_for_offset(offset + pos, tweak);
+        if (EVP_EncryptInit_ex(cipher_ctx, NULL, NULL, NULL, tweak) != 1 ||
+            EVP_EncryptUpdate(cipher_ctx, out + pos, &n, in + pos, (int)unit) != 1)
+            goto fail;
+    }
+    *outlen = len;
+    return ETDK_SUCCESS;
+
+fail:
+    fprintf(stderr, "\nError during encryption: %s\n", ERR_error_string(ERR_get_error(), NULL));
+    return ETDK_ERROR_CRYPTO;
+}
+
+/**
+ * @brief Size of the encrypted file for a plaintext length
+ *
+ * @param mode Cipher mode
+ * @param length Plaintext length
+ * @return Ciphertext length including padding or tag
+ */
+static uint64_t file_output_size(etdk_cipher_t mode, uint64_t length) {
+    switch (mode) {
+    case ETDK_CIPHER_CBC:
+        return length - length % AES_BLOCK_SIZE + AES_BLOCK_SIZE; // PKCS#7 always adds a block or part of one
+    case ETDK_CIPHER_GCM:
+        return length + ETDK_GCM_TAG_SIZE;
+    default:
+        return length;
+    }
+}
+
+/**
+ * @brief Finalize a file encryption and write its trailer
+ *
+ * - CBC: the held-back partial block plus PKCS#7 padding, at the last block boundary
+ * - CTR: nothing
+ * - GCM: the authentication tag, right after the ciphertext
+ *
+ * @param cipher_ctx Cipher context after the last update
+ * @param ctx Crypto context (mode)
+ * @param out_fd Output file descriptor
+ * @param length Plaintext length
+ * @return ETDK_SUCCESS, ETDK_ERROR_CRYPTO or ETDK_ERROR_IO
+ */
+static int finish_file_cipher(EVP_CIPHER_CTX *cipher_ctx, const crypto_context_t *ctx, int out_fd,
+                              uint64_t length) {
+    unsigned char final[EVP_MAX_BLOCK_LENGTH];
+    unsigned char tag[ETDK_GCM_TAG_SIZE];
+    int outlen;
+
+    if (EVP_EncryptFinal_ex(cipher_ctx, final, &outlen) != 1) {
+        fprintf(stderr, "Error finalizing encryption: %s\n", ERR_error_string(ERR_get_error(), NULL));
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    if (ctx->mode == ETDK_CIPHER_GCM) {
+        if (EVP_CIPHER_CTX_ctrl(cipher_ctx, EVP_CTRL_GCM_GET_TAG, ETDK_GCM_TAG_SIZE, tag) != 1) {
+            fprintf(stderr, "Error finalizing encryption: %s\n", ERR_error_string(ERR_get_error(), NULL));
+            return ETDK_ERROR_CRYPTO;
+        }
+        if (platform_pwrite_full(out_fd, tag, sizeof(tag), length) != ETDK_SUCCESS) {
+            perror("Error writing output file");
+            return ETDK_ERROR_IO;
+        }
+        return ETDK_SUCCESS;
+    }
+
+    if (outlen > 0 &&
+        platform_pwrite_full(out_fd, final, (size_t)outlen, length - length % AES_BLOCK_SIZE) != ETDK_SUCCESS) {
+        perror("Error writing output file");
+        return ETDK_ERROR_IO;
+    }
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Get human-readable name of the cipher in use
+ *
+ * @param ctx Pointer to crypto_context_t
+ * @return Static string naming algorithm and mode
+ */
+const char *crypto_cipher_name(const crypto_context_t *ctx) {
+    return cipher_info(ctx ? ctx->mode : ETDK_CIPHER_CBC)->name;
+}
+
+/**
+ * @brief Number of key bytes the cipher in use needs
+ *
+ * @param ctx Pointer to crypto_context_t
+ * @return AES_KEY_SIZE, or twice that for XTS (data key + tweak key)
+ */
+size_t crypto_key_size(const crypto_context_t *ctx) {
+    return cipher_info(ctx ? ctx->mode : ETDK_CIPHER_CBC)->key_size;
+}
+
+/**
+ * @brief Parse a --cipher list into ETDK_CIPHER_BIT() flags
+ *
+ * "auto" allows every mode; otherwise the list names the allowed modes,
+ * e.g. "ctr,xts".
+ *
+ * @param list Comma-separated mode names
+ * @param ciphers Receives the allowed modes
+ * @return ETDK_SUCCESS, or ETDK_ERROR_CRYPTO for an unknown name
+ */
+int crypto_parse_ciphers(const char *list, unsigned int *ciphers) {
+    if (!list || !ciphers) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    unsigned int allowed = 0;
+    for (const char *p = list; *p;) {
+        size_t len = strcspn(p, ",");
+        int found = 0;
+
+        if (len == 4 && strncmp(p, "auto", 4) == 0) {
+            allowed |= (1u << ETDK_CIPHER_COUNT) - 1;
+            found = 1;
+        }
+        for (int m = 0; m < ETDK_CIPHER_COUNT && !found; m++) {
+            if (strlen(cipher_table[m].option) == len && strncmp(p, cipher_table[m].option, len) == 0) {
+                allowed |= ETDK_CIPHER_BIT(m);
+                found = 1;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Unknown cipher '%.*s' (use auto, cbc, ctr, xts or gcm)\n", (int)len, p);
+            return ETDK_ERROR_CRYPTO;
+        }
+
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+
+    if (!allowed) {
+        fprintf(stderr, "Empty cipher list\n");
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    *ciphers = allowed;
+    return ETDK_SUCCESS;
+}
+
+/** Bytes per cipher probe pass and number of timed passes */
+#define CIPHER_PROBE_SIZE (1024 * 1024)
+#define CIPHER_PROBE_PASSES 8
+
+/**
+ * @brief Measure the throughput of a mode on this CPU
+ *
+ * Uses a throwaway random key, so no key material of the run is copied.
+ *
+ * @param mode Cipher mode
+ * @param buf Scratch buffer of CIPHER_PROBE_SIZE bytes
+ * @return Throughput in MB/s, or 0 on failure
+ */
+static double cipher_probe(etdk_cipher_t mode, unsigned char *buf) {
+    crypto_context_t probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.mode = mode;
+    if (RAND_bytes(probe.key, sizeof(probe.key)) != 1 || RAND_bytes(probe.iv, sizeof(probe.iv)) != 1) {
+        return 0;
+    }
+
+    EVP_CIPHER_CTX *cipher_ctx = init_cipher_context(&probe, 0);
+    if (!cipher_ctx) {
+        return 0;
+    }
+
+    struct timespec start, end;
+    size_t outlen;
+    int ok = cipher_update(cipher_ctx, &probe, buf, buf, CIPHER_PROBE_SIZE, 0, &outlen) == ETDK_SUCCESS; // warm-up
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint64_t pass = 1; ok && pass <= CIPHER_PROBE_PASSES; pass++) {
+        ok = cipher_update(cipher_ctx, &probe, buf, buf, CIPHER_PROBE_SIZE, pass * CIPHER_PROBE_SIZE, &outlen) ==
+             ETDK_SUCCESS;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    EVP_CIPHER_CTX_free(cipher_ctx);
+
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    if (!ok || seconds <= 0) {
+        return 0;
+    }
+    return (double)CIPHER_PROBE_PASSES * CIPHER_PROBE_SIZE / (1024.0 * 1024.0) / seconds;
+}
+
+/**
+ * @brief Choose ctx->mode for a target
+ *
+ * Without --cipher the built-in defaults apply: CBC for files and devices,
+ * CTR for in-place files and for devices with --threads, --discard=hybrid
+ * or --priority (those engines need a seekable mode).
+ *
+ * With --cipher, the allowed modes that suit the target are measured with
+ * cipher_probe() and the fastest is used. Ties within 10% go to the
+ * earlier mode in the order CTR, XTS, GCM, CBC (seekable modes parallelize
+ * and need no padding). Measuring picks up AES-NI/VAES/ARMv8 Crypto
+ * through OpenSSL's own dispatch, so no CPU-specific code path is needed
+ * here; the detected features are only reported.
+ *
+ * @param ctx Crypto context (options.ciphers, options.threads, options.discard, options.priority)
+ * @param target Kind of target
+ * @return ETDK_SUCCESS, or ETDK_ERROR_CRYPTO if no allowed mode suits the target
+ */
+static int select_mode(crypto_context_t *ctx, etdk_target_t target) {
+    static const etdk_cipher_t preference[ETDK_CIPHER_COUNT] = {ETDK_CIPHER_CTR, ETDK_CIPHER_XTS, ETDK_CIPHER_GCM,
+                                                                ETDK_CIPHER_CBC};
+    if (!ctx) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    int seekable_only = target == ETDK_TARGET_DEVICE && (ctx->options.threads > 0 || ctx->options.priority ||
+                                                         ctx->options.discard == ETDK_DISCARD_HYBRID);
+
+    if (ctx->options.ciphers == 0) {
+        ctx->mode = (target == ETDK_TARGET_INPLACE || seekable_only) ? ETDK_CIPHER_CTR : ETDK_CIPHER_CBC;
+        return ETDK_SUCCESS;
+    }
+
+    etdk_cipher_t candidates[ETDK_CIPHER_COUNT];
+    int count = 0;
+    for (int i = 0; i < ETDK_CIPHER_COUNT; i++) {
+        const cipher_info_t *info = cipher_info(preference[i]);
+        if ((ctx->options.ciphers & ETDK_CIPHER_BIT(preference[i])) && (info->targets & TARGET_BIT(target)) &&
+            (!seekable_only || info->seekable))
+            candidates[count++] = preference[i];
+    }
+    if (count == 0) {
+        fprintf(stderr, "None of the ciphers allowed by --cipher can encrypt this target%s\n",
+                seekable_only ? " with --threads, --discard=hybrid or --priority" : "");
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    char cpu[64];
+    platform_cpu_describe(platform_cpu_features(), cpu, sizeof(cpu));
+
+    if (count == 1) {
+        ctx->mode = candidates[0];
+        printf("Cipher: %s (CPU: %s)\n", cipher_info(ctx->mode)->name, cpu);
+        return ETDK_SUCCESS;
+    }
+
+    unsigned char *buf = malloc(CIPHER_PROBE_SIZE);
+    if (!buf) {
+        return ETDK_ERROR_MEMORY;
+    }
+    memset(buf, 0, CIPHER_PROBE_SIZE);
+
+    etdk_cipher_t best = candidates[0];
+    double best_rate = 0;
+    for (int i = 0; i < count; i++) {
+        double rate = cipher_probe(candidates[i], buf);
+        if (rate > best_rate * 1.10) {
+            best = candidates[i];
+            best_rate = rate;
+        }
+    }
+    free(buf);
+
+    ctx->mode = best;
+    printf("Cipher: %s (%.0f MB/s, fastest of %d allowed; CPU: %s)\n", cipher_info(best)->name, best_rate, count,
+           cpu);
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Check that the kernel engine can run ctx->mode (--crypto-engine kernel)
+ *
+ * Opens a stream with the run's key once and reports the kernel driver,
+ * so the engines can rely on kcrypto_open(). Otherwise the run continues
+ * with OpenSSL and says why.
+ *
+ * @param ctx Crypto context (mode chosen, options.crypto_engine updated)
+ */
+static void select_kernel_engine(crypto_context_t *ctx) {
+    kcrypto_t *k = NULL;
+    char driver[128];
+
+    if (kcrypto_open(&k, ctx->key, ctx->mode, ctx->iv) != ETDK_SUCCESS) {
+        printf("Crypto: kernel crypto API cannot run %s here (%s), using OpenSSL\n", cipher_info(ctx->mode)->name,
+               strerror(errno));
+        ctx->options.crypto_engine = ETDK_CRYPTO_OPENSSL;
+        return;
+    }
+    kcrypto_close(k);
+
+    if (kcrypto_driver(ctx->mode, driver, sizeof(driver)) != ETDK_SUCCESS)
+        snprintf(driver, sizeof(driver), "unknown");
+    printf("Crypto: kernel crypto API, AF_ALG %s (driver %s)\n", cipher_info(ctx->mode)->name, driver);
+}
+
+/**
+ * @brief Choose ctx->mode for a target, then the AES implementation
+ *
+ * See select_mode() for the mode and select_kernel_engine() for the
+ * engine.
+ *
+ * @param ctx Crypto context (options.ciphers, options.threads, options.discard, options.crypto_engine)
+ * @param target Kind of target
+ * @return ETDK_SUCCESS, or ETDK_ERROR_CRYPTO if no allowed mode suits the target
+ */
+int crypto_select_cipher(crypto_context_t *ctx, etdk_target_t target) {
+    int result = select_mode(ctx, target);
+    if (result == ETDK_SUCCESS && ctx->options.crypto_engine == ETDK_CRYPTO_KERNEL)
+        select_kernel_engine(ctx);
+    return result;
+}
+
+/**
+ * @brief State shared by the pipeline transform and progress callbacks
+ */
+typedef struct {
+    EVP_CIPHER_CTX *cipher_ctx; /**< Sequential cipher context */
+    uint64_t total;             /**< Total bytes */
+    crypto_context_t *ctx;      /**< Mode (XTS needs the offset of every chunk) and ctx->written */
+    progress_t *progress;       /**< Progress reporter (devices only) */
+    platform_writeback_t *wb;   /**< Write-out of buffered output (NULL = none) */
+} pipeline_crypto_t;
+
+/**
+ * @brief Record that ciphertext is about to be written up to end
+ *
+ * Called before every write of an in-place or device run, so a run that
+ * fails can still report how far the target may already be encrypted:
+ * everything past ctx->written is untouched.
+ *
+ * @param ctx Crypto context (shared by the workers of a run)
+ * @param end End offset of the write
+ */
+static void note_written(crypto_context_t *ctx, uint64_t end) {
+    uint64_t seen = __atomic_load_n(&ctx->written, __ATOMIC_RELAXED);
+    while (seen < end &&
+           !__atomic_compare_exchange_n(&ctx->written, &seen, end, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * @brief Pipeline transform: encrypt one chunk in place
+ *
+ * Called by pipeline_run() in offset order from a single thread, so the
+ * CBC chain (or CTR counter) simply continues from the previous chunk.
+ *
+ * @param arg Pointer to pipeline_crypto_t
+ * @param buf Chunk buffer (plaintext in, ciphertext out)
+ * @param len Plaintext length
+ * @param offset Byte offset of the chunk (chunks arrive in order)
+ * @param outlen Receives the ciphertext length
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+static int pipeline_encrypt(void *arg, unsigned char *buf, size_t len, uint64_t offset, size_t *outlen) {
+    pipeline_crypto_t *pc = arg;
+    note_written(pc->ctx, offset + len);
+    return cipher_update(pc->cipher_ctx, pc->ctx, buf, buf, len, offset, outlen);
+}
+
+/**
+ * @brief Pipeline transform of --mode=overwrite: fill a chunk with keystream
+ *
+ * CTR over zeros is the keystream itself; the chunk's old contents
+ * (the previous chunk's keystream, nothing read from the device) are
+ * cleared first.
+ *
+ * @param arg Pointer to pipeline_crypto_t
+ * @param buf Chunk buffer
+ * @param len Chunk length
+ * @param offset Byte offset of the chunk
+ * @param outlen Receives len
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+static int pipeline_keystream(void *arg, unsigned char *buf, size_t len, uint64_t offset, size_t *outlen) {
+    pipeline_crypto_t *pc = arg;
+    memset(buf, 0, len);
+    return cipher_update(pc->cipher_ctx, pc->ctx, buf, buf, len, offset, outlen);
+}
+
+/**
+ * @brief Pipeline progress callback: progress and write-out of the output
+ *
+ * @param arg Pointer to pipeline_crypto_t
+ * @param processed Bytes written so far
+ */
+static void pipeline_written(void *arg, uint64_t processed) {
+    const pipeline_crypto_t *pc = arg;
+    progress_update(pc->progress, processed);
+    platform_writeback_advance(pc->wb, processed);
+}
+
 /**
  * @brief Initialize cryptographic context with random key and IV
  *
@@ -54,8 +636,8 @@ int crypto_init(crypto_context_t *ctx) {
 
     memset(ctx, 0, sizeof(crypto_context_t));
 
-    // Generate random key
-    if (crypto_generate_key(ctx->key, AES_KEY_SIZE) != ETDK_SUCCESS) {
+    // Generate the largest key any mode uses; shorter modes use its prefix
+    if (crypto_generate_key(ctx->key, sizeof(ctx->key)) != ETDK_SUCCESS) {
         return ETDK_ERROR_CRYPTO;
     }
 
@@ -65,230 +647,2798 @@ int crypto_init(crypto_context_t *ctx) {
         return ETDK_ERROR_CRYPTO;
     }
 
-    return ETDK_SUCCESS;
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Generate a cryptographically secure random key
+ *
+ * Uses OpenSSL's RAND_bytes() which provides cryptographic-quality
+ * random numbers suitable for key generation.
+ *
+ * @param key Pointer to buffer where key will be stored
+ * @param key_size Size of the key in bytes (1..ETDK_MAX_KEY_SIZE)
+ * @return ETDK_SUCCESS on success, ETDK_ERROR_CRYPTO on failure
+ */
+int crypto_generate_key(uint8_t *key, size_t key_size) {
+    if (!key || key_size == 0 || key_size > ETDK_MAX_KEY_SIZE) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    // Use OpenSSL's cryptographically secure random number generator
+    if (RAND_bytes(key, key_size) != 1) {
+        fprintf(stderr, "Error generating key: %s\n", ERR_error_string(ERR_get_error(), NULL));
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Chunk size of a run
+ *
+ * @param ctx Crypto context
+ * @return options.chunk_size, or ETDK_DEVICE_CHUNK_SIZE if unset
+ */
+static size_t io_chunk_size(const crypto_context_t *ctx) {
+    return ctx->options.chunk_size ? ctx->options.chunk_size : ETDK_DEVICE_CHUNK_SIZE;
+}
+
+/** Bytes the pipeline keeps in flight when its depth is tuned (flash / spinning disks) */
+#define TUNE_INFLIGHT_FLASH (32 * 1024 * 1024)
+#define TUNE_INFLIGHT_ROTATIONAL (8 * 1024 * 1024)
+
+/**
+ * @brief Choose chunk size and queue depth for a target from its I/O geometry
+ *
+ * The chunk starts at ETDK_DEVICE_CHUNK_SIZE and becomes a whole multiple
+ * of the preferred request size (the RAID stripe width, or st_blksize for
+ * files), so no request straddles a stripe and parity is written in full
+ * stripes. A minimum_io_size above that (RAID chunk) raises it the same
+ * way. The result is a multiple of ETDK_CHUNK_ALIGN (direct I/O, AES
+ * blocks, XTS data units) and at most ETDK_MAX_CHUNK_SIZE; geometry that
+ * cannot satisfy this is ignored.
+ *
+ * The queue depth keeps TUNE_INFLIGHT_FLASH bytes in flight on flash and
+ * TUNE_INFLIGHT_ROTATIONAL on spinning disks, where deep queues only add
+ * seeks.
+ *
+ * @param ctx Crypto context (options updated)
+ * @param path Device or file (for batch runs, one of the files)
+ */
+void crypto_tune_io(crypto_context_t *ctx, const char *path) {
+    if (!ctx || !path) {
+        return;
+    }
+
+    platform_io_hints_t hints;
+    if (platform_get_io_hints(path, &hints) != ETDK_SUCCESS) {
+        memset(&hints, 0, sizeof(hints));
+        hints.rotational = -1;
+    }
+
+    int user_chunk = ctx->options.chunk_size != 0;
+    if (!user_chunk) {
+        size_t chunk = ETDK_DEVICE_CHUNK_SIZE;
+        uint32_t units[] = {hints.optimal_io_size, hints.minimum_io_size};
+
+        for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+            uint32_t unit = units[i];
+            if (unit == 0 || unit % ETDK_CHUNK_ALIGN != 0 || unit > ETDK_MAX_CHUNK_SIZE)
+                continue;
+            size_t tuned = (chunk + unit - 1) / unit * unit;
+            if (tuned <= ETDK_MAX_CHUNK_SIZE)
+                chunk = tuned;
+        }
+        ctx->options.chunk_size = chunk;
+    }
+
+    if (ctx->options.tune_queue_depth) {
+        size_t inflight = hints.rotational == 1 ? TUNE_INFLIGHT_ROTATIONAL : TUNE_INFLIGHT_FLASH;
+        size_t depth = inflight / ctx->options.chunk_size;
+        if (depth < 2)
+            depth = 2;
+        if (depth > ETDK_MAX_QUEUE_DEPTH)
+            depth = ETDK_MAX_QUEUE_DEPTH;
+        ctx->options.queue_depth = (unsigned int)depth;
+    }
+
+    printf("Tuning: chunk %zu KB%s", ctx->options.chunk_size / 1024, user_chunk ? " (--chunk-size)" : "");
+    if (ctx->options.queue_depth > 0)
+        printf(", queue depth %u", ctx->options.queue_depth);
+    if (hints.logical_block_size) {
+        printf("; device: block %u, min_io %u, opt_io %u, max_sectors_kb %u, %s\n", hints.logical_block_size,
+               hints.minimum_io_size, hints.optimal_io_size, hints.max_transfer / 1024,
+               hints.rotational == 1 ? "rotational" : hints.rotational == 0 ? "non-rotational" : "rotational unknown");
+    } else {
+        printf("; file: st_blksize %u\n", hints.optimal_io_size);
+    }
+}
+
+/**
+ * @brief Preallocate the chunk buffers of a run in one locked arena
+ *
+ * Every worker needs at most max(queue_depth, 2) buffers at a time (the
+ * pipeline's slots, or the in/out pair of the sequential loop), each one
+ * chunk plus ETDK_CHUNK_ALIGN for cipher padding. They are mapped and
+ * locked once here and reused across chunks, files and threads; the total
+ * is capped at ETDK_ARENA_MAX_BYTES and any excess demand falls back to
+ * per-run heap buffers. Failure is not fatal: ctx->arena stays NULL.
+ * Nothing is printed when ctx->progress is set.
+ *
+ * @param ctx Crypto context (chunk size and queue depth final; arena set)
+ * @param workers Number of threads that encrypt concurrently
+ */
+void crypto_buffers_create(crypto_context_t *ctx, unsigned int workers) {
+    if (!ctx || ctx->arena) {
+        return;
+    }
+
+    size_t slot = io_chunk_size(ctx) + ETDK_CHUNK_ALIGN;
+    uint64_t count = (uint64_t)(workers ? workers : 1) * (ctx->options.queue_depth > 2 ? ctx->options.queue_depth : 2);
+    if (count * slot > ETDK_ARENA_MAX_BYTES)
+        count = ETDK_ARENA_MAX_BYTES / slot;
+    if (count == 0)
+        count = 1;
+
+    ctx->arena = platform_arena_create(slot, (unsigned int)count);
+    if (ctx->progress) {
+        return; // The caller owns the output
+    }
+    if (!ctx->arena) {
+        printf("Buffers: arena unavailable, allocating per run\n");
+        return;
+    }
+
+    char desc[128];
+    platform_arena_describe(ctx->arena, desc, sizeof(desc));
+    printf("Buffers: %s\n", desc);
+}
+
+/**
+ * @brief Wipe and release the buffer arena of a context
+ *
+ * @param ctx Crypto context (arena reset to NULL)
+ */
+void crypto_buffers_destroy(crypto_context_t *ctx) {
+    if (ctx && ctx->arena) {
+        platform_arena_destroy(ctx->arena);
+        ctx->arena = NULL;
+    }
+}
+
+/**
+ * @brief Derive a per-target IV from the context IV and a label
+ *
+ * IV' = first 16 bytes of SHA-256(IV || label). Used by batch runs so that
+ * every file gets its own IV under the shared key (no CTR keystream is
+ * ever reused across files) while staying recoverable from the displayed
+ * key, IV and the file path.
+ *
+ * @param ctx Pointer to crypto_context_t holding the base IV
+ * @param label Target identifier, e.g. the file path as given
+ * @param iv_out Receives the derived IV (AES_BLOCK_SIZE bytes)
+ * @return ETDK_SUCCESS on success, ETDK_ERROR_CRYPTO on failure
+ */
+int crypto_derive_iv(const crypto_context_t *ctx, const char *label, uint8_t *iv_out) {
+    if (!ctx || !label || !iv_out) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    EVP_MD_CTX *md = EVP_MD_CTX_new();
+    if (!md) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    int ok = EVP_DigestInit_ex(md, EVP_sha256(), NULL) == 1 && EVP_DigestUpdate(md, ctx->iv, AES_BLOCK_SIZE) == 1 &&
+             EVP_DigestUpdate(md, label, strlen(label)) == 1 && EVP_DigestFinal_ex(md, digest, &digest_len) == 1;
+    EVP_MD_CTX_free(md);
+
+    if (!ok) {
+        fprintf(stderr, "Error deriving IV: %s\n", ERR_error_string(ERR_get_error(), NULL));
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    memcpy(iv_out, digest, AES_BLOCK_SIZE);
+    memset(digest, 0, sizeof(digest));
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Decode a hexadecimal string (key or IV as printed by crypto_display_key())
+ *
+ * @param hex Hex digits, upper or lower case, no separators
+ * @param out Receives the bytes
+ * @param size Expected number of bytes
+ * @return ETDK_SUCCESS, or ETDK_ERROR_CRYPTO if hex is not exactly size bytes of hex
+ */
+int crypto_parse_hex(const char *hex, uint8_t *out, size_t size) {
+    if (!hex || !out || strlen(hex) != 2 * size) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        unsigned int byte = 0;
+        for (int d = 0; d < 2; d++) {
+            char c = hex[2 * i + (size_t)d];
+            unsigned int v;
+            if (c >= '0' && c <= '9')
+                v = (unsigned int)(c - '0');
+            else if (c >= 'a' && c <= 'f')
+                v = (unsigned int)(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F')
+                v = (unsigned int)(c - 'A' + 10);
+            else
+                return ETDK_ERROR_CRYPTO;
+            byte = byte << 4 | v;
+        }
+        out[i] = (uint8_t)byte;
+    }
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Decrypt one extent of ciphertext in place, independently of all others
+ *
+ * Every mode can start at an extent boundary, so extents can be decrypted
+ * on any thread in any order:
+ * - CTR: counter derived from the byte offset, as when encrypting
+ * - GCM: CTR keystream from the nonce with the counter at 2 + offset / 16
+ *   (the tag is not checked)
+ * - XTS: each data unit decrypted under the tweak of its offset
+ * - CBC: each plaintext block only needs the ciphertext block before it,
+ *   so chain is the ciphertext block preceding offset (ctx->iv at offset 0)
+ *
+ * No padding is removed. CBC needs offset and len in whole AES blocks, XTS
+ * an offset in whole data units.
+ *
+ * @param ctx Crypto context (key, IV, mode)
+ * @param buf Ciphertext in, plaintext out
+ * @param len Length
+ * @param offset Byte offset of buf[0] in the ciphertext
+ * @param chain CBC: the AES_BLOCK_SIZE bytes of ciphertext before offset, or NULL to use ctx->iv
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+int crypto_decrypt_extent(const crypto_context_t *ctx, unsigned char *buf, size_t len, uint64_t offset,
+                          const uint8_t *chain) {
+    if (!ctx || (!buf && len > 0) || len > INT_MAX) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    EVP_CIPHER_CTX *cipher_ctx;
+    size_t outlen;
+    int n, ok;
+
+    switch (ctx->mode) {
+    case ETDK_CIPHER_CTR:
+        cipher_ctx = init_cipher_context(ctx, offset);
+        ok = cipher_ctx && cipher_update(cipher_ctx, ctx, buf, buf, len, offset, &outlen) == ETDK_SUCCESS;
+        break;
+
+    case ETDK_CIPHER_GCM: {
+        // GCM encrypts with CTR from J0 + 1, J0 = nonce || 00000001 for a 96-bit nonce
+        crypto_context_t ctr;
+        memcpy(&ctr, ctx, sizeof(ctr));
+        ctr.mode = ETDK_CIPHER_CTR;
+        memset(ctr.iv + ETDK_GCM_NONCE_SIZE, 0, AES_BLOCK_SIZE - ETDK_GCM_NONCE_SIZE);
+        ctr.iv[AES_BLOCK_SIZE - 1] = 2;
+        cipher_ctx = init_cipher_context(&ctr, offset);
+        ok = cipher_ctx && cipher_update(cipher_ctx, &ctr, buf, buf, len, offset, &outlen) == ETDK_SUCCESS;
+        crypto_secure_wipe_key(&ctr);
+        break;
+    }
+
+    case ETDK_CIPHER_XTS:
+        cipher_ctx = EVP_CIPHER_CTX_new();
+        ok = cipher_ctx && offset % ETDK_XTS_DATA_UNIT == 0 &&
+             EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_xts(), NULL, ctx->key, NULL) == 1;
+        for (size_t pos = 0; ok && pos < len; pos += ETDK_XTS_DATA_UNIT) {
+            size_t unit = (len - pos < ETDK_XTS_DATA_UNIT) ? len - pos : ETDK_XTS_DATA_UNIT;
+            uint8_t tweak[AES_BLOCK_SIZE];
+            xts_tweak_for_offset(offset + pos, tweak);
+            ok = EVP_DecryptInit_ex(cipher_ctx, NULL, NULL, NULL, tweak) == 1 &&
+                 EVP_DecryptUpdate(cipher_ctx, buf + pos, &n, buf + pos, (int)unit) == 1;
+        }
+        break;
+
+    default:
+        cipher_ctx = EVP_CIPHER_CTX_new();
+        ok = cipher_ctx && offset % AES_BLOCK_SIZE == 0 && len % AES_BLOCK_SIZE == 0 &&
+             EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, ctx->key, chain ? chain : ctx->iv) == 1 &&
+             EVP_CIPHER_CTX_set_padding(cipher_ctx, 0) == 1 &&
+             EVP_DecryptUpdate(cipher_ctx, buf, &n, buf, (int)len) == 1;
+        break;
+    }
+
+    EVP_CIPHER_CTX_free(cipher_ctx);
+    if (!ok) {
+        fprintf(stderr, "\nError during decryption at offset %llu: %s\n", (unsigned long long)offset,
+                ERR_error_string(ERR_get_error(), NULL));
+        return ETDK_ERROR_CRYPTO;
+    }
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Encrypt a file through the asynchronous pipeline
+ *
+ * Same output format as the stdio loop (AES-256-CBC with PKCS#7 padding),
+ * but reads run ahead of the encryptor and writes trail behind it. Every
+ * chunk except the last is a multiple of the AES block size, so ciphertext
+ * lands at the plaintext offset and the final padded block follows it.
+ *
+ * @param input_path Path to the input file
+ * @param output_path Path where the encrypted file will be written
+ * @param ctx Pointer to initialized crypto_context_t
+ * @return ETDK_SUCCESS on success, error code on failure
+ */
+static int encrypt_file_pipeline(const char *input_path, const char *output_path, crypto_context_t *ctx) {
+    platform_io_t in = {-1, 0, 512};
+    platform_io_t out = {-1, 0, 512};
+    uint64_t length = 0;
+
+    in.fd = open(input_path, O_RDONLY);
+    if (in.fd < 0) {
+        perror("Cannot open input file");
+        return ETDK_ERROR_IO;
+    }
+    if (platform_get_device_size(input_path, &length) != ETDK_SUCCESS) {
+        close(in.fd);
+        return ETDK_ERROR_IO;
+    }
+
+    out.fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out.fd < 0) {
+        perror("Cannot open output file");
+        close(in.fd);
+        return ETDK_ERROR_IO;
+    }
+
+    platform_writeback_t wb;
+    platform_writeback_init(&wb, out.fd, in.fd);
+    pipeline_crypto_t pc = {init_cipher_context(ctx, 0), 0, ctx, NULL, &wb};
+    if (!pc.cipher_ctx) {
+        close(in.fd);
+        close(out.fd);
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    pipeline_job_t job = {&in, &out, length, io_chunk_size(ctx), 0, ctx->options.queue_depth,
+                          pipeline_encrypt, pipeline_written, &pc, ctx->arena, ctx->metrics};
+    int result = pipeline_run(&job, ctx->options.io_engine);
+
+    // Finalize encryption: padding block or tag after the streamed data
+    if (result == ETDK_SUCCESS)
+        result = finish_file_cipher(pc.cipher_ctx, ctx, out.fd, length);
+    if (platform_writeback_finish(&wb) != ETDK_SUCCESS && result == ETDK_SUCCESS) {
+        perror("Error syncing output file");
+        result = ETDK_ERROR_IO;
+    }
+
+    EVP_CIPHER_CTX_free(pc.cipher_ctx);
+    close(in.fd);
+    if (close(out.fd) != 0 && result == ETDK_SUCCESS)
+        result = ETDK_ERROR_IO;
+
+    return result;
+}
+
+/**
+ * @brief Encrypt a file through memory-mapped windows
+ *
+ * The input is mapped read-only and the output (pre-sized with ftruncate)
+ * read/write in ETDK_MMAP_WINDOW_SIZE windows; EVP_EncryptUpdate() reads
+ * straight from one mapping and writes into the other, so there is no
+ * read()/write() per chunk and no intermediate buffer. Each window is
+ * unmapped as soon as it is done, keeping the resident set bounded.
+ *
+ * Output format is unchanged. Windows are multiples of the AES block size,
+ * so ciphertext offsets equal plaintext offsets and only the trailer
+ * (CBC padding block or GCM tag) is written separately.
+ *
+ * @param input_path Path to the input file
+ * @param output_path Path where the encrypted file will be written
+ * @param ctx Pointer to initialized crypto_context_t
+ * @return ETDK_SUCCESS on success, error code on failure
+ */
+static int encrypt_file_mmap(const char *input_path, const char *output_path, crypto_context_t *ctx) {
+    uint64_t length = 0;
+    if (platform_get_device_size(input_path, &length) != ETDK_SUCCESS) {
+        perror("Cannot stat input file");
+        return ETDK_ERROR_IO;
+    }
+
+    int in_fd = open(input_path, O_RDONLY);
+    if (in_fd < 0) {
+        perror("Cannot open input file");
+        return ETDK_ERROR_IO;
+    }
+
+    int out_fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (out_fd < 0) {
+        perror("Cannot open output file");
+        close(in_fd);
+        return ETDK_ERROR_IO;
+    }
+
+    // Final size including the trailer
+    uint64_t out_size = file_output_size(ctx->mode, length);
+    if (ftruncate(out_fd, (off_t)out_size) != 0) {
+        perror("Cannot size output file");
+        close(in_fd);
+        close(out_fd);
+        return ETDK_ERROR_IO;
+    }
+
+    EVP_CIPHER_CTX *cipher_ctx = init_cipher_context(ctx, 0);
+    if (!cipher_ctx) {
+        close(in_fd);
+        close(out_fd);
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    platform_writeback_t wb;
+    platform_writeback_init(&wb, out_fd, in_fd);
+
+    int result = ETDK_SUCCESS;
+    for (uint64_t offset = 0; offset < length; offset += ETDK_MMAP_WINDOW_SIZE) {
+        size_t len = ETDK_MMAP_WINDOW_SIZE;
+        if (length - offset < len)
+            len = (size_t)(length - offset);
+
+        unsigned char *in = platform_map_window(in_fd, offset, len, 0);
+        unsigned char *out = platform_map_window(out_fd, offset, len, 1);
+        if (!in || !out) {
+            perror("Cannot map file window");
+            if (in)
+                platform_unmap_window(in, len);
+            if (out)
+                platform_unmap_window(out, len);
+            result = ETDK_ERROR_IO;
+            break;
+        }
+
+        size_t outlen;
+        result = cipher_update(cipher_ctx, ctx, out, in, len, offset, &outlen);
+
+        platform_unmap_window(in, len);
+        platform_unmap_window(out, len);
+        if (result != ETDK_SUCCESS)
+            break;
+        platform_writeback_advance(&wb, offset + len);
+    }
+
+    if (result == ETDK_SUCCESS)
+        result = finish_file_cipher(cipher_ctx, ctx, out_fd, length);
+    if (platform_writeback_finish(&wb) != ETDK_SUCCESS && result == ETDK_SUCCESS) {
+        perror("Error syncing output file");
+        result = ETDK_ERROR_IO;
+    }
+
+    EVP_CIPHER_CTX_free(cipher_ctx);
+    close(in_fd);
+    if (close(out_fd) != 0 && result == ETDK_SUCCESS)
+        result = ETDK_ERROR_IO;
+
+    return result;
+}
+
+/**
+ * @brief Encrypt an open file in place through writable mapped windows
+ *
+ * CTR keystream is applied directly to the shared mapping; dirty pages are
+ * written back window by window and made durable by the caller.
+ *
+ * @param fd File descriptor opened read/write
+ * @param length File size in bytes
+ * @param pc CTR cipher context positioned at offset 0 and write-out state of fd
+ * @return ETDK_SUCCESS on success, error code on failure
+ */
+static int encrypt_inplace_mmap(int fd, uint64_t length, pipeline_crypto_t *pc) {
+    for (uint64_t offset = 0; offset < length; offset += ETDK_MMAP_WINDOW_SIZE) {
+        size_t len = ETDK_MMAP_WINDOW_SIZE;
+        if (length - offset < len)
+            len = (size_t)(length - offset);
+
+        unsigned char *win = platform_map_window(fd, offset, len, 1);
+        if (!win) {
+            perror("Cannot map file window");
+            return ETDK_ERROR_IO;
+        }
+
+        int outlen;
+        note_written(pc->ctx, offset + len);
+        int ok = EVP_EncryptUpdate(pc->cipher_ctx, win, &outlen, win, (int)len) == 1;
+        platform_unmap_window(win, len);
+        if (!ok) {
+            fprintf(stderr, "Error during encryption: %s\n", ERR_error_string(ERR_get_error(), NULL));
+            return ETDK_ERROR_CRYPTO;
+        }
+        platform_writeback_advance(pc->wb, offset + len);
+    }
+
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Report that a file is encrypted sparse-aware
+ *
+ * @param path File path
+ * @param length Apparent size
+ * @param allocated Allocated size
+ */
+static void print_sparse_note(const char *path, uint64_t length, uint64_t allocated) {
+    printf("Sparse: %s (%llu of %llu bytes allocated, holes kept, AES-256-CTR)\n", path,
+           (unsigned long long)allocated, (unsigned long long)length);
+}
+
+/**
+ * @brief Check whether a file has holes worth skipping
+ *
+ * Only real holes count (platform_has_holes()); a compressed or
+ * deduplicated file without holes keeps the run's mode.
+ *
+ * @param fd Open file descriptor
+ * @param length Apparent file size
+ * @param allocated Receives the allocated size in bytes (for print_sparse_note())
+ * @return Non-zero if the file has a hole before length
+ */
+static int file_is_sparse(int fd, uint64_t length, uint64_t *allocated) {
+    if (!platform_has_holes(fd, length) || platform_allocated_size(fd, allocated) != ETDK_SUCCESS) {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Encrypt only the allocated ranges of a sparse file with AES-256-CTR
+ *
+ * Data ranges are enumerated with platform_next_data() and encrypted at
+ * their absolute offsets (the CTR counter follows the offset, see
+ * init_cipher_context()). Holes are neither read nor written, so they stay
+ * holes and run time scales with the allocated data, not the apparent size.
+ *
+ * @param in_fd Source descriptor
+ * @param out_fd Destination descriptor (same as in_fd for in-place encryption)
+ * @param length Apparent file size
+ * @param ctx Pointer to crypto_context_t (mode must be ETDK_CIPHER_CTR)
+ * @param wb Write-out state of out_fd
+ * @return ETDK_SUCCESS on success, error code on failure
+ */
+static int encrypt_sparse(int in_fd, int out_fd, uint64_t length, crypto_context_t *ctx,
+                          platform_writeback_t *wb) {
+    size_t chunk = io_chunk_size(ctx);
+    unsigned char *buf = platform_arena_alloc(ctx->arena, chunk, ETDK_CHUNK_ALIGN);
+    if (!buf) {
+        return ETDK_ERROR_MEMORY;
+    }
+
+    int result = ETDK_SUCCESS;
+    int found = 0;
+    uint64_t pos = 0, start, end;
+
+    while (result == ETDK_SUCCESS && (found = platform_next_data(in_fd, pos, length, &start, &end)) > 0) {
+        pipeline_crypto_t pc = {init_cipher_context(ctx, start), length, ctx, NULL, NULL};
+        if (!pc.cipher_ctx) {
+            result = ETDK_ERROR_CRYPTO;
+            break;
+        }
+
+        for (uint64_t offset = start; offset < end;) {
+            size_t len = chunk;
+            if (end - offset < len)
+                len = (size_t)(end - offset);
+
+            int64_t n = platform_pread_full(in_fd, buf, len, offset);
+            if (n <= 0) {
+                if (n < 0) {
+                    perror("Error reading file");
+                    result = ETDK_ERROR_IO;
+                }
+                end = offset; // File shrank while encrypting
+                break;
+            }
+
+            size_t outlen;
+            if (pipeline_encrypt(&pc, buf, (size_t)n, offset, &outlen) != ETDK_SUCCESS) {
+                result = ETDK_ERROR_CRYPTO;
+                break;
+            }
+            if (platform_pwrite_full(out_fd, buf, outlen, offset) != ETDK_SUCCESS) {
+                perror("Error writing file");
+                result = ETDK_ERROR_IO;
+                break;
+            }
+
+            offset += (uint64_t)n;
+            platform_writeback_advance(wb, offset);
+        }
+
+        EVP_CIPHER_CTX_free(pc.cipher_ctx);
+        pos = end;
+    }
+
+    if (found < 0) {
+        perror("Cannot find data ranges");
+        result = ETDK_ERROR_IO;
+    }
+
+    platform_arena_free(ctx->arena, buf);
+    return result;
+}
+
+/**
+ * @brief Encrypt a sparse file into a new sparse file
+ *
+ * The output is sized with ftruncate(), which leaves it one big hole,
+ * and only the input's data ranges are written into it (AES-256-CTR, so
+ * ciphertext lands at the plaintext offset and the size is unchanged).
+ *
+ * @param in_fd Input descriptor
+ * @param output_path Path where the encrypted file will be written
+ * @param length Apparent input size
+ * @param ctx Pointer to crypto_context_t (switched to ETDK_CIPHER_CTR)
+ * @return ETDK_SUCCESS on success, error code on failure
+ */
+static int encrypt_file_sparse(int in_fd, const char *output_path, uint64_t length, crypto_context_t *ctx) {
+    int out_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out_fd < 0) {
+        perror("Cannot open output file");
+        return ETDK_ERROR_IO;
+    }
+
+    if (ftruncate(out_fd, (off_t)length) != 0) {
+        perror("Cannot size output file");
+        close(out_fd);
+        return ETDK_ERROR_IO;
+    }
+
+    ctx->mode = ETDK_CIPHER_CTR;
+    platform_writeback_t wb;
+    platform_writeback_init(&wb, out_fd, in_fd);
+    int result = encrypt_sparse(in_fd, out_fd, length, ctx, &wb);
+    if (platform_writeback_finish(&wb) != ETDK_SUCCESS && result == ETDK_SUCCESS) {
+        perror("Error syncing output file");
+        result = ETDK_ERROR_IO;
+    }
+
+    if (close(out_fd) != 0 && result == ETDK_SUCCESS)
+        result = ETDK_ERROR_IO;
+
+    return result;
+}
+
+/**
+ * @brief Encrypt a file with the kernel crypto engine (--crypto-engine kernel)
+ *
+ * The input's page cache pages are spliced into the AF_ALG socket, so the
+ * plaintext is never copied into this process; only the ciphertext is
+ * read back and written with pwrite(). The CBC padding block is built
+ * from the last partial block, as EVP_EncryptFinal_ex() would.
+ *
+ * @param input_path Path to the input file to encrypt
+ * @param output_path Path where encrypted file will be written
+ * @param ctx Pointer to crypto_context_t, mode CBC or CTR
+ * @return ETDK_SUCCESS on success, error code on failure
+ */
+static int encrypt_file_kernel(const char *input_path, const char *output_path, crypto_context_t *ctx) {
+    int in_fd = open(input_path, O_RDONLY);
+    if (in_fd < 0) {
+        perror("Cannot open input file");
+        return ETDK_ERROR_IO;
+    }
+
+    uint64_t length = 0;
+    int out_fd = platform_get_device_size(input_path, &length) == ETDK_SUCCESS
+                     ? open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0666)
+                     : -1;
+    if (out_fd < 0) {
+        perror("Cannot open output file");
+        close(in_fd);
+        return ETDK_ERROR_IO;
+    }
+
+    size_t chunk = io_chunk_size(ctx);
+    unsigned char *buf = platform_arena_alloc(ctx->arena, chunk, ETDK_CHUNK_ALIGN);
+    kcrypto_t *k = buf ? init_kernel_cipher(ctx, 0) : NULL;
+    if (!k) {
+        platform_arena_free(ctx->arena, buf);
+        close(in_fd);
+        close(out_fd);
+        return buf ? ETDK_ERROR_CRYPTO : ETDK_ERROR_MEMORY;
+    }
+
+    uint64_t bulk = ctx->mode == ETDK_CIPHER_CBC ? length - length % AES_BLOCK_SIZE : length;
+    int result = ETDK_SUCCESS;
+    platform_writeback_t wb;
+    platform_writeback_init(&wb, out_fd, in_fd);
+
+    for (uint64_t offset = 0; offset < bulk && result == ETDK_SUCCESS;) {
+        size_t len = bulk - offset < chunk ? (size_t)(bulk - offset) : chunk;
+        result = kcrypto_encrypt_fd(k, in_fd, offset, buf, len);
+        if (result == ETDK_SUCCESS && platform_pwrite_full(out_fd, buf, len, offset) != ETDK_SUCCESS) {
+            perror("Error writing output file");
+            result = ETDK_ERROR_IO;
+        }
+        offset += len;
+        platform_writeback_advance(&wb, offset);
+    }
+
+    if (result == ETDK_SUCCESS && ctx->mode == ETDK_CIPHER_CBC) {
+        // PKCS#7: the remaining 0..15 bytes plus 16 - n bytes of value 16 - n
+        unsigned char block[AES_BLOCK_SIZE];
+        size_t rest = (size_t)(length - bulk);
+        if (platform_pread_full(in_fd, block, rest, bulk) != (int64_t)rest) {
+            perror("Error reading input file");
+            result = ETDK_ERROR_IO;
+        } else {
+            memset(block + rest, (int)(AES_BLOCK_SIZE - rest), AES_BLOCK_SIZE - rest);
+            result = kcrypto_encrypt(k, block, buf, AES_BLOCK_SIZE);
+            if (result == ETDK_SUCCESS && platform_pwrite_full(out_fd, buf, AES_BLOCK_SIZE, bulk) != ETDK_SUCCESS)
+                result = ETDK_ERROR_IO;
+        }
+    }
+
+    kcrypto_close(k);
+    platform_arena_free(ctx->arena, buf);
+    if (platform_writeback_finish(&wb) != ETDK_SUCCESS && result == ETDK_SUCCESS) {
+        perror("Error syncing output file");
+        result = ETDK_ERROR_IO;
+    }
+    close(in_fd);
+    if (close(out_fd) != 0 && result == ETDK_SUCCESS)
+        result = ETDK_ERROR_IO;
+
+    return result;
+}
+
+/**
+ * @brief Encrypt a file with the cipher in ctx->mode
+ *
+ * Reads the input file in chunks, encrypts each chunk (AES-256-CBC,
+ * -CTR or -GCM), and writes the encrypted data to the output file. CBC
+ * output carries PKCS#7 padding, GCM output is followed by the 16-byte tag.
+ *
+ * Sparse files (fewer bytes allocated than their size) are encrypted with
+ * AES-256-CTR over their data ranges only and keep their holes, see
+ * encrypt_file_sparse(), unless --cipher excludes CTR; ctx->mode reports
+ * the cipher actually used.
+ *
+ * @param input_path Path to the input file to encrypt
+ * @param output_path Path where encrypted file will be written
+ * @param ctx Pointer to initialized crypto_context_t with key and IV
+ * @return ETDK_SUCCESS on success, error code on failure
+ */
+int crypto_encrypt_file(const char *input_path, const char *output_path, crypto_context_t *ctx) {
+    if (!input_path || !output_path || !ctx) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    if (!(cipher_info(ctx->mode)->targets & TARGET_BIT(ETDK_TARGET_FILE))) {
+        fprintf(stderr, "%s cannot encrypt files\n", crypto_cipher_name(ctx));
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    int in_fd = -1;
+    if (ctx->options.ciphers == 0 || (ctx->options.ciphers & ETDK_CIPHER_BIT(ETDK_CIPHER_CTR)))
+        in_fd = open(input_path, O_RDONLY);
+    if (in_fd >= 0) {
+        uint64_t length = 0, allocated = 0;
+        if (platform_get_device_size(input_path, &length) == ETDK_SUCCESS &&
+            file_is_sparse(in_fd, length, &allocated)) {
+            print_sparse_note(input_path, length, allocated);
+            int result = encrypt_file_sparse(in_fd, output_path, length, ctx);
+            close(in_fd);
+            return result;
+        }
+        close(in_fd);
+    }
+
+    if (ctx->options.mmap_io) {
+        return encrypt_file_mmap(input_path, output_path, ctx);
+    }
+
+    if (ctx->options.queue_depth > 0) {
+        return encrypt_file_pipeline(input_path, output_path, ctx);
+    }
+
+    if (ctx->options.crypto_engine == ETDK_CRYPTO_KERNEL) {
+        return encrypt_file_kernel(input_path, output_path, ctx);
+    }
+
+    FILE *input = fopen(input_path, "rb");
+    if (!input) {
+        perror("Cannot open input file");
+        return ETDK_ERROR_IO;
+    }
+
+    FILE *output = fopen(output_path, "wb");
+    if (!output) {
+        perror("Cannot open output file");
+        fclose(input);
+        return ETDK_ERROR_IO;
+    }
+
+    /* Encrypt file in chunks (1MB unless tuned, see crypto_tune_io())
+     * Processing in chunks allows encryption of files larger than available RAM.
+     * Each chunk is encrypted in place and immediately written to reduce memory usage.
+     */
+    size_t chunk = io_chunk_size(ctx);
+    unsigned char *buf = platform_arena_alloc(ctx->arena, chunk + EVP_MAX_BLOCK_LENGTH, ETDK_CHUNK_ALIGN);
+    EVP_CIPHER_CTX *cipher_ctx = buf ? init_cipher_context(ctx, 0) : NULL;
+    if (!cipher_ctx) {
+        platform_arena_free(ctx->arena, buf);
+        fclose(input);
+        fclose(output);
+        return buf ? ETDK_ERROR_CRYPTO : ETDK_ERROR_MEMORY;
+    }
+
+    size_t inlen, outlen;
+    uint64_t length = 0, written = 0;
+    int result = ETDK_SUCCESS;
+    platform_writeback_t wb;
+    platform_writeback_init(&wb, fileno(output), fileno(input));
+
+    while ((inlen = fread(buf, 1, chunk, input)) > 0) {
+        if (cipher_update(cipher_ctx, ctx, buf, buf, inlen, length, &outlen) != ETDK_SUCCESS) {
+            EVP_CIPHER_CTX_free(cipher_ctx);
+            platform_arena_free(ctx->arena, buf);
+            fclose(input);
+            fclose(output);
+            return ETDK_ERROR_CRYPTO;
+        }
+        if (fwrite(buf, 1, outlen, output) != outlen) {
+            perror("Error writing output file");
+            result = ETDK_ERROR_IO;
+            break;
+        }
+        length += inlen;
+        written += outlen;
+
+        // Hand the stdio buffer to the kernel only when a write-out window is due
+        if (written >= wb.started + ETDK_WRITEBACK_WINDOW && fflush(output) == 0)
+            platform_writeback_advance(&wb, written);
+    }
+    platform_arena_free(ctx->arena, buf);
+
+    /* Finalize encryption
+     * In CBC mode, this adds PKCS#7 padding to ensure the last block
+     * is complete; in GCM mode the authentication tag is appended.
+     */
+    if (result == ETDK_SUCCESS)
+        result = (fflush(output) == 0) ? finish_file_cipher(cipher_ctx, ctx, fileno(output), length) : ETDK_ERROR_IO;
+    if (platform_writeback_finish(&wb) != ETDK_SUCCESS && result == ETDK_SUCCESS) {
+        perror("Error syncing output file");
+        result = ETDK_ERROR_IO;
+    }
+
+    EVP_CIPHER_CTX_free(cipher_ctx);
+    fclose(input);
+    if (fclose(output) != 0 && result == ETDK_SUCCESS)
+        result = ETDK_ERROR_IO;
+
+    return result;
+}
+
+/**
+ * @brief Encrypt a small file with one read, one encryption and one write
+ *
+ * The whole file is read with one pread() (one byte more than expected
+ * detects a file that grew), encrypted in buf including the CBC padding
+ * or GCM tag, and written with one pwrite(). The cipher context is kept
+ * in ctx->cipher_ctx across calls: the key schedule is set up once per
+ * worker, each further file only sets its IV. crypto_cleanup() frees it.
+ *
+ * @param in_fd Input opened for reading
+ * @param out_fd Empty output opened for writing
+ * @param length Input size, at most ETDK_SMALL_FILE_SIZE
+ * @param ctx Crypto context (key, IV, mode; cipher_ctx is set)
+ * @param buf Buffer of ETDK_SMALL_FILE_SIZE + ETDK_CHUNK_ALIGN bytes
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO or ETDK_ERROR_CRYPTO
+ */
+int crypto_encrypt_small(int in_fd, int out_fd, uint64_t length, crypto_context_t *ctx, unsigned char *buf) {
+    if (!ctx || !buf || length > ETDK_SMALL_FILE_SIZE) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    if (!(cipher_info(ctx->mode)->targets & TARGET_BIT(ETDK_TARGET_FILE))) {
+        fprintf(stderr, "%s cannot encrypt files\n", crypto_cipher_name(ctx));
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    int64_t n = platform_pread_full(in_fd, buf, (size_t)length + 1, 0);
+    if (n != (int64_t)length) {
+        if (n < 0)
+            perror("Error reading input file");
+        else
+            fprintf(stderr, "Input file changed size while being read\n");
+        return ETDK_ERROR_IO;
+    }
+
+    EVP_CIPHER_CTX *cipher_ctx = ctx->cipher_ctx;
+    if (!cipher_ctx) {
+        cipher_ctx = init_cipher_context(ctx, 0);
+        if (!cipher_ctx)
+            return ETDK_ERROR_CRYPTO;
+        ctx->cipher_ctx = cipher_ctx;
+    } else if (EVP_EncryptInit_ex(cipher_ctx, NULL, NULL, NULL, ctx->iv) != 1) {
+        // Offset 0: the CTR counter block is the IV itself
+        fprintf(stderr, "Error initializing encryption: %s\n", ERR_error_string(ERR_get_error(), NULL));
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    size_t outlen;
+    int finlen;
+    if (cipher_update(cipher_ctx, ctx, buf, buf, (size_t)length, 0, &outlen) != ETDK_SUCCESS)
+        return ETDK_ERROR_CRYPTO;
+    if (EVP_EncryptFinal_ex(cipher_ctx, buf + outlen, &finlen) != 1 ||
+        (ctx->mode == ETDK_CIPHER_GCM &&
+         EVP_CIPHER_CTX_ctrl(cipher_ctx, EVP_CTRL_GCM_GET_TAG, ETDK_GCM_TAG_SIZE, buf + outlen + finlen) != 1)) {
+        fprintf(stderr, "Error finalizing encryption: %s\n", ERR_error_string(ERR_get_error(), NULL));
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    if (platform_pwrite_full(out_fd, buf, (size_t)file_output_size(ctx->mode, length), 0) != ETDK_SUCCESS) {
+        perror("Error writing output file");
+        return ETDK_ERROR_IO;
+    }
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Encrypt a regular file in place with AES-256-CTR
+ *
+ * Overwrites the file's own blocks instead of writing a temporary copy:
+ * each chunk is read with pread(), encrypted in place and written back
+ * with pwrite() at the same offset. CTR is length-preserving, so the file
+ * keeps its size, no free space is needed and the original extents are
+ * overwritten (on filesystems that do not relocate rewritten blocks).
+ *
+ * Holes of sparse files are skipped (see encrypt_sparse()), so they are
+ * not allocated and only the stored data is rewritten.
+ *
+ * @param path Path to the file to encrypt
+ * @param ctx Pointer to initialized crypto_context_t with key and IV
+ * @return ETDK_SUCCESS on success, error code on failure
+ */
+int crypto_encrypt_file_inplace(const char *path, crypto_context_t *ctx) {
+    if (!path || !ctx) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    ctx->mode = ETDK_CIPHER_CTR;
+
+    uint64_t length = 0;
+    if (platform_get_device_size(path, &length) != ETDK_SUCCESS) {
+        perror("Cannot stat file");
+        return ETDK_ERROR_IO;
+    }
+
+    platform_io_t io;
+    if (platform_io_open(&io, path, 0) != ETDK_SUCCESS) {
+        perror("Cannot open file");
+        return ETDK_ERROR_IO;
+    }
+
+    platform_writeback_t wb;
+    platform_writeback_init(&wb, io.fd, -1);
+    pipeline_crypto_t pc = {init_cipher_context(ctx, 0), length, ctx, NULL, &wb};
+    if (!pc.cipher_ctx) {
+        platform_io_close(&io);
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    int result = ETDK_SUCCESS;
+    uint64_t allocated = 0;
+
+    if (file_is_sparse(io.fd, length, &allocated)) {
+        print_sparse_note(path, length, allocated);
+        result = encrypt_sparse(io.fd, io.fd, length, ctx, &wb);
+    } else if (ctx->options.mmap_io) {
+        result = encrypt_inplace_mmap(io.fd, length, &pc);
+    } else if (ctx->options.queue_depth > 0) {
+        // Overlap reads and writes of the same file; CTR output length equals input length
+        pipeline_job_t job = {&io, &io, length, io_chunk_size(ctx), 0, ctx->options.queue_depth,
+                              pipeline_encrypt, pipeline_written, &pc, ctx->arena, ctx->metrics};
+        result = pipeline_run(&job, ctx->options.io_engine);
+    } else {
+        size_t chunk = io_chunk_size(ctx);
+        unsigned char *buf = platform_arena_alloc(ctx->arena, chunk, ETDK_CHUNK_ALIGN);
+        if (!buf) {
+            result = ETDK_ERROR_MEMORY;
+        }
+
+        for (uint64_t offset = 0; buf && offset < length;) {
+            size_t len = chunk;
+            if (length - offset < len)
+                len = (size_t)(length - offset);
+
+            int64_t n = platform_io_read(&io, buf, len, offset);
+            if (n <= 0) {
+                if (n < 0) {
+                    perror("Error reading file");
+                    result = ETDK_ERROR_IO;
+                }
+                break; // File shrank while encrypting: nothing left to overwrite
+            }
+
+            size_t outlen;
+            if (pipeline_encrypt(&pc, buf, (size_t)n, offset, &outlen) != ETDK_SUCCESS) {
+                result = ETDK_ERROR_CRYPTO;
+                break;
+            }
+
+            if (platform_io_write(&io, buf, outlen, offset) != ETDK_SUCCESS) {
+                perror("Error writing file");
+                result = ETDK_ERROR_IO;
+                break;
+            }
+
+            offset += (uint64_t)n;
+            platform_writeback_advance(&wb, offset);
+        }
+
+        platform_arena_free(ctx->arena, buf);
+    }
+
+    EVP_CIPHER_CTX_free(pc.cipher_ctx);
+
+    // Make sure the ciphertext has replaced the plaintext on disk
+    int synced = platform_writeback_finish(&wb);
+    if ((platform_io_close(&io) != ETDK_SUCCESS || synced != ETDK_SUCCESS) && result == ETDK_SUCCESS) {
+        perror("Error syncing file");
+        result = ETDK_ERROR_IO;
+    }
+
+    return result;
+}
+
+_Static_assert(sizeof(etdk_container_header_t) <= ETDK_CONTAINER_HEADER_SIZE, "container header must fit");
+
+/**
+ * @brief Compute the checksum of a container header
+ *
+ * @param header Header (digest field excluded)
+ * @param digest Receives the SHA-256 digest (32 bytes)
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+static int container_digest(const etdk_container_header_t *header, unsigned char *digest) {
+    unsigned int len = 0;
+    return EVP_Digest(header, offsetof(etdk_container_header_t, digest), digest, &len, EVP_sha256(), NULL) == 1
+               ? ETDK_SUCCESS
+               : ETDK_ERROR_CRYPTO;
+}
+
+/**
+ * @brief Read and check the header at the start of a container
+ *
+ * @param fd Open file
+ * @param header Receives the header
+ * @return ETDK_SUCCESS, or ETDK_ERROR_IO if fd does not hold a valid header
+ */
+static int container_read(int fd, etdk_container_header_t *header) {
+    unsigned char digest[32];
+
+    if (platform_pread_full(fd, header, sizeof(*header), 0) != (int64_t)sizeof(*header) ||
+        memcmp(header->magic, ETDK_CONTAINER_MAGIC, sizeof(header->magic)) != 0 ||
+        header->header_size != ETDK_CONTAINER_HEADER_SIZE || header->mode != ETDK_CIPHER_CTR ||
+        container_digest(header, digest) != ETDK_SUCCESS || memcmp(digest, header->digest, sizeof(digest)) != 0) {
+        return ETDK_ERROR_IO;
+    }
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Wrap or unwrap a 256-bit data key (AES-256 key wrap, RFC 3394)
+ *
+ * Unwrapping checks the integrity value of the wrapped key, so a wrong
+ * key-encryption key is detected instead of yielding a wrong data key.
+ *
+ * @param kek Key-encryption key (32 bytes)
+ * @param in Data key (32 bytes) or wrapped key (ETDK_CONTAINER_WRAPPED_SIZE bytes)
+ * @param out Receives the wrapped or unwrapped key
+ * @param wrap Non-zero to wrap, 0 to unwrap
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+static int container_wrap_key(const uint8_t *kek, const uint8_t *in, uint8_t *out, int wrap) {
+    EVP_CIPHER_CTX *wrap_ctx = EVP_CIPHER_CTX_new();
+    if (!wrap_ctx) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    int in_len = wrap ? 32 : ETDK_CONTAINER_WRAPPED_SIZE;
+    int out_len = 0, final_len = 0;
+    EVP_CIPHER_CTX_set_flags(wrap_ctx, EVP_CIPHER_CTX_FLAG_WRAP_ALLOW);
+    int ok = EVP_CipherInit_ex(wrap_ctx, EVP_aes_256_wrap(), NULL, kek, NULL, wrap) == 1 &&
+             EVP_CipherUpdate(wrap_ctx, out, &out_len, in, in_len) == 1 &&
+             EVP_CipherFinal_ex(wrap_ctx, out + out_len, &final_len) == 1 &&
+             out_len + final_len == (wrap ? ETDK_CONTAINER_WRAPPED_SIZE : 32);
+
+    EVP_CIPHER_CTX_free(wrap_ctx);
+    return ok ? ETDK_SUCCESS : ETDK_ERROR_CRYPTO;
+}
+
+/**
+ * @brief Encrypt the input behind the header of a container
+ *
+ * @param in_fd Input file
+ * @param out_fd Container
+ * @param payload Context with the data key, payload IV and options
+ * @param length Receives the payload length
+ * @return ETDK_SUCCESS or error code
+ */
+static int container_payload(int in_fd, int out_fd, const crypto_context_t *payload, uint64_t *length) {
+    size_t chunk = io_chunk_size(payload);
+    unsigned char *buf = platform_arena_alloc(payload->arena, chunk, ETDK_CHUNK_ALIGN);
+    EVP_CIPHER_CTX *cipher_ctx = buf ? init_cipher_context(payload, 0) : NULL;
+    if (!cipher_ctx) {
+        platform_arena_free(payload->arena, buf);
+        return buf ? ETDK_ERROR_CRYPTO : ETDK_ERROR_MEMORY;
+    }
+
+    platform_writeback_t wb;
+    platform_writeback_init(&wb, out_fd, in_fd);
+
+    int result = ETDK_SUCCESS;
+    uint64_t offset = 0;
+    for (;;) {
+        int64_t n = platform_pread_full(in_fd, buf, chunk, offset);
+        if (n <= 0) {
+            if (n < 0) {
+                perror("Error reading input file");
+                result = ETDK_ERROR_IO;
+            }
+            break;
+        }
+
+        size_t outlen;
+        result = cipher_update(cipher_ctx, payload, buf, buf, (size_t)n, offset, &outlen);
+        if (result != ETDK_SUCCESS)
+            break;
+        if (platform_pwrite_full(out_fd, buf, outlen, ETDK_CONTAINER_HEADER_SIZE + offset) != ETDK_SUCCESS) {
+            perror("Error writing container");
+            result = ETDK_ERROR_IO;
+            break;
+        }
+
+        offset += (uint64_t)n;
+        platform_writeback_advance(&wb, ETDK_CONTAINER_HEADER_SIZE + offset);
+    }
+
+    EVP_CIPHER_CTX_free(cipher_ctx);
+    platform_arena_free(payload->arena, buf);
+    *length = offset;
+    return result;
+}
+
+/**
+ * @brief Encrypt a file into an ETDK container
+ *
+ * Layout: a ETDK_CONTAINER_HEADER_SIZE header holding the key slot, then
+ * the payload, AES-256-CTR under a random data key and IV that are unique
+ * to the container. The data key is stored only wrapped with ctx->key, the
+ * key-encryption key (KEK) of the run, so many containers can share one
+ * KEK and each can still be destroyed on its own by overwriting its header
+ * (crypto_destroy_container()), without touching the payload.
+ *
+ * The payload is written first and the header last, then everything is
+ * synced once; a container is only valid after a complete run.
+ *
+ * @param input_path Path to the input file
+ * @param output_path Path of the container to write
+ * @param ctx Crypto context whose key is the KEK (ctx->mode set to ETDK_CIPHER_CTR)
+ * @return ETDK_SUCCESS on success, error code on failure
+ */
+int crypto_encrypt_container(const char *input_path, const char *output_path, crypto_context_t *ctx) {
+    if (!input_path || !output_path || !ctx) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    ctx->mode = ETDK_CIPHER_CTR;
+
+    int in_fd = open(input_path, O_RDONLY);
+    if (in_fd < 0) {
+        perror("Cannot open input file");
+        return ETDK_ERROR_IO;
+    }
+
+    int out_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out_fd < 0) {
+        perror("Cannot open output file");
+        close(in_fd);
+        return ETDK_ERROR_IO;
+    }
+
+    // The data key lives in a copy of the context in the locked key slab, wiped before returning
+    crypto_context_t *payload = crypto_secure_alloc(sizeof(crypto_context_t));
+    if (!payload) {
+        close(in_fd);
+        close(out_fd);
+        return ETDK_ERROR_MEMORY;
+    }
+    payload->mode = ETDK_CIPHER_CTR;
+    payload->options = ctx->options;
+    payload->arena = ctx->arena;
+
+    unsigned char block[ETDK_CONTAINER_HEADER_SIZE];
+    etdk_container_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ETDK_CONTAINER_MAGIC, sizeof(header.magic));
+    header.header_size = ETDK_CONTAINER_HEADER_SIZE;
+    header.mode = ETDK_CIPHER_CTR;
+
+    int result = ETDK_ERROR_CRYPTO;
+    if (crypto_generate_key(payload->key, crypto_key_size(payload)) == ETDK_SUCCESS &&
+        RAND_bytes(payload->iv, AES_BLOCK_SIZE) == 1 &&
+        container_wrap_key(ctx->key, payload->key, header.wrapped_key, 1) == ETDK_SUCCESS) {
+        memcpy(header.iv, payload->iv, AES_BLOCK_SIZE);
+        result = container_payload(in_fd, out_fd, payload, &header.payload_length);
+    }
+
+    if (result == ETDK_SUCCESS)
+        result = container_digest(&header, header.digest);
+    if (result == ETDK_SUCCESS) {
+        memset(block, 0, sizeof(block));
+        memcpy(block, &header, sizeof(header));
+        if (platform_pwrite_full(out_fd, block, sizeof(block), 0) != ETDK_SUCCESS ||
+            (header.payload_length == 0 && ftruncate(out_fd, ETDK_CONTAINER_HEADER_SIZE) != 0) ||
+            fdatasync(out_fd) != 0) {
+            perror("Error writing container header");
+            result = ETDK_ERROR_IO;
+        }
+    }
+
+    crypto_secure_free(payload, sizeof(crypto_context_t));
+    OPENSSL_cleanse(&header, sizeof(header));
+    OPENSSL_cleanse(block, sizeof(block));
+
+    close(in_fd);
+    if (close(out_fd) != 0 && result == ETDK_SUCCESS)
+        result = ETDK_ERROR_IO;
+
+    return result;
+}
+
+/**
+ * @brief Check whether a file starts with a valid container header
+ *
+ * @param path File path
+ * @return 1 for an ETDK container, 0 otherwise
+ */
+int crypto_container_probe(const char *path) {
+    if (!path) {
+        return 0;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    etdk_container_header_t header;
+    int found = container_read(fd, &header) == ETDK_SUCCESS;
+    close(fd);
+    return found;
+}
+
+/**
+ * @brief Read a container header and unwrap its data key
+ *
+ * @param fd Container opened for reading
+ * @param ctx Crypto context holding the KEK; receives data key, payload IV and mode
+ * @param header Receives the header
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO (not a container), or ETDK_ERROR_CRYPTO (wrong key)
+ */
+int crypto_container_open(int fd, crypto_context_t *ctx, etdk_container_header_t *header) {
+    if (!ctx || !header) {
+        return ETDK_ERROR_CRYPTO;
+    }
+    if (container_read(fd, header) != ETDK_SUCCESS) {
+        return ETDK_ERROR_IO;
+    }
+
+    uint8_t key[32];
+    if (container_wrap_key(ctx->key, header->wrapped_key, key, 0) != ETDK_SUCCESS) {
+        OPENSSL_cleanse(key, sizeof(key));
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    OPENSSL_cleanse(ctx->key, sizeof(ctx->key));
+    memcpy(ctx->key, key, sizeof(key));
+    OPENSSL_cleanse(key, sizeof(key));
+    memcpy(ctx->iv, header->iv, AES_BLOCK_SIZE);
+    ctx->mode = (etdk_cipher_t)header->mode;
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Crypto-erase a container
+ *
+ * The header is overwritten with random data and then zeros, each pass
+ * synced (as journal_destroy() does for key files), its blocks are
+ * released with platform_punch_hole() so SSDs can discard them, and the
+ * file is unlinked. Without the wrapped data key the payload is noise,
+ * so it is left for the filesystem to free: the cost is a few KB of
+ * writes regardless of the payload size.
+ *
+ * @param path Container path (refused unless it carries a valid header)
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO, or ETDK_ERROR_CRYPTO
+ */
+int crypto_destroy_container(const char *path) {
+    if (!path) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    int fd = open(path, O_RDWR | O_NOFOLLOW);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return ETDK_ERROR_IO;
+    }
+
+    etdk_container_header_t header;
+    if (container_read(fd, &header) != ETDK_SUCCESS) {
+        fprintf(stderr, "%s is not an ETDK container, left untouched\n", path);
+        close(fd);
+        return ETDK_ERROR_IO;
+    }
+    OPENSSL_cleanse(&header, sizeof(header));
+
+    unsigned char junk[ETDK_CONTAINER_HEADER_SIZE];
+    int result = ETDK_SUCCESS;
+    for (int pass = 0; pass < 2; pass++) {
+        // Zeroed first so a failed random fill degrades to a zero pass, never stack contents
+        memset(junk, 0, sizeof(junk));
+        if (pass == 0 && RAND_bytes(junk, sizeof(junk)) != 1)
+            result = ETDK_ERROR_CRYPTO;
+
+        if (platform_pwrite_full(fd, junk, sizeof(junk), 0) != ETDK_SUCCESS || fdatasync(fd) != 0) {
+            fprintf(stderr, "Error overwriting the key slot of %s: %s\n", path, strerror(errno));
+            close(fd);
+            return ETDK_ERROR_IO;
+        }
+    }
+
+    // Best effort: not every filesystem can punch holes
+    platform_punch_hole(fd, 0, ETDK_CONTAINER_HEADER_SIZE);
+    close(fd);
+
+    if (unlink(path) != 0 || platform_sync_directory(path) != ETDK_SUCCESS) {
+        fprintf(stderr, "Key slot of %s destroyed, but removing the file failed: %s\n", path, strerror(errno));
+        result = ETDK_ERROR_IO;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Display the encryption key and IV in hexadecimal format
+ *
+ * Shows the key to the user ONE TIME ONLY before it is securely deleted.
+ * This allows for potential data recovery if needed. Once the key is wiped,
+ * the encrypted data becomes permanently irrecoverable.
+ *
+ * @param ctx Pointer to crypto_context_t containing the key and IV
+ */
+void crypto_display_key(const crypto_context_t *ctx) {
+    if (!ctx)
+        return;
+
+    printf("---\n");
+    printf("ENCRYPTION KEY - SAVE NOW OR LOSE FOREVER\n");
+    printf("\n");
+    printf("Key: ");
+    for (size_t i = 0; i < crypto_key_size(ctx); i++) {
+        printf("%02x", ctx->key[i]);
+    }
+    printf("\n");
+    if (ctx->options.container) {
+        // Key-encryption key: every container carries its own data key and IV in its key slot
+        printf("IV:  - (ETDK container: data key and IV are in each container's key slot)\n");
+    } else if (ctx->mode == ETDK_CIPHER_XTS) {
+        // No IV: the tweak is the 4096-byte data unit number (dm-crypt plain64)
+        printf("IV:  - (XTS, tweak = byte offset / %d)\n", ETDK_XTS_DATA_UNIT);
+    } else {
+        printf("IV:  ");
+        for (int i = 0; i < AES_BLOCK_SIZE; i++) {
+            printf("%02x", ctx->iv[i]);
+        }
+        // Batch runs derive per-file IVs from all 16 bytes, so print them all
+        printf(ctx->mode == ETDK_CIPHER_GCM ? " (GCM nonce: first %d bytes)\n" : "\n", ETDK_GCM_NONCE_SIZE);
+    }
+    printf("Mode: %s\n", crypto_cipher_name(ctx));
+    printf("\n");
+    printf("Key is stored in RAM only and will be wiped immediately.\n");
+    printf("Write it down now if you need to decrypt later. (both hex values below)\n");
+    printf("---\n");
+
+    // A pause to copy the key is for someone reading a terminal, not for scripts
+    if (isatty(STDOUT_FILENO))
+        sleep(3);
+}
+
+/**
+ * @brief Securely wipe encryption key using 5-pass overwrite method
+ *
+ * Implements a multi-pass overwrite strategy to prevent key recovery:
+ * Pass 1: Write all zeros (0x00)
+ * Pass 2: Write all ones (0xFF)
+ * Pass 3: Write cryptographically secure random data
+ * Pass 4: Write all zeros again (clean state)
+ * Pass 5: Volatile pointer overwrite (prevents compiler optimization)
+ *
+ * Why 5 passes are sufficient:
+ * - RAM has no magnetic remanence (unlike HDDs)
+ * - Random data pass makes pattern analysis impossible
+ * - Volatile pointers prevent compiler from optimizing away writes
+ * - Modern SSDs/RAM don't need 35-pass Gutmann (designed for magnetic media)
+ * - BSI recommends multi-pass with random data for RAM/SSD
+ *
+ * This follows BSI recommendations for secure key destruction in volatile memory.
+ *
+ * @param ctx Pointer to crypto_context_t containing key to wipe
+ * @return ETDK_SUCCESS on success, ETDK_ERROR_CRYPTO on failure
+ */
+int crypto_secure_wipe_key(crypto_context_t *ctx) {
+    if (!ctx)
+        return ETDK_ERROR_CRYPTO;
+
+    /* Pass 1: Overwrite with zeros
+     * Clears any existing data with a known pattern
+     */
+    memset(ctx->key, 0x00, sizeof(ctx->key));
+    memset(ctx->iv, 0x00, AES_BLOCK_SIZE);
+
+    /* Pass 2: Overwrite with ones
+     * Flips all bits from previous pass
+     */
+    memset(ctx->key, 0xFF, sizeof(ctx->key));
+    memset(ctx->iv, 0xFF, AES_BLOCK_SIZE);
+
+    /* Pass 3: Overwrite with random data
+     * Introduces unpredictability, making pattern analysis impossible
+     */
+    RAND_bytes(ctx->key, sizeof(ctx->key));
+    RAND_bytes(ctx->iv, AES_BLOCK_SIZE);
+
+    /* Pass 4: Final overwrite with zeros
+     * Leaves memory in a known, clean state
+     */
+    memset(ctx->key, 0x00, sizeof(ctx->key));
+    memset(ctx->iv, 0x00, AES_BLOCK_SIZE);
+
+    /* Pass 5: Volatile overwrite to prevent compiler optimization
+     * Compilers may optimize away memset() calls if they determine the
+     * memory won't be read again. Using volatile pointers forces the
+     * compiler to perform the write operation.
+     */
+    volatile uint8_t *vkey = (volatile uint8_t *)ctx->key;
+    volatile uint8_t *viv = (volatile uint8_t *)ctx->iv;
+    for (size_t i = 0; i < sizeof(ctx->key); i++) {
+        vkey[i] = 0;
+    }
+    for (size_t i = 0; i < AES_BLOCK_SIZE; i++) {
+        viv[i] = 0;
+    }
+
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Cleanup crypto context and securely wipe all sensitive data
+ *
+ * Frees the cipher context kept by crypto_encrypt_small() (OpenSSL
+ * cleanses its key schedule), calls crypto_secure_wipe_key() to perform
+ * secure key deletion, destroys the buffer arena, then zeros out the
+ * entire context structure.
+ *
+ * @param ctx Pointer to crypto_context_t to cleanup
+ */
+void crypto_cleanup(crypto_context_t *ctx) {
+    if (ctx) {
+        EVP_CIPHER_CTX_free(ctx->cipher_ctx);
+        crypto_secure_wipe_key(ctx);
+        crypto_buffers_destroy(ctx);
+        memset(ctx, 0, sizeof(crypto_context_t));
+    }
+}
+
+/** @brief Process-wide locked slab behind crypto_secure_alloc() (NULL if it could not be created) */
+static platform_arena_t *key_slab;
+static pthread_once_t key_slab_once = PTHREAD_ONCE_INIT;
+static size_t key_slab_page;
+
+/**
+ * @brief Create the key slab on first use (pthread_once)
+ */
+static void key_slab_create(void) {
+    key_slab_page = (size_t)sysconf(_SC_PAGESIZE);
+    key_slab = platform_arena_create(key_slab_page, ETDK_KEY_SLAB_SLOTS);
+}
+
+/**
+ * @brief Allocate locked memory for key material
+ *
+ * The length is rounded up to whole pages, so the memory never shares a
+ * page with anything else. A slot of the locked slab costs no system
+ * call; anything else (large objects, a full or unlocked slab) is locked
+ * on its own, which is safe because munlock() then only touches its own
+ * pages.
+ *
+ * @param len Bytes needed
+ * @return Zeroed memory, or NULL on failure
+ */
+void *crypto_secure_alloc(size_t len) {
+    pthread_once(&key_slab_once, key_slab_create);
+    size_t span = (len + key_slab_page - 1) / key_slab_page * key_slab_page;
+
+    void *ptr = platform_arena_alloc(key_slab, span, key_slab_page);
+    if (!ptr) {
+        return NULL;
+    }
+    memset(ptr, 0, len);
+    if (!platform_arena_locked(key_slab, ptr))
+        platform_lock_memory(ptr, span);
+    return ptr;
+}
+
+/**
+ * @brief Wipe and release memory from crypto_secure_alloc()
+ *
+ * @param ptr Memory (may be NULL)
+ * @param len Length passed to crypto_secure_alloc()
+ */
+void crypto_secure_free(void *ptr, size_t len) {
+    if (!ptr) {
+        return;
+    }
+    size_t span = (len + key_slab_page - 1) / key_slab_page * key_slab_page;
+
+    OPENSSL_cleanse(ptr, len);
+    if (!platform_arena_locked(key_slab, ptr))
+        platform_unlock_memory(ptr, span);
+    platform_arena_free(key_slab, ptr);
+}
+
+_Static_assert(ETDK_STREAM_IV_SIZE == AES_BLOCK_SIZE, "crypto_key_fn receives the whole IV");
+
+/**
+ * @brief State of one streaming encryption (see crypto_stream_begin())
+ *
+ * Everything a stream needs lives here, so independent streams can run
+ * on any number of threads at once without shared state.
+ */
+struct crypto_stream {
+    crypto_context_t ctx;          /**< Fresh key and IV of this stream (locked while it exists) */
+    EVP_CIPHER_CTX *cipher_ctx;    /**< Cipher state between updates */
+    crypto_stream_config_t config; /**< Callbacks and expected length */
+    uint64_t done;                 /**< Plaintext bytes encrypted so far */
+};
+
+/**
+ * @brief Release a stream: wipe its key and return its slot
+ *
+ * @param s Stream
+ */
+static void stream_release(crypto_stream_t *s) {
+    EVP_CIPHER_CTX_free(s->cipher_ctx);
+    crypto_cleanup(&s->ctx);
+    crypto_secure_free(s, sizeof(*s));
+}
+
+/**
+ * @brief Start encrypting one object with a fresh key
+ *
+ * Generates a new key and IV and sets up the cipher for config->mode.
+ * No throughput probe and no output happen here, so a stream costs one
+ * slot of the locked key slab (crypto_secure_alloc(), no system call),
+ * two RAND_bytes() calls and the OpenSSL key schedule. Like the rest of
+ * the stream API it prints nothing: failures are return codes, with the
+ * OpenSSL error queue of the calling thread left for the caller.
+ *
+ * @param stream Receives the stream
+ * @param config Mode and callbacks (copied)
+ * @return ETDK_SUCCESS, ETDK_ERROR_MEMORY, or ETDK_ERROR_CRYPTO (also for XTS, which needs whole data units)
+ */
+int crypto_stream_begin(crypto_stream_t **stream, const crypto_stream_config_t *config) {
+    if (!stream || !config || (unsigned int)config->mode >= ETDK_CIPHER_COUNT || config->mode == ETDK_CIPHER_XTS) {
+        return ETDK_ERROR_CRYPTO;
+    }
+    *stream = NULL;
+
+    crypto_stream_t *s = crypto_secure_alloc(sizeof(crypto_stream_t));
+    if (!s) {
+        return ETDK_ERROR_MEMORY;
+    }
+
+    // Not crypto_init(): it reports failures on stderr
+    if (RAND_bytes(s->ctx.key, sizeof(s->ctx.key)) != 1 || RAND_bytes(s->ctx.iv, AES_BLOCK_SIZE) != 1) {
+        stream_release(s);
+        return ETDK_ERROR_CRYPTO;
+    }
+    s->ctx.mode = config->mode;
+    s->config = *config;
+
+    s->cipher_ctx = cipher_context_new(&s->ctx, 0);
+    if (!s->cipher_ctx) {
+        stream_release(s);
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    *stream = s;
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Encrypt the next piece of an object
+ *
+ * CBC holds back a partial block until the next update or the finish,
+ * so out needs room for len + AES_BLOCK_SIZE bytes; CTR and GCM return
+ * exactly len bytes. out may equal in for CTR and GCM; for CBC it must not
+ * overlap in (a held-back block shifts the output). Calls config.progress
+ * with the plaintext bytes encrypted so far.
+ *
+ * @param s Stream
+ * @param in Plaintext
+ * @param len Plaintext length (at most INT_MAX)
+ * @param out Ciphertext buffer of at least len + AES_BLOCK_SIZE bytes
+ * @param outlen Receives the ciphertext length
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+int crypto_stream_update(crypto_stream_t *s, const unsigned char *in, size_t len, unsigned char *out,
+                         size_t *outlen) {
+    if (!s || (!in && len > 0) || !out || !outlen || len > INT_MAX - AES_BLOCK_SIZE) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    // Streams are never XTS, so this is cipher_update() without its error message
+    int n;
+    if (EVP_EncryptUpdate(s->cipher_ctx, out, &n, in, (int)len) != 1) {
+        return ETDK_ERROR_CRYPTO;
+    }
+    *outlen = (size_t)n;
+
+    s->done += len;
+    if (s->config.progress)
+        s->config.progress(s->config.arg, s->done, s->config.total);
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Finish an object, hand off its key and wipe it
+ *
+ * Writes the trailer (CBC: last block with PKCS#7 padding, GCM: the
+ * authentication tag, CTR: nothing) and calls config.key_handoff, if
+ * set, with key, IV and mode while they still exist. The key is then
+ * wiped and the stream freed, also on failure.
+ *
+ * @param s Stream
+ * @param out Buffer of at least ETDK_STREAM_TRAILER_MAX bytes
+ * @param outlen Receives the trailer length
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+int crypto_stream_finish(crypto_stream_t *s, unsigned char *out, size_t *outlen) {
+    if (!s) {
+        return ETDK_ERROR_CRYPTO;
+    }
+    if (!out || !outlen) {
+        stream_release(s);
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    int n = 0;
+    int result = ETDK_SUCCESS;
+    if (EVP_EncryptFinal_ex(s->cipher_ctx, out, &n) != 1 ||
+        (s->ctx.mode == ETDK_CIPHER_GCM &&
+         EVP_CIPHER_CTX_ctrl(s->cipher_ctx, EVP_CTRL_GCM_GET_TAG, ETDK_GCM_TAG_SIZE, out + n) != 1)) {
+        result = ETDK_ERROR_CRYPTO;
+    }
+
+    if (result == ETDK_SUCCESS) {
+        *outlen = (size_t)n + (s->ctx.mode == ETDK_CIPHER_GCM ? ETDK_GCM_TAG_SIZE : 0);
+        if (s->config.key_handoff)
+            s->config.key_handoff(s->config.arg, s->ctx.key, crypto_key_size(&s->ctx), s->ctx.iv, s->ctx.mode);
+    }
+
+    stream_release(s);
+    return result;
+}
+
+/**
+ * @brief Abandon a stream without handing off its key
+ *
+ * @param s Stream, or NULL
+ */
+void crypto_stream_abort(crypto_stream_t *s) {
+    if (s)
+        stream_release(s);
+}
+
+/**
+ * @brief write() all of a buffer, retrying on EINTR and short writes
+ *
+ * @param fd File descriptor (pipe, socket or file)
+ * @param buf Data
+ * @param len Length
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return ETDK_ERROR_IO;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Encrypt everything readable from in_fd into out_fd
+ *
+ * Reads until end of file with read(), so pipes and sockets work as well
+ * as regular files; output is written sequentially with write(). One
+ * input and one output buffer of ETDK_STREAM_CHUNK_SIZE are used per call
+ * and wiped before they are freed. Nothing is printed; after
+ * ETDK_ERROR_IO, errno tells what failed.
+ *
+ * @param in_fd Plaintext source
+ * @param out_fd Ciphertext destination
+ * @param config Mode and callbacks (see crypto_stream_begin())
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO, ETDK_ERROR_MEMORY, or ETDK_ERROR_CRYPTO
+ */
+int crypto_stream_fd(int in_fd, int out_fd, const crypto_stream_config_t *config) {
+    unsigned char *buf = malloc(2 * ETDK_STREAM_CHUNK_SIZE + AES_BLOCK_SIZE);
+    if (!buf) {
+        return ETDK_ERROR_MEMORY;
+    }
+    unsigned char *out = buf + ETDK_STREAM_CHUNK_SIZE;
+
+    crypto_stream_t *s;
+    int result = crypto_stream_begin(&s, config);
+    if (result != ETDK_SUCCESS) {
+        free(buf);
+        return result;
+    }
+
+    for (;;) {
+        ssize_t n = read(in_fd, buf, ETDK_STREAM_CHUNK_SIZE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            result = ETDK_ERROR_IO;
+            break;
+        }
+        if (n == 0)
+            break;
+
+        size_t outlen;
+        result = crypto_stream_update(s, buf, (size_t)n, out, &outlen);
+        if (result == ETDK_SUCCESS && write_all(out_fd, out, outlen) != ETDK_SUCCESS)
+            result = ETDK_ERROR_IO;
+        if (result != ETDK_SUCCESS)
+            break;
+    }
+
+    if (result != ETDK_SUCCESS) {
+        crypto_stream_abort(s);
+    } else {
+        size_t outlen;
+        result = crypto_stream_finish(s, out, &outlen);
+        if (result == ETDK_SUCCESS && write_all(out_fd, out, outlen) != ETDK_SUCCESS)
+            result = ETDK_ERROR_IO;
+    }
+
+    // The last plaintext chunk is still in buf
+    OPENSSL_cleanse(buf, 2 * ETDK_STREAM_CHUNK_SIZE + AES_BLOCK_SIZE);
+    free(buf);
+    return result;
+}
+
+/**
+ * @brief Group of leading ranges whose completion is reported (--priority)
+ */
+typedef struct {
+    const char *name;  /**< Progress event name */
+    const char *label; /**< Message prefix ("<label> regions destroyed") */
+    size_t ranges;     /**< Ranges of the group */
+    uint64_t bytes;    /**< Bytes of the group */
+    uint64_t end;      /**< Extents below this index (and not below the previous group's end) belong to it */
+    uint64_t pending;  /**< Extents of the group not finished yet */
+} device_milestone_t;
+
+/**
+ * @brief Shared state of a parallel device encryption run
+ *
+ * Workers claim extents by index under the lock, so every extent is
+ * processed exactly once regardless of the number of threads. Extents
+ * are numbered through the ranges in list order.
+ */
+typedef struct {
+    crypto_context_t *ctx;            /**< Key, IV, options and ctx->written */
+    platform_io_t io;                 /**< Device handle (pread/pwrite are thread-safe) */
+    const device_range_t *ranges;     /**< Ranges to encrypt, in processing order */
+    size_t range_count;               /**< Number of ranges */
+    uint64_t device_size;             /**< Total bytes to encrypt (sum of ranges) */
+    size_t chunk;                     /**< Extent size (options.chunk_size) */
+    uint64_t extent_count;            /**< Number of extents over all ranges */
+    uint64_t next_extent;             /**< Next unclaimed extent index */
+    uint64_t processed;               /**< Bytes completed so far */
+    int status;                       /**< First error encountered, ETDK_SUCCESS otherwise */
+    journal_t *journal;               /**< Checkpoint journal, or NULL */
+    uint8_t *done_map;                /**< One bit per finished extent (journal runs only) */
+    uint64_t watermark;               /**< Extents below this index are all finished */
+    uint64_t watermark_bytes;         /**< Bytes covered by the extents below watermark */
+    uint64_t checkpointed;            /**< watermark_bytes at the last checkpoint */
+    uint64_t interval;                /**< Bytes between checkpoints (journal_interval()) */
+    uint64_t window;                  /**< Extents that may be claimed past the watermark (journal runs) */
+    pthread_cond_t advanced;          /**< Signalled when the watermark moves or the run fails */
+    progress_t *progress;             /**< Progress reporter */
+    device_milestone_t milestones[2]; /**< Critical and metadata regions of a priority run */
+    size_t milestone_count;           /**< Used entries of milestones */
+    size_t next_milestone;            /**< First milestone not reported yet */
+    struct timespec start;            /**< Start of the run (CLOCK_MONOTONIC) */
+    pthread_mutex_t lock;             /**< Protects all mutable fields */
+} device_job_t;
+
+/**
+ * @brief Map a global extent index to its device offset and length
+ *
+ * @param job Parallel job
+ * @param extent Extent index (< job->extent_count)
+ * @param offset Receives the byte offset on the device
+ * @param len Receives the extent length
+ */
+static void job_extent(const device_job_t *job, uint64_t extent, uint64_t *offset, size_t *len) {
+    for (size_t r = 0; r < job->range_count; r++) {
+        uint64_t n = (job->ranges[r].length + job->chunk - 1) / job->chunk;
+        if (extent < n) {
+            uint64_t rel = extent * job->chunk;
+            *offset = job->ranges[r].offset + rel;
+            *len = job->chunk;
+            if (job->ranges[r].length - rel < *len)
+                *len = (size_t)(job->ranges[r].length - rel);
+            return;
+        }
+        extent -= n;
+    }
+    *offset = 0;
+    *len = 0;
+}
+
+/**
+ * @brief Make progress durable: sync the device, then record it in the journal
+ *
+ * The order matters: a checkpoint must never cover data that is still in
+ * a volatile cache, or a resumed run would skip plaintext.
+ *
+ * @param journal Checkpoint journal
+ * @param io Device handle
+ * @param done Bytes encrypted, in processing order
+ * @param metrics Stage metrics, or NULL
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+static int device_checkpoint(journal_t *journal, const platform_io_t *io, uint64_t done, metrics_t *metrics) {
+    uint64_t start = metrics_now(metrics);
+    if (fdatasync(io->fd) != 0) {
+        perror("\nError syncing device");
+        return ETDK_ERROR_IO;
+    }
+    metrics_stage(metrics, METRIC_SYNC, start, 0);
+    return journal_checkpoint(journal, done);
+}
+
+/**
+ * @brief Mark an extent finished and checkpoint once the contiguous prefix grew enough
+ *
+ * Workers finish extents out of order; only the prefix of extents that are
+ * all done may be recorded. Called with job->lock held.
+ *
+ * @param job Parallel job
+ * @param extent Finished extent index
+ */
+static void job_extent_done(device_job_t *job, uint64_t extent) {
+    job->done_map[extent / 8] |= (uint8_t)(1u << (extent % 8));
+
+    while (job->watermark < job->extent_count && (job->done_map[job->watermark / 8] & (1u << (job->watermark % 8)))) {
+        uint64_t offset;
+        size_t len;
+        job_extent(job, job->watermark, &offset, &len);
+        job->watermark_bytes += len;
+        job->watermark++;
+        pthread_cond_broadcast(&job->advanced);
+    }
+
+    if (job->watermark_bytes - job->checkpointed >= job->interval && job->status == ETDK_SUCCESS) {
+        if (device_checkpoint(job->journal, &job->io, job->watermark_bytes, job->ctx->metrics) != ETDK_SUCCESS)
+            job->status = ETDK_ERROR_IO;
+        job->checkpointed = job->watermark_bytes;
+    }
+}
+
+/**
+ * @brief Count a finished extent against its milestone and report the milestones reached, in order
+ *
+ * A milestone is reported once all of its extents are finished and the
+ * device was synced, so "destroyed" means the ciphertext is on stable
+ * storage; with a journal the sync also serves as a checkpoint. The sync
+ * runs under the lock, stalling the other workers for one flush, at most
+ * once per milestone. Called with job->lock held.
+ *
+ * @param job Parallel job
+ * @param extent Finished extent index
+ */
+static void job_milestone_done(device_job_t *job, uint64_t extent) {
+    for (size_t m = 0; m < job->milestone_count; m++) {
+        if (extent < job->milestones[m].end) {
+            job->milestones[m].pending--;
+            break;
+        }
+    }
+
+    while (job->next_milestone < job->milestone_count && job->milestones[job->next_milestone].pending == 0 &&
+           job->status == ETDK_SUCCESS) {
+        const device_milestone_t *m = &job->milestones[job->next_milestone++];
+
+        uint64_t start = metrics_now(job->ctx->metrics);
+        if (fdatasync(job->io.fd) != 0) {
+            perror("\nError syncing device");
+            job->status = ETDK_ERROR_IO;
+            return;
+        }
+        metrics_stage(job->ctx->metrics, METRIC_SYNC, start, 0);
+
+        // The device was just synced, so a resumed run need not redo the milestone
+        if (job->journal && job->watermark_bytes > job->checkpointed) {
+            if (journal_checkpoint(job->journal, job->watermark_bytes) != ETDK_SUCCESS) {
+                job->status = ETDK_ERROR_IO;
+                return;
+            }
+            job->checkpointed = job->watermark_bytes;
+        }
+
+        progress_event(job->progress, m->name);
+        if (!job->ctx->progress) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            printf("\n%s regions destroyed: %zu region%s, %.1f MB in %.1f s\n", m->label, m->ranges,
+                   m->ranges == 1 ? "" : "s", m->bytes / (1024.0 * 1024.0),
+                   (double)(now.tv_sec - job->start.tv_sec) + (now.tv_nsec - job->start.tv_nsec) / 1e9);
+            fflush(stdout);
+        }
+    }
+}
+
+/**
+ * @brief Open a device for encryption and report the I/O mode in use
+ *
+ * Direct I/O is requested unless --buffered was given; if the device or
+ * filesystem does not support it, buffered I/O is used instead.
+ *
+ * @param io Handle to initialize
+ * @param device_path Path to the block device
+ * @param ctx Crypto context (for options)
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+static int open_device_io(platform_io_t *io, const char *device_path, const crypto_context_t *ctx) {
+    if (platform_io_open(io, device_path, !ctx->options.buffered) != ETDK_SUCCESS) {
+        perror("Cannot open device");
+        return ETDK_ERROR_IO;
+    }
+
+    if (!ctx->progress)
+        printf("I/O:    %s (%u-byte blocks)\n", io->direct ? "direct" : "buffered", io->block_size);
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Sync and close a device handle, timing the sync
+ *
+ * @param io Handle from open_device_io()
+ * @param ctx Crypto context (for metrics)
+ * @param wb Write-out state of a sequential engine, or NULL
+ * @return ETDK_SUCCESS, or ETDK_ERROR_IO if the sync or a write-out failed
+ */
+static int close_device_io(platform_io_t *io, const crypto_context_t *ctx, platform_writeback_t *wb) {
+    uint64_t start = metrics_now(ctx->metrics);
+    int synced = platform_writeback_finish(wb);
+    int result = platform_io_close(io);
+    metrics_stage(ctx->metrics, METRIC_SYNC, start, 0);
+    return synced == ETDK_SUCCESS ? result : synced;
+}
+
+/**
+ * @brief Worker thread for parallel device encryption
+ *
+ * Each worker owns one cipher context and one aligned buffer. For every
+ * claimed extent the CTR counter (or the XTS tweaks) is re-derived from
+ * the extent's byte offset, the extent is read, encrypted in place and
+ * written back.
+ *
+ * @param arg Pointer to device_job_t
+ * @return NULL
+ */
+static void *device_worker(void *arg) {
+    device_job_t *job = arg;
+    int status = ETDK_SUCCESS;
+
+    unsigned char *buf = platform_arena_alloc(job->ctx->arena, job->chunk, job->io.block_size);
+    EVP_CIPHER_CTX *cipher_ctx = init_cipher_context(job->ctx, 0);
+    if (!buf || !cipher_ctx) {
+        status = buf ? ETDK_ERROR_CRYPTO : ETDK_ERROR_MEMORY;
+        goto done;
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        // Stay within one interval of the watermark: a resumed run then re-encrypts at most two intervals
+        while (job->journal && job->status == ETDK_SUCCESS && job->next_extent < job->extent_count &&
+               job->next_extent >= job->watermark + job->window)
+            pthread_cond_wait(&job->advanced, &job->lock);
+        if (job->status != ETDK_SUCCESS || job->next_extent >= job->extent_count) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        uint64_t extent = job->next_extent++;
+        pthread_mutex_unlock(&job->lock);
+
+        uint64_t offset;
+        size_t len;
+        job_extent(job, extent, &offset, &len);
+
+        metrics_t *metrics = job->ctx->metrics;
+        uint64_t start = metrics_now(metrics);
+        if (platform_io_read(&job->io, buf, len, offset) != (int64_t)len) {
+            fprintf(stderr, "\nError reading device at offset %llu\n", (unsigned long long)offset);
+            status = ETDK_ERROR_IO;
+            break;
+        }
+        metrics_stage(metrics, METRIC_READ, start, len);
+
+        // Reposition the counter; extents are block aligned so no keystream skip is needed.
+        // XTS derives the tweak of every data unit from the offset in cipher_update().
+        uint8_t counter[AES_BLOCK_SIZE];
+        size_t outlen;
+        ctr_iv_for_offset(job->ctx->iv, offset, counter);
+        if (job->ctx->mode == ETDK_CIPHER_CTR && EVP_EncryptInit_ex(cipher_ctx, NULL, NULL, NULL, counter) != 1) {
+            fprintf(stderr, "\nError during encryption: %s\n", ERR_error_string(ERR_get_error(), NULL));
+            status = ETDK_ERROR_CRYPTO;
+            break;
+        }
+        start = metrics_now(metrics);
+        if (cipher_update(cipher_ctx, job->ctx, buf, buf, len, offset, &outlen) != ETDK_SUCCESS) {
+            status = ETDK_ERROR_CRYPTO;
+            break;
+        }
+        metrics_stage(metrics, METRIC_ENCRYPT, start, len);
+
+        start = metrics_now(metrics);
+        note_written(job->ctx, offset + len);
+        if (platform_io_write(&job->io, buf, len, offset) != ETDK_SUCCESS) {
+            fprintf(stderr, "\nError writing to device at offset %llu\n", (unsigned long long)offset);
+            status = ETDK_ERROR_IO;
+            break;
+        }
+        metrics_stage(metrics, METRIC_WRITE, start, len);
+
+        pthread_mutex_lock(&job->lock);
+        job->processed += len;
+        if (job->journal)
+            job_extent_done(job, extent);
+        if (job->milestone_count > 0)
+            job_milestone_done(job, extent);
+        progress_update(job->progress, job->processed);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+done:
+    if (status != ETDK_SUCCESS) {
+        pthread_mutex_lock(&job->lock);
+        if (job->status == ETDK_SUCCESS)
+            job->status = status;
+        pthread_cond_broadcast(&job->advanced);
+        pthread_mutex_unlock(&job->lock);
+    }
+    EVP_CIPHER_CTX_free(cipher_ctx);
+    platform_arena_free(job->ctx->arena, buf);
+    return NULL;
+}
+
+/**
+ * @brief Encrypt ranges of a block device with AES-256-CTR or -XTS using a pool of worker threads
+ *
+ * The ranges (the whole device if ranges is NULL) are split into
+ * extents of options.chunk_size bytes. Since the CTR counter (XTS tweak) of every
+ * extent is derived from its byte offset, the ciphertext is identical for any
+ * thread count, including 1, and for any subset of ranges.
+ *
+ * With a journal, the run starts after the last checkpoint and records
+ * the finished prefix every journal_interval() bytes. Workers claim
+ * extents at most one interval ahead of that prefix, so a crash leaves at
+ * most two intervals past the last checkpoint to be encrypted again.
+ *
+ * With a priority list, the ranges start with its critical and metadata
+ * regions (see priority_schedule()); workers claim extents in order, so
+ * these are written first, and the moment each group is on stable
+ * storage is reported.
+ *
+ * @param device_path Path to the block device
+ * @param ctx Pointer to crypto_context_t (mode must be ETDK_CIPHER_CTR or ETDK_CIPHER_XTS)
+ * @param threads Number of worker threads (1..ETDK_MAX_THREADS)
+ * @param ranges Ranges to encrypt in order, or NULL for the whole device
+ * @param range_count Number of ranges
+ * @param journal Checkpoint journal, or NULL
+ * @param priority Priority list the ranges start with, or NULL
+ * @return ETDK_SUCCESS on success, error code on failure
+ */
+static int encrypt_device_parallel(const char *device_path, crypto_context_t *ctx, unsigned int threads,
+                                   const device_range_t *ranges, size_t range_count, journal_t *journal,
+                                   const priority_list_t *priority) {
+    device_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.ctx = ctx;
+
+    device_range_t whole = {0, 0};
+    if (!ranges) {
+        if (platform_get_device_size(device_path, &whole.length) != ETDK_SUCCESS) {
+            fprintf(stderr, "Error getting device size\n");
+            return ETDK_ERROR_IO;
+        }
+        ranges = &whole;
+        range_count = 1;
+    }
+    job.ranges = ranges;
+    job.range_count = range_count;
+    job.chunk = io_chunk_size(ctx);
+    for (size_t r = 0; r < range_count; r++) {
+        job.device_size += ranges[r].length;
+        job.extent_count += (ranges[r].length + job.chunk - 1) / job.chunk;
+    }
+
+    if (journal) {
+        job.journal = journal;
+        job.done_map = calloc((size_t)(job.extent_count / 8 + 1), 1);
+        if (!job.done_map) {
+            return ETDK_ERROR_MEMORY;
+        }
+
+        // Skip the extents covered by the last checkpoint
+        while (job.watermark < job.extent_count && job.watermark_bytes < journal->state.done) {
+            uint64_t offset;
+            size_t len;
+            job_extent(&job, job.watermark, &offset, &len);
+            job.done_map[job.watermark / 8] |= (uint8_t)(1u << (job.watermark % 8));
+            job.watermark_bytes += len;
+            job.watermark++;
+        }
+        job.next_extent = job.watermark;
+        job.processed = job.checkpointed = job.watermark_bytes;
+        job.interval = journal_interval(journal);
+        job.window = job.interval / job.chunk ? job.interval / job.chunk : 1;
+    }
+
+    if (priority) {
+        static const char *const names[2][2] = {{"critical", "Critical"}, {"metadata", "Metadata"}};
+        const size_t group_end[2] = {priority->critical, priority->count};
+        size_t r = 0;
+        uint64_t extent = 0;
+
+        for (int g = 0; g < 2; g++) {
+            device_milestone_t *m = &job.milestones[job.milestone_count];
+            uint64_t first = extent;
+            m->ranges = group_end[g] - r;
+            for (; r < group_end[g] && r < range_count; r++) {
+                m->bytes += ranges[r].length;
+                extent += (ranges[r].length + job.chunk - 1) / job.chunk;
+            }
+            if (m->ranges == 0)
+                continue;
+            m->name = names[g][0];
+            m->label = names[g][1];
+            m->end = extent;
+            // Extents below the watermark were finished by the interrupted run
+            m->pending = extent > job.watermark ? extent - (first > job.watermark ? first : job.watermark) : 0;
+            job.milestone_count++;
+        }
+        while (job.next_milestone < job.milestone_count && job.milestones[job.next_milestone].pending == 0)
+            job.next_milestone++;
+    }
+
+    if (open_device_io(&job.io, device_path, ctx) != ETDK_SUCCESS) {
+        free(job.done_map);
+        return ETDK_ERROR_IO;
+    }
+
+    if (threads > job.extent_count && job.extent_count > 0)
+        threads = (unsigned int)job.extent_count;
+
+    pthread_t *workers = calloc(threads, sizeof(pthread_t));
+    if (!workers) {
+        platform_io_close(&job.io);
+        free(job.done_map);
+        return ETDK_ERROR_MEMORY;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.advanced, NULL);
+
+    if (!ctx->progress) {
+        printf("\n");
+        printf("Encrypting device with %u thread%s%s...\n", threads, threads == 1 ? "" : "s",
+               job.milestone_count > 0 ? ", priority regions first" : "");
+        printf("\n");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &job.start);
+    job.progress = progress_start(ctx, PROGRESS_ENCRYPT, device_path, job.device_size, job.processed);
+
+    unsigned int started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, device_worker, &job) != 0) {
+            fprintf(stderr, "\nError creating worker thread\n");
+            pthread_mutex_lock(&job.lock);
+            job.status = ETDK_ERROR_MEMORY;
+            pthread_cond_broadcast(&job.advanced);
+            pthread_mutex_unlock(&job.lock);
+            break;
+        }
+    }
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    progress_finish(job.progress, job.status);
+
+    if (!ctx->progress)
+        printf("\n\n");
+
+    if (close_device_io(&job.io, ctx, NULL) != ETDK_SUCCESS && job.status == ETDK_SUCCESS) {
+        perror("Error syncing device");
+        job.status = ETDK_ERROR_IO;
+    }
+
+    pthread_cond_destroy(&job.advanced);
+    pthread_mutex_destroy(&job.lock);
+    free(workers);
+    free(job.done_map);
+
+    return job.status;
+}
+
+/**
+ * @brief Encrypt a block device through the asynchronous pipeline
+ *
+ * Produces the same AES-256-CBC output as the synchronous loop while
+ * keeping queue_depth chunks in flight (io_uring, or reader/writer
+ * threads as fallback).
+ *
+ * @param device_path Path to the block device
+ * @param ctx Pointer to initialized crypto_context_t
+ * @return ETDK_SUCCESS on success, error code on failure
+ */
+static int encrypt_device_pipeline(const char *device_path, crypto_context_t *ctx) {
+    platform_writeback_t wb;
+    pipeline_crypto_t pc = {NULL, 0, ctx, NULL, &wb};
+    if (platform_get_device_size(device_path, &pc.total) != ETDK_SUCCESS) {
+        fprintf(stderr, "Error getting device size\n");
+        return ETDK_ERROR_IO;
+    }
+
+    platform_io_t io;
+    if (open_device_io(&io, device_path, ctx) != ETDK_SUCCESS) {
+        return ETDK_ERROR_IO;
+    }
+
+    platform_writeback_init(&wb, io.direct ? -1 : io.fd, -1);
+    pc.cipher_ctx = init_cipher_context(ctx, 0);
+    if (!pc.cipher_ctx) {
+        platform_io_close(&io);
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    if (!ctx->progress) {
+        printf("\n");
+        printf("Encrypting device (%s, queue depth %u)...\n", pipeline_engine_name(ctx->options.io_engine),
+               ctx->options.queue_depth);
+        printf("\n");
+    }
+
+    pipeline_job_t job = {&io, &io, pc.total, io_chunk_size(ctx), io.block_size, ctx->options.queue_depth,
+                          pipeline_encrypt, pipeline_written, &pc, ctx->arena, ctx->metrics};
+    pc.progress = progress_start(ctx, PROGRESS_ENCRYPT, device_path, pc.total, 0);
+    int result = pipeline_run(&job, ctx->options.io_engine);
+    progress_finish(pc.progress, result);
+
+    if (!ctx->progress)
+        printf("\n\n");
+
+    EVP_CIPHER_CTX_free(pc.cipher_ctx);
+    if (close_device_io(&io, ctx, &wb) != ETDK_SUCCESS && result == ETDK_SUCCESS) {
+        perror("Error syncing device");
+        result = ETDK_ERROR_IO;
+    }
+
+    return result;
 }
 
 /**
- * @brief Generate a cryptographically secure random key
+ * @brief Overwrite a block device with AES-256-CTR keystream (--mode=overwrite)
  *
- * Uses OpenSSL's RAND_bytes() which provides cryptographic-quality
- * random numbers suitable for key generation.
+ * The key is about to be wiped and never displayed, so there is nothing
+ * to preserve: the device is not read at all. The pipeline runs without
+ * a source, pipeline_keystream() fills each chunk, and the writes are
+ * purely sequential with queue_depth (ETDK_DEFAULT_QUEUE_DEPTH unless
+ * given) in flight. That halves the I/O of an encrypting pass and, on
+ * rotational disks, removes the read-seek-write turnaround per chunk.
  *
- * @param key Pointer to buffer where key will be stored
- * @param key_size Size of the key in bytes (must be AES_KEY_SIZE)
- * @return ETDK_SUCCESS on success, ETDK_ERROR_CRYPTO on failure
+ * @param device_path Path to the block device
+ * @param ctx Crypto context with a fresh key (mode CTR)
+ * @return ETDK_SUCCESS on success, error code on failure
  */
-int crypto_generate_key(uint8_t *key, size_t key_size) {
-    if (!key || key_size != AES_KEY_SIZE) {
-        return ETDK_ERROR_CRYPTO;
+static int overwrite_device(const char *device_path, crypto_context_t *ctx) {
+    platform_writeback_t wb;
+    pipeline_crypto_t pc = {NULL, 0, ctx, NULL, &wb};
+    if (platform_get_device_size(device_path, &pc.total) != ETDK_SUCCESS) {
+        fprintf(stderr, "Error getting device size\n");
+        return ETDK_ERROR_IO;
     }
 
-    // Use OpenSSL's cryptographically secure random number generator
-    if (RAND_bytes(key, key_size) != 1) {
-        fprintf(stderr, "Error generating key: %s\n", ERR_error_string(ERR_get_error(), NULL));
+    platform_io_t io;
+    if (open_device_io(&io, device_path, ctx) != ETDK_SUCCESS) {
+        return ETDK_ERROR_IO;
+    }
+
+    platform_writeback_init(&wb, io.direct ? -1 : io.fd, -1);
+    pc.cipher_ctx = init_cipher_context(ctx, 0);
+    if (!pc.cipher_ctx) {
+        platform_io_close(&io);
         return ETDK_ERROR_CRYPTO;
     }
 
-    return ETDK_SUCCESS;
+    unsigned int depth = ctx->options.queue_depth ? ctx->options.queue_depth : ETDK_DEFAULT_QUEUE_DEPTH;
+    if (!ctx->progress) {
+        printf("\n");
+        printf("Overwriting device with keystream (%s, queue depth %u, no reads)...\n",
+               pipeline_engine_name(ctx->options.io_engine), depth);
+        printf("\n");
+    }
+
+    pipeline_job_t job = {NULL, &io, pc.total, io_chunk_size(ctx), io.block_size, depth,
+                          pipeline_keystream, pipeline_written, &pc, ctx->arena, ctx->metrics};
+    pc.progress = progress_start(ctx, PROGRESS_ENCRYPT, device_path, pc.total, 0);
+    int result = pipeline_run(&job, ctx->options.io_engine);
+    progress_finish(pc.progress, result);
+
+    if (!ctx->progress)
+        printf("\n\n");
+
+    EVP_CIPHER_CTX_free(pc.cipher_ctx);
+    if (close_device_io(&io, ctx, &wb) != ETDK_SUCCESS && result == ETDK_SUCCESS) {
+        perror("Error syncing device");
+        result = ETDK_ERROR_IO;
+    }
+
+    return result;
 }
 
 /**
- * @brief Encrypt a file using AES-256-CBC
+ * @brief Encrypt a block device in place with one sequential AES-256-CBC pass
  *
- * Reads the input file in 4KB chunks, encrypts each chunk using
- * AES-256-CBC mode, and writes the encrypted data to the output file.
+ * Reads the device in 1MB chunks, encrypts each chunk using
+ * AES-256-CBC mode, and writes the encrypted data back to the device.
+ * Shows progress indicator during operation.
  *
- * @param input_path Path to the input file to encrypt
- * @param output_path Path where encrypted file will be written
+ * The device is accessed with pread()/pwrite() on block-aligned buffers,
+ * bypassing the page cache with direct I/O where supported (see
+ * platform_io_open()).
+ *
+ * With a journal, encryption starts at the last checkpoint (a new CBC
+ * chain under the segment IV in ctx->iv) and progress is made durable
+ * every journal_interval() bytes.
+ *
+ * @param device_path Path to the block device (e.g., /dev/sdb)
  * @param ctx Pointer to initialized crypto_context_t with key and IV
+ * @param journal Checkpoint journal, or NULL
  * @return ETDK_SUCCESS on success, error code on failure
  */
-int crypto_encrypt_file(const char *input_path, const char *output_path, crypto_context_t *ctx) {
-    if (!input_path || !output_path || !ctx) {
-        return ETDK_ERROR_CRYPTO;
-    }
-
-    FILE *input = fopen(input_path, "rb");
-    if (!input) {
-        perror("Cannot open input file");
+static int encrypt_device_sequential(const char *device_path, crypto_context_t *ctx, journal_t *journal) {
+    // Get device size
+    uint64_t device_size = 0;
+    if (platform_get_device_size(device_path, &device_size) != ETDK_SUCCESS) {
+        fprintf(stderr, "Error getting device size\n");
         return ETDK_ERROR_IO;
     }
 
-    FILE *output = fopen(output_path, "wb");
-    if (!output) {
-        perror("Cannot open output file");
-        fclose(input);
+    // Open device for positional read/write, direct I/O if supported
+    platform_io_t io;
+    if (open_device_io(&io, device_path, ctx) != ETDK_SUCCESS) {
         return ETDK_ERROR_IO;
     }
 
-    EVP_CIPHER_CTX *cipher_ctx = init_cipher_context(ctx);
-    if (!cipher_ctx) {
-        fclose(input);
-        fclose(output);
+    // OpenSSL, or the kernel's AES through AF_ALG (--crypto-engine kernel)
+    EVP_CIPHER_CTX *cipher_ctx = NULL;
+    kcrypto_t *kernel = NULL;
+    if (ctx->options.crypto_engine == ETDK_CRYPTO_KERNEL)
+        kernel = init_kernel_cipher(ctx, 0);
+    else
+        cipher_ctx = init_cipher_context(ctx, 0);
+    if (!cipher_ctx && !kernel) {
+        platform_io_close(&io);
         return ETDK_ERROR_CRYPTO;
     }
 
-    /* Encrypt file in 4KB chunks
-     * Processing in chunks allows encryption of files larger than available RAM.
-     * Each chunk is encrypted and immediately written to reduce memory usage.
-     */
-    unsigned char inbuf[4096];
-    unsigned char outbuf[4096 + EVP_MAX_BLOCK_LENGTH];
-    int inlen, outlen;
+    // Buffered I/O: keep dirty data to a few windows and out of other processes' cache
+    platform_writeback_t wb;
+    platform_writeback_init(&wb, io.direct ? -1 : io.fd, -1);
 
-    while ((inlen = fread(inbuf, 1, sizeof(inbuf), input)) > 0) {
-        if (EVP_EncryptUpdate(cipher_ctx, outbuf, &outlen, inbuf, inlen) != 1) {
-            fprintf(stderr, "Error during encryption: %s\n", ERR_error_string(ERR_get_error(), NULL));
-            EVP_CIPHER_CTX_free(cipher_ctx);
-            fclose(input);
-            fclose(output);
-            return ETDK_ERROR_CRYPTO;
-        }
-        fwrite(outbuf, 1, outlen, output);
-    }
+    // Process device in chunks (1MB unless tuned, see crypto_tune_io())
+    // Buffers are aligned to the logical block size as required by O_DIRECT
+    const size_t CHUNK_SIZE = io_chunk_size(ctx);
+    unsigned char *inbuf = platform_arena_alloc(ctx->arena, CHUNK_SIZE, io.block_size);
+    unsigned char *outbuf = platform_arena_alloc(ctx->arena, CHUNK_SIZE + EVP_MAX_BLOCK_LENGTH, io.block_size);
 
-    /* Finalize encryption
-     * In CBC mode, this adds PKCS#7 padding to ensure the last block
-     * is complete. The padding is necessary for proper decryption.
-     */
-    if (EVP_EncryptFinal_ex(cipher_ctx, outbuf, &outlen) != 1) {
-        fprintf(stderr, "Error finalizing encryption: %s\n", ERR_error_string(ERR_get_error(), NULL));
+    if (!inbuf || !outbuf) {
+        fprintf(stderr, "Memory allocation failed\n");
+        platform_arena_free(ctx->arena, inbuf);
+        platform_arena_free(ctx->arena, outbuf);
         EVP_CIPHER_CTX_free(cipher_ctx);
-        fclose(input);
-        fclose(output);
-        return ETDK_ERROR_CRYPTO;
+        kcrypto_close(kernel);
+        platform_io_close(&io);
+        return ETDK_ERROR_MEMORY;
+    }
+
+    uint64_t processed = journal ? journal->state.done : 0;
+    uint64_t checkpointed = processed;
+    wb.started = wb.dropped = processed; // Resumed runs: earlier data was synced at the checkpoint
+    int outlen;
+    int result = ETDK_SUCCESS;
+
+    if (!ctx->progress) {
+        printf("\n");
+        printf("Encrypting device...\n");
+        printf("\n");
+    }
+    progress_t *progress = progress_start(ctx, PROGRESS_ENCRYPT, device_path, device_size, processed);
+
+    // Read, encrypt, and write back in chunks
+    while (processed < device_size) {
+        size_t len = CHUNK_SIZE;
+        if (device_size - processed < len)
+            len = (size_t)(device_size - processed);
+
+        uint64_t start = metrics_now(ctx->metrics);
+        int64_t bytes_read = platform_io_read(&io, inbuf, len, processed);
+        if (bytes_read <= 0) {
+            if (bytes_read < 0) {
+                fprintf(stderr, "\nError reading device at offset %llu\n", (unsigned long long)processed);
+                result = ETDK_ERROR_IO;
+            }
+            break;
+        }
+        metrics_stage(ctx->metrics, METRIC_READ, start, (size_t)bytes_read);
+
+        // Encrypt chunk
+        start = metrics_now(ctx->metrics);
+        if (kernel) {
+            result = kcrypto_encrypt(kernel, inbuf, outbuf, (size_t)bytes_read);
+            if (result != ETDK_SUCCESS)
+                break;
+            outlen = (int)bytes_read;
+        } else if (EVP_EncryptUpdate(cipher_ctx, outbuf, &outlen, inbuf, (int)bytes_read) != 1) {
+            fprintf(stderr, "\nError during encryption: %s\n", ERR_error_string(ERR_get_error(), NULL));
+            result = ETDK_ERROR_CRYPTO;
+            break;
+        }
+        metrics_stage(ctx->metrics, METRIC_ENCRYPT, start, (size_t)bytes_read);
+
+        // Write encrypted data back to the same position
+        start = metrics_now(ctx->metrics);
+        note_written(ctx, processed + (uint64_t)outlen);
+        if (platform_io_write(&io, outbuf, (size_t)outlen, processed) != ETDK_SUCCESS) {
+            fprintf(stderr, "\nError writing to device\n");
+            result = ETDK_ERROR_IO;
+            break;
+        }
+        metrics_stage(ctx->metrics, METRIC_WRITE, start, (size_t)outlen);
+
+        processed += (uint64_t)bytes_read;
+        platform_writeback_advance(&wb, processed);
+
+        if (journal && processed - checkpointed >= journal_interval(journal)) {
+            // A write-out error consumed by sync_file_range() must not be checkpointed past
+            if (wb.failed || device_checkpoint(journal, &io, processed, ctx->metrics) != ETDK_SUCCESS) {
+                result = ETDK_ERROR_IO;
+                break;
+            }
+            checkpointed = processed;
+        }
+
+        progress_update(progress, processed);
     }
-    fwrite(outbuf, 1, outlen, output);
+    progress_finish(progress, result);
+
+    // Note: We don't call EVP_EncryptFinal_ex for devices
+    // because we're encrypting raw sectors, not a padded file format
+
+    if (!ctx->progress)
+        printf("\n\n");
 
+    platform_arena_free(ctx->arena, inbuf);
+    platform_arena_free(ctx->arena, outbuf);
     EVP_CIPHER_CTX_free(cipher_ctx);
-    fclose(input);
-    fclose(output);
+    kcrypto_close(kernel);
 
-    return ETDK_SUCCESS;
+    // Single fsync at the end instead of a flush per chunk
+    if (close_device_io(&io, ctx, &wb) != ETDK_SUCCESS && result == ETDK_SUCCESS) {
+        perror("Error syncing device");
+        result = ETDK_ERROR_IO;
+    }
+
+    return result;
 }
 
 /**
- * @brief Display the encryption key and IV in hexadecimal format
+ * @brief Discard stage of the device workflow
  *
- * Shows the key to the user ONE TIME ONLY before it is securely deleted.
- * This allows for potential data recovery if needed. Once the key is wiped,
- * the encrypted data becomes permanently irrecoverable.
+ * Discards the whole device with the strongest primitive it accepts and
+ * reports which one was used.
  *
- * @param ctx Pointer to crypto_context_t containing the key and IV
+ * @param device_path Path to the block device
+ * @param size Device size in bytes
+ * @param required Non-zero if the run depends on the discard (hybrid mode)
+ * @return ETDK_SUCCESS, or error code if a required discard failed
  */
-void crypto_display_key(const crypto_context_t *ctx) {
-    if (!ctx)
-        return;
+static int discard_device_stage(const char *device_path, uint64_t size, int required) {
+    platform_discard_t used;
 
-    printf("---\n");
-    printf("ENCRYPTION KEY - SAVE NOW OR LOSE FOREVER\n");
-    printf("\n");
-    printf("Key: ");
-    for (int i = 0; i < AES_KEY_SIZE; i++) {
-        printf("%02x", ctx->key[i]);
+    printf("Discarding device...\n");
+    fflush(stdout);
+
+    int result = platform_discard_device(device_path, 0, size, &used);
+    if (result == ETDK_SUCCESS) {
+        printf("Discard: %s\n\n", platform_discard_name(used));
+        if (required && used == PLATFORM_DISCARD_UNMAP) {
+            fprintf(stderr, "WARNING: Only the first and last %llu MB were encrypted; the rest of the\n"
+                            "         device relies on an advisory discard.\n\n",
+                    ETDK_HYBRID_REGION_SIZE / (1024 * 1024));
+        }
+        return ETDK_SUCCESS;
     }
-    printf("\n");
-    printf("IV:  ");
-    for (int i = 0; i < AES_BLOCK_SIZE; i++) {
-        printf("%02x", ctx->iv[i]);
+
+    if (result == ETDK_ERROR_PLATFORM) {
+        fprintf(stderr, "Discard: not supported by this device\n\n");
+    } else {
+        fprintf(stderr, "Discard: %s failed\n\n", platform_discard_name(used));
     }
-    printf("\n");
-    printf("\n");
-    printf("Key is stored in RAM only and will be wiped immediately.\n");
-    printf("Write it down now if you need to decrypt later. (both hex values below)\n");
-    printf("---\n");
 
-    sleep(3);
+    // After a full encryption pass the discard is only a bonus
+    return required ? ETDK_ERROR_PLATFORM : ETDK_SUCCESS;
 }
 
 /**
- * @brief Securely wipe encryption key using 5-pass overwrite method
- *
- * Implements a multi-pass overwrite strategy to prevent key recovery:
- * Pass 1: Write all zeros (0x00)
- * Pass 2: Write all ones (0xFF)
- * Pass 3: Write cryptographically secure random data
- * Pass 4: Write all zeros again (clean state)
- * Pass 5: Volatile pointer overwrite (prevents compiler optimization)
+ * @brief Device offset of a position in processing order
  *
- * Why 5 passes are sufficient:
- * - RAM has no magnetic remanence (unlike HDDs)
- * - Random data pass makes pattern analysis impossible
- * - Volatile pointers prevent compiler from optimizing away writes
- * - Modern SSDs/RAM don't need 35-pass Gutmann (designed for magnetic media)
- * - BSI recommends multi-pass with random data for RAM/SSD
+ * @param ranges Ranges in processing order
+ * @param range_count Number of ranges
+ * @param pos Byte position counted through the ranges
+ * @return Byte offset on the device
+ */
+static uint64_t range_device_offset(const device_range_t *ranges, size_t range_count, uint64_t pos) {
+    for (size_t r = 0; r < range_count; r++) {
+        if (pos < ranges[r].length)
+            return ranges[r].offset + pos;
+        pos -= ranges[r].length;
+    }
+    return ranges[range_count - 1].offset + ranges[range_count - 1].length;
+}
+
+/**
+ * @brief Processing order of a device run
  *
- * This follows BSI recommendations for secure key destruction in volatile memory.
+ * @param regions Ranges the run covers, sorted and disjoint
+ * @param region_count Number of regions
+ * @param priority Priority list processed first, or NULL
+ * @param order Receives the ranges in processing order (free() it)
+ * @param order_count Receives the number of ranges
+ * @param total Receives the bytes the run encrypts
+ * @return ETDK_SUCCESS or ETDK_ERROR_MEMORY
+ */
+static int schedule_device(const device_range_t *regions, size_t region_count, const priority_list_t *priority,
+                           device_range_t **order, size_t *order_count, uint64_t *total) {
+    if (priority) {
+        if (priority_schedule(priority, regions, region_count, order, order_count) != ETDK_SUCCESS)
+            return ETDK_ERROR_MEMORY;
+    } else {
+        *order = malloc(region_count * sizeof(device_range_t));
+        if (!*order)
+            return ETDK_ERROR_MEMORY;
+        memcpy(*order, regions, region_count * sizeof(device_range_t));
+        *order_count = region_count;
+    }
+
+    *total = 0;
+    for (size_t r = 0; r < *order_count; r++)
+        *total += (*order)[r].length;
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Print the device ranges of a stretch of the processing order
  *
- * @param ctx Pointer to crypto_context_t containing key to wipe
- * @return ETDK_SUCCESS on success, ETDK_ERROR_CRYPTO on failure
+ * @param out Stream to print to
+ * @param ranges Ranges in processing order
+ * @param range_count Number of ranges
+ * @param from First position, counted through the ranges
+ * @param to End position (exclusive)
  */
-int crypto_secure_wipe_key(crypto_context_t *ctx) {
-    if (!ctx)
-        return ETDK_ERROR_CRYPTO;
+static void print_order_ranges(FILE *out, const device_range_t *ranges, size_t range_count, uint64_t from,
+                               uint64_t to) {
+    size_t shown = 0;
+    uint64_t pos = 0;
+    for (size_t r = 0; r < range_count && pos < to; pos += ranges[r].length, r++) {
+        uint64_t start = from > pos ? from - pos : 0;
+        uint64_t end = to - pos < ranges[r].length ? to - pos : ranges[r].length;
+        if (start >= end)
+            continue;
+        if (shown++ < 8)
+            fprintf(out, "    bytes %llu-%llu\n", (unsigned long long)(ranges[r].offset + start),
+                    (unsigned long long)(ranges[r].offset + end - 1));
+    }
+    if (shown > 8)
+        fprintf(out, "    and %zu more ranges\n", shown - 8);
+}
 
-    /* Pass 1: Overwrite with zeros
-     * Clears any existing data with a known pattern
-     */
-    memset(ctx->key, 0x00, AES_KEY_SIZE);
-    memset(ctx->iv, 0x00, AES_BLOCK_SIZE);
+/**
+ * @brief End of the stretch a resumed segment may encrypt a second time
+ *
+ * The engines write at most two checkpoint intervals past the last
+ * checkpoint (one interval of finished prefix plus, with --threads, the
+ * claim window ahead of it), so only that stretch after the start of a
+ * segment can also hold ciphertext of the interrupted attempt.
+ *
+ * @param journal Open journal
+ * @param start Start of the segment, in processing order
+ * @return End position (exclusive), at most the bytes of the run
+ */
+static uint64_t rewrite_end(const journal_t *journal, uint64_t start) {
+    uint64_t end = start + 2 * journal_interval(journal);
+    return end < journal->state.total ? end : journal->state.total;
+}
 
-    /* Pass 2: Overwrite with ones
-     * Flips all bits from previous pass
-     */
-    memset(ctx->key, 0xFF, AES_KEY_SIZE);
-    memset(ctx->iv, 0xFF, AES_BLOCK_SIZE);
+/**
+ * @brief Open or create the checkpoint journal of a device run and settle its processing order
+ *
+ * A new run records key, IV, mode and priority list of ctx. A resumed run
+ * loads them from the key file and starts a new segment with a fresh IV at
+ * the last checkpoint; ctx->iv is set to that IV for the engines. The
+ * priority list is never probed again on resume: the device is partly
+ * encrypted by then, and only the recorded order matches the checkpoint.
+ *
+ * @param journal Journal to initialize
+ * @param device_path Path to the block device
+ * @param ctx Crypto context (options.key_file, options.resume)
+ * @param device_size Device size in bytes
+ * @param regions Ranges the run covers, sorted and disjoint
+ * @param region_count Number of regions
+ * @param priority Priority list (built for a new run, loaded on resume), or NULL
+ * @param order Receives the ranges in processing order (free() it)
+ * @param order_count Receives the number of ranges
+ * @return ETDK_SUCCESS or error code
+ */
+static int device_journal_open(journal_t *journal, const char *device_path, crypto_context_t *ctx,
+                               uint64_t device_size, const device_range_t *regions, size_t region_count,
+                               priority_list_t *priority, device_range_t **order, size_t *order_count) {
+    const char *path = ctx->options.key_file;
+    uint64_t total;
 
-    /* Pass 3: Overwrite with random data
-     * Introduces unpredictability, making pattern analysis impossible
-     */
-    RAND_bytes(ctx->key, AES_KEY_SIZE);
-    RAND_bytes(ctx->iv, AES_BLOCK_SIZE);
+    if (!ctx->options.resume) {
+        if (schedule_device(regions, region_count, priority, order, order_count, &total) != ETDK_SUCCESS)
+            return ETDK_ERROR_MEMORY;
+        if (journal_create(journal, path, ctx, device_path, device_size, total, priority) != ETDK_SUCCESS) {
+            free(*order);
+            return ETDK_ERROR_IO;
+        }
+        printf("Key file: %s (checkpoint every %.1f MB)\n", path, journal_interval(journal) / (1024.0 * 1024.0));
+        return ETDK_SUCCESS;
+    }
 
-    /* Pass 4: Final overwrite with zeros
-     * Leaves memory in a known, clean state
-     */
-    memset(ctx->key, 0x00, AES_KEY_SIZE);
-    memset(ctx->iv, 0x00, AES_BLOCK_SIZE);
+    if (journal_open(journal, path, ctx, device_path, device_size) != ETDK_SUCCESS)
+        return ETDK_ERROR_IO;
 
-    /* Pass 5: Volatile overwrite to prevent compiler optimization
-     * Compilers may optimize away memset() calls if they determine the
-     * memory won't be read again. Using volatile pointers forces the
-     * compiler to perform the write operation.
-     */
-    volatile uint8_t *vkey = (volatile uint8_t *)ctx->key;
-    volatile uint8_t *viv = (volatile uint8_t *)ctx->iv;
-    for (size_t i = 0; i < AES_KEY_SIZE; i++) {
-        vkey[i] = 0;
+    int result = (priority != NULL) == (journal->state.priority.count > 0) ? ETDK_SUCCESS : ETDK_ERROR_IO;
+    if (result == ETDK_SUCCESS && priority)
+        *priority = journal->state.priority;
+    if (result == ETDK_SUCCESS)
+        result = schedule_device(regions, region_count, priority, order, order_count, &total);
+    if (result == ETDK_SUCCESS && journal->state.total != total) {
+        free(*order);
+        result = ETDK_ERROR_IO;
     }
-    for (size_t i = 0; i < AES_BLOCK_SIZE; i++) {
-        viv[i] = 0;
+    if (result != ETDK_SUCCESS) {
+        if (result == ETDK_ERROR_IO)
+            fprintf(stderr, "Cannot resume from key file %s: the run was started with different options\n", path);
+        journal_close(journal);
+        return result;
     }
 
+    printf("Key file: %s (resuming at %.2f GB of %.2f GB, chunk %llu KB%s)\n", path,
+           journal->state.done / (1024.0 * 1024.0 * 1024.0), total / (1024.0 * 1024.0 * 1024.0),
+           (unsigned long long)(journal->state.chunk_size / 1024), priority ? ", recorded priority order" : "");
+
+    if (journal->state.done < total && journal_begin_segment(journal, ctx->iv) != ETDK_SUCCESS) {
+        free(*order);
+        journal_close(journal);
+        return ETDK_ERROR_IO;
+    }
+    if (journal->state.done < total) {
+        fflush(stdout);
+        fprintf(stderr, "Warning: the interrupted run may have encrypted past its last checkpoint; that data is now\n"
+                        "         encrypted a second time, under the new IV. It can lie in:\n");
+        uint64_t done = journal->state.done;
+        print_order_ranges(stderr, *order, *order_count, done, rewrite_end(journal, done));
+    }
     return ETDK_SUCCESS;
 }
 
 /**
- * @brief Cleanup crypto context and securely wipe all sensitive data
+ * @brief Print the IVs of a run that was resumed
  *
- * Calls crypto_secure_wipe_key() to perform secure key deletion,
- * then zeros out the entire context structure.
+ * Every segment is encrypted under its own IV and must be decrypted
+ * separately, starting at the given device offset. In a priority run a
+ * segment is a stretch of the processing order, so its device ranges are
+ * listed as well. The start of every later segment may also hold ciphertext
+ * of the interrupted attempt (see rewrite_end()), which is named too.
  *
- * @param ctx Pointer to crypto_context_t to cleanup
+ * @param journal Journal of the completed run
+ * @param ranges Ranges in processing order
+ * @param range_count Number of ranges
  */
-void crypto_cleanup(crypto_context_t *ctx) {
-    if (ctx) {
-        crypto_secure_wipe_key(ctx);
-        memset(ctx, 0, sizeof(crypto_context_t));
+static void print_journal_segments(const journal_t *journal, const device_range_t *ranges, size_t range_count) {
+    const journal_state_t *state = &journal->state;
+    if (state->segment_count < 2)
+        return;
+
+    printf("Resumed run: %u segments, each encrypted with its own IV\n", state->segment_count);
+    for (uint32_t i = 0; i < state->segment_count; i++) {
+        printf("  from byte %llu: IV ", (unsigned long long)range_device_offset(ranges, range_count,
+                                                                                 state->segments[i].start));
+        for (int b = 0; b < AES_BLOCK_SIZE; b++)
+            printf("%02x", state->segments[i].iv[b]);
+        printf("\n");
+        if (state->priority.count > 0)
+            print_order_ranges(stdout, ranges, range_count, state->segments[i].start,
+                               i + 1 < state->segment_count ? state->segments[i + 1].start : state->total);
+        if (i > 0) {
+            printf("  may be encrypted twice, under this IV over the previous one:\n");
+            print_order_ranges(stdout, ranges, range_count, state->segments[i].start,
+                               rewrite_end(journal, state->segments[i].start));
+        }
     }
+    printf("\n");
 }
 
 /**
- * @brief Encrypt a block device using AES-256-CBC
+ * @brief Encrypt a block device in place
  *
- * Reads the device in 1MB chunks, encrypts each chunk using
- * AES-256-CBC mode, and writes the encrypted data back to the device.
- * Shows progress indicator during operation.
+ * Selects the engine from ctx->mode and ctx->options:
+ * - seekable mode (CTR, XTS) or threads > 0: pool of worker threads (encrypt_device_parallel())
+ * - queue_depth > 0: AES-256-CBC with overlapped I/O (encrypt_device_pipeline())
+ * - otherwise: sequential AES-256-CBC (encrypt_device_sequential())
+ *
+ * With --discard=after the device is discarded once encryption succeeded.
+ * With --discard=hybrid only the first and last ETDK_HYBRID_REGION_SIZE
+ * bytes (partition tables, superblocks, LUKS/LVM headers, backup GPT) are
+ * encrypted with a seekable mode and the whole device is then discarded; the
+ * run fails if the device accepts no discard primitive.
+ *
+ * With --priority the metadata regions found by priority_build() are
+ * encrypted first and reported as destroyed once they are on stable
+ * storage; the rest follows in device order (see priority_schedule()).
+ * The mode is seekable, so the ciphertext equals that of a linear run.
+ *
+ * With --key-file the key and durable checkpoints are kept in a locked
+ * key file (see journal_create()), so an interrupted run can continue with
+ * --resume. The key file is destroyed once the run has completed.
  *
  * WARNING: This DESTROYS all data on the device permanently!
  *
@@ -301,97 +3451,111 @@ int crypto_encrypt_device(const char *device_path, crypto_context_t *ctx) {
         return ETDK_ERROR_CRYPTO;
     }
 
-    // Open device for read/write with synchronous I/O
-    FILE *device = fopen(device_path, "r+b");
-    if (!device) {
-        perror("Cannot open device");
-        return ETDK_ERROR_IO;
-    }
-
-    // Get device size
     uint64_t device_size = 0;
     if (platform_get_device_size(device_path, &device_size) != ETDK_SUCCESS) {
         fprintf(stderr, "Error getting device size\n");
-        fclose(device);
         return ETDK_ERROR_IO;
     }
 
-    EVP_CIPHER_CTX *cipher_ctx = init_cipher_context(ctx);
-    if (!cipher_ctx) {
-        fclose(device);
-        return ETDK_ERROR_CRYPTO;
-    }
-
-    // Process device in 1MB chunks for efficiency
-    const size_t CHUNK_SIZE = 1024 * 1024; // 1MB
-    unsigned char *inbuf = malloc(CHUNK_SIZE);
-    unsigned char *outbuf = malloc(CHUNK_SIZE + EVP_MAX_BLOCK_LENGTH);
+    unsigned int threads = ctx->options.threads;
+    int hybrid = ctx->options.discard == ETDK_DISCARD_HYBRID;
 
-    if (!inbuf || !outbuf) {
-        fprintf(stderr, "Memory allocation failed\n");
-        free(inbuf);
-        free(outbuf);
-        EVP_CIPHER_CTX_free(cipher_ctx);
-        fclose(device);
-        return ETDK_ERROR_MEMORY;
+    // Crypto-then-trim: make the metadata unreadable, let the device drop the rest
+    device_range_t regions[2] = {{0, device_size}, {0, 0}};
+    size_t region_count = 1;
+    if (hybrid && device_size > 2 * ETDK_HYBRID_REGION_SIZE) {
+        regions[0].length = ETDK_HYBRID_REGION_SIZE;
+        // Start on an XTS data unit so every mode sees whole units
+        regions[1].offset = (device_size - ETDK_HYBRID_REGION_SIZE) & ~(uint64_t)(ETDK_XTS_DATA_UNIT - 1);
+        regions[1].length = device_size - regions[1].offset;
+        region_count = 2;
     }
 
-    uint64_t processed = 0;
-    int outlen;
-    size_t bytes_read;
-
-    printf("\n");
-    printf("Encrypting device...\n");
-    printf("\n");
+    if ((hybrid || threads > 0 || ctx->options.overwrite || ctx->options.priority) &&
+        !cipher_info(ctx->mode)->seekable) {
+        ctx->mode = ETDK_CIPHER_CTR;
+    }
 
-    // Read, encrypt, and write back in chunks
-    while ((bytes_read = fread(inbuf, 1, CHUNK_SIZE, device)) > 0) {
-        // Encrypt chunk
-        if (EVP_EncryptUpdate(cipher_ctx, outbuf, &outlen, inbuf, bytes_read) != 1) {
-            fprintf(stderr, "\nError during encryption: %s\n", ERR_error_string(ERR_get_error(), NULL));
-            free(inbuf);
-            free(outbuf);
-            EVP_CIPHER_CTX_free(cipher_ctx);
-            fclose(device);
-            return ETDK_ERROR_CRYPTO;
+    // A resumed run takes its priority list from the key file instead
+    priority_list_t priority;
+    priority_list_t *pl = NULL;
+    if (ctx->options.priority) {
+        pl = &priority;
+        if (!ctx->options.resume && priority_build(pl, device_path, device_size, ctx) != ETDK_SUCCESS) {
+            return ETDK_ERROR_IO;
         }
+    }
 
-        // Seek back to write position
-        fseek(device, -(long)bytes_read, SEEK_CUR);
-
-        // Write encrypted data back to device
-        if (fwrite(outbuf, 1, outlen, device) != (size_t)outlen) {
-            fprintf(stderr, "\nError writing to device\n");
-            free(inbuf);
-            free(outbuf);
-            EVP_CIPHER_CTX_free(cipher_ctx);
-            fclose(device);
+    device_range_t *order;
+    size_t order_count;
+    uint64_t total;
+    journal_t *jp = NULL;
+    if (ctx->options.key_file) {
+        // The journal holds the key: locked pages of its own, never shared with the caller's context
+        jp = crypto_secure_alloc(sizeof(journal_t));
+        if (!jp) {
+            return ETDK_ERROR_MEMORY;
+        }
+        if (device_journal_open(jp, device_path, ctx, device_size, regions, region_count, pl, &order,
+                                &order_count) != ETDK_SUCCESS) {
+            crypto_secure_free(jp, sizeof(journal_t));
             return ETDK_ERROR_IO;
         }
+    } else if (schedule_device(regions, region_count, pl, &order, &order_count, &total) != ETDK_SUCCESS) {
+        return ETDK_ERROR_MEMORY;
+    }
 
-        // Flush to ensure data is written
-        fflush(device);
+    int result = ETDK_SUCCESS;
 
-        processed += bytes_read;
+    // Fingerprint the sampled blocks while they still hold plaintext
+    verify_plan_t plan;
+    memset(&plan, 0, sizeof(plan));
+    if (ctx->options.verify != ETDK_VERIFY_OFF) {
+        result = verify_prepare(&plan, device_path, order, order_count, jp ? jp->state.done : 0);
+    }
 
-        // Show progress
-        double percent = (processed * 100.0) / device_size;
-        double gb_processed = processed / (1024.0 * 1024.0 * 1024.0);
-        double gb_total = device_size / (1024.0 * 1024.0 * 1024.0);
+    if (result != ETDK_SUCCESS) {
+        fprintf(stderr, "Cannot prepare verification\n");
+    } else if (jp && jp->state.done == jp->state.total) {
+        printf("Encryption already complete\n\n");
+    } else if (ctx->options.overwrite) {
+        result = overwrite_device(device_path, ctx);
+    } else if (hybrid || pl || cipher_info(ctx->mode)->seekable) {
+        // A resumed CTR/XTS run keeps its mode even without --threads
+        result = encrypt_device_parallel(device_path, ctx, threads ? threads : 1, order, order_count, jp, pl);
+    } else if (ctx->options.queue_depth > 0 && !jp) {
+        result = encrypt_device_pipeline(device_path, ctx);
+    } else {
+        result = encrypt_device_sequential(device_path, ctx, jp);
+    }
 
-        printf("\rProgress: %.2f GB / %.2f GB (%.1f%%)  ", gb_processed, gb_total, percent);
-        fflush(stdout);
+    if (jp && result == ETDK_SUCCESS && jp->state.done != jp->state.total) {
+        // The engines synced the device when closing it
+        result = journal_checkpoint(jp, jp->state.total);
     }
 
-    // Note: We don't call EVP_EncryptFinal_ex for devices
-    // because we're encrypting raw sectors, not a padded file format
+    // Read back before discarding: a discarded device no longer returns the ciphertext
+    if (result == ETDK_SUCCESS && ctx->options.verify != ETDK_VERIFY_OFF) {
+        result = verify_run(&plan, device_path, ctx);
+    }
+    verify_free(&plan);
 
-    printf("\n\n");
+    if (result == ETDK_SUCCESS && ctx->options.discard != ETDK_DISCARD_OFF) {
+        result = discard_device_stage(device_path, device_size, hybrid);
+    }
 
-    free(inbuf);
-    free(outbuf);
-    EVP_CIPHER_CTX_free(cipher_ctx);
-    fclose(device);
+    if (jp) {
+        memcpy(ctx->iv, jp->state.segments[0].iv, AES_BLOCK_SIZE);
+        if (result == ETDK_SUCCESS) {
+            print_journal_segments(jp, order, order_count);
+            journal_destroy(jp);
+        } else {
+            fprintf(stderr, "Progress is saved in %s; run again with --resume to continue\n", jp->path);
+            journal_close(jp);
+        }
+        crypto_secure_free(jp, sizeof(journal_t));
+    }
+    free(order);
 
-    return ETDK_SUCCESS;
+    return result;
 }
@@ -0,0 +1,420 @@
+/*
+ * ETDK - Encrypt-then-Delete-Key
+ * Decrypt mode - parallel, random-access recovery of encrypted files and devices
+ */
+
+#include "etdk.h"
+// cppcheck-suppress-begin missingIncludeSystem
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// cppcheck-suppress-end missingIncludeSystem
+
+/**
+ * @brief Shared state of a decryption run
+ *
+ * Workers claim extents of the range by index under the lock, like the
+ * --threads encryption engine; every extent is decrypted independently
+ * (see crypto_decrypt_extent()), so the result does not depend on the
+ * number of workers.
+ */
+typedef struct {
+    const crypto_context_t *ctx; /**< Key, IV, mode and options */
+    int in_fd;                   /**< Ciphertext source, read-only */
+    int out_fd;                  /**< Plaintext destination */
+    uint64_t base;               /**< Source position of ciphertext byte 0 (container header size) */
+    uint64_t start;              /**< First ciphertext byte of the range */
+    uint64_t length;             /**< Ciphertext bytes of the range */
+    int strip_padding;           /**< Non-zero removes CBC PKCS#7 padding from the last block */
+    int sparse;                  /**< Non-zero if the source has holes: only its data ranges are decrypted */
+    size_t chunk;                /**< Extent size (options.chunk_size) */
+    uint64_t extent_count;       /**< Number of extents */
+    uint64_t next_extent;        /**< Next unclaimed extent index */
+    uint64_t processed;          /**< Ciphertext bytes decrypted so far */
+    size_t padding;              /**< Padding bytes removed from the end */
+    int status;                  /**< First error encountered, ETDK_SUCCESS otherwise */
+    progress_t *progress;        /**< Progress reporter */
+    pthread_mutex_t lock;        /**< Protects all mutable fields */
+} decrypt_job_t;
+
+/**
+ * @brief Length of valid PKCS#7 padding at the end of the last block
+ *
+ * @param block Last plaintext block (AES_BLOCK_SIZE bytes)
+ * @return Padding length (1..AES_BLOCK_SIZE), or 0 if the block carries no valid padding
+ */
+static size_t pkcs7_padding(const unsigned char *block) {
+    unsigned char pad = block[AES_BLOCK_SIZE - 1];
+    if (pad == 0 || pad > AES_BLOCK_SIZE)
+        return 0;
+    for (size_t i = AES_BLOCK_SIZE - pad; i < AES_BLOCK_SIZE; i++) {
+        if (block[i] != pad)
+            return 0;
+    }
+    return pad;
+}
+
+/**
+ * @brief Decrypt the data ranges of one extent of a sparse source
+ *
+ * Sparse files are encrypted range by range with AES-256-CTR and their
+ * holes are never written, so a hole stands for plaintext zeros, not for
+ * ciphertext. Only the ranges reported by platform_next_data() are read,
+ * decrypted and written; holes stay holes in the output, which is
+ * truncated to its full size at the end of the run.
+ *
+ * @param job Decryption run
+ * @param data Buffer of at least job->chunk bytes
+ * @param offset First ciphertext byte of the extent
+ * @param len Length of the extent
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO or ETDK_ERROR_CRYPTO
+ */
+static int decrypt_sparse_extent(const decrypt_job_t *job, unsigned char *data, uint64_t offset, size_t len) {
+    uint64_t pos = offset, start, end;
+    int found;
+
+    while ((found = platform_next_data(job->in_fd, pos, offset + len, &start, &end)) > 0) {
+        size_t n = (size_t)(end - start);
+        if (platform_pread_full(job->in_fd, data, n, start) != (int64_t)n) {
+            fprintf(stderr, "\nError reading source at offset %llu\n", (unsigned long long)start);
+            return ETDK_ERROR_IO;
+        }
+
+        int status = crypto_decrypt_extent(job->ctx, data, n, start, NULL);
+        if (status != ETDK_SUCCESS)
+            return status;
+
+        if (platform_pwrite_full(job->out_fd, data, n, start - job->start) != ETDK_SUCCESS) {
+            fprintf(stderr, "\nError writing output at offset %llu: %s\n", (unsigned long long)(start - job->start),
+                    strerror(errno));
+            return ETDK_ERROR_IO;
+        }
+        pos = end;
+    }
+
+    if (found < 0) {
+        perror("\nCannot find data ranges of the source");
+        return ETDK_ERROR_IO;
+    }
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Worker thread: read, decrypt and write claimed extents
+ *
+ * The buffer holds one AES block in front of the extent, which receives
+ * the preceding ciphertext block for CBC (the chain value of the extent).
+ *
+ * @param arg Pointer to decrypt_job_t
+ * @return NULL
+ */
+static void *decrypt_worker(void *arg) {
+    decrypt_job_t *job = arg;
+    const crypto_context_t *ctx = job->ctx;
+    int status = ETDK_SUCCESS;
+
+    unsigned char *buf = platform_arena_alloc(ctx->arena, job->chunk + AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+    if (!buf) {
+        status = ETDK_ERROR_MEMORY;
+        goto done;
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        if (job->status != ETDK_SUCCESS || job->next_extent >= job->extent_count) {
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+        uint64_t extent = job->next_extent++;
+        pthread_mutex_unlock(&job->lock);
+
+        uint64_t rel = extent * job->chunk;
+        uint64_t offset = job->start + rel;
+        size_t len = job->length - rel < job->chunk ? (size_t)(job->length - rel) : job->chunk;
+
+        if (job->sparse) {
+            status = decrypt_sparse_extent(job, buf + AES_BLOCK_SIZE, offset, len);
+            if (status != ETDK_SUCCESS)
+                break;
+            pthread_mutex_lock(&job->lock);
+            job->processed += len;
+            progress_update(job->progress, job->processed);
+            pthread_mutex_unlock(&job->lock);
+            continue;
+        }
+
+        // CBC past the start of the ciphertext chains from the block before the extent,
+        // except at the start of a range whose IV was given (a resumed segment)
+        int chained = ctx->mode == ETDK_CIPHER_CBC && offset > 0 && (extent > 0 || !ctx->options.decrypt_iv);
+        size_t lead = chained ? AES_BLOCK_SIZE : 0;
+
+        if (platform_pread_full(job->in_fd, buf + AES_BLOCK_SIZE - lead, len + lead, job->base + offset - lead) !=
+            (int64_t)(len + lead)) {
+            fprintf(stderr, "\nError reading source at offset %llu\n", (unsigned long long)offset);
+            status = ETDK_ERROR_IO;
+            break;
+        }
+
+        unsigned char *data = buf + AES_BLOCK_SIZE;
+        status = crypto_decrypt_extent(ctx, data, len, offset, chained ? buf : NULL);
+        if (status != ETDK_SUCCESS)
+            break;
+
+        size_t out_len = len;
+        if (job->strip_padding && rel + len == job->length) {
+            size_t pad = pkcs7_padding(data + len - AES_BLOCK_SIZE);
+            if (pad == 0) {
+                fprintf(stderr, "\nWarning: no valid CBC padding at the end; output kept unpadded\n");
+            }
+            out_len -= pad;
+            pthread_mutex_lock(&job->lock);
+            job->padding = pad;
+            pthread_mutex_unlock(&job->lock);
+        }
+
+        if (platform_pwrite_full(job->out_fd, data, out_len, rel) != ETDK_SUCCESS) {
+            fprintf(stderr, "\nError writing output at offset %llu: %s\n", (unsigned long long)rel, strerror(errno));
+            status = ETDK_ERROR_IO;
+            break;
+        }
+
+        pthread_mutex_lock(&job->lock);
+        job->processed += len;
+        progress_update(job->progress, job->processed);
+        pthread_mutex_unlock(&job->lock);
+    }
+
+done:
+    platform_arena_free(ctx->arena, buf);
+    if (status != ETDK_SUCCESS) {
+        pthread_mutex_lock(&job->lock);
+        if (job->status == ETDK_SUCCESS)
+            job->status = status;
+        pthread_mutex_unlock(&job->lock);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Number of workers for a decryption run
+ *
+ * @param ctx Crypto context (options.threads, 0 = online CPUs)
+ * @param extents Extents in the range
+ * @return Worker count, at least 1 and at most extents
+ */
+static unsigned int decrypt_thread_count(const crypto_context_t *ctx, uint64_t extents) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int threads = ctx->options.threads ? ctx->options.threads : (unsigned int)(cpus > 0 ? cpus : 1);
+
+    if (threads > ETDK_MAX_THREADS)
+        threads = ETDK_MAX_THREADS;
+    if (extents > 0 && threads > extents)
+        threads = (unsigned int)extents;
+    return threads ? threads : 1;
+}
+
+/**
+ * @brief Check the range of a run against the ciphertext and the mode
+ *
+ * @param ctx Crypto context (mode, options.decrypt_offset, options.decrypt_length)
+ * @param data_size Ciphertext bytes of the source (without a GCM tag)
+ * @param length Receives the length of the range
+ * @return ETDK_SUCCESS, or ETDK_ERROR_IO with a message
+ */
+static int decrypt_range(const crypto_context_t *ctx, uint64_t data_size, uint64_t *length) {
+    uint64_t offset = ctx->options.decrypt_offset;
+    if (offset >= data_size) {
+        fprintf(stderr, "Error: --offset %llu is beyond the ciphertext (%llu bytes)\n", (unsigned long long)offset,
+                (unsigned long long)data_size);
+        return ETDK_ERROR_IO;
+    }
+
+    *length = data_size - offset;
+    if (ctx->options.decrypt_length && ctx->options.decrypt_length < *length)
+        *length = ctx->options.decrypt_length;
+    int to_end = offset + *length == data_size;
+
+    if (ctx->mode == ETDK_CIPHER_CBC && (offset % AES_BLOCK_SIZE || *length % AES_BLOCK_SIZE)) {
+        fprintf(stderr, "Error: CBC ranges must start and end on a %d-byte block boundary\n", AES_BLOCK_SIZE);
+        return ETDK_ERROR_IO;
+    }
+    if (ctx->mode == ETDK_CIPHER_XTS &&
+        (offset % ETDK_XTS_DATA_UNIT || (!to_end && *length % ETDK_XTS_DATA_UNIT) || *length < AES_BLOCK_SIZE)) {
+        fprintf(stderr, "Error: XTS ranges must start and end on a %d-byte data unit boundary\n",
+                ETDK_XTS_DATA_UNIT);
+        return ETDK_ERROR_IO;
+    }
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Decrypt a range of an encrypted file or device into a new file or device
+ *
+ * The range [options.decrypt_offset, + options.decrypt_length) of the
+ * ciphertext is split into chunk-sized extents that a worker pool reads,
+ * decrypts and writes concurrently; plaintext byte offset + i lands at
+ * position i of dest. Nothing before the range is read, except for CBC,
+ * where each extent reads the one ciphertext block before it as its IV.
+ *
+ * The source is opened read-only. For regular files, a GCM tag at the end
+ * is excluded (and not checked), CBC padding is removed when the range
+ * reaches the end, and the holes of a sparse CTR source are skipped (see
+ * decrypt_sparse_extent()); block devices never carry any of these. With
+ * options.container the source is an ETDK container: ctx->key is its
+ * key-encryption key, replaced by the unwrapped data key, and offsets
+ * count from the start of the payload.
+ *
+ * @param source Encrypted file or block device
+ * @param dest Output file (created or truncated) or block device, never the source
+ * @param ctx Crypto context with key, IV, mode and the decrypt options (chunk size from crypto_tune_io());
+ *            the buffer arena is created here
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO, ETDK_ERROR_MEMORY, or ETDK_ERROR_CRYPTO
+ */
+int decrypt_run(const char *source, const char *dest, crypto_context_t *ctx) {
+    if (!source || !dest || !ctx) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    decrypt_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.ctx = ctx;
+    job.start = ctx->options.decrypt_offset;
+    job.chunk = ctx->options.chunk_size ? ctx->options.chunk_size : ETDK_DEVICE_CHUNK_SIZE;
+
+    int source_device = platform_is_device(source) == 1;
+    uint64_t data_size;
+    job.in_fd = open(source, O_RDONLY);
+    if (job.in_fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", source, strerror(errno));
+        return ETDK_ERROR_IO;
+    }
+    if (source_device) {
+        if (platform_get_device_size(source, &data_size) != ETDK_SUCCESS) {
+            close(job.in_fd);
+            return ETDK_ERROR_IO;
+        }
+    } else {
+        struct stat st;
+        if (fstat(job.in_fd, &st) != 0) {
+            perror("Cannot examine source");
+            close(job.in_fd);
+            return ETDK_ERROR_IO;
+        }
+        data_size = (uint64_t)st.st_size;
+        if (ctx->mode == ETDK_CIPHER_GCM)
+            data_size = data_size > ETDK_GCM_TAG_SIZE ? data_size - ETDK_GCM_TAG_SIZE : 0;
+    }
+
+    if (ctx->options.container) {
+        etdk_container_header_t header;
+        int status = crypto_container_open(job.in_fd, ctx, &header);
+        if (status != ETDK_SUCCESS) {
+            if (status == ETDK_ERROR_CRYPTO)
+                fprintf(stderr, "Error: --key does not unwrap the key slot of %s\n", source);
+            else
+                fprintf(stderr, "Error: %s is not an ETDK container\n", source);
+            close(job.in_fd);
+            return status;
+        }
+        job.base = header.header_size;
+        data_size = header.payload_length;
+    }
+
+    if (decrypt_range(ctx, data_size, &job.length) != ETDK_SUCCESS) {
+        close(job.in_fd);
+        return ETDK_ERROR_IO;
+    }
+    job.strip_padding = !source_device && ctx->mode == ETDK_CIPHER_CBC && job.start + job.length == data_size;
+
+    // Only sparse encryption leaves holes, and it always uses CTR
+    job.sparse = !source_device && !ctx->options.container && ctx->mode == ETDK_CIPHER_CTR &&
+                 platform_has_holes(job.in_fd, data_size);
+    job.extent_count = (job.length + job.chunk - 1) / job.chunk;
+
+    int dest_device = platform_is_device(dest) == 1;
+    job.out_fd = open(dest, dest_device ? O_WRONLY : O_WRONLY | O_CREAT, 0600);
+    if (job.out_fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", dest, strerror(errno));
+        close(job.in_fd);
+        return ETDK_ERROR_IO;
+    }
+
+    struct stat in_st, out_st;
+    if (fstat(job.in_fd, &in_st) == 0 && fstat(job.out_fd, &out_st) == 0 && in_st.st_dev == out_st.st_dev &&
+        in_st.st_ino == out_st.st_ino) {
+        fprintf(stderr, "Error: %s and %s are the same file\n", source, dest);
+        close(job.out_fd);
+        close(job.in_fd);
+        return ETDK_ERROR_IO;
+    }
+    // Truncate only now: dest may have been the source under another name
+    if (!dest_device && ftruncate(job.out_fd, 0) != 0) {
+        perror("Cannot truncate output");
+        close(job.out_fd);
+        close(job.in_fd);
+        return ETDK_ERROR_IO;
+    }
+
+    unsigned int threads = decrypt_thread_count(ctx, job.extent_count);
+    crypto_buffers_create(ctx, threads);
+    printf("Range:  bytes %llu to %llu (%.2f GB), %u worker%s\n", (unsigned long long)job.start,
+           (unsigned long long)(job.start + job.length), job.length / (1024.0 * 1024.0 * 1024.0), threads,
+           threads == 1 ? "" : "s");
+    if (ctx->mode == ETDK_CIPHER_GCM)
+        printf("Note:   GCM tag not checked (decrypted as the equivalent CTR keystream)\n");
+    if (job.sparse)
+        printf("Sparse: only data ranges are decrypted, holes are kept as zeros\n");
+    printf("\nDecrypting...\n");
+    fflush(stdout);
+
+    pthread_t *workers = calloc(threads, sizeof(pthread_t));
+    if (!workers) {
+        close(job.out_fd);
+        close(job.in_fd);
+        return ETDK_ERROR_MEMORY;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    job.progress = progress_start(ctx, PROGRESS_DECRYPT, source, job.length, 0);
+
+    unsigned int started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, decrypt_worker, &job) != 0)
+            break;
+    }
+    if (started == 0) {
+        // No thread could be created: decrypt on the calling thread
+        decrypt_worker(&job);
+    }
+    for (unsigned int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    int result = job.status;
+    if (result == ETDK_SUCCESS && !dest_device && ftruncate(job.out_fd, (off_t)(job.length - job.padding)) != 0) {
+        perror("\nError truncating output");
+        result = ETDK_ERROR_IO;
+    }
+    if (result == ETDK_SUCCESS && fsync(job.out_fd) != 0) {
+        perror("\nError syncing output");
+        result = ETDK_ERROR_IO;
+    }
+    progress_finish(job.progress, result);
+    printf("\n\n");
+
+    pthread_mutex_destroy(&job.lock);
+    if (close(job.out_fd) != 0 && result == ETDK_SUCCESS) {
+        perror("Error closing output");
+        result = ETDK_ERROR_IO;
+    }
+    close(job.in_fd);
+
+    if (result == ETDK_SUCCESS)
+        printf("Decrypted: %llu bytes to %s\n\n", (unsigned long long)(job.length - job.padding), dest);
+    return result;
+}
@@ -0,0 +1,336 @@
+/*
+ * ETDK - Encrypt-then-Delete-Key
+ * Checkpoint journal - key file with durable progress for resumable device runs
+ */
+
+#include "etdk.h"
+// cppcheck-suppress-begin missingIncludeSystem
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+// cppcheck-suppress-end missingIncludeSystem
+
+/** Journal magic and format version (2 added the priority list) */
+#define JOURNAL_MAGIC "ETDKJRN2"
+
+/** Distance between the two journal copies in the key file */
+#define JOURNAL_SLOT_SIZE 32768
+
+/**
+ * @brief One journal copy as stored on disk
+ */
+typedef struct {
+    journal_state_t state;    /**< Journal contents */
+    unsigned char digest[32]; /**< SHA-256 over state */
+} journal_record_t;
+
+_Static_assert(sizeof(journal_record_t) <= JOURNAL_SLOT_SIZE, "journal record must fit in one slot");
+
+/**
+ * @brief Compute the checksum of a journal state
+ *
+ * @param state Journal contents
+ * @param digest Receives the SHA-256 digest (32 bytes)
+ * @return ETDK_SUCCESS or ETDK_ERROR_CRYPTO
+ */
+static int journal_digest(const journal_state_t *state, unsigned char *digest) {
+    unsigned int len = 0;
+    return EVP_Digest(state, sizeof(*state), digest, &len, EVP_sha256(), NULL) == 1 ? ETDK_SUCCESS
+                                                                                     : ETDK_ERROR_CRYPTO;
+}
+
+/**
+ * @brief Write the current state durably
+ *
+ * The two copies are written alternately, so a write torn by a power cut
+ * can only damage the copy being replaced; the other one still holds the
+ * previous checkpoint.
+ *
+ * @param journal Open journal
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+static int journal_write(journal_t *journal) {
+    journal_record_t record;
+
+    journal->state.sequence++;
+    record.state = journal->state;
+    if (journal_digest(&record.state, record.digest) != ETDK_SUCCESS) {
+        OPENSSL_cleanse(&record, sizeof(record));
+        return ETDK_ERROR_IO;
+    }
+
+    uint64_t offset = (journal->state.sequence % 2) * JOURNAL_SLOT_SIZE;
+    int result = platform_pwrite_full(journal->fd, &record, sizeof(record), offset);
+    OPENSSL_cleanse(&record, sizeof(record));
+
+    if (result != ETDK_SUCCESS || fdatasync(journal->fd) != 0) {
+        perror("Error writing key file");
+        return ETDK_ERROR_IO;
+    }
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Open and lock the key file
+ *
+ * @param path Key file path
+ * @param flags Extra open() flags (O_CREAT | O_EXCL for a new run)
+ * @return File descriptor, or -1 on failure (message printed)
+ */
+static int journal_open_fd(const char *path, int flags) {
+    int fd = open(path, O_RDWR | O_NOFOLLOW | O_CLOEXEC | flags, 0600);
+    if (fd < 0) {
+        if (errno == EEXIST)
+            fprintf(stderr, "Key file %s already exists (use --resume to continue that run)\n", path);
+        else
+            fprintf(stderr, "Cannot open key file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // One run per key file: a second etdk on the same journal would corrupt it
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        fprintf(stderr, "Key file %s is in use by another process\n", path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * @brief Create a new key file for a run
+ *
+ * The file is created exclusively with mode 0600 and stays locked with
+ * flock() while the run is active. The first segment uses the IV of ctx.
+ *
+ * @param journal Journal to initialize
+ * @param path Key file path
+ * @param ctx Context with key, IV and mode of the run
+ * @param device Device path
+ * @param device_size Device size in bytes
+ * @param total Bytes the run will encrypt
+ * @param priority Regions processed first, or NULL
+ * @return ETDK_SUCCESS or error code
+ */
+int journal_create(journal_t *journal, const char *path, const crypto_context_t *ctx, const char *device,
+                   uint64_t device_size, uint64_t total, const priority_list_t *priority) {
+    if (!journal || !path || !ctx || !device) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    memset(journal, 0, sizeof(*journal));
+    journal->path = path;
+    journal->fd = journal_open_fd(path, O_CREAT | O_EXCL);
+    if (journal->fd < 0) {
+        return ETDK_ERROR_IO;
+    }
+
+    journal_state_t *state = &journal->state;
+    memcpy(state->magic, JOURNAL_MAGIC, sizeof(state->magic));
+    memcpy(state->key, ctx->key, sizeof(state->key));
+    state->mode = (uint32_t)ctx->mode;
+    state->chunk_size = ctx->options.chunk_size ? ctx->options.chunk_size : ETDK_DEVICE_CHUNK_SIZE;
+    state->device_size = device_size;
+    state->total = total;
+    state->segment_count = 1;
+    memcpy(state->segments[0].iv, ctx->iv, AES_BLOCK_SIZE);
+    snprintf(state->device, sizeof(state->device), "%s", device);
+    if (priority)
+        state->priority = *priority;
+
+    if (journal_write(journal) != ETDK_SUCCESS) {
+        journal_destroy(journal);
+        return ETDK_ERROR_IO;
+    }
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Open an existing key file and load the run it describes
+ *
+ * Both copies are read; the valid one with the higher sequence number is
+ * the last durable checkpoint. Key, mode and chunk size are copied into
+ * ctx, and ctx->iv is set to the IV of the first segment.
+ *
+ * @param journal Journal to initialize
+ * @param path Key file path
+ * @param ctx Context receiving key, IV and mode
+ * @param device Device path (must match the journal)
+ * @param device_size Device size in bytes (must match the journal)
+ * @return ETDK_SUCCESS or error code
+ */
+int journal_open(journal_t *journal, const char *path, crypto_context_t *ctx, const char *device,
+                 uint64_t device_size) {
+    if (!journal || !path || !ctx || !device) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    memset(journal, 0, sizeof(*journal));
+    journal->path = path;
+    journal->fd = journal_open_fd(path, 0);
+    if (journal->fd < 0) {
+        return ETDK_ERROR_IO;
+    }
+
+    int found = 0;
+    for (int slot = 0; slot < 2; slot++) {
+        journal_record_t record;
+        unsigned char digest[32];
+
+        if (platform_pread_full(journal->fd, &record, sizeof(record), (uint64_t)slot * JOURNAL_SLOT_SIZE) ==
+                (int64_t)sizeof(record) &&
+            memcmp(record.state.magic, JOURNAL_MAGIC, sizeof(record.state.magic)) == 0 &&
+            journal_digest(&record.state, digest) == ETDK_SUCCESS &&
+            memcmp(digest, record.digest, sizeof(digest)) == 0 &&
+            (!found || record.state.sequence > journal->state.sequence)) {
+            journal->state = record.state;
+            found = 1;
+        }
+        OPENSSL_cleanse(&record, sizeof(record));
+    }
+
+    journal_state_t *state = &journal->state;
+    const char *problem = NULL;
+    if (!found)
+        problem = "no valid checkpoint";
+    else if (state->segment_count == 0 || state->segment_count > ETDK_JOURNAL_MAX_SEGMENTS)
+        problem = "corrupt segment table";
+    else if (state->chunk_size == 0 || state->chunk_size % ETDK_CHUNK_ALIGN != 0 ||
+             state->chunk_size > ETDK_MAX_CHUNK_SIZE)
+        problem = "corrupt chunk size";
+    else if (strncmp(state->device, device, sizeof(state->device)) != 0)
+        problem = "it belongs to a different device";
+    else if (state->device_size != device_size)
+        problem = "the device size has changed";
+    else if (state->priority.count > ETDK_PRIORITY_MAX_RANGES || state->priority.critical > state->priority.count)
+        problem = "corrupt priority list";
+
+    if (problem) {
+        fprintf(stderr, "Cannot resume from key file %s: %s\n", path, problem);
+        journal_close(journal);
+        return ETDK_ERROR_IO;
+    }
+
+    memcpy(ctx->key, state->key, sizeof(ctx->key));
+    memcpy(ctx->iv, state->segments[0].iv, AES_BLOCK_SIZE);
+    ctx->mode = (etdk_cipher_t)state->mode;
+    ctx->options.chunk_size = (size_t)state->chunk_size;
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Start a new segment at the last checkpoint
+ *
+ * Everything after the checkpoint may already have been encrypted before
+ * the interruption. A fresh IV guarantees that re-encrypting it never
+ * reuses the keystream of the previous attempt.
+ *
+ * @param journal Open journal
+ * @param iv_out Receives the IV of the new segment
+ * @return ETDK_SUCCESS or error code
+ */
+int journal_begin_segment(journal_t *journal, uint8_t *iv_out) {
+    journal_state_t *state = &journal->state;
+
+    if (state->segment_count >= ETDK_JOURNAL_MAX_SEGMENTS) {
+        fprintf(stderr, "Key file %s: too many resumed segments\n", journal->path);
+        return ETDK_ERROR_IO;
+    }
+
+    journal_segment_t *segment = &state->segments[state->segment_count];
+    if (RAND_bytes(segment->iv, AES_BLOCK_SIZE) != 1) {
+        return ETDK_ERROR_CRYPTO;
+    }
+    segment->start = state->done;
+    state->segment_count++;
+
+    memcpy(iv_out, segment->iv, AES_BLOCK_SIZE);
+    return journal_write(journal);
+}
+
+/**
+ * @brief Durably record progress
+ *
+ * The caller must have synced the device up to done first, otherwise a
+ * checkpoint could claim data that never reached the disk.
+ *
+ * @param journal Open journal
+ * @param done Bytes encrypted, in processing order
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+int journal_checkpoint(journal_t *journal, uint64_t done) {
+    journal->state.done = done;
+    return journal_write(journal);
+}
+
+/**
+ * @brief Bytes between two checkpoints of the run
+ *
+ * ETDK_CHECKPOINT_INTERVAL, or 1/ETDK_CHECKPOINT_DIVISOR of a smaller run,
+ * rounded down to whole chunks (at least one). Whatever an interrupted run
+ * encrypted past its last checkpoint is encrypted again when it resumes,
+ * so the interval must stay small against the device, not just in bytes.
+ *
+ * @param journal Open journal
+ * @return Interval in bytes
+ */
+uint64_t journal_interval(const journal_t *journal) {
+    uint64_t interval = journal->state.total / ETDK_CHECKPOINT_DIVISOR;
+    if (interval > ETDK_CHECKPOINT_INTERVAL)
+        interval = ETDK_CHECKPOINT_INTERVAL;
+    interval -= interval % journal->state.chunk_size;
+    return interval ? interval : journal->state.chunk_size;
+}
+
+/**
+ * @brief Close the key file, keeping it for --resume
+ *
+ * @param journal Open journal
+ */
+void journal_close(journal_t *journal) {
+    if (journal->fd >= 0) {
+        close(journal->fd); // Releases the flock()
+        journal->fd = -1;
+    }
+    OPENSSL_cleanse(&journal->state, sizeof(journal->state));
+}
+
+/**
+ * @brief Overwrite, sync and delete the key file after a completed run
+ *
+ * Both copies are overwritten with random data and then zeros before the
+ * file is unlinked, so the key does not survive in the file's blocks on
+ * filesystems that rewrite in place.
+ *
+ * @param journal Open journal
+ * @return ETDK_SUCCESS, ETDK_ERROR_CRYPTO if the random pass failed, or ETDK_ERROR_IO
+ */
+int journal_destroy(journal_t *journal) {
+    unsigned char junk[2 * JOURNAL_SLOT_SIZE];
+    int result = ETDK_SUCCESS;
+
+    for (int pass = 0; pass < 2; pass++) {
+        // Zeroed first so a failed random fill degrades to a zero pass, never stack contents
+        memset(junk, 0, sizeof(junk));
+        if (pass == 0 && RAND_bytes(junk, sizeof(junk)) != 1)
+            result = ETDK_ERROR_CRYPTO;
+
+        if (platform_pwrite_full(journal->fd, junk, sizeof(junk), 0) != ETDK_SUCCESS || fsync(journal->fd) != 0)
+            result = ETDK_ERROR_IO;
+    }
+
+    if (unlink(journal->path) != 0)
+        result = ETDK_ERROR_IO;
+
+    if (result != ETDK_SUCCESS)
+        fprintf(stderr, "Warning: could not fully destroy key file %s: %s\n", journal->path, strerror(errno));
+
+    journal_close(journal);
+    return result;
+}
@@ -0,0 +1,365 @@
+/*
+ * ETDK - Encrypt-then-Delete-Key
+ * Kernel crypto engine - AES through an AF_ALG skcipher socket, data moved with splice/vmsplice
+ */
+
+#ifdef PLATFORM_LINUX
+#define _GNU_SOURCE // splice, vmsplice, F_SETPIPE_SZ
+#endif
+
+#include "etdk.h"
+// cppcheck-suppress-begin missingIncludeSystem
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(PLATFORM_LINUX) && defined(HAVE_AF_ALG)
+#include <fcntl.h>
+#include <linux/if_alg.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+// cppcheck-suppress-end missingIncludeSystem
+
+/**
+ * @brief Kernel algorithm name of a mode
+ * @param mode Cipher mode
+ * @return "cbc(aes)", "ctr(aes)", or NULL if the engine does not run the mode
+ */
+static const char *kcrypto_alg(etdk_cipher_t mode) {
+    if (mode == ETDK_CIPHER_CBC)
+        return "cbc(aes)";
+    if (mode == ETDK_CIPHER_CTR)
+        return "ctr(aes)";
+    return NULL; // XTS needs a request per data unit, GCM a tag: both stay on OpenSSL
+}
+
+/**
+ * @brief Kernel driver that serves a mode, from /proc/crypto
+ *
+ * The kernel instantiates the highest-priority implementation of the
+ * algorithm; that is the one reported.
+ *
+ * @param mode ETDK_CIPHER_CBC or ETDK_CIPHER_CTR
+ * @param out Buffer for the driver name
+ * @param size Size of out
+ * @return ETDK_SUCCESS, or ETDK_ERROR_PLATFORM if unknown
+ */
+int kcrypto_driver(etdk_cipher_t mode, char *out, size_t size) {
+    const char *alg = kcrypto_alg(mode);
+    FILE *f = alg && out && size ? fopen("/proc/crypto", "r") : NULL;
+    if (!f) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    char line[256], name[128] = "", driver[128] = "";
+    long priority = -1, best = -1;
+    int found = 0;
+    for (;;) {
+        char *got = fgets(line, sizeof(line), f);
+        char value[128];
+
+        if (!got || line[0] == '\n') {
+            // End of an entry
+            if (strcmp(name, alg) == 0 && priority > best) {
+                snprintf(out, size, "%s", driver);
+                best = priority;
+                found = 1;
+            }
+            name[0] = driver[0] = '\0';
+            priority = -1;
+            if (!got)
+                break;
+        } else if (sscanf(line, "name : %127s", value) == 1) {
+            snprintf(name, sizeof(name), "%s", value);
+        } else if (sscanf(line, "driver : %127s", value) == 1) {
+            snprintf(driver, sizeof(driver), "%s", value);
+        } else {
+            sscanf(line, "priority : %ld", &priority);
+        }
+    }
+    fclose(f);
+
+    return found ? ETDK_SUCCESS : ETDK_ERROR_PLATFORM;
+}
+
+#if defined(PLATFORM_LINUX) && defined(HAVE_AF_ALG)
+
+#ifndef SOL_ALG
+#define SOL_ALG 279
+#endif
+
+/**
+ * Bytes per AF_ALG request. 16 pages is what every kernel's transmit
+ * scatterlist accepts from one splice; larger chunks are split.
+ */
+#define KCRYPTO_REQUEST_SIZE (64 * 1024)
+
+/**
+ * @brief Kernel cipher stream
+ */
+struct kcrypto {
+    int tfm;                    /**< Transform socket bound to the algorithm, holds the key */
+    int op;                     /**< Operation socket (accept() on tfm) */
+    int pipe[2];                /**< Carries the pages from the source into op */
+    etdk_cipher_t mode;         /**< CBC or CTR */
+    uint8_t iv[AES_BLOCK_SIZE]; /**< IV of the next request: last ciphertext block or next counter */
+};
+
+/**
+ * @brief Open a kernel cipher stream
+ *
+ * @param k Receives the stream
+ * @param key 256-bit key
+ * @param mode ETDK_CIPHER_CBC or ETDK_CIPHER_CTR
+ * @param iv IV, or the counter block of the first byte for CTR
+ * @return ETDK_SUCCESS, or ETDK_ERROR_PLATFORM with errno set
+ */
+int kcrypto_open(kcrypto_t **k, const uint8_t *key, etdk_cipher_t mode, const uint8_t *iv) {
+    const char *alg = kcrypto_alg(mode);
+    if (!k || !key || !iv || !alg) {
+        errno = EOPNOTSUPP;
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    kcrypto_t *s = calloc(1, sizeof(kcrypto_t));
+    if (!s) {
+        return ETDK_ERROR_PLATFORM;
+    }
+    s->op = s->pipe[0] = s->pipe[1] = -1;
+    s->mode = mode;
+    memcpy(s->iv, iv, AES_BLOCK_SIZE);
+
+    struct sockaddr_alg sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.salg_family = AF_ALG;
+    snprintf((char *)sa.salg_type, sizeof(sa.salg_type), "skcipher");
+    snprintf((char *)sa.salg_name, sizeof(sa.salg_name), "%s", alg);
+
+    s->tfm = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (s->tfm < 0 || bind(s->tfm, (struct sockaddr *)&sa, sizeof(sa)) != 0 ||
+        setsockopt(s->tfm, SOL_ALG, ALG_SET_KEY, key, AES_KEY_SIZE) != 0 ||
+        (s->op = accept4(s->tfm, NULL, NULL, SOCK_CLOEXEC)) < 0 || pipe2(s->pipe, O_CLOEXEC) != 0) {
+        int saved = errno;
+        kcrypto_close(s);
+        errno = saved;
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    // Room for a whole request plus an unaligned buffer's extra page (best effort, 64 KB is the default)
+    fcntl(s->pipe[1], F_SETPIPE_SZ, 2 * KCRYPTO_REQUEST_SIZE);
+
+    *k = s;
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Start a request: encrypt with the stream's current IV, more data follows
+ * @param k Stream
+ * @return 0 on success, -1 on error
+ */
+static int request_begin(kcrypto_t *k) {
+    union {
+        char buf[CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct af_alg_iv) + AES_BLOCK_SIZE)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_ALG;
+    cmsg->cmsg_type = ALG_SET_OP;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+    uint32_t op = ALG_OP_ENCRYPT;
+    memcpy(CMSG_DATA(cmsg), &op, sizeof(op));
+
+    cmsg = CMSG_NXTHDR(&msg, cmsg);
+    cmsg->cmsg_level = SOL_ALG;
+    cmsg->cmsg_type = ALG_SET_IV;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct af_alg_iv) + AES_BLOCK_SIZE);
+    struct af_alg_iv *alg_iv = (struct af_alg_iv *)CMSG_DATA(cmsg);
+    alg_iv->ivlen = AES_BLOCK_SIZE;
+    memcpy(alg_iv->iv, k->iv, AES_BLOCK_SIZE);
+
+    return sendmsg(k->op, &msg, MSG_MORE) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Move the bytes waiting in the pipe into the request
+ * @param k Stream
+ * @param len Bytes in the pipe
+ * @return 0 on success, -1 on error
+ */
+static int pipe_to_request(kcrypto_t *k, size_t len) {
+    while (len > 0) {
+        ssize_t n = splice(k->pipe[0], NULL, k->op, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Run one request of at most KCRYPTO_REQUEST_SIZE bytes
+ *
+ * Plaintext pages reach the cipher by reference: vmsplice() of the
+ * caller's buffer, or splice() from the file's page cache. Ending the
+ * request with an empty message lets the kernel process it; read()
+ * then returns the ciphertext.
+ *
+ * @param k Stream
+ * @param in Plaintext buffer, or NULL to read from in_fd
+ * @param in_fd Source file (in == NULL)
+ * @param in_offset Offset in in_fd, advanced
+ * @param out Ciphertext buffer
+ * @param len Bytes
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO or ETDK_ERROR_CRYPTO
+ */
+static int request_run(kcrypto_t *k, const unsigned char *in, int in_fd, loff_t *in_offset, unsigned char *out,
+                       size_t len) {
+    if (request_begin(k) != 0)
+        return ETDK_ERROR_CRYPTO;
+
+    for (size_t moved = 0; moved < len;) {
+        ssize_t n;
+        if (in) {
+            struct iovec iov = {(void *)(in + moved), len - moved};
+            n = vmsplice(k->pipe[1], &iov, 1, 0);
+        } else {
+            n = splice(in_fd, in_offset, k->pipe[1], NULL, len - moved, SPLICE_F_MOVE);
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            if (n == 0)
+                errno = EIO; // Source shorter than expected
+            return in ? ETDK_ERROR_CRYPTO : ETDK_ERROR_IO;
+        }
+        if (pipe_to_request(k, (size_t)n) != 0)
+            return ETDK_ERROR_CRYPTO;
+        moved += (size_t)n;
+    }
+
+    struct msghdr end;
+    memset(&end, 0, sizeof(end));
+    if (sendmsg(k->op, &end, 0) < 0)
+        return ETDK_ERROR_CRYPTO;
+
+    for (size_t got = 0; got < len;) {
+        ssize_t n = read(k->op, out + got, len - got);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return ETDK_ERROR_CRYPTO;
+        got += (size_t)n;
+    }
+
+    // Continue the stream: CBC chains on the last ciphertext block, CTR counts on
+    if (k->mode == ETDK_CIPHER_CBC) {
+        memcpy(k->iv, out + len - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+    } else {
+        uint64_t blocks = (len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+        for (int i = AES_BLOCK_SIZE - 1; i >= 0 && blocks; i--) {
+            uint64_t sum = k->iv[i] + (blocks & 0xFF);
+            k->iv[i] = (uint8_t)sum;
+            blocks = (blocks >> 8) + (sum >> 8);
+        }
+    }
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Split a range into requests
+ */
+static int kcrypto_run(kcrypto_t *k, const unsigned char *in, int in_fd, uint64_t in_offset, unsigned char *out,
+                       size_t len) {
+    if (!k || !out || (k->mode == ETDK_CIPHER_CBC && len % AES_BLOCK_SIZE != 0)) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    loff_t offset = (loff_t)in_offset;
+    for (size_t pos = 0; pos < len; pos += KCRYPTO_REQUEST_SIZE) {
+        size_t n = len - pos < KCRYPTO_REQUEST_SIZE ? len - pos : KCRYPTO_REQUEST_SIZE;
+        int result = request_run(k, in ? in + pos : NULL, in_fd, &offset, out + pos, n);
+        if (result != ETDK_SUCCESS) {
+            fprintf(stderr, "\nError in kernel crypto (%s): %s\n", kcrypto_alg(k->mode), strerror(errno));
+            return result;
+        }
+    }
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Encrypt a buffer; the pages are handed to the kernel with vmsplice()
+ */
+int kcrypto_encrypt(kcrypto_t *k, const unsigned char *in, unsigned char *out, size_t len) {
+    return in ? kcrypto_run(k, in, -1, 0, out, len) : ETDK_ERROR_CRYPTO;
+}
+
+/**
+ * @brief Encrypt bytes of a file; the page cache pages are spliced to the kernel cipher
+ */
+int kcrypto_encrypt_fd(kcrypto_t *k, int in_fd, uint64_t in_offset, unsigned char *out, size_t len) {
+    return in_fd >= 0 ? kcrypto_run(k, NULL, in_fd, in_offset, out, len) : ETDK_ERROR_IO;
+}
+
+/**
+ * @brief Close a kernel cipher stream
+ */
+void kcrypto_close(kcrypto_t *k) {
+    if (!k)
+        return;
+
+    for (int i = 0; i < 2; i++) {
+        if (k->pipe[i] >= 0)
+            close(k->pipe[i]);
+    }
+    if (k->op >= 0)
+        close(k->op);
+    if (k->tfm >= 0)
+        close(k->tfm);
+    free(k);
+}
+
+#else // No AF_ALG: the selection in crypto_select_cipher() falls back to OpenSSL
+
+int kcrypto_open(kcrypto_t **k, const uint8_t *key, etdk_cipher_t mode, const uint8_t *iv) {
+    (void)k;
+    (void)key;
+    (void)mode;
+    (void)iv;
+    errno = EOPNOTSUPP;
+    return ETDK_ERROR_PLATFORM;
+}
+
+int kcrypto_encrypt(kcrypto_t *k, const unsigned char *in, unsigned char *out, size_t len) {
+    (void)k;
+    (void)in;
+    (void)out;
+    (void)len;
+    return ETDK_ERROR_CRYPTO;
+}
+
+int kcrypto_encrypt_fd(kcrypto_t *k, int in_fd, uint64_t in_offset, unsigned char *out, size_t len) {
+    (void)k;
+    (void)in_fd;
+    (void)in_offset;
+    (void)out;
+    (void)len;
+    return ETDK_ERROR_CRYPTO;
+}
+
+void kcrypto_close(kcrypto_t *k) {
+    (void)k;
+}
+
+#endif // PLATFORM_LINUX && HAVE_AF_ALG
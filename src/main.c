@@ -8,6 +8,9 @@
 
 #include "etdk.h"
 // cppcheck-suppress-begin missingIncludeSystem
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,15 +24,112 @@ void print_usage(const char *program_name) {
     printf("ETDK v%s - Encrypt and Delete Key\n", ETDK_VERSION);
     printf("\"Makes data powerless\"\n");
     printf("Based on BSI recommendations (Germany)\n\n");
-    printf("Usage: %s <file|device>\n\n", program_name);
+    printf("Usage: %s [options] <file|device>\n", program_name);
+    printf("       %s [options] <file|directory>... | --stdin\n", program_name);
+    printf("       %s [options] <device> <device>...\n", program_name);
+    printf("       %s --decrypt --key HEX [--iv HEX] [options] <source> <output>\n", program_name);
+    printf("       %s --destroy <container|directory>... | --stdin\n\n", program_name);
     printf("Description:\n");
     printf("  Encrypts files or entire block devices with AES-256-CBC.\n");
     printf("  The encryption key is displayed once, then securely destroyed.\n");
     printf("  After encryption, the file/device is gibberish - worthless without the key.\n\n");
+    printf("Options:\n");
+    printf("  --threads N        Encrypt devices with N parallel workers (AES-256-CTR,\n");
+    printf("                     output is identical for any N); batch worker count\n");
+    printf("  --in-place         Overwrite files in place with AES-256-CTR (no temp copy,\n");
+    printf("                     size unchanged, no free space needed)\n");
+    printf("  --mmap             Encrypt files through 64 MB memory-mapped windows\n");
+    printf("  --buffered         Use the page cache for devices instead of direct I/O\n");
+    printf("  --cipher LIST      Allowed modes: auto or a list of cbc, ctr, xts (devices),\n");
+    printf("                     gcm (files); the fastest suitable one on this CPU is used\n");
+    printf("  --discard[=MODE]   SSDs: after (default) encrypts, then discards the device;\n");
+    printf("                     hybrid encrypts the first/last 64 MB, then discards all.\n");
+    printf("                     Uses BLKSECDISCARD, BLKDISCARD or BLKZEROOUT, whichever works\n");
+    printf("  --key-file FILE    Devices: keep the key and checkpoints in FILE (created, 0600,\n");
+    printf("                     locked) so an interrupted run can be resumed; FILE is\n");
+    printf("                     destroyed when the run completes\n");
+    printf("  --resume           Continue the run recorded in --key-file from its last checkpoint\n");
+    printf("  --priority[=LIST]  Devices: encrypt partition tables, filesystem superblocks and\n");
+    printf("                     other metadata first (auto, the default) and/or OFFSET:LENGTH\n");
+    printf("                     ranges, e.g. auto,0:64M; reports when they are destroyed\n");
+    printf("  --verify[=MODE]    Devices: read back afterwards. sample (default) checks 4096\n");
+    printf("                     random blocks against plaintext fingerprints and an entropy\n");
+    printf("                     test; full also entropy-tests every block\n");
+    printf("  --progress-fd N    Devices: also write progress events to descriptor N, about\n");
+    printf("                     4 per second plus start and end (e.g. 3>progress.log)\n");
+    printf("  --progress-format F\n");
+    printf("                     Event format on --progress-fd: text (default) or json\n");
+    printf("  --metrics FILE     Devices: write read/encrypt/write/sync latency and queue\n");
+    printf("                     occupancy histograms as JSON to FILE when the run ends\n");
+    printf("  --metrics-prom FILE\n");
+    printf("                     Devices: the same metrics for node_exporter's textfile collector\n");
+    printf("  --queue-depth N    Overlap reads, encryption and writes with N chunks in flight\n");
+    printf("                     (auto: derived from the device queue limits)\n");
+    printf("  --io-engine E      Engine for --queue-depth: auto, uring or threads (default: auto)\n");
+    printf("  --mode M           Devices: encrypt (default) or overwrite (keystream from a key\n");
+    printf("                     that is never shown, device not read; NOT recoverable)\n");
+    printf("  --crypto-engine E  AES implementation: openssl (default) or kernel (Linux AF_ALG,\n");
+    printf("                     CBC/CTR, files and sequential devices; input spliced, not copied)\n");
+    printf("  --chunk-size SIZE  Bytes per read/encrypt/write step, e.g. 4M (default: derived\n");
+    printf("                     from the RAID stripe / optimal I/O size, at least 1M)\n");
+    printf("  --stdin            Read a newline-separated file list from stdin (batch mode)\n");
+    printf("  --null             With --stdin: entries are NUL-separated (find -print0)\n");
+    printf("  --yes              Do not ask for confirmation\n");
+    printf("  --decrypt          Recover plaintext with the displayed key (see Decrypt mode)\n");
+    printf("  --container        Write files as ETDK containers that --destroy erases in\n");
+    printf("                     constant time (see Container mode)\n");
+    printf("  --destroy          Crypto-erase ETDK containers (overwrite the key slot, delete)\n");
+    printf("  --key HEX          --decrypt: key as displayed; --container: existing key to\n");
+    printf("                     wrap the data keys with (not displayed)\n");
+    printf("  --iv HEX           --decrypt: IV as displayed (not for XTS; optional for CBC ranges)\n");
+    printf("  --offset SIZE      --decrypt: first ciphertext byte to recover, e.g. 100G\n");
+    printf("  --length SIZE      --decrypt: bytes to recover (default: to the end)\n");
+    printf("  -h, --help         Show this help message\n\n");
+    printf("Batch mode:\n");
+    printf("  Several paths, directories (walked recursively) or --stdin encrypt all files\n");
+    printf("  with one key on a worker pool, largest files first. Each file gets its own IV:\n");
+    printf("  SHA-256(IV || path) truncated to 16 bytes. Failures are reported per file.\n");
+    printf("  Files up to %d KB are read and written in one step, directories synced in groups.\n\n",
+           ETDK_SMALL_FILE_SIZE / 1024);
+    printf("Multi-device mode:\n");
+    printf("  Several block devices are encrypted concurrently with one key, each on its own\n");
+    printf("  pipeline with its threads on the device's NUMA node and its own IV (derived as\n");
+    printf("  in batch mode). A progress table is printed every %d seconds.\n\n", ETDK_MULTI_REPORT_INTERVAL);
+    printf("Decrypt mode:\n");
+    printf("  Decrypts <source> (file or device, opened read-only) into <output> on a worker\n");
+    printf("  pool (--threads, default: all CPUs). --cipher names the mode shown as \"Mode:\"\n");
+    printf("  (default cbc). --offset/--length recover a range without reading what is before\n");
+    printf("  it; for CBC each extent takes the ciphertext block before it as its IV, and --iv\n");
+    printf("  is only needed at offset 0 or for a resumed segment. Batch and multi-device runs\n");
+    printf("  need the per-target IV (SHA-256(IV || path), first 16 bytes).\n\n");
+    printf("Container mode:\n");
+    printf("  --container replaces each file with an ETDK container: a 4 KB key slot holding a\n");
+    printf("  random data key wrapped with the run's key, then the payload in AES-256-CTR.\n");
+    printf("  --decrypt --key reads containers (no --iv or --cipher). --destroy overwrites and\n");
+    printf("  discards only the key slot and deletes the file, so erasing a container takes\n");
+    printf("  the same time for any size. Other files are never touched by --destroy.\n\n");
+    printf("Overwrite mode:\n");
+    printf("  --mode=overwrite writes AES-256-CTR keystream from a fresh key over the whole\n");
+    printf("  device without reading it: pure sequential writes at full write bandwidth,\n");
+    printf("  half the I/O of encrypting. The key is never shown; the data is unrecoverable.\n\n");
     printf("Examples:\n");
     printf("  %s secret.txt              # Encrypt file\n", program_name);
     printf("  %s /dev/sdb                # Encrypt entire drive (requires root)\n", program_name);
-    printf("  %s /dev/sdb1               # Encrypt partition\n\n", program_name);
+    printf("  %s /dev/sdb1               # Encrypt partition\n", program_name);
+    printf("  %s --threads 8 /dev/nvme0n1 # Encrypt NVMe drive on 8 cores\n", program_name);
+    printf("  %s --cipher ctr,xts --threads 8 /dev/nvme0n1  # Faster of CTR and XTS\n", program_name);
+    printf("  %s --in-place ~/Maildir    # Encrypt every file below a directory\n", program_name);
+    printf("  %s --key-file /root/sdb.key /dev/sdb           # Resumable run\n", program_name);
+    printf("  %s --key-file /root/sdb.key --resume /dev/sdb  # Continue after a crash\n", program_name);
+    printf("  %s --threads 8 --verify /dev/nvme0n1            # Confirm the rewrite\n", program_name);
+    printf("  %s --priority --threads 8 /dev/sdb              # Metadata first\n", program_name);
+    printf("  %s --threads 4 /dev/nvme0n1 /dev/nvme1n1        # Two drives at once\n", program_name);
+    printf("  %s --mode=overwrite /dev/sdb                    # Wipe a disk, nothing recoverable\n", program_name);
+    printf("  find /srv -name '*.dump' -print0 | %s --stdin --null --yes\n", program_name);
+    printf("  %s --decrypt --cipher ctr --key K --iv I --offset 1G --length 64M /dev/sdb part.img\n",
+           program_name);
+    printf("  %s --container --key K /srv/archive  # Store files as containers under key K\n", program_name);
+    printf("  %s --destroy /srv/archive/2019.tar   # Erase a container in constant time\n\n", program_name);
     printf("To complete secure deletion:\n");
     printf("  1. Remove the encrypted file with normal methods (rm).\n");
     printf("  2. Forget the key if you don't need the data.\n");
@@ -40,6 +140,943 @@ void print_usage(const char *program_name) {
     printf("  - This DESTROYS all data permanently if you don't save the key!\n");
 }
 
+/**
+ * @brief Parse an unsigned decimal option value
+ * @param value String to parse
+ * @param min Smallest accepted value
+ * @param max Largest accepted value
+ * @param out Parsed value
+ * @return 0 on success, -1 if value is not a number within [min, max]
+ */
+static int parse_unsigned(const char *value, unsigned long min, unsigned long max, unsigned long *out) {
+    if (!value || *value == '\0' || *value == '-')
+        return -1;
+
+    char *end;
+    unsigned long v = strtoul(value, &end, 10);
+    if (*end != '\0' || v < min || v > max)
+        return -1;
+
+    *out = v;
+    return 0;
+}
+
+/**
+ * @brief Parse a size option value with an optional K or M suffix (binary units)
+ * @param value String to parse, e.g. "4M"
+ * @param out Parsed size in bytes
+ * @return 0 on success, -1 if value is not a valid chunk size
+ */
+static int parse_chunk_size(const char *value, size_t *out) {
+    if (!value || *value == '\0' || *value == '-')
+        return -1;
+
+    char *end;
+    unsigned long long v = strtoull(value, &end, 10);
+    if ((*end == 'K' || *end == 'k') && end[1] == '\0')
+        v *= 1024;
+    else if ((*end == 'M' || *end == 'm') && end[1] == '\0')
+        v *= 1024 * 1024;
+    else if (*end != '\0')
+        return -1;
+
+    if (v < ETDK_MIN_CHUNK_SIZE || v > ETDK_MAX_CHUNK_SIZE || v % ETDK_CHUNK_ALIGN != 0)
+        return -1;
+
+    *out = (size_t)v;
+    return 0;
+}
+
+/**
+ * @brief Parse a byte count with an optional K, M, G or T suffix (binary units)
+ * @param value String to parse, e.g. "100G"
+ * @param out Parsed byte count
+ * @return 0 on success, -1 if value is not a valid byte count
+ */
+static int parse_byte_count(const char *value, uint64_t *out) {
+    if (!value || *value == '\0' || *value == '-')
+        return -1;
+
+    char *end;
+    unsigned long long v = strtoull(value, &end, 10);
+    if (end == value)
+        return -1;
+
+    int shift = 0;
+    if (*end != '\0') {
+        const char *units = strchr("KMGT", *end == 'k' ? 'K' : *end);
+        if (!units || end[1] != '\0')
+            return -1;
+        shift = 10 * (int)(units - "KMGT" + 1);
+    }
+    if (v > (UINT64_MAX >> shift))
+        return -1;
+
+    *out = (uint64_t)v << shift;
+    return 0;
+}
+
+/**
+ * @brief User ranges of --priority (options.priority_ranges points here)
+ */
+static device_range_t priority_ranges[ETDK_PRIORITY_MAX_USER];
+
+/**
+ * @brief Parse the value of --priority=SPEC
+ *
+ * SPEC is a comma-separated list of "auto" (probe partition tables and
+ * filesystems) and OFFSET:LENGTH byte ranges, e.g. "auto,0:64M,1T:1G".
+ *
+ * @param value String to parse
+ * @param opts Options to fill in (priority_detect, priority_ranges)
+ * @return 0 on success, -1 on an invalid list
+ */
+static int parse_priority(const char *value, etdk_options_t *opts) {
+    char spec[256];
+    if (strlen(value) >= sizeof(spec))
+        return -1;
+    strcpy(spec, value);
+
+    char *save = NULL;
+    for (char *item = strtok_r(spec, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        if (strcmp(item, "auto") == 0) {
+            opts->priority_detect = 1;
+            continue;
+        }
+
+        char *colon = strchr(item, ':');
+        if (!colon || opts->priority_range_count == ETDK_PRIORITY_MAX_USER)
+            return -1;
+        *colon = '\0';
+        device_range_t *range = &priority_ranges[opts->priority_range_count];
+        if (parse_byte_count(item, &range->offset) != 0 || parse_byte_count(colon + 1, &range->length) != 0 ||
+            range->length == 0 || range->offset > UINT64_MAX - range->length)
+            return -1;
+        opts->priority_range_count++;
+    }
+
+    opts->priority_ranges = priority_ranges;
+    return opts->priority_detect || opts->priority_range_count > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Fetch the value of an option given as "--name value" or "--name=value"
+ * @param argc Number of command-line arguments
+ * @param argv Array of command-line argument strings
+ * @param i Index of the current argument (advanced if the value is separate)
+ * @param name Option name including leading dashes
+ * @return Pointer to the value, or NULL if argv[i] is not this option
+ */
+static const char *option_value(int argc, char *argv[], int *i, const char *name) {
+    size_t len = strlen(name);
+
+    if (strncmp(argv[*i], name, len) != 0)
+        return NULL;
+    if (argv[*i][len] == '=')
+        return argv[*i] + len + 1;
+    if (argv[*i][len] != '\0')
+        return NULL;
+    if (*i + 1 >= argc)
+        return "";
+    return argv[++(*i)];
+}
+
+/**
+ * @struct cli_targets_t
+ * @brief Targets collected from the command line
+ */
+typedef struct {
+    char **paths;   /**< Target paths (pointers into argv, array owned) */
+    int count;      /**< Number of target paths */
+    int from_stdin; /**< Read additional paths from stdin */
+    int separator;  /**< Separator for the stdin list ('\n' or '\0') */
+} cli_targets_t;
+
+/**
+ * @brief Parse command-line options and the target paths
+ * @param argc Number of command-line arguments
+ * @param argv Array of command-line argument strings
+ * @param opts Options to fill in
+ * @param targets Receives the target paths
+ * @return 0 on success, 1 if help was requested, -1 on invalid usage
+ */
+static int parse_arguments(int argc, char *argv[], etdk_options_t *opts, cli_targets_t *targets) {
+    memset(opts, 0, sizeof(*opts));
+    memset(targets, 0, sizeof(*targets));
+    targets->separator = '\n';
+
+    // Targets are a subset of argv, so argc entries always suffice
+    targets->paths = calloc((size_t)argc, sizeof(char *));
+    if (!targets->paths) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return -1;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        const char *value;
+        unsigned long n;
+
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "help") == 0) {
+            return 1;
+        } else if ((value = option_value(argc, argv, &i, "--threads")) != NULL) {
+            if (parse_unsigned(value, 1, ETDK_MAX_THREADS, &n) != 0) {
+                fprintf(stderr, "Error: --threads expects a number between 1 and %d\n", ETDK_MAX_THREADS);
+                return -1;
+            }
+            opts->threads = (unsigned int)n;
+        } else if (strcmp(argv[i], "--in-place") == 0) {
+            opts->in_place = 1;
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            opts->mmap_io = 1;
+        } else if (strcmp(argv[i], "--buffered") == 0) {
+            opts->buffered = 1;
+        } else if ((value = option_value(argc, argv, &i, "--queue-depth")) != NULL) {
+            int tune = strcmp(value, "auto") == 0;
+            if (!tune && parse_unsigned(value, 1, ETDK_MAX_QUEUE_DEPTH, &n) != 0) {
+                fprintf(stderr, "Error: --queue-depth expects auto or a number between 1 and %d\n",
+                        ETDK_MAX_QUEUE_DEPTH);
+                return -1;
+            }
+            opts->queue_depth = tune ? ETDK_DEFAULT_QUEUE_DEPTH : (unsigned int)n;
+            opts->tune_queue_depth = tune;
+        } else if ((value = option_value(argc, argv, &i, "--io-engine")) != NULL) {
+            if (strcmp(value, "auto") == 0) {
+                opts->io_engine = ETDK_IO_AUTO;
+            } else if (strcmp(value, "uring") == 0) {
+                opts->io_engine = ETDK_IO_URING;
+            } else if (strcmp(value, "threads") == 0) {
+                opts->io_engine = ETDK_IO_THREADS;
+            } else {
+                fprintf(stderr, "Error: --io-engine expects auto, uring or threads\n");
+                return -1;
+            }
+            if (opts->queue_depth == 0) {
+                opts->queue_depth = ETDK_DEFAULT_QUEUE_DEPTH;
+                opts->tune_queue_depth = 1;
+            }
+        } else if ((value = option_value(argc, argv, &i, "--mode")) != NULL) {
+            if (strcmp(value, "encrypt") == 0) {
+                opts->overwrite = 0;
+            } else if (strcmp(value, "overwrite") == 0) {
+                opts->overwrite = 1;
+            } else {
+                fprintf(stderr, "Error: --mode expects encrypt or overwrite\n");
+                return -1;
+            }
+        } else if ((value = option_value(argc, argv, &i, "--crypto-engine")) != NULL) {
+            if (strcmp(value, "openssl") == 0) {
+                opts->crypto_engine = ETDK_CRYPTO_OPENSSL;
+            } else if (strcmp(value, "kernel") == 0) {
+                opts->crypto_engine = ETDK_CRYPTO_KERNEL;
+            } else {
+                fprintf(stderr, "Error: --crypto-engine expects openssl or kernel\n");
+                return -1;
+            }
+        } else if ((value = option_value(argc, argv, &i, "--chunk-size")) != NULL) {
+            if (parse_chunk_size(value, &opts->chunk_size) != 0) {
+                fprintf(stderr, "Error: --chunk-size expects a multiple of %d KB between %d KB and %d MB\n",
+                        ETDK_CHUNK_ALIGN / 1024, ETDK_MIN_CHUNK_SIZE / 1024, ETDK_MAX_CHUNK_SIZE / (1024 * 1024));
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--discard") == 0 || strcmp(argv[i], "--discard=after") == 0) {
+            opts->discard = ETDK_DISCARD_AFTER;
+        } else if (strcmp(argv[i], "--discard=hybrid") == 0) {
+            opts->discard = ETDK_DISCARD_HYBRID;
+        } else if (strcmp(argv[i], "--priority") == 0) {
+            opts->priority = 1;
+            opts->priority_detect = 1;
+        } else if (strncmp(argv[i], "--priority=", 11) == 0) {
+            opts->priority = 1;
+            if (parse_priority(argv[i] + 11, opts) != 0) {
+                fprintf(stderr, "Error: --priority expects a list of auto and OFFSET:LENGTH (at most %d), "
+                                "e.g. auto,0:64M\n",
+                        ETDK_PRIORITY_MAX_USER);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--verify") == 0 || strcmp(argv[i], "--verify=sample") == 0) {
+            opts->verify = ETDK_VERIFY_SAMPLE;
+        } else if (strcmp(argv[i], "--verify=full") == 0) {
+            opts->verify = ETDK_VERIFY_FULL;
+        } else if ((value = option_value(argc, argv, &i, "--key-file")) != NULL) {
+            if (*value == '\0') {
+                fprintf(stderr, "Error: --key-file expects a file name\n");
+                return -1;
+            }
+            opts->key_file = value;
+        } else if ((value = option_value(argc, argv, &i, "--progress-fd")) != NULL) {
+            if (parse_unsigned(value, 1, INT_MAX, &n) != 0) {
+                fprintf(stderr, "Error: --progress-fd expects a file descriptor number\n");
+                return -1;
+            }
+            opts->progress_fd = (int)n;
+        } else if ((value = option_value(argc, argv, &i, "--progress-format")) != NULL) {
+            if (strcmp(value, "text") == 0) {
+                opts->progress_format = ETDK_PROGRESS_TEXT;
+            } else if (strcmp(value, "json") == 0) {
+                opts->progress_format = ETDK_PROGRESS_JSON;
+            } else {
+                fprintf(stderr, "Error: --progress-format expects text or json\n");
+                return -1;
+            }
+        } else if ((value = option_value(argc, argv, &i, "--metrics")) != NULL) {
+            if (*value == '\0') {
+                fprintf(stderr, "Error: --metrics expects a file name\n");
+                return -1;
+            }
+            opts->metrics_file = value;
+        } else if ((value = option_value(argc, argv, &i, "--metrics-prom")) != NULL) {
+            if (*value == '\0') {
+                fprintf(stderr, "Error: --metrics-prom expects a file name\n");
+                return -1;
+            }
+            opts->metrics_prom = value;
+        } else if ((value = option_value(argc, argv, &i, "--cipher")) != NULL) {
+            if (crypto_parse_ciphers(value, &opts->ciphers) != ETDK_SUCCESS) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--decrypt") == 0) {
+            opts->decrypt = 1;
+        } else if (strcmp(argv[i], "--container") == 0) {
+            opts->container = 1;
+        } else if (strcmp(argv[i], "--destroy") == 0) {
+            opts->destroy = 1;
+        } else if ((value = option_value(argc, argv, &i, "--key")) != NULL) {
+            opts->decrypt_key = value;
+        } else if ((value = option_value(argc, argv, &i, "--iv")) != NULL) {
+            opts->decrypt_iv = value;
+        } else if ((value = option_value(argc, argv, &i, "--offset")) != NULL) {
+            if (parse_byte_count(value, &opts->decrypt_offset) != 0) {
+                fprintf(stderr, "Error: --offset expects a byte count, e.g. 4096 or 100G\n");
+                return -1;
+            }
+        } else if ((value = option_value(argc, argv, &i, "--length")) != NULL) {
+            if (parse_byte_count(value, &opts->decrypt_length) != 0 || opts->decrypt_length == 0) {
+                fprintf(stderr, "Error: --length expects a byte count above 0, e.g. 64M\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            opts->resume = 1;
+        } else if (strcmp(argv[i], "--stdin") == 0) {
+            targets->from_stdin = 1;
+        } else if (strcmp(argv[i], "--null") == 0) {
+            targets->separator = '\0';
+        } else if (strcmp(argv[i], "--yes") == 0) {
+            opts->assume_yes = 1;
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            fprintf(stderr, "Error: Unknown option %s\n", argv[i]);
+            return -1;
+        } else {
+            targets->paths[targets->count++] = argv[i];
+        }
+    }
+
+    if (opts->resume && !opts->key_file) {
+        fprintf(stderr, "Error: --resume requires --key-file\n");
+        return -1;
+    }
+    if (opts->key_file && opts->queue_depth > 0 && opts->threads == 0) {
+        fprintf(stderr, "Error: --key-file works with the sequential and --threads engines, not --queue-depth\n");
+        return -1;
+    }
+    if (opts->progress_format != ETDK_PROGRESS_NONE && opts->progress_fd == 0) {
+        fprintf(stderr, "Error: --progress-format requires --progress-fd\n");
+        return -1;
+    }
+    if (opts->progress_fd > 0) {
+        if (fcntl(opts->progress_fd, F_GETFD) < 0) {
+            fprintf(stderr, "Error: --progress-fd %d is not an open file descriptor\n", opts->progress_fd);
+            return -1;
+        }
+        if (opts->progress_format == ETDK_PROGRESS_NONE)
+            opts->progress_format = ETDK_PROGRESS_TEXT;
+    }
+
+    if (!opts->decrypt && (opts->decrypt_iv || opts->decrypt_offset || opts->decrypt_length)) {
+        fprintf(stderr, "Error: --iv, --offset and --length require --decrypt\n");
+        return -1;
+    }
+    if (opts->decrypt_key && !opts->decrypt && !opts->container) {
+        fprintf(stderr, "Error: --key requires --decrypt or --container\n");
+        return -1;
+    }
+    if (opts->container && (opts->decrypt || opts->in_place || opts->mmap_io || opts->queue_depth)) {
+        fprintf(stderr, "Error: --container does not work with --decrypt, --in-place, --mmap or --queue-depth\n");
+        return -1;
+    }
+    if (opts->crypto_engine == ETDK_CRYPTO_KERNEL &&
+        (opts->queue_depth || opts->in_place || opts->mmap_io || opts->container || opts->decrypt ||
+         opts->discard == ETDK_DISCARD_HYBRID || opts->priority)) {
+        fprintf(stderr, "Error: --crypto-engine kernel drives the sequential file and device engines only; it does\n"
+                        "       not work with --queue-depth, --in-place, --mmap, --container, --decrypt,\n"
+                        "       --discard=hybrid or --priority\n");
+        return -1;
+    }
+    if (opts->overwrite && (opts->threads || opts->key_file || opts->ciphers || opts->discard == ETDK_DISCARD_HYBRID ||
+                            opts->crypto_engine == ETDK_CRYPTO_KERNEL || opts->priority || opts->decrypt ||
+                            opts->destroy)) {
+        fprintf(stderr, "Error: --mode=overwrite always writes AES-256-CTR keystream through the pipeline; it does\n"
+                        "       not work with --threads, --key-file, --cipher, --discard=hybrid, --crypto-engine,\n"
+                        "       --priority, --decrypt or --destroy\n");
+        return -1;
+    }
+    if (opts->overwrite && opts->queue_depth == 0) {
+        // Keystream writes always go through the pipeline; let crypto_tune_io() size the queue
+        opts->queue_depth = ETDK_DEFAULT_QUEUE_DEPTH;
+        opts->tune_queue_depth = 1;
+    }
+    if (opts->destroy && (opts->decrypt || opts->container || opts->decrypt_key || opts->in_place)) {
+        fprintf(stderr, "Error: --destroy only takes container paths (with --yes, --stdin, --null)\n");
+        return -1;
+    }
+    if (opts->decrypt && (targets->count != 2 || targets->from_stdin || !opts->decrypt_key)) {
+        fprintf(stderr, "Error: --decrypt expects --key and exactly two paths: <source> <output>\n");
+        return -1;
+    }
+
+    return (targets->count > 0 || targets->from_stdin) ? 0 : -1;
+}
+
+/**
+ * @brief Name of the first given option that only applies to block devices
+ * @param opts Parsed options
+ * @return Option name, or NULL if none is set
+ */
+static const char *device_only_option(const etdk_options_t *opts) {
+    if (opts->overwrite)
+        return "--mode=overwrite";
+    if (opts->key_file)
+        return "--key-file";
+    if (opts->priority)
+        return "--priority";
+    if (opts->verify)
+        return "--verify";
+    if (opts->progress_format != ETDK_PROGRESS_NONE)
+        return "--progress-fd";
+    if (opts->metrics_file)
+        return "--metrics";
+    if (opts->metrics_prom)
+        return "--metrics-prom";
+    return NULL;
+}
+
+/**
+ * @brief Name of the first given option that does not apply to --decrypt
+ * @param opts Parsed options
+ * @return Option name, or NULL if none is set
+ */
+static const char *encrypt_only_option(const etdk_options_t *opts) {
+    if (opts->in_place)
+        return "--in-place";
+    if (opts->mmap_io)
+        return "--mmap";
+    if (opts->queue_depth)
+        return "--queue-depth";
+    if (opts->discard)
+        return "--discard";
+    if (opts->key_file)
+        return "--key-file";
+    if (opts->priority)
+        return "--priority";
+    if (opts->verify)
+        return "--verify";
+    if (opts->metrics_file || opts->metrics_prom)
+        return "--metrics";
+    return NULL;
+}
+
+/**
+ * @brief Write the stage metrics requested with --metrics and --metrics-prom
+ *
+ * Metrics are written after failed runs too; they are most useful then.
+ * A write error is reported but does not fail the run.
+ *
+ * @param ctx Crypto context holding the metrics (NULL metrics = off)
+ * @param target Description of the target(s)
+ */
+static void write_metrics(const crypto_context_t *ctx, const char *target) {
+    if (!ctx->metrics)
+        return;
+
+    const etdk_options_t *opts = &ctx->options;
+    if (opts->metrics_file && metrics_write_json(ctx->metrics, opts->metrics_file, target) == ETDK_SUCCESS)
+        printf("Metrics: %s\n", opts->metrics_file);
+    if (opts->metrics_prom && metrics_write_prometheus(ctx->metrics, opts->metrics_prom, target) == ETDK_SUCCESS)
+        printf("Metrics: %s\n", opts->metrics_prom);
+    printf("\n");
+}
+
+/**
+ * @brief Ask the user to type YES before destroying data
+ *
+ * Reads from stdin, or from the controlling terminal when stdin carries
+ * the file list. --yes skips the prompt.
+ *
+ * @param what Description of the target(s)
+ * @param opts Options (assume_yes)
+ * @param stdin_busy Non-zero if stdin was used for the file list
+ * @return 1 if confirmed, 0 otherwise
+ */
+static int confirm_destruction(const char *what, const etdk_options_t *opts, int stdin_busy) {
+    if (opts->destroy)
+        printf("WARNING: This will PERMANENTLY DESTROY %s; no key can recover them!\n", what);
+    else if (opts->overwrite)
+        printf("WARNING: This will PERMANENTLY DESTROY all data on %s; no key is shown, nothing can recover it!\n",
+               what);
+    else
+        printf("WARNING: This will DESTROY all data on %s if you don't save the key!\n", what);
+    if (opts->assume_yes) {
+        printf("Confirmed by --yes\n\n");
+        return 1;
+    }
+
+    FILE *in = stdin;
+    if (stdin_busy) {
+        in = fopen("/dev/tty", "r");
+        if (!in) {
+            fprintf(stderr, "Error: stdin is used for the file list and no terminal is available; use --yes\n");
+            return 0;
+        }
+    }
+
+    printf("Type YES to confirm: ");
+    fflush(stdout);
+    char confirm[10];
+    int ok = fgets(confirm, sizeof(confirm), in) != NULL && strncmp(confirm, "YES\n", 4) == 0;
+    if (in != stdin)
+        fclose(in);
+
+    if (!ok) {
+        printf("Aborted.\n");
+        return 0;
+    }
+    printf("\n");
+    return 1;
+}
+
+/**
+ * @brief Print the final report after the key has been wiped
+ * @param target Target description
+ * @param ctx Crypto context (for the cipher name)
+ */
+static void print_success(const char *target, const crypto_context_t *ctx) {
+    if (ctx->options.container) {
+        printf("OPERATION SUCCESSFUL\n");
+        printf("\n");
+        printf("Target:         %s\n", target);
+        printf("Status:         ETDK CONTAINER (%s payload, wrapped data key)\n", crypto_cipher_name(ctx));
+        printf("Container key:  SECURELY WIPED FROM MEMORY\n");
+        printf("\n");
+        printf("Read a container with: etdk --decrypt --key <key> <container> <output>\n");
+        printf("Erase it at any time, whatever its size: etdk --destroy <container>\n");
+        printf("\n");
+        return;
+    }
+
+    if (ctx->options.overwrite) {
+        printf("OPERATION SUCCESSFUL\n");
+        printf("\n");
+        printf("Target:         %s\n", target);
+        printf("Status:         OVERWRITTEN (%s keystream, device not read)\n", crypto_cipher_name(ctx));
+        printf("Keystream key:  NEVER DISPLAYED, SECURELY WIPED FROM MEMORY\n");
+        printf("\n");
+        printf("The data is unrecoverable: no key exists that could decrypt it.\n");
+        printf("\n");
+        return;
+    }
+
+    printf("OPERATION SUCCESSFUL\n");
+    printf("\n");
+    printf("Target:         %s\n", target);
+    printf("Status:         ENCRYPTED (%s)\n", crypto_cipher_name(ctx));
+    printf("Encryption key: SECURELY WIPED FROM MEMORY\n");
+    printf("\n");
+    printf("The file/device is now encrypted and permanently unrecoverable - worthless without the key.\n");
+    printf("\n");
+    printf("To complete secure deletion process:\n");
+    printf(" 1) You can safely remove the encrypted file with normal methods.\n");
+    printf(" 2) Forget the key if you do not need to recover the data.\n");
+    printf("\n");
+}
+
+/**
+ * @brief Prepare the key of a --container run
+ *
+ * The run's key becomes the key-encryption key of the containers: the
+ * random one from crypto_init(), or the one given with --key.
+ *
+ * @param ctx Initialized crypto context
+ * @return ETDK_SUCCESS, or ETDK_ERROR_CRYPTO for a malformed --key
+ */
+static int container_key(crypto_context_t *ctx) {
+    ctx->mode = ETDK_CIPHER_CTR;
+    if (ctx->options.decrypt_key &&
+        crypto_parse_hex(ctx->options.decrypt_key, ctx->key, crypto_key_size(ctx)) != ETDK_SUCCESS) {
+        fprintf(stderr, "Error: --key expects %zu hex digits\n", 2 * crypto_key_size(ctx));
+        return ETDK_ERROR_CRYPTO;
+    }
+    printf("Container: %s payload, data keys wrapped with %s\n", crypto_cipher_name(ctx),
+           ctx->options.decrypt_key ? "the --key key" : "the key displayed at the end");
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Show the key of a run once, unless --container took it from --key
+ * @param ctx Crypto context
+ * @param iv_note Line explaining per-target IVs, or NULL
+ */
+static void show_key(const crypto_context_t *ctx, const char *iv_note) {
+    if (ctx->options.container && ctx->options.decrypt_key) {
+        printf("Container key: as given with --key (not displayed)\n\n");
+        return;
+    }
+    if (ctx->options.overwrite) {
+        printf("Key: not displayed (--mode=overwrite), the data cannot be recovered\n\n");
+        return;
+    }
+    crypto_display_key(ctx);
+    if (iv_note && !ctx->options.container)
+        printf("%s\n\n", iv_note);
+}
+
+/**
+ * @brief Report a run that failed after it started overwriting its target
+ *
+ * In-place and device runs have no copy of the plaintext: the part of the
+ * target that was already written can only be recovered with the key, so
+ * the caller shows it instead of wiping it unseen.
+ *
+ * @param target File or device path
+ * @param ctx Crypto context of the failed run
+ */
+static void report_partial(const char *target, const crypto_context_t *ctx) {
+    fflush(stdout); // Keep the warning after the run's own output
+    fprintf(stderr, "\nWarning: %s is partly encrypted: its first %llu bytes may hold %s ciphertext,\n", target,
+            (unsigned long long)ctx->written, crypto_cipher_name(ctx));
+    fprintf(stderr, "         the rest is unchanged. Save the key below: --decrypt --length %llu with the\n",
+            (unsigned long long)ctx->written);
+    fprintf(stderr, "         displayed key, IV and mode recovers that part.\n\n");
+}
+
+/**
+ * @brief Batch workflow: many files, one confirmation, one key
+ *
+ * @param targets Paths from the command line and/or stdin
+ * @param options Parsed options
+ * @return 0 if every file was encrypted, 1 otherwise
+ */
+static int run_batch(const cli_targets_t *targets, const etdk_options_t *options) {
+    batch_list_t list;
+    memset(&list, 0, sizeof(list));
+
+    int result = ETDK_SUCCESS;
+    for (int i = 0; result == ETDK_SUCCESS && i < targets->count; i++) {
+        result = batch_add_path(&list, targets->paths[i]);
+    }
+    if (result == ETDK_SUCCESS && targets->from_stdin) {
+        result = batch_read_list(&list, stdin, targets->separator);
+    }
+    if (result != ETDK_SUCCESS) {
+        fprintf(stderr, "Out of memory while collecting files\n");
+        batch_free(&list);
+        return 1;
+    }
+    if (list.count == 0) {
+        fprintf(stderr, "Error: No regular files to encrypt\n");
+        batch_free(&list);
+        return 1;
+    }
+
+    crypto_context_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.options = *options;
+
+    printf("\n");
+    printf("ETDK v%s - Encrypt and Delete Key\n", ETDK_VERSION);
+    printf("\n");
+    printf("Target: %zu files (%.2f GB)", list.count, list.total_bytes / (1024.0 * 1024.0 * 1024.0));
+    if (list.skipped > 0)
+        printf(", %zu paths skipped", list.skipped);
+    printf("\n");
+    printf("Type:   Batch (%u workers, largest files first)\n", batch_worker_count(&ctx, list.count));
+    printf("Method: Encrypt-then-Delete-Key\n\n");
+
+    char what[64];
+    snprintf(what, sizeof(what), "%zu files", list.count);
+    if (!confirm_destruction(what, options, targets->from_stdin)) {
+        batch_free(&list);
+        return 1;
+    }
+
+    if (crypto_init(&ctx) != ETDK_SUCCESS) {
+        fprintf(stderr, "Failed to initialize cryptography\n");
+        batch_free(&list);
+        return 1;
+    }
+    ctx.options = *options;
+
+    // Lock key in memory to prevent swapping
+    platform_lock_memory(&ctx, sizeof(ctx));
+
+    if ((options->container ? container_key(&ctx)
+                            : crypto_select_cipher(&ctx, options->in_place ? ETDK_TARGET_INPLACE : ETDK_TARGET_FILE)) !=
+        ETDK_SUCCESS) {
+        platform_unlock_memory(&ctx, sizeof(ctx));
+        crypto_cleanup(&ctx);
+        batch_free(&list);
+        return 1;
+    }
+    crypto_tune_io(&ctx, list.entries[0].path); // Batch files normally share one filesystem
+    crypto_buffers_create(&ctx, batch_worker_count(&ctx, list.count));
+
+    result = batch_run(&list, &ctx);
+
+    size_t failed = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        if (list.entries[i].status != ETDK_SUCCESS)
+            failed++;
+    }
+    printf("Encrypted: %zu files, failed: %zu\n\n", list.count - failed, failed);
+
+    // Display key even after partial failure: the encrypted files need it for recovery
+    show_key(&ctx, "Per-file IV: SHA-256(IV || path) truncated to 16 bytes");
+
+    if (crypto_secure_wipe_key(&ctx) != ETDK_SUCCESS) {
+        fprintf(stderr, "Key wiping failed\n");
+        result = ETDK_ERROR_CRYPTO;
+    }
+
+    if (result == ETDK_SUCCESS) {
+        print_success(what, &ctx);
+    } else {
+        fprintf(stderr, "Batch encryption finished with errors (%zu of %zu files failed)\n", failed, list.count);
+    }
+
+    platform_unlock_memory(&ctx, sizeof(ctx));
+    crypto_cleanup(&ctx);
+    batch_free(&list);
+
+    return result == ETDK_SUCCESS ? 0 : 1;
+}
+
+/**
+ * @brief Multi-device workflow: several block devices, one confirmation, one key
+ *
+ * @param targets Device paths from the command line
+ * @param options Parsed options
+ * @return 0 if every device was encrypted, 1 otherwise
+ */
+static int run_devices(const cli_targets_t *targets, const etdk_options_t *options) {
+    printf("\n");
+    printf("ETDK v%s - Encrypt and Delete Key\n", ETDK_VERSION);
+    printf("\n");
+    printf("Targets:\n");
+    for (int i = 0; i < targets->count; i++) {
+        uint64_t size = 0;
+        platform_get_device_size(targets->paths[i], &size);
+        int node = platform_get_numa_node(targets->paths[i]);
+        printf("  %-24s %10.2f GB", targets->paths[i], size / (1024.0 * 1024.0 * 1024.0));
+        if (node >= 0)
+            printf("  (NUMA node %d)", node);
+        printf("\n");
+    }
+    printf("Type:   %d Block Devices (concurrent)\n", targets->count);
+    printf("Method: %s\n\n", options->overwrite ? "Keystream overwrite (write-only)" : "Encrypt-then-Delete-Key");
+
+    char what[64];
+    snprintf(what, sizeof(what), "%d devices", targets->count);
+    if (!confirm_destruction(what, options, 0)) {
+        return 1;
+    }
+
+    crypto_context_t ctx;
+    if (crypto_init(&ctx) != ETDK_SUCCESS) {
+        fprintf(stderr, "Failed to initialize cryptography\n");
+        return 1;
+    }
+    ctx.options = *options;
+
+    // Lock key in memory to prevent swapping
+    platform_lock_memory(&ctx, sizeof(ctx));
+
+    if (!options->overwrite && crypto_select_cipher(&ctx, ETDK_TARGET_DEVICE) != ETDK_SUCCESS) {
+        platform_unlock_memory(&ctx, sizeof(ctx));
+        crypto_cleanup(&ctx);
+        return 1;
+    }
+
+    if (options->metrics_file || options->metrics_prom)
+        ctx.metrics = metrics_create();
+
+    int result = multi_run(targets->paths, (size_t)targets->count, &ctx);
+
+    write_metrics(&ctx, what);
+    metrics_destroy(ctx.metrics);
+    ctx.metrics = NULL;
+
+    // Display key even after partial failure: the encrypted devices need it for recovery
+    show_key(&ctx, "Per-device IV: SHA-256(IV || device path) truncated to 16 bytes");
+
+    if (crypto_secure_wipe_key(&ctx) != ETDK_SUCCESS) {
+        fprintf(stderr, "Key wiping failed\n");
+        result = ETDK_ERROR_CRYPTO;
+    }
+
+    if (result == ETDK_SUCCESS) {
+        print_success(what, &ctx);
+    } else {
+        fprintf(stderr, "Device encryption finished with errors\n");
+    }
+
+    platform_unlock_memory(&ctx, sizeof(ctx));
+    crypto_cleanup(&ctx);
+
+    return result == ETDK_SUCCESS ? 0 : 1;
+}
+
+/**
+ * @brief Decrypt workflow: recover plaintext from a source with the displayed key and IV
+ *
+ * @param targets Source and output path
+ * @param options Parsed options (decrypt set)
+ * @return 0 on success, 1 otherwise
+ */
+static int run_decrypt(const cli_targets_t *targets, const etdk_options_t *options) {
+    const char *source = targets->paths[0];
+    const char *dest = targets->paths[1];
+
+    if (encrypt_only_option(options)) {
+        fprintf(stderr, "Error: %s is not supported with --decrypt\n", encrypt_only_option(options));
+        return 1;
+    }
+    if (platform_is_device(dest) == 1 && !options->assume_yes) {
+        fprintf(stderr, "Error: writing the plaintext to block device %s overwrites it; add --yes\n", dest);
+        return 1;
+    }
+
+    crypto_context_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    platform_lock_memory(&ctx, sizeof(ctx));
+    ctx.options = *options;
+
+    // A container brings mode, IV and the wrapped data key; --key is its key-encryption key
+    ctx.options.container = platform_is_device(source) != 1 && crypto_container_probe(source);
+    if (ctx.options.container && (options->ciphers || options->decrypt_iv)) {
+        fprintf(stderr, "Error: %s is an ETDK container; --cipher and --iv do not apply\n", source);
+        goto fail;
+    }
+
+    // Exactly one mode: the one the run printed as "Mode:" (CBC if the run did not choose)
+    ctx.mode = ctx.options.container ? ETDK_CIPHER_CTR : ETDK_CIPHER_CBC;
+    unsigned int ciphers = options->ciphers;
+    if (ciphers && (ciphers & (ciphers - 1)) != 0) {
+        fprintf(stderr, "Error: --decrypt needs exactly one mode in --cipher\n");
+        goto fail;
+    }
+    for (int m = 0; m < ETDK_CIPHER_COUNT; m++) {
+        if (ciphers & ETDK_CIPHER_BIT(m))
+            ctx.mode = (etdk_cipher_t)m;
+    }
+
+    if (crypto_parse_hex(options->decrypt_key, ctx.key, crypto_key_size(&ctx)) != ETDK_SUCCESS) {
+        fprintf(stderr, "Error: --key expects %zu hex digits for %s\n", 2 * crypto_key_size(&ctx),
+                crypto_cipher_name(&ctx));
+        goto fail;
+    }
+    if (options->decrypt_iv && crypto_parse_hex(options->decrypt_iv, ctx.iv, AES_BLOCK_SIZE) != ETDK_SUCCESS) {
+        fprintf(stderr, "Error: --iv expects %d hex digits\n", 2 * AES_BLOCK_SIZE);
+        goto fail;
+    }
+    int chain = ctx.mode == ETDK_CIPHER_CBC && options->decrypt_offset > 0;
+    if (!options->decrypt_iv && ctx.mode != ETDK_CIPHER_XTS && !chain && !ctx.options.container) {
+        fprintf(stderr, "Error: %s needs --iv\n", crypto_cipher_name(&ctx));
+        goto fail;
+    }
+
+    printf("\n");
+    printf("ETDK v%s - Decrypt\n", ETDK_VERSION);
+    printf("\n");
+    printf("Source: %s\n", source);
+    printf("Output: %s\n", dest);
+    const char *note = "";
+    if (ctx.options.container)
+        note = " (ETDK container, data key from its key slot)";
+    else if (chain && !options->decrypt_iv)
+        note = " (IV from the preceding ciphertext block)";
+    printf("Mode:   %s%s\n", crypto_cipher_name(&ctx), note);
+    crypto_tune_io(&ctx, source);
+
+    int result = decrypt_run(source, dest, &ctx);
+    if (result != ETDK_SUCCESS)
+        fprintf(stderr, "Decryption failed\n");
+
+    platform_unlock_memory(&ctx, sizeof(ctx));
+    crypto_cleanup(&ctx);
+    return result == ETDK_SUCCESS ? 0 : 1;
+
+fail:
+    platform_unlock_memory(&ctx, sizeof(ctx));
+    crypto_cleanup(&ctx);
+    return 1;
+}
+
+/**
+ * @brief Destroy workflow: crypto-erase ETDK containers
+ *
+ * Paths that are not containers are reported and left untouched, so a
+ * directory can be given to erase the containers below it.
+ *
+ * @param targets Container paths, directories and/or stdin list
+ * @param options Parsed options (destroy set)
+ * @return 0 if every container was destroyed, 1 otherwise
+ */
+static int run_destroy(const cli_targets_t *targets, const etdk_options_t *options) {
+    batch_list_t list;
+    memset(&list, 0, sizeof(list));
+
+    int result = ETDK_SUCCESS;
+    for (int i = 0; result == ETDK_SUCCESS && i < targets->count; i++) {
+        result = batch_add_path(&list, targets->paths[i]);
+    }
+    if (result == ETDK_SUCCESS && targets->from_stdin) {
+        result = batch_read_list(&list, stdin, targets->separator);
+    }
+    if (result != ETDK_SUCCESS) {
+        fprintf(stderr, "Out of memory while collecting files\n");
+        batch_free(&list);
+        return 1;
+    }
+    if (list.count == 0) {
+        fprintf(stderr, "Error: No files to destroy\n");
+        batch_free(&list);
+        return 1;
+    }
+
+    printf("\n");
+    printf("ETDK v%s - Destroy containers\n", ETDK_VERSION);
+    printf("\n");
+    printf("Target: %zu files (%.2f GB)\n", list.count, list.total_bytes / (1024.0 * 1024.0 * 1024.0));
+    printf("Method: Overwrite and discard the key slot, then delete\n\n");
+
+    char what[64];
+    snprintf(what, sizeof(what), "the ETDK containers among %zu files", list.count);
+    if (!confirm_destruction(what, options, targets->from_stdin)) {
+        batch_free(&list);
+        return 1;
+    }
+
+    size_t failed = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        if (crypto_destroy_container(list.entries[i].path) == ETDK_SUCCESS)
+            printf("Destroyed: %s\n", list.entries[i].path);
+        else
+            failed++;
+    }
+    printf("\nDestroyed: %zu containers, failed or skipped: %zu\n\n", list.count - failed, failed);
+
+    batch_free(&list);
+    return failed == 0 ? 0 : 1;
+}
+
 /**
  * @brief Main entry point for ETDK application
  *
@@ -54,18 +1091,87 @@ void print_usage(const char *program_name) {
  * @return 0 on success, 1 on error
  */
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
+    etdk_options_t options;
+    cli_targets_t targets;
+
+    // Parse options; help flags print usage and exit successfully
+    int parsed = parse_arguments(argc, argv, &options, &targets);
+    if (parsed != 0) {
+        free(targets.paths);
         print_usage(argv[0]);
-        return 1;
+        return parsed > 0 ? 0 : 1;
     }
 
-    // Check for help flags
-    if (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "help") == 0) {
-        print_usage(argv[0]);
-        return 0;
+    // A consumer closing the progress stream must not kill a run halfway through a device
+    if (options.progress_fd > 0)
+        signal(SIGPIPE, SIG_IGN);
+
+    if (options.decrypt) {
+        int status = run_decrypt(&targets, &options);
+        free(targets.paths);
+        return status;
+    }
+    if (options.destroy) {
+        int status = run_destroy(&targets, &options);
+        free(targets.paths);
+        return status;
     }
 
-    char *target_file = argv[1];
+    // Several block devices run concurrently, each on its own pipeline
+    if (targets.count > 1 && !targets.from_stdin) {
+        int devices = 0;
+        for (int i = 0; i < targets.count; i++) {
+            if (platform_is_device(targets.paths[i]) == 1)
+                devices++;
+            for (int j = 0; j < i; j++) {
+                if (strcmp(targets.paths[i], targets.paths[j]) == 0) {
+                    fprintf(stderr, "Error: %s is given more than once\n", targets.paths[i]);
+                    free(targets.paths);
+                    return 1;
+                }
+            }
+        }
+        if (devices > 0 && devices < targets.count) {
+            fprintf(stderr, "Error: cannot mix block devices with files or directories\n");
+            free(targets.paths);
+            return 1;
+        }
+        if (devices == targets.count) {
+            if (options.key_file) {
+                fprintf(stderr, "Error: --key-file is only supported for a single device\n");
+                free(targets.paths);
+                return 1;
+            }
+            if (options.container) {
+                fprintf(stderr, "Error: --container is only supported for files\n");
+                free(targets.paths);
+                return 1;
+            }
+            if (options.crypto_engine == ETDK_CRYPTO_KERNEL && options.threads) {
+                fprintf(stderr, "Error: --crypto-engine kernel runs the sequential device engine, not --threads\n");
+                free(targets.paths);
+                return 1;
+            }
+            int status = run_devices(&targets, &options);
+            free(targets.paths);
+            return status;
+        }
+    }
+
+    // Several targets, a file list or a directory select batch mode
+    if (targets.count != 1 || targets.from_stdin || platform_is_directory(targets.paths[0])) {
+        if (device_only_option(&options)) {
+            fprintf(stderr, "Error: %s is only supported for block devices\n", device_only_option(&options));
+            free(targets.paths);
+            return 1;
+        }
+        int status = run_batch(&targets, &options);
+        free(targets.paths);
+        return status;
+    }
+
+    char *target_file = targets.paths[0];
+    free(targets.paths);
 
     // Check if target is a block device
     int is_device = platform_is_device(target_file);
@@ -74,13 +1180,25 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Error: Cannot access %s\n", target_file);
         return 1;
     }
+    if (device_only_option(&options) && !is_device) {
+        fprintf(stderr, "Error: %s is only supported for block devices\n", device_only_option(&options));
+        return 1;
+    }
+    if (options.container && is_device) {
+        fprintf(stderr, "Error: --container is only supported for files\n");
+        return 1;
+    }
+    if (options.crypto_engine == ETDK_CRYPTO_KERNEL && options.threads && is_device) {
+        fprintf(stderr, "Error: --crypto-engine kernel runs the sequential device engine, not --threads\n");
+        return 1;
+    }
 
     printf("\n");
     printf("ETDK v%s - Encrypt and Delete Key\n", ETDK_VERSION);
     printf("\n");
     printf("Target: %s\n", target_file);
     printf("Type:   %s\n", is_device ? "Block Device" : "Regular File");
-    printf("Method: Encrypt-then-Delete-Key\n\n");
+    printf("Method: %s\n\n", options.overwrite ? "Keystream overwrite (write-only)" : "Encrypt-then-Delete-Key");
 
     if (is_device) {
         uint64_t size;
@@ -90,64 +1208,67 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    printf("WARNING: This will DESTROY all data on %s if you don't save the key!\n", target_file);
-    printf("Type YES to confirm: ");
-    char confirm[10];
-    if (fgets(confirm, sizeof(confirm), stdin) == NULL || strncmp(confirm, "YES\n", 4) != 0) {
-        printf("Aborted.\n");
+    if (!confirm_destruction(target_file, &options, 0)) {
         return 1;
     }
-    printf("\n");
 
     crypto_context_t ctx;
     if (crypto_init(&ctx) != ETDK_SUCCESS) {
         fprintf(stderr, "Failed to initialize cryptography\n");
         return 1;
     }
+    ctx.options = options;
 
     // Lock key in memory to prevent swapping
     platform_lock_memory(&ctx, sizeof(ctx));
 
-    int result;
+    etdk_target_t kind = is_device ? ETDK_TARGET_DEVICE : (options.in_place ? ETDK_TARGET_INPLACE : ETDK_TARGET_FILE);
+    int result = ETDK_SUCCESS;
+    if (options.container)
+        result = container_key(&ctx);
+    else if (!options.overwrite)
+        result = crypto_select_cipher(&ctx, kind); // --mode=overwrite: always AES-256-CTR
+    if (result != ETDK_SUCCESS) {
+        platform_unlock_memory(&ctx, sizeof(ctx));
+        crypto_cleanup(&ctx);
+        return 1;
+    }
+    crypto_tune_io(&ctx, target_file);
+    crypto_buffers_create(&ctx, is_device && options.threads ? options.threads : 1);
 
     if (is_device) {
+        if (options.metrics_file || options.metrics_prom)
+            ctx.metrics = metrics_create();
+
         // Encrypt entire block device
         result = crypto_encrypt_device(target_file, &ctx);
 
-        if (result != ETDK_SUCCESS) {
+        write_metrics(&ctx, target_file);
+        metrics_destroy(ctx.metrics);
+        ctx.metrics = NULL;
+
+        if (result != ETDK_SUCCESS)
             fprintf(stderr, "Device encryption failed\n");
-            platform_unlock_memory(&ctx, sizeof(ctx));
-            crypto_cleanup(&ctx);
-            return 1;
-        }
     } else {
-        // Encrypt regular file
-        char temp_path[512];
-        char encrypted_path[512];
-        snprintf(temp_path, sizeof(temp_path), "%s.tmp_encrypted", target_file);
-        snprintf(encrypted_path, sizeof(encrypted_path), "%s", target_file);
-
-        result = crypto_encrypt_file(target_file, temp_path, &ctx);
+        // Encrypt regular file (in place, or via temp file that replaces the original)
+        result = batch_encrypt_file(target_file, &ctx);
 
-        if (result != ETDK_SUCCESS) {
+        if (result != ETDK_SUCCESS)
             fprintf(stderr, "Encryption failed\n");
-            platform_unlock_memory(&ctx, sizeof(ctx));
-            crypto_cleanup(&ctx);
-            return 1;
-        }
+    }
 
-        // Rename temp file to original name (overwrites original)
-        if (remove(target_file) != 0 || rename(temp_path, encrypted_path) != 0) {
-            fprintf(stderr, "Failed to replace original file with encrypted version\n");
-            remove(temp_path);
-            platform_unlock_memory(&ctx, sizeof(ctx));
-            crypto_cleanup(&ctx);
-            return 1;
-        }
+    // A failed copy run leaves the original intact; a failed in-place or device run may not
+    if (result != ETDK_SUCCESS && (ctx.written == 0 || !(is_device || options.in_place) || options.overwrite)) {
+        platform_unlock_memory(&ctx, sizeof(ctx));
+        crypto_cleanup(&ctx);
+        return 1;
     }
+    int failed = result != ETDK_SUCCESS;
+    if (failed)
+        report_partial(target_file, &ctx);
 
     // Display key
-    crypto_display_key(&ctx);
+    show_key(&ctx, NULL);
 
     // Wipe key from memory
     result = crypto_secure_wipe_key(&ctx);
@@ -159,21 +1280,11 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    printf("OPERATION SUCCESSFUL\n");
-    printf("\n");
-    printf("Target:         %s\n", target_file);
-    printf("Status:         ENCRYPTED (AES-256-CBC)\n");
-    printf("Encryption key: SECURELY WIPED FROM MEMORY\n");
-    printf("\n");
-    printf("The file/device is now encrypted and permanently unrecoverable - worthless without the key.\n");
-    printf("\n");
-    printf("To complete secure deletion process:\n");
-    printf(" 1) You can safely remove the encrypted file with normal methods.\n");
-    printf(" 2) Forget the key if you do not need to recover the data.\n");
-    printf("\n");
+    if (!failed)
+        print_success(target_file, &ctx);
 
     platform_unlock_memory(&ctx, sizeof(ctx));
     crypto_cleanup(&ctx);
 
-    return 0;
+    return failed;
 }
@@ -0,0 +1,373 @@
+/*
+ * ETDK - Encrypt-then-Delete-Key
+ * Stage metrics - read/encrypt/write/sync latency and queue occupancy histograms
+ */
+
+#include "etdk.h"
+// cppcheck-suppress-begin missingIncludeSystem
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+// cppcheck-suppress-end missingIncludeSystem
+
+/** Sub-buckets per power of two: 2^4 = 16, so every bucket is within 1/16 (6.25%) of its values */
+#define METRICS_SUB_BITS 4
+#define METRICS_SUB_COUNT (1 << METRICS_SUB_BITS)
+
+/** Buckets covering all of uint64_t */
+#define METRICS_BUCKETS (64 * METRICS_SUB_COUNT)
+
+/**
+ * @brief Log-linear (HDR-style) histogram, updated with relaxed atomics
+ */
+typedef struct {
+    uint64_t counts[METRICS_BUCKETS]; /**< Values per bucket */
+    uint64_t count;                   /**< Values recorded */
+    uint64_t sum;                     /**< Sum of the values */
+    uint64_t min;                     /**< Smallest value (UINT64_MAX while empty) */
+    uint64_t max;                     /**< Largest value */
+    uint64_t bytes;                   /**< Bytes moved by the recorded operations */
+} histogram_t;
+
+/**
+ * @brief Metrics of a run
+ */
+struct metrics {
+    histogram_t stages[METRIC_STAGE_COUNT]; /**< One histogram per stage */
+    struct timespec start;                  /**< Creation time (CLOCK_MONOTONIC) */
+};
+
+/**
+ * @brief Names and units of the stages
+ */
+static const struct {
+    const char *name; /**< Stage name in both outputs */
+    int timed;        /**< Non-zero for durations in ns, 0 for plain counts */
+} stage_info[METRIC_STAGE_COUNT] = {
+    [METRIC_READ] = {"read", 1},
+    [METRIC_ENCRYPT] = {"encrypt", 1},
+    [METRIC_WRITE] = {"write", 1},
+    [METRIC_SYNC] = {"sync", 1},
+    [METRIC_QUEUE] = {"queue", 0},
+};
+
+/** Quantiles reported for every stage */
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+/**
+ * @brief Bucket of a value
+ *
+ * Values below 16 have a bucket each; above that, every power of two is
+ * split into 16 equal sub-buckets.
+ */
+static unsigned int bucket_index(uint64_t value) {
+    if (value < METRICS_SUB_COUNT)
+        return (unsigned int)value;
+    unsigned int exponent = 63u - (unsigned int)__builtin_clzll(value);
+    unsigned int sub = (unsigned int)(value >> (exponent - METRICS_SUB_BITS)) & (METRICS_SUB_COUNT - 1);
+    return (exponent - METRICS_SUB_BITS + 1) * METRICS_SUB_COUNT + sub;
+}
+
+/**
+ * @brief Largest value that falls into a bucket
+ */
+static uint64_t bucket_upper(unsigned int index) {
+    if (index < METRICS_SUB_COUNT)
+        return index;
+    unsigned int exponent = index / METRICS_SUB_COUNT + METRICS_SUB_BITS - 1;
+    uint64_t sub = index % METRICS_SUB_COUNT;
+    uint64_t low = (METRICS_SUB_COUNT + sub) << (exponent - METRICS_SUB_BITS);
+    return low + (1ULL << (exponent - METRICS_SUB_BITS)) - 1;
+}
+
+/**
+ * @brief Create an empty metrics set
+ *
+ * @return Metrics, or NULL on allocation failure
+ */
+metrics_t *metrics_create(void) {
+    metrics_t *m = calloc(1, sizeof(metrics_t));
+    if (!m) {
+        return NULL;
+    }
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++)
+        m->stages[s].min = UINT64_MAX;
+    clock_gettime(CLOCK_MONOTONIC, &m->start);
+    return m;
+}
+
+/**
+ * @brief Free a metrics set
+ *
+ * @param m Metrics, or NULL
+ */
+void metrics_destroy(metrics_t *m) {
+    free(m);
+}
+
+/**
+ * @brief Timestamp for a stage timer
+ *
+ * Returns 0 without reading the clock when metrics are off, so an
+ * uninstrumented run pays one branch per stage.
+ *
+ * @param m Metrics, or NULL
+ * @return Monotonic time in ns, or 0
+ */
+uint64_t metrics_now(const metrics_t *m) {
+    if (!m)
+        return 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Record one value (safe from any thread)
+ *
+ * @param m Metrics, or NULL
+ * @param stage Stage
+ * @param value Duration in ns, or a count for METRIC_QUEUE
+ */
+void metrics_record(metrics_t *m, metric_stage_t stage, uint64_t value) {
+    if (!m)
+        return;
+
+    histogram_t *h = &m->stages[stage];
+    __atomic_fetch_add(&h->counts[bucket_index(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+
+    uint64_t seen = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while (value < seen && !__atomic_compare_exchange_n(&h->min, &seen, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    seen = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (value > seen && !__atomic_compare_exchange_n(&h->max, &seen, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/**
+ * @brief Record the duration of an operation that started at start
+ *
+ * @param m Metrics, or NULL
+ * @param stage Timed stage
+ * @param start Value of metrics_now() before the operation
+ * @param bytes Bytes the operation moved (0 if none)
+ */
+void metrics_stage(metrics_t *m, metric_stage_t stage, uint64_t start, size_t bytes) {
+    if (!m)
+        return;
+    metrics_record(m, stage, metrics_now(m) - start);
+    __atomic_fetch_add(&m->stages[stage].bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Value below which a share of the recorded values lies
+ *
+ * Reports the upper end of the bucket (at most the maximum), so the
+ * error is below 1/16 of the value.
+ *
+ * @param h Histogram
+ * @param q Quantile (0..1)
+ * @return Value, 0 for an empty histogram
+ */
+static uint64_t histogram_quantile(const histogram_t *h, double q) {
+    if (h->count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(q * (double)h->count);
+    if (rank >= h->count)
+        rank = h->count - 1;
+
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < METRICS_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen > rank)
+            return bucket_upper(i) < h->max ? bucket_upper(i) : h->max;
+    }
+    return h->max;
+}
+
+/**
+ * @brief Seconds since the metrics set was created
+ */
+static double metrics_elapsed(const metrics_t *m) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - m->start.tv_sec) + (now.tv_nsec - m->start.tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Open a temporary file next to path
+ *
+ * Both outputs are written to "<path>.tmp" and renamed into place, so a
+ * reader (node_exporter's textfile collector) never sees a partial file.
+ *
+ * @param path Final path
+ * @param tmp Receives the temporary path
+ * @param size Size of tmp
+ * @return Open stream, or NULL (message printed)
+ */
+static FILE *open_output(const char *path, char *tmp, size_t size) {
+    if ((size_t)snprintf(tmp, size, "%s.tmp", path) >= size) {
+        fprintf(stderr, "Metrics path too long: %s\n", path);
+        return NULL;
+    }
+    FILE *f = fopen(tmp, "w");
+    if (!f)
+        perror("Cannot write metrics");
+    return f;
+}
+
+/**
+ * @brief Close the temporary file and rename it into place
+ *
+ * @param f Stream from open_output()
+ * @param tmp Temporary path
+ * @param path Final path
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+static int close_output(FILE *f, const char *tmp, const char *path) {
+    int failed = ferror(f);
+    if (fclose(f) != 0 || failed || rename(tmp, path) != 0) {
+        perror("Cannot write metrics");
+        remove(tmp);
+        return ETDK_ERROR_IO;
+    }
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Write a JSON escaped string
+ */
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+/**
+ * @brief Write the summary as JSON
+ *
+ * One object per stage with count, sum, min, mean, p50, p90, p99, p999
+ * and max (ns for timed stages, chunks for "queue"), bytes, and for timed
+ * stages the rate while busy (bytes / sum), which names the bottleneck:
+ * the stage with the lowest busy rate limits the run.
+ *
+ * @param m Metrics
+ * @param path Output file
+ * @param target Description of what was encrypted
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+int metrics_write_json(const metrics_t *m, const char *path, const char *target) {
+    if (!m || !path || !target) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    char tmp[4096];
+    FILE *f = open_output(path, tmp, sizeof(tmp));
+    if (!f) {
+        return ETDK_ERROR_IO;
+    }
+
+    fprintf(f, "{\n  \"target\": ");
+    json_string(f, target);
+    fprintf(f, ",\n  \"elapsed\": %.3f,\n  \"stages\": {", metrics_elapsed(m));
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+        const histogram_t *h = &m->stages[s];
+        fprintf(f, "%s\n    \"%s\": {\"unit\": \"%s\", \"count\": %llu, \"sum\": %llu, \"min\": %llu, \"mean\": %.0f",
+                s ? "," : "", stage_info[s].name, stage_info[s].timed ? "ns" : "chunks", (unsigned long long)h->count,
+                (unsigned long long)h->sum, (unsigned long long)(h->count ? h->min : 0),
+                h->count ? (double)h->sum / (double)h->count : 0.0);
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+            fprintf(f, ", \"p%g\": %llu", quantiles[q] * 100, (unsigned long long)histogram_quantile(h, quantiles[q]));
+        fprintf(f, ", \"max\": %llu, \"bytes\": %llu", (unsigned long long)h->max, (unsigned long long)h->bytes);
+        if (stage_info[s].timed)
+            fprintf(f, ", \"busy_rate\": %.0f", h->sum ? h->bytes * 1e9 / (double)h->sum : 0.0);
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n  }\n}\n");
+
+    return close_output(f, tmp, path);
+}
+
+/**
+ * @brief Write the summary in the Prometheus text format (node_exporter textfile collector)
+ *
+ * Timed stages become the summary etdk_stage_seconds{stage=...}, queue
+ * occupancy the summary etdk_queue_occupancy_chunks; bytes per stage are
+ * etdk_stage_bytes_total and the run time etdk_elapsed_seconds.
+ *
+ * @param m Metrics
+ * @param path Output file (*.prom in the collector's directory)
+ * @param target Description of what was encrypted (label "target")
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+int metrics_write_prometheus(const metrics_t *m, const char *path, const char *target) {
+    if (!m || !path || !target) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    // Label values escape backslash, quote and newline
+    char label[1024];
+    size_t pos = 0;
+    for (const char *s = target; *s && pos + 3 < sizeof(label); s++) {
+        if (*s == '\\' || *s == '"' || *s == '\n')
+            label[pos++] = '\\';
+        label[pos++] = *s == '\n' ? 'n' : *s;
+    }
+    label[pos] = '\0';
+
+    char tmp[4096];
+    FILE *f = open_output(path, tmp, sizeof(tmp));
+    if (!f) {
+        return ETDK_ERROR_IO;
+    }
+
+    fprintf(f, "# HELP etdk_stage_seconds Duration of one operation per stage\n");
+    fprintf(f, "# TYPE etdk_stage_seconds summary\n");
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+        const histogram_t *h = &m->stages[s];
+        if (!stage_info[s].timed)
+            continue;
+        for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+            fprintf(f, "etdk_stage_seconds{target=\"%s\",stage=\"%s\",quantile=\"%g\"} %.9f\n", label,
+                    stage_info[s].name, quantiles[q], histogram_quantile(h, quantiles[q]) / 1e9);
+        fprintf(f, "etdk_stage_seconds_sum{target=\"%s\",stage=\"%s\"} %.9f\n", label, stage_info[s].name,
+                h->sum / 1e9);
+        fprintf(f, "etdk_stage_seconds_count{target=\"%s\",stage=\"%s\"} %llu\n", label, stage_info[s].name,
+                (unsigned long long)h->count);
+    }
+
+    const histogram_t *queue = &m->stages[METRIC_QUEUE];
+    fprintf(f, "# HELP etdk_queue_occupancy_chunks Pipeline chunks in flight, sampled per chunk\n");
+    fprintf(f, "# TYPE etdk_queue_occupancy_chunks summary\n");
+    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+        fprintf(f, "etdk_queue_occupancy_chunks{target=\"%s\",quantile=\"%g\"} %llu\n", label, quantiles[q],
+                (unsigned long long)histogram_quantile(queue, quantiles[q]));
+    fprintf(f, "etdk_queue_occupancy_chunks_sum{target=\"%s\"} %llu\n", label, (unsigned long long)queue->sum);
+    fprintf(f, "etdk_queue_occupancy_chunks_count{target=\"%s\"} %llu\n", label, (unsigned long long)queue->count);
+
+    fprintf(f, "# HELP etdk_stage_bytes_total Bytes moved per stage\n");
+    fprintf(f, "# TYPE etdk_stage_bytes_total counter\n");
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+        if (stage_info[s].timed)
+            fprintf(f, "etdk_stage_bytes_total{target=\"%s\",stage=\"%s\"} %llu\n", label, stage_info[s].name,
+                    (unsigned long long)m->stages[s].bytes);
+    }
+
+    fprintf(f, "# HELP etdk_elapsed_seconds Run time of the encryption\n");
+    fprintf(f, "# TYPE etdk_elapsed_seconds gauge\n");
+    fprintf(f, "etdk_elapsed_seconds{target=\"%s\"} %.3f\n", label, metrics_elapsed(m));
+
+    return close_output(f, tmp, path);
+}
@@ -0,0 +1,286 @@
+/*
+ * ETDK - Encrypt-then-Delete-Key
+ * Multi-device mode - several block devices wiped concurrently with one progress table
+ */
+
+#include "etdk.h"
+// cppcheck-suppress-begin missingIncludeSystem
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+// cppcheck-suppress-end missingIncludeSystem
+
+typedef struct multi_job multi_job_t;
+
+/**
+ * @brief One device of a multi-device run
+ */
+typedef struct {
+    const char *path;      /**< Device path as given */
+    multi_job_t *job;      /**< Owning run */
+    crypto_context_t *ctx; /**< Locked copy of the master context with the device's IV */
+    uint64_t size;         /**< Device size in bytes */
+    uint64_t processed;    /**< Bytes encrypted so far */
+    uint64_t total;        /**< Bytes the engine encrypts (less than size with --discard=hybrid) */
+    uint64_t reported;     /**< processed at the previous table */
+    int node;              /**< NUMA node of the device, -1 if unknown */
+    int pinned;            /**< Non-zero if the device's threads run on its node */
+    int finished;          /**< Non-zero once the engine returned */
+    int status;            /**< Result of crypto_encrypt_device() */
+    double seconds;        /**< Run time of the device */
+    pthread_t thread;      /**< Thread running the device */
+} multi_device_t;
+
+/**
+ * @brief Shared state of a multi-device run
+ */
+struct multi_job {
+    multi_device_t *devices; /**< Devices, in command line order */
+    size_t count;            /**< Number of devices */
+    size_t finished;         /**< Devices whose engine returned */
+    struct timespec start;   /**< Start of the run (CLOCK_MONOTONIC) */
+    pthread_mutex_t lock;    /**< Protects progress fields, finished and output */
+    pthread_cond_t changed;  /**< Signalled when a device finishes */
+};
+
+/**
+ * @brief Seconds since a start time
+ *
+ * @param start Start time (CLOCK_MONOTONIC)
+ * @return Elapsed seconds
+ */
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Progress sink of one device (crypto_context_t.progress)
+ *
+ * @param arg Pointer to multi_device_t
+ * @param processed Bytes encrypted so far
+ * @param total Bytes the engine encrypts
+ */
+static void device_progress(void *arg, uint64_t processed, uint64_t total) {
+    multi_device_t *dev = arg;
+
+    pthread_mutex_lock(&dev->job->lock);
+    dev->processed = processed;
+    dev->total = total;
+    pthread_mutex_unlock(&dev->job->lock);
+}
+
+/**
+ * @brief Device thread: pin to the device's node, then run its engine
+ *
+ * The chunk buffers are allocated after pinning, so they are faulted in
+ * on the node whose CPUs encrypt them and whose controller moves them.
+ *
+ * @param arg Pointer to multi_device_t
+ * @return NULL
+ */
+static void *device_thread(void *arg) {
+    multi_device_t *dev = arg;
+    multi_job_t *job = dev->job;
+
+    if (dev->node >= 0)
+        dev->pinned = platform_pin_to_numa_node(dev->node) == ETDK_SUCCESS;
+
+    unsigned int threads = dev->ctx->options.threads;
+    crypto_buffers_create(dev->ctx, threads ? threads : 1);
+    int result = crypto_encrypt_device(dev->path, dev->ctx);
+    crypto_buffers_destroy(dev->ctx);
+
+    pthread_mutex_lock(&job->lock);
+    dev->status = result;
+    dev->finished = 1;
+    dev->seconds = seconds_since(&job->start);
+    if (result == ETDK_SUCCESS)
+        dev->processed = dev->total;
+    job->finished++;
+    printf("%s: %s after %.0f s\n", dev->path, result == ETDK_SUCCESS ? "done" : "FAILED", dev->seconds);
+    fflush(stdout);
+    pthread_cond_signal(&job->changed);
+    pthread_mutex_unlock(&job->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Print the progress table
+ *
+ * One row per device and a total row. Rates are measured since the
+ * previous table; the final table shows averages over each device's
+ * run time instead. Plain text, so the tables also read well in a log.
+ *
+ * @param job Run state (lock held)
+ * @param interval Seconds since the previous table
+ * @param final Non-zero for the table printed after all devices finished
+ */
+static void print_table(multi_job_t *job, double interval, int final) {
+    double elapsed = seconds_since(&job->start);
+    uint64_t done = 0, total = 0;
+    double rate = 0;
+    const double gb = 1024.0 * 1024.0 * 1024.0;
+    const double mb = 1024.0 * 1024.0;
+
+    printf("\n%s after %.0f s\n", final ? "Finished" : "Progress", elapsed);
+    printf("%-24s %4s %10s %10s %6s %9s  %s\n", "DEVICE", "NODE", "DONE GB", "TOTAL GB", "%", "MB/s", "STATE");
+
+    for (size_t i = 0; i < job->count; i++) {
+        multi_device_t *dev = &job->devices[i];
+        uint64_t dev_total = dev->total ? dev->total : dev->size;
+        double dev_rate;
+        if (final)
+            dev_rate = dev->seconds > 0 ? dev->processed / mb / dev->seconds : 0;
+        else
+            dev_rate = interval > 0 ? (dev->processed - dev->reported) / mb / interval : 0;
+        dev->reported = dev->processed;
+
+        char node[16];
+        if (dev->node < 0)
+            snprintf(node, sizeof(node), "-");
+        else
+            snprintf(node, sizeof(node), "%d%s", dev->node, dev->pinned ? "" : "?");
+
+        const char *state = "running";
+        if (dev->finished)
+            state = dev->status == ETDK_SUCCESS ? "done" : "FAILED";
+
+        printf("%-24s %4s %10.2f %10.2f %6.1f %9.1f  %s\n", dev->path, node, dev->processed / gb, dev_total / gb,
+               dev_total ? dev->processed * 100.0 / dev_total : 100.0, dev_rate, state);
+
+        done += dev->processed;
+        total += dev_total;
+        if (!final)
+            rate += dev_rate;
+    }
+
+    if (final)
+        rate = elapsed > 0 ? done / mb / elapsed : 0;
+    printf("%-24s %4s %10.2f %10.2f %6.1f %9.1f  %zu of %zu finished\n", "TOTAL", "", done / gb, total / gb,
+           total ? done * 100.0 / total : 100.0, rate, job->finished, job->count);
+    fflush(stdout);
+}
+
+/**
+ * @brief Encrypt several block devices concurrently
+ *
+ * Every device gets a locked copy of the context in one key slab and its
+ * own IV, SHA-256(IV || path), so no two devices share a keystream. The
+ * engines run unchanged on one thread per device (which starts that
+ * device's workers or pipeline); with ctx->progress set they print no
+ * progress lines of their own, and this thread prints a table every
+ * ETDK_MULTI_REPORT_INTERVAL seconds and a last one when all are done.
+ *
+ * @param paths Device paths
+ * @param count Number of devices
+ * @param ctx Crypto context with key, base IV, mode and options (mode updated to the one the devices used)
+ * @return ETDK_SUCCESS if every device was encrypted, ETDK_ERROR_IO otherwise
+ */
+int multi_run(char *const *paths, size_t count, crypto_context_t *ctx) {
+    if (!paths || count == 0 || !ctx) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    multi_job_t job;
+    memset(&job, 0, sizeof(job));
+    job.count = count;
+    job.devices = calloc(count, sizeof(multi_device_t));
+    platform_arena_t *keys = platform_arena_create(sizeof(crypto_context_t), (unsigned int)count);
+    if (!job.devices || !keys) {
+        free(job.devices);
+        platform_arena_destroy(keys);
+        return ETDK_ERROR_MEMORY;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.changed, NULL);
+
+    int result = ETDK_SUCCESS;
+    for (size_t i = 0; i < count && result == ETDK_SUCCESS; i++) {
+        multi_device_t *dev = &job.devices[i];
+        dev->path = paths[i];
+        dev->job = &job;
+        dev->node = platform_get_numa_node(dev->path);
+        dev->ctx = platform_arena_alloc(keys, sizeof(crypto_context_t), sizeof(void *));
+        if (!dev->ctx || platform_get_device_size(dev->path, &dev->size) != ETDK_SUCCESS) {
+            fprintf(stderr, "Cannot prepare %s\n", dev->path);
+            result = dev->ctx ? ETDK_ERROR_IO : ETDK_ERROR_MEMORY;
+            break;
+        }
+
+        memcpy(dev->ctx, ctx, sizeof(crypto_context_t));
+        dev->ctx->arena = NULL;
+        dev->ctx->progress = device_progress;
+        dev->ctx->progress_arg = dev;
+        result = crypto_derive_iv(ctx, dev->path, dev->ctx->iv);
+
+        printf("%s: ", dev->path);
+        crypto_tune_io(dev->ctx, dev->path);
+    }
+
+    size_t started = 0;
+    if (result == ETDK_SUCCESS) {
+        clock_gettime(CLOCK_MONOTONIC, &job.start);
+        printf("\nEncrypting %zu devices...\n", count);
+        fflush(stdout);
+
+        for (; started < count; started++) {
+            if (pthread_create(&job.devices[started].thread, NULL, device_thread, &job.devices[started]) != 0) {
+                fprintf(stderr, "Error creating thread for %s\n", job.devices[started].path);
+                result = ETDK_ERROR_MEMORY;
+                break;
+            }
+        }
+
+        // Report until every started device has finished
+        pthread_mutex_lock(&job.lock);
+        print_table(&job, 0, 0);
+        double last = seconds_since(&job.start);
+        while (job.finished < started) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += ETDK_MULTI_REPORT_INTERVAL;
+            if (pthread_cond_timedwait(&job.changed, &job.lock, &deadline) == ETIMEDOUT) {
+                double now = seconds_since(&job.start);
+                print_table(&job, now - last, 0);
+                last = now;
+            }
+        }
+        print_table(&job, 0, 1);
+        pthread_mutex_unlock(&job.lock);
+
+        for (size_t i = 0; i < started; i++)
+            pthread_join(job.devices[i].thread, NULL);
+        printf("\n");
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        multi_device_t *dev = &job.devices[i];
+        if (i < started && dev->status != ETDK_SUCCESS) {
+            fprintf(stderr, "FAILED: %s\n", dev->path);
+            result = ETDK_ERROR_IO;
+        }
+    }
+    if (started < count && result == ETDK_SUCCESS)
+        result = ETDK_ERROR_IO;
+
+    // All devices made the same CBC -> CTR decision (same options); show the mode they used
+    if (started > 0)
+        ctx->mode = job.devices[0].ctx->mode;
+
+    for (size_t i = 0; i < count; i++) {
+        if (job.devices[i].ctx)
+            crypto_cleanup(job.devices[i].ctx);
+    }
+    platform_arena_destroy(keys);
+    pthread_cond_destroy(&job.changed);
+    pthread_mutex_destroy(&job.lock);
+    free(job.devices);
+
+    return result;
+}
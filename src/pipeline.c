@@ -0,0 +1,669 @@
+/*
+ * ETDK - Encrypt-then-Delete-Key
+ * Asynchronous read/encrypt/write pipeline (io_uring with thread fallback)
+ */
+
+#include "etdk.h"
+// cppcheck-suppress-begin missingIncludeSystem
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+// cppcheck-suppress-end missingIncludeSystem
+
+/**
+ * @brief Life cycle of one pipeline buffer
+ *
+ * Chunk number seq always uses slot seq % queue_depth, and every stage
+ * handles chunks in ascending order, so a slot can only be reused once
+ * the write of the chunk queue_depth positions earlier has completed.
+ */
+typedef enum {
+    SLOT_FREE = 0, /**< Available for the next read */
+    SLOT_READING,  /**< Read submitted */
+    SLOT_READ,     /**< Plaintext available, waiting for the encryptor */
+    SLOT_WRITING   /**< Ciphertext handed to the writer */
+} slot_state_t;
+
+/**
+ * @brief One in-flight chunk
+ */
+typedef struct {
+    unsigned char *buf; /**< Aligned buffer (chunk_size + AES_BLOCK_SIZE bytes) */
+    slot_state_t state; /**< Current stage */
+    uint64_t offset;    /**< Byte offset of the chunk */
+    size_t len;         /**< Plaintext length */
+    size_t outlen;      /**< Ciphertext length produced by the transform */
+    size_t done;        /**< Bytes transferred so far (short read/write resubmission) */
+    uint64_t started;   /**< metrics_now() when the current read or write was submitted */
+} pipeline_slot_t;
+
+/**
+ * @brief Allocate the slot ring
+ *
+ * @param job Pipeline description
+ * @return Array of queue_depth slots, or NULL on failure
+ */
+static pipeline_slot_t *alloc_slots(const pipeline_job_t *job) {
+    pipeline_slot_t *slots = calloc(job->queue_depth, sizeof(pipeline_slot_t));
+    if (!slots)
+        return NULL;
+
+    for (unsigned int i = 0; i < job->queue_depth; i++) {
+        slots[i].buf = platform_arena_alloc(job->arena, job->chunk_size + AES_BLOCK_SIZE, job->alignment);
+        if (!slots[i].buf) {
+            for (unsigned int j = 0; j < i; j++)
+                platform_arena_free(job->arena, slots[j].buf);
+            free(slots);
+            return NULL;
+        }
+    }
+
+    return slots;
+}
+
+/**
+ * @brief Free the slot ring
+ *
+ * @param job Pipeline description passed to alloc_slots()
+ * @param slots Slot array from alloc_slots()
+ */
+static void free_slots(const pipeline_job_t *job, pipeline_slot_t *slots) {
+    if (!slots)
+        return;
+    for (unsigned int i = 0; i < job->queue_depth; i++)
+        platform_arena_free(job->arena, slots[i].buf);
+    free(slots);
+}
+
+/**
+ * @brief Prepare the next chunk for a slot
+ *
+ * @param job Pipeline description
+ * @param slot Slot to fill
+ * @param offset Byte offset of the chunk
+ */
+static void slot_begin_read(const pipeline_job_t *job, pipeline_slot_t *slot, uint64_t offset) {
+    slot->offset = offset;
+    slot->len = job->chunk_size;
+    if (job->length - offset < slot->len)
+        slot->len = (size_t)(job->length - offset);
+    slot->outlen = 0;
+    slot->done = 0;
+    slot->state = SLOT_READING;
+}
+
+/**
+ * @brief Queue occupancy: chunks between read submission and write completion
+ *
+ * @param job Pipeline description
+ * @param slots Slot ring
+ * @return Slots not free
+ */
+static unsigned int slots_in_flight(const pipeline_job_t *job, const pipeline_slot_t *slots) {
+    unsigned int busy = 0;
+    for (unsigned int i = 0; i < job->queue_depth; i++)
+        busy += slots[i].state != SLOT_FREE;
+    return busy;
+}
+
+/* ==============================================================================
+ * Thread engine: reader thread -> encryptor (caller) -> writer thread
+ * ============================================================================== */
+
+/**
+ * @brief Shared state of the thread-based pipeline
+ */
+typedef struct {
+    const pipeline_job_t *job; /**< Pipeline description */
+    pipeline_slot_t *slots;    /**< Slot ring */
+    uint64_t chunks;           /**< Total number of chunks */
+    int status;                /**< First error, ETDK_SUCCESS otherwise */
+    pthread_mutex_t lock;      /**< Protects slot states and status */
+    pthread_cond_t changed;    /**< Signalled on every state change */
+} thread_pipeline_t;
+
+/**
+ * @brief Wait until a slot reaches the wanted state or the run fails
+ *
+ * @param tp Pipeline state (lock held by caller)
+ * @param slot Slot to wait for
+ * @param state State to wait for
+ * @return 1 if the state was reached, 0 if the pipeline failed
+ */
+static int wait_slot(thread_pipeline_t *tp, const pipeline_slot_t *slot, slot_state_t state) {
+    while (slot->state != state && tp->status == ETDK_SUCCESS)
+        pthread_cond_wait(&tp->changed, &tp->lock);
+    return tp->status == ETDK_SUCCESS;
+}
+
+/**
+ * @brief Record an error and wake all stages
+ *
+ * @param tp Pipeline state
+ * @param status Error code
+ */
+static void fail_pipeline(thread_pipeline_t *tp, int status) {
+    pthread_mutex_lock(&tp->lock);
+    if (tp->status == ETDK_SUCCESS)
+        tp->status = status;
+    pthread_cond_broadcast(&tp->changed);
+    pthread_mutex_unlock(&tp->lock);
+}
+
+/**
+ * @brief Reader stage: keeps up to queue_depth chunks read ahead
+ *
+ * @param arg Pointer to thread_pipeline_t
+ * @return NULL
+ */
+static void *reader_thread(void *arg) {
+    thread_pipeline_t *tp = arg;
+    const pipeline_job_t *job = tp->job;
+
+    for (uint64_t seq = 0; seq < tp->chunks; seq++) {
+        pipeline_slot_t *slot = &tp->slots[seq % job->queue_depth];
+
+        pthread_mutex_lock(&tp->lock);
+        if (!wait_slot(tp, slot, SLOT_FREE)) {
+            pthread_mutex_unlock(&tp->lock);
+            return NULL;
+        }
+        slot_begin_read(job, slot, seq * job->chunk_size);
+        pthread_mutex_unlock(&tp->lock);
+
+        // Write-only runs (no source) hand the slot straight to the transform
+        uint64_t start = metrics_now(job->metrics);
+        if (job->in && platform_io_read(job->in, slot->buf, slot->len, slot->offset) != (int64_t)slot->len) {
+            fprintf(stderr, "\nError reading at offset %llu\n", (unsigned long long)slot->offset);
+            fail_pipeline(tp, ETDK_ERROR_IO);
+            return NULL;
+        }
+        if (job->in)
+            metrics_stage(job->metrics, METRIC_READ, start, slot->len);
+
+        pthread_mutex_lock(&tp->lock);
+        slot->state = SLOT_READ;
+        pthread_cond_broadcast(&tp->changed);
+        pthread_mutex_unlock(&tp->lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Writer stage: writes encrypted chunks behind the encryptor
+ *
+ * @param arg Pointer to thread_pipeline_t
+ * @return NULL
+ */
+static void *writer_thread(void *arg) {
+    thread_pipeline_t *tp = arg;
+    const pipeline_job_t *job = tp->job;
+    uint64_t processed = 0;
+
+    for (uint64_t seq = 0; seq < tp->chunks; seq++) {
+        pipeline_slot_t *slot = &tp->slots[seq % job->queue_depth];
+
+        pthread_mutex_lock(&tp->lock);
+        if (!wait_slot(tp, slot, SLOT_WRITING)) {
+            pthread_mutex_unlock(&tp->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&tp->lock);
+
+        uint64_t start = metrics_now(job->metrics);
+        if (slot->outlen > 0 && platform_io_write(job->out, slot->buf, slot->outlen, slot->offset) != ETDK_SUCCESS) {
+            fprintf(stderr, "\nError writing at offset %llu\n", (unsigned long long)slot->offset);
+            fail_pipeline(tp, ETDK_ERROR_IO);
+            return NULL;
+        }
+        if (slot->outlen > 0)
+            metrics_stage(job->metrics, METRIC_WRITE, start, slot->outlen);
+        processed += slot->len;
+        if (job->progress)
+            job->progress(job->arg, processed);
+
+        pthread_mutex_lock(&tp->lock);
+        slot->state = SLOT_FREE;
+        pthread_cond_broadcast(&tp->changed);
+        pthread_mutex_unlock(&tp->lock);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Run the pipeline with a reader and a writer thread
+ *
+ * The calling thread is the encryptor, so the transform is always invoked
+ * from one thread and in offset order.
+ *
+ * @param job Pipeline description
+ * @return ETDK_SUCCESS or error code
+ */
+static int run_threads(const pipeline_job_t *job) {
+    thread_pipeline_t tp;
+    memset(&tp, 0, sizeof(tp));
+    tp.job = job;
+    tp.chunks = (job->length + job->chunk_size - 1) / job->chunk_size;
+    tp.slots = alloc_slots(job);
+    if (!tp.slots)
+        return ETDK_ERROR_MEMORY;
+
+    pthread_mutex_init(&tp.lock, NULL);
+    pthread_cond_init(&tp.changed, NULL);
+
+    pthread_t reader, writer;
+    int have_reader = pthread_create(&reader, NULL, reader_thread, &tp) == 0;
+    int have_writer = have_reader && pthread_create(&writer, NULL, writer_thread, &tp) == 0;
+    if (!have_writer)
+        fail_pipeline(&tp, ETDK_ERROR_MEMORY);
+
+    for (uint64_t seq = 0; have_writer && seq < tp.chunks; seq++) {
+        pipeline_slot_t *slot = &tp.slots[seq % job->queue_depth];
+
+        pthread_mutex_lock(&tp.lock);
+        if (!wait_slot(&tp, slot, SLOT_READ)) {
+            pthread_mutex_unlock(&tp.lock);
+            break;
+        }
+        if (job->metrics)
+            metrics_record(job->metrics, METRIC_QUEUE, slots_in_flight(job, tp.slots));
+        pthread_mutex_unlock(&tp.lock);
+
+        uint64_t start = metrics_now(job->metrics);
+        if (job->transform(job->arg, slot->buf, slot->len, slot->offset, &slot->outlen) != ETDK_SUCCESS) {
+            fail_pipeline(&tp, ETDK_ERROR_CRYPTO);
+            break;
+        }
+        metrics_stage(job->metrics, METRIC_ENCRYPT, start, slot->len);
+
+        pthread_mutex_lock(&tp.lock);
+        slot->state = SLOT_WRITING;
+        pthread_cond_broadcast(&tp.changed);
+        pthread_mutex_unlock(&tp.lock);
+    }
+
+    if (have_reader)
+        pthread_join(reader, NULL);
+    if (have_writer)
+        pthread_join(writer, NULL);
+
+    pthread_cond_destroy(&tp.changed);
+    pthread_mutex_destroy(&tp.lock);
+    free_slots(job, tp.slots);
+
+    return tp.status;
+}
+
+/* ==============================================================================
+ * io_uring engine (Linux 5.1+, raw system calls, no liburing dependency)
+ * ============================================================================== */
+
+#ifdef HAVE_IO_URING
+
+/**
+ * @brief Mapped submission/completion rings
+ */
+typedef struct {
+    int fd;                         /**< io_uring file descriptor */
+    void *sq_ptr;                   /**< Submission ring mapping */
+    void *cq_ptr;                   /**< Completion ring mapping (may equal sq_ptr) */
+    size_t sq_size;                 /**< Size of sq_ptr mapping */
+    size_t cq_size;                 /**< Size of cq_ptr mapping */
+    struct io_uring_sqe *sqes;      /**< Submission queue entries */
+    size_t sqes_size;               /**< Size of sqes mapping */
+    unsigned *sq_head, *sq_tail;    /**< Submission ring indices */
+    unsigned *sq_mask, *sq_array;   /**< Submission ring mask and index array */
+    unsigned *cq_head, *cq_tail;    /**< Completion ring indices */
+    unsigned *cq_mask;              /**< Completion ring mask */
+    struct io_uring_cqe *cqes;      /**< Completion queue entries */
+    unsigned pending;               /**< SQEs queued but not yet submitted */
+} uring_t;
+
+/**
+ * @brief Create an io_uring instance and map its rings
+ *
+ * @param ring Ring to initialize
+ * @param entries Number of submission entries
+ * @return 0 on success, -1 if io_uring is unavailable
+ */
+static int uring_setup(uring_t *ring, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+        return -1;
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_size > ring->sq_size)
+            ring->sq_size = ring->cq_size;
+        ring->cq_size = ring->sq_size;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED)
+        goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_size);
+            goto fail;
+        }
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ptr != ring->sq_ptr)
+            munmap(ring->cq_ptr, ring->cq_size);
+        munmap(ring->sq_ptr, ring->sq_size);
+        goto fail;
+    }
+
+    unsigned char *sq = ring->sq_ptr;
+    unsigned char *cq = ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    return 0;
+
+fail:
+    close(ring->fd);
+    return -1;
+}
+
+/**
+ * @brief Unmap rings and close the io_uring descriptor
+ *
+ * @param ring Ring from uring_setup()
+ */
+static void uring_teardown(uring_t *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ptr != ring->sq_ptr)
+        munmap(ring->cq_ptr, ring->cq_size);
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+}
+
+/**
+ * @brief Queue a vectored read or write for a slot
+ *
+ * @param ring Ring
+ * @param opcode IORING_OP_READV or IORING_OP_WRITEV
+ * @param fd Target descriptor
+ * @param iov I/O vector (must stay valid until completion)
+ * @param offset Absolute byte offset
+ * @param tag Slot index returned in the completion
+ */
+static void uring_queue(uring_t *ring, int opcode, int fd, struct iovec *iov, uint64_t offset, unsigned tag) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (uint8_t)opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = 1;
+    sqe->off = offset;
+    sqe->user_data = tag;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->pending++;
+}
+
+/**
+ * @brief Submit queued entries and optionally wait for a completion
+ *
+ * @param ring Ring
+ * @param wait Number of completions to wait for
+ * @return 0 on success, -1 on error
+ */
+static int uring_enter(uring_t *ring, unsigned wait) {
+    for (;;) {
+        long ret = syscall(__NR_io_uring_enter, ring->fd, ring->pending, wait, wait ? IORING_ENTER_GETEVENTS : 0,
+                           NULL, 0);
+        if (ret >= 0) {
+            ring->pending -= (unsigned)ret;
+            return 0;
+        }
+        if (errno != EINTR)
+            return -1;
+    }
+}
+
+/**
+ * @brief Run the pipeline on io_uring
+ *
+ * Reads are queued for every free slot ahead of the encryptor and writes
+ * are queued as soon as a chunk is encrypted; the only blocking point is
+ * waiting for the next completion when no slot can make progress.
+ *
+ * @param job Pipeline description
+ * @return ETDK_SUCCESS, error code, or 1 if io_uring is unavailable
+ */
+static int run_uring(const pipeline_job_t *job) {
+    uring_t ring;
+    if (uring_setup(&ring, job->queue_depth * 2) != 0)
+        return 1;
+
+    pipeline_slot_t *slots = alloc_slots(job);
+    struct iovec *iov = calloc(job->queue_depth, sizeof(struct iovec));
+    if (!slots || !iov) {
+        free_slots(job, slots);
+        free(iov);
+        uring_teardown(&ring);
+        return ETDK_ERROR_MEMORY;
+    }
+
+    uint64_t chunks = (job->length + job->chunk_size - 1) / job->chunk_size;
+    uint64_t next_read = 0, next_encrypt = 0, written = 0, processed = 0;
+    unsigned inflight = 0;
+    int status = ETDK_SUCCESS;
+
+    while (written < chunks && status == ETDK_SUCCESS) {
+        // Fill free slots with read-ahead
+        while (next_read < chunks && slots[next_read % job->queue_depth].state == SLOT_FREE) {
+            unsigned tag = (unsigned)(next_read % job->queue_depth);
+            slot_begin_read(job, &slots[tag], next_read * job->chunk_size);
+            next_read++;
+            if (!job->in) {
+                slots[tag].state = SLOT_READ; // Write-only run: nothing to read
+                continue;
+            }
+            iov[tag].iov_base = slots[tag].buf;
+            iov[tag].iov_len = slots[tag].len;
+            slots[tag].started = metrics_now(job->metrics);
+            uring_queue(&ring, IORING_OP_READV, job->in->fd, &iov[tag], slots[tag].offset, tag);
+            inflight++;
+        }
+
+        // Encrypt chunks whose reads completed, in order, and queue their writes
+        while (next_encrypt < next_read && slots[next_encrypt % job->queue_depth].state == SLOT_READ) {
+            unsigned tag = (unsigned)(next_encrypt % job->queue_depth);
+            pipeline_slot_t *slot = &slots[tag];
+            if (job->metrics)
+                metrics_record(job->metrics, METRIC_QUEUE, slots_in_flight(job, slots));
+            uint64_t start = metrics_now(job->metrics);
+            if (job->transform(job->arg, slot->buf, slot->len, slot->offset, &slot->outlen) != ETDK_SUCCESS) {
+                status = ETDK_ERROR_CRYPTO;
+                break;
+            }
+            metrics_stage(job->metrics, METRIC_ENCRYPT, start, slot->len);
+            slot->state = SLOT_WRITING;
+            slot->done = 0;
+            if (slot->outlen == 0) {
+                // Nothing to write yet (CBC held back a partial block)
+                slot->state = SLOT_FREE;
+                processed += slot->len;
+                written++;
+                if (job->progress)
+                    job->progress(job->arg, processed);
+            } else {
+                iov[tag].iov_base = slot->buf;
+                iov[tag].iov_len = slot->outlen;
+                slot->started = metrics_now(job->metrics);
+                uring_queue(&ring, IORING_OP_WRITEV, job->out->fd, &iov[tag], slot->offset, tag);
+                inflight++;
+            }
+            next_encrypt++;
+        }
+        if (status != ETDK_SUCCESS || written == chunks)
+            break;
+
+        if (uring_enter(&ring, inflight ? 1 : 0) != 0) {
+            perror("\nio_uring_enter");
+            status = ETDK_ERROR_IO;
+            break;
+        }
+
+        // Reap completions
+        unsigned head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            unsigned tag = (unsigned)cqe->user_data;
+            int res = cqe->res;
+            pipeline_slot_t *slot = &slots[tag];
+            head++;
+            inflight--;
+
+            size_t want = (slot->state == SLOT_READING) ? slot->len : slot->outlen;
+            if (res <= 0) {
+                fprintf(stderr, "\nError %s at offset %llu: %s\n", slot->state == SLOT_READING ? "reading" : "writing",
+                        (unsigned long long)slot->offset, res ? strerror(-res) : "unexpected end of data");
+                status = ETDK_ERROR_IO;
+                continue;
+            }
+
+            slot->done += (size_t)res;
+            if (slot->done < want) {
+                // Short transfer: resubmit the remainder
+                iov[tag].iov_base = slot->buf + slot->done;
+                iov[tag].iov_len = want - slot->done;
+                uring_queue(&ring, slot->state == SLOT_READING ? IORING_OP_READV : IORING_OP_WRITEV,
+                            slot->state == SLOT_READING ? job->in->fd : job->out->fd, &iov[tag],
+                            slot->offset + slot->done, tag);
+                inflight++;
+            } else if (slot->state == SLOT_READING) {
+                // Latency from submission to completion, including time queued in the ring
+                metrics_stage(job->metrics, METRIC_READ, slot->started, slot->len);
+                slot->state = SLOT_READ;
+            } else {
+                metrics_stage(job->metrics, METRIC_WRITE, slot->started, slot->outlen);
+                slot->state = SLOT_FREE;
+                processed += slot->len;
+                written++;
+                if (job->progress)
+                    job->progress(job->arg, processed);
+            }
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    // Drain in-flight requests before the buffers are freed
+    while (inflight > 0 && uring_enter(&ring, 1) == 0) {
+        unsigned head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            head++;
+            inflight--;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    free(iov);
+    free_slots(job, slots);
+    uring_teardown(&ring);
+
+    return status;
+}
+
+#endif // HAVE_IO_URING
+
+/**
+ * @brief Run an asynchronous read/encrypt/write pipeline
+ *
+ * Uses io_uring when it was compiled in and the kernel allows it, and
+ * otherwise the reader/writer thread engine. Both keep queue_depth chunks
+ * in flight so that disk and CPU work overlap.
+ *
+ * @param job Pipeline description
+ * @param engine Requested engine
+ * @return ETDK_SUCCESS or error code
+ */
+int pipeline_run(const pipeline_job_t *job, etdk_io_engine_t engine) {
+    if (!job || !job->out || !job->transform || job->chunk_size == 0 || job->queue_depth == 0 ||
+        job->chunk_size % AES_BLOCK_SIZE != 0) {
+        return ETDK_ERROR_PLATFORM;
+    }
+    if (job->length == 0)
+        return ETDK_SUCCESS;
+
+#ifdef HAVE_IO_URING
+    if (engine != ETDK_IO_THREADS) {
+        int result = run_uring(job);
+        if (result != 1) {
+            return result;
+        }
+        if (engine == ETDK_IO_URING)
+            fprintf(stderr, "io_uring unavailable, using thread engine\n");
+    }
+#else
+    if (engine == ETDK_IO_URING)
+        fprintf(stderr, "io_uring not supported by this build, using thread engine\n");
+#endif
+
+    return run_threads(job);
+}
+
+/**
+ * @brief Name of the engine pipeline_run() will use
+ *
+ * Probes io_uring availability without keeping the instance.
+ *
+ * @param engine Requested engine
+ * @return "io_uring" or "threads"
+ */
+const char *pipeline_engine_name(etdk_io_engine_t engine) {
+#ifdef HAVE_IO_URING
+    if (engine != ETDK_IO_THREADS) {
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        int fd = (int)syscall(__NR_io_uring_setup, 2, &p);
+        if (fd >= 0) {
+            close(fd);
+            return "io_uring";
+        }
+    }
+#else
+    (void)engine;
+#endif
+    return "threads";
+}
@@ -3,9 +3,18 @@
  * Platform-specific functions for Windows, Linux, and macOS
  */
 
+#ifdef PLATFORM_LINUX
+#define _GNU_SOURCE // O_DIRECT
+#endif
+
 #include "etdk.h"
 // cppcheck-suppress-begin missingIncludeSystem
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 
 #ifdef PLATFORM_WINDOWS
@@ -16,7 +25,14 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #ifdef PLATFORM_LINUX
+#include <limits.h>
 #include <linux/fs.h>
+#include <sched.h>
+#include <sys/sysmacros.h>
+#if defined(__aarch64__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
 #endif
 #ifdef PLATFORM_MACOS
 #include <sys/disk.h>
@@ -116,6 +132,281 @@ int platform_get_device_size(const char *device_path, uint64_t *size) {
     return ETDK_SUCCESS;
 }
 
+/**
+ * @brief Read a block queue limit from sysfs
+ *
+ * Resolves the device number of device_path and reads
+ * /sys/dev/block/<major>:<minor>/queue/<attr>. Partitions have no queue
+ * directory of their own, so the parent disk's queue is used for them.
+ *
+ * @param device_path Path to the block device
+ * @param attr Attribute name, e.g. "discard_granularity"
+ * @param value Pointer where the value will be stored
+ * @return ETDK_SUCCESS, or ETDK_ERROR_PLATFORM if unavailable
+ */
+int platform_get_queue_limit(const char *device_path, const char *attr, uint64_t *value) {
+    if (!device_path || !attr || !value) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+#ifdef PLATFORM_LINUX
+    struct stat st;
+    if (stat(device_path, &st) != 0 || !S_ISBLK(st.st_mode)) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    const char *layouts[] = {"/sys/dev/block/%u:%u/queue/%s", "/sys/dev/block/%u:%u/../queue/%s"};
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        char sysfs_path[256];
+        snprintf(sysfs_path, sizeof(sysfs_path), layouts[i], major(st.st_rdev), minor(st.st_rdev), attr);
+
+        FILE *f = fopen(sysfs_path, "r");
+        if (!f)
+            continue;
+
+        unsigned long long v;
+        int ok = fscanf(f, "%llu", &v) == 1;
+        fclose(f);
+        if (ok) {
+            *value = v;
+            return ETDK_SUCCESS;
+        }
+    }
+#else
+    (void)attr;
+#endif
+
+    return ETDK_ERROR_PLATFORM;
+}
+
+/**
+ * @brief NUMA node of the controller a block device is attached to
+ *
+ * Resolves /sys/dev/block/<major>:<minor>/device (the parent disk's for
+ * partitions) and walks up the device tree until an ancestor reports a
+ * numa_node: SCSI and SATA disks only have one on their host adapter's
+ * PCI function, NVMe namespaces on the controller.
+ *
+ * @param device_path Path to the block device
+ * @return Node number, or -1 if unknown or the system has no NUMA topology
+ */
+int platform_get_numa_node(const char *device_path) {
+    if (!device_path) {
+        return -1;
+    }
+
+#ifdef PLATFORM_LINUX
+    struct stat st;
+    if (stat(device_path, &st) != 0 || !S_ISBLK(st.st_mode)) {
+        return -1;
+    }
+
+    const char *layouts[] = {"/sys/dev/block/%u:%u/device", "/sys/dev/block/%u:%u/../device"};
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+        char link[64];
+        char dir[PATH_MAX];
+        snprintf(link, sizeof(link), layouts[i], major(st.st_rdev), minor(st.st_rdev));
+        if (!realpath(link, dir))
+            continue;
+
+        while (strncmp(dir, "/sys/devices/", strlen("/sys/devices/")) == 0) {
+            char attr[PATH_MAX + 16];
+            snprintf(attr, sizeof(attr), "%s/numa_node", dir);
+
+            FILE *f = fopen(attr, "r");
+            if (f) {
+                int node;
+                int ok = fscanf(f, "%d", &node) == 1;
+                fclose(f);
+                if (ok)
+                    return node < 0 ? -1 : node;
+            }
+
+            char *slash = strrchr(dir, '/');
+            if (!slash)
+                break;
+            *slash = '\0';
+        }
+    }
+#endif
+
+    return -1;
+}
+
+/**
+ * @brief Restrict the calling thread to the CPUs of a NUMA node
+ *
+ * Reads /sys/devices/system/node/node<N>/cpulist ("0-15,32-47"). Threads
+ * created afterwards inherit the mask, so pinning the thread that starts
+ * a device's engine pins all of its workers, and the buffers it faults
+ * in are allocated on the same node.
+ *
+ * @param node Node number
+ * @return ETDK_SUCCESS, or ETDK_ERROR_PLATFORM if unsupported or the node has no CPUs
+ */
+int platform_pin_to_numa_node(int node) {
+#ifdef PLATFORM_LINUX
+    char path[64];
+    char list[4096];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return ETDK_ERROR_PLATFORM;
+    }
+    int ok = fgets(list, sizeof(list), f) != NULL;
+    fclose(f);
+    if (!ok) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    char *save = NULL;
+    for (char *range = strtok_r(list, ",\n", &save); range; range = strtok_r(NULL, ",\n", &save)) {
+        unsigned int first, last;
+        int n = sscanf(range, "%u-%u", &first, &last);
+        if (n < 1)
+            continue;
+        if (n == 1)
+            last = first;
+        for (unsigned int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &set);
+    }
+
+    if (CPU_COUNT(&set) == 0 || pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        return ETDK_ERROR_PLATFORM;
+    }
+    return ETDK_SUCCESS;
+#else
+    (void)node;
+    return ETDK_ERROR_PLATFORM;
+#endif
+}
+
+/**
+ * @brief Get human-readable name of a discard primitive
+ *
+ * @param method Primitive reported by platform_discard_device()
+ * @return Static string such as "BLKSECDISCARD"
+ */
+const char *platform_discard_name(platform_discard_t method) {
+    switch (method) {
+    case PLATFORM_DISCARD_SECURE:
+        return "BLKSECDISCARD (secure erase of the mapped blocks)";
+    case PLATFORM_DISCARD_UNMAP:
+        return "BLKDISCARD (unmap, advisory - data may persist in flash)";
+    case PLATFORM_DISCARD_ZEROOUT:
+        return "BLKZEROOUT (zeroes written/unmapped by the device)";
+    default:
+        return "none";
+    }
+}
+
+#ifdef PLATFORM_LINUX
+/**
+ * @brief Issue one discard primitive over a range in large aligned pieces
+ *
+ * @param fd Device opened for writing
+ * @param request BLKSECDISCARD, BLKDISCARD or BLKZEROOUT
+ * @param start First byte (aligned)
+ * @param end End byte (aligned, exclusive)
+ * @param piece Maximum bytes per ioctl
+ * @return 0 on success, errno of the first failing ioctl otherwise
+ */
+static int discard_range(int fd, unsigned long request, uint64_t start, uint64_t end, uint64_t piece) {
+    for (uint64_t off = start; off < end; off += piece) {
+        uint64_t range[2] = {off, (end - off < piece) ? end - off : piece};
+        if (ioctl(fd, request, range) != 0) {
+            return errno ? errno : EIO;
+        }
+    }
+    return 0;
+}
+#endif
+
+/**
+ * @brief Discard a byte range of a block device
+ *
+ * Tries the primitives from strongest to weakest and stops at the first
+ * one the device accepts:
+ * 1. BLKSECDISCARD - discard and erase all copies (eMMC/UFS, some NVMe)
+ * 2. BLKDISCARD    - TRIM/UNMAP/Deallocate, fast but advisory
+ * 3. BLKZEROOUT    - write zeroes (offloaded as WRITE ZEROES/unmap where supported)
+ *
+ * The range is shrunk to the queue's discard_granularity and issued in
+ * pieces of at most discard_max_bytes (1 GB if unknown), read from sysfs.
+ *
+ * @param device_path Path to the block device
+ * @param offset First byte to discard
+ * @param length Number of bytes to discard
+ * @param used Receives the primitive that was accepted
+ * @return ETDK_SUCCESS, ETDK_ERROR_IO on failure, ETDK_ERROR_PLATFORM if unsupported
+ */
+int platform_discard_device(const char *device_path, uint64_t offset, uint64_t length, platform_discard_t *used) {
+    if (!device_path || !used) {
+        return ETDK_ERROR_PLATFORM;
+    }
+    *used = PLATFORM_DISCARD_NONE;
+
+#ifdef PLATFORM_LINUX
+    uint64_t granularity = 512;
+    uint64_t max_bytes = 0;
+    platform_get_queue_limit(device_path, "discard_granularity", &granularity);
+    platform_get_queue_limit(device_path, "discard_max_bytes", &max_bytes);
+    if (granularity < 512)
+        granularity = 512;
+
+    uint64_t piece = (max_bytes >= granularity) ? max_bytes - max_bytes % granularity : 0;
+    if (piece == 0 || piece > (1ULL << 30))
+        piece = (1ULL << 30) - (1ULL << 30) % granularity;
+
+    uint64_t start = (offset + granularity - 1) / granularity * granularity;
+    uint64_t end = (offset + length) / granularity * granularity;
+    if (end <= start) {
+        return ETDK_SUCCESS;
+    }
+
+    int fd = open(device_path, O_WRONLY);
+    if (fd < 0) {
+        return ETDK_ERROR_IO;
+    }
+
+    const struct {
+        unsigned long request;
+        platform_discard_t method;
+    } primitives[] = {
+        {BLKSECDISCARD, PLATFORM_DISCARD_SECURE},
+        {BLKDISCARD, PLATFORM_DISCARD_UNMAP},
+        {BLKZEROOUT, PLATFORM_DISCARD_ZEROOUT},
+    };
+
+    int result = ETDK_ERROR_PLATFORM;
+    for (size_t i = 0; i < sizeof(primitives) / sizeof(primitives[0]); i++) {
+        // Probe with the first piece; an unsupported primitive fails there
+        uint64_t probe_end = (end - start < piece) ? end : start + piece;
+        int err = discard_range(fd, primitives[i].request, start, probe_end, piece);
+        if (err == EOPNOTSUPP || err == ENOTTY || err == EINVAL) {
+            continue;
+        }
+        if (err == 0) {
+            err = discard_range(fd, primitives[i].request, probe_end, end, piece);
+        }
+
+        *used = primitives[i].method;
+        result = (err == 0) ? ETDK_SUCCESS : ETDK_ERROR_IO;
+        break;
+    }
+
+    close(fd);
+    return result;
+#else
+    (void)offset;
+    (void)length;
+    return ETDK_ERROR_PLATFORM;
+#endif
+}
+
 /**
  * @brief Check if a path points to a block device
  *
@@ -148,6 +439,31 @@ int platform_is_device(const char *path) {
 #endif
 }
 
+/**
+ * @brief Check if a path points to a directory
+ *
+ * Symbolic links are not followed, matching the batch directory walk.
+ *
+ * @param path Path to check
+ * @return 1 if path is a directory, 0 otherwise
+ */
+int platform_is_directory(const char *path) {
+    if (!path)
+        return 0;
+
+    struct stat st;
+#ifdef PLATFORM_WINDOWS
+    if (stat(path, &st) != 0)
+#else
+    if (lstat(path, &st) != 0)
+#endif
+    {
+        return 0;
+    }
+
+    return S_ISDIR(st.st_mode);
+}
+
 /**
  * @brief Lock memory pages to prevent swapping to disk
  *
@@ -191,3 +507,994 @@ int platform_unlock_memory(void *addr, size_t len) {
     return (munlock(addr, len) == 0) ? ETDK_SUCCESS : ETDK_ERROR_PLATFORM;
 #endif
 }
+
+/**
+ * @brief Read exactly len bytes from a file descriptor at an absolute offset
+ *
+ * pread() may return fewer bytes than requested (signals, pipes, some
+ * drivers). This helper loops until the buffer is full or end of file
+ * is reached, so callers can treat a short result as EOF.
+ *
+ * @param fd Open file descriptor
+ * @param buf Destination buffer
+ * @param len Number of bytes to read
+ * @param offset Absolute byte offset to read from
+ * @return Number of bytes read, or -1 on error
+ */
+int64_t platform_pread_full(int fd, void *buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = pread(fd, (unsigned char *)buf + done, len - done, (off_t)(offset + done));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break; // End of file/device
+        done += (size_t)n;
+    }
+
+    return (int64_t)done;
+}
+
+/**
+ * @brief Write exactly len bytes to a file descriptor at an absolute offset
+ *
+ * Loops over short writes and EINTR. A write that makes no progress is
+ * reported as an I/O error (e.g. end of device reached).
+ *
+ * @param fd Open file descriptor
+ * @param buf Source buffer
+ * @param len Number of bytes to write
+ * @param offset Absolute byte offset to write to
+ * @return ETDK_SUCCESS on success, ETDK_ERROR_IO on failure
+ */
+int platform_pwrite_full(int fd, const void *buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = pwrite(fd, (const unsigned char *)buf + done, len - done, (off_t)(offset + done));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return ETDK_ERROR_IO;
+        }
+        if (n == 0)
+            return ETDK_ERROR_IO;
+        done += (size_t)n;
+    }
+
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Number of bytes a file actually occupies on disk
+ *
+ * st_blocks counts 512-byte units regardless of the filesystem block
+ * size. A value below the apparent size means the file has holes.
+ *
+ * @param fd Open file descriptor
+ * @param bytes Receives the allocated size in bytes
+ * @return ETDK_SUCCESS or ETDK_ERROR_IO
+ */
+int platform_allocated_size(int fd, uint64_t *bytes) {
+    struct stat st;
+    if (!bytes || fstat(fd, &st) != 0) {
+        return ETDK_ERROR_IO;
+    }
+
+#ifdef PLATFORM_WINDOWS
+    *bytes = (uint64_t)st.st_size;
+#else
+    *bytes = (uint64_t)st.st_blocks * 512;
+#endif
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Check whether a file has holes
+ *
+ * Asks the filesystem with SEEK_HOLE instead of comparing st_blocks with
+ * the size: compressed or deduplicated files (btrfs, ZFS) also occupy
+ * fewer blocks than they are long, but every byte of them is data. A
+ * file without holes reports its only "hole" at the end of the file.
+ *
+ * @param fd Open file descriptor (its file offset is preserved)
+ * @param length Apparent file size
+ * @return Non-zero if a hole starts before length, 0 otherwise or without hole support
+ */
+int platform_has_holes(int fd, uint64_t length) {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    off_t hole = lseek(fd, 0, SEEK_HOLE);
+    if (pos >= 0)
+        lseek(fd, pos, SEEK_SET);
+    return hole >= 0 && (uint64_t)hole < length;
+#else
+    (void)fd;
+    (void)length;
+    return 0;
+#endif
+}
+
+/**
+ * @brief Find the next allocated data range of a file
+ *
+ * Uses lseek() with SEEK_DATA/SEEK_HOLE, so only extents that are backed
+ * by storage are reported and holes can be skipped. Where the filesystem
+ * or platform has no hole support the rest of the file is reported as one
+ * data range (every filesystem may treat the whole file as data).
+ *
+ * @param fd Open file descriptor
+ * @param from Offset to search from
+ * @param length Apparent file size; ranges are clipped to it
+ * @param start Receives the first byte of the data range
+ * @param end Receives the end (exclusive) of the data range
+ * @return 1 if a data range was found, 0 if there is no data after from, -1 on error
+ */
+int platform_next_data(int fd, uint64_t from, uint64_t length, uint64_t *start, uint64_t *end) {
+    if (from >= length) {
+        return 0;
+    }
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t data = lseek(fd, (off_t)from, SEEK_DATA);
+    if (data < 0) {
+        if (errno == ENXIO)
+            return 0; // Only a hole is left
+        if (errno != EINVAL && errno != ENOTSUP)
+            return -1;
+    } else {
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0)
+            return -1;
+        if ((uint64_t)data >= length)
+            return 0;
+        *start = (uint64_t)data;
+        *end = ((uint64_t)hole < length) ? (uint64_t)hole : length;
+        return 1;
+    }
+#else
+    (void)fd;
+#endif
+
+    // No hole support: everything from here on is data
+    *start = from;
+    *end = length;
+    return 1;
+}
+
+/**
+ * @brief Get the logical block size of a device
+ *
+ * Platform-specific implementation:
+ * - Linux: Uses ioctl() with BLKSSZGET
+ * - macOS: Uses ioctl() with DKIOCGETBLOCKSIZE
+ * - Regular files and other platforms: 512 bytes
+ *
+ * @param device_path Path to the device or file
+ * @param block_size Pointer where block size will be stored (in bytes)
+ * @return ETDK_SUCCESS on success, ETDK_ERROR_IO if the path cannot be opened
+ */
+int platform_get_block_size(const char *device_path, uint32_t *block_size) {
+    if (!device_path || !block_size) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    *block_size = 512;
+
+#if defined(PLATFORM_LINUX) || defined(PLATFORM_MACOS)
+    int fd = open(device_path, O_RDONLY);
+    if (fd < 0) {
+        return ETDK_ERROR_IO;
+    }
+
+#ifdef PLATFORM_LINUX
+    int ssz = 0;
+    if (ioctl(fd, BLKSSZGET, &ssz) == 0 && ssz > 0) {
+        *block_size = (uint32_t)ssz;
+    }
+#else
+    uint32_t bsz = 0;
+    if (ioctl(fd, DKIOCGETBLOCKSIZE, &bsz) == 0 && bsz > 0) {
+        *block_size = bsz;
+    }
+#endif
+
+    close(fd);
+#endif
+
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Read the I/O geometry of a device or file
+ *
+ * - Block devices (Linux): logical_block_size, minimum_io_size,
+ *   optimal_io_size, max_sectors_kb and rotational from the sysfs queue
+ *   directory; other platforms report the logical block size only
+ * - Regular files: st_blksize as the preferred request size
+ *
+ * @param path Path to the device or file
+ * @param hints Receives the geometry (unknown fields 0, rotational -1)
+ * @return ETDK_SUCCESS, or ETDK_ERROR_IO if the path cannot be examined
+ */
+int platform_get_io_hints(const char *path, platform_io_hints_t *hints) {
+    if (!path || !hints) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    memset(hints, 0, sizeof(*hints));
+    hints->rotational = -1;
+
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return ETDK_ERROR_IO;
+    }
+
+#ifndef PLATFORM_WINDOWS
+    if (!S_ISBLK(st.st_mode)) {
+        hints->optimal_io_size = (uint32_t)st.st_blksize;
+        return ETDK_SUCCESS;
+    }
+#endif
+
+    platform_get_block_size(path, &hints->logical_block_size);
+
+    uint64_t v;
+    if (platform_get_queue_limit(path, "minimum_io_size", &v) == ETDK_SUCCESS)
+        hints->minimum_io_size = (uint32_t)v;
+    if (platform_get_queue_limit(path, "optimal_io_size", &v) == ETDK_SUCCESS)
+        hints->optimal_io_size = (uint32_t)v;
+    if (platform_get_queue_limit(path, "max_sectors_kb", &v) == ETDK_SUCCESS && v < UINT32_MAX / 1024)
+        hints->max_transfer = (uint32_t)(v * 1024);
+    if (platform_get_queue_limit(path, "rotational", &v) == ETDK_SUCCESS)
+        hints->rotational = v != 0;
+
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Open a device or file for positional I/O
+ *
+ * With direct set, the page cache is bypassed so wiping a large device
+ * neither copies every byte through kernel buffers nor evicts other
+ * cached data:
+ * - Linux: open() with O_DIRECT, retried without it if the filesystem
+ *   rejects the flag (e.g. tmpfs returns EINVAL)
+ * - macOS: fcntl() with F_NOCACHE
+ *
+ * @param io Handle to initialize
+ * @param path Path to the device or file
+ * @param direct Non-zero to request direct I/O
+ * @return ETDK_SUCCESS on success, ETDK_ERROR_IO on failure
+ */
+int platform_io_open(platform_io_t *io, const char *path, int direct) {
+    if (!io || !path) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    io->fd = -1;
+    io->direct = 0;
+    if (platform_get_block_size(path, &io->block_size) != ETDK_SUCCESS) {
+        return ETDK_ERROR_IO;
+    }
+
+#ifdef PLATFORM_LINUX
+    if (direct) {
+        io->fd = open(path, O_RDWR | O_DIRECT);
+        io->direct = (io->fd >= 0);
+    }
+#endif
+    if (io->fd < 0) {
+        io->fd = open(path, O_RDWR);
+    }
+    if (io->fd < 0) {
+        return ETDK_ERROR_IO;
+    }
+
+#ifdef PLATFORM_MACOS
+    if (direct && fcntl(io->fd, F_NOCACHE, 1) == 0) {
+        io->direct = 1;
+    }
+#endif
+
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Switch a descriptor from direct to buffered I/O
+ *
+ * Called when the kernel rejects a direct transfer with EINVAL, typically
+ * for an unaligned tail of a regular file. Clearing the flag on the shared
+ * descriptor is idempotent, so concurrent workers may race here safely.
+ *
+ * @param fd File descriptor
+ * @return 1 if direct I/O was active and has been disabled, 0 otherwise
+ */
+static int io_drop_direct(int fd) {
+#ifdef PLATFORM_LINUX
+    int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0 && (flags & O_DIRECT)) {
+        return fcntl(fd, F_SETFL, flags & ~O_DIRECT) == 0;
+    }
+#else
+    (void)fd;
+#endif
+    return 0;
+}
+
+/**
+ * @brief Read from an I/O handle
+ *
+ * @param io Open handle
+ * @param buf Destination buffer (aligned for direct I/O)
+ * @param len Number of bytes to read
+ * @param offset Absolute byte offset
+ * @return Number of bytes read, or -1 on error
+ */
+int64_t platform_io_read(const platform_io_t *io, void *buf, size_t len, uint64_t offset) {
+    int64_t n = platform_pread_full(io->fd, buf, len, offset);
+
+    if (n < 0 && errno == EINVAL && io->direct) {
+        io_drop_direct(io->fd);
+        n = platform_pread_full(io->fd, buf, len, offset);
+    }
+
+    return n;
+}
+
+/**
+ * @brief Write to an I/O handle
+ *
+ * @param io Open handle
+ * @param buf Source buffer (aligned for direct I/O)
+ * @param len Number of bytes to write
+ * @param offset Absolute byte offset
+ * @return ETDK_SUCCESS on success, ETDK_ERROR_IO on failure
+ */
+int platform_io_write(const platform_io_t *io, const void *buf, size_t len, uint64_t offset) {
+    int result = platform_pwrite_full(io->fd, buf, len, offset);
+
+    if (result != ETDK_SUCCESS && errno == EINVAL && io->direct) {
+        io_drop_direct(io->fd);
+        result = platform_pwrite_full(io->fd, buf, len, offset);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Flush and close an I/O handle
+ *
+ * Direct I/O bypasses the page cache but not the drive's volatile write
+ * cache, so fsync() is issued in both modes before closing.
+ *
+ * @param io Open handle
+ * @return ETDK_SUCCESS on success, ETDK_ERROR_IO if fsync() failed
+ */
+int platform_io_close(platform_io_t *io) {
+    if (!io || io->fd < 0) {
+        return ETDK_SUCCESS;
+    }
+
+    int result = (fsync(io->fd) == 0) ? ETDK_SUCCESS : ETDK_ERROR_IO;
+    close(io->fd);
+    io->fd = -1;
+
+    return result;
+}
+
+/**
+ * @brief Start tracking the write-out of an output
+ *
+ * @param wb State to initialize
+ * @param fd Output descriptor, or -1 to disable
+ * @param source Input descriptor read in step with the output, or -1
+ */
+void platform_writeback_init(platform_writeback_t *wb, int fd, int source) {
+    wb->fd = fd;
+    wb->source = source;
+    wb->started = 0;
+    wb->dropped = 0;
+    wb->failed = 0;
+}
+
+/**
+ * @brief Drop a written-back range of the output (and input) from the page cache
+ *
+ * @param wb Write-out state
+ * @param offset Range start
+ * @param len Range length in bytes, 0 = to the end of the file
+ */
+static void writeback_drop(const platform_writeback_t *wb, uint64_t offset, uint64_t len) {
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(wb->fd, (off_t)offset, (off_t)len, POSIX_FADV_DONTNEED);
+    if (wb->source >= 0)
+        posix_fadvise(wb->source, (off_t)offset, (off_t)len, POSIX_FADV_DONTNEED);
+#else
+    (void)wb;
+    (void)offset;
+    (void)len;
+#endif
+}
+
+/**
+ * @brief Advance the write cursor, writing back and dropping completed windows
+ *
+ * Once a full ETDK_WRITEBACK_WINDOW has been written since the last call,
+ * its write-out is started with sync_file_range(SYNC_FILE_RANGE_WRITE),
+ * which does not block on the device. The window submitted the call before
+ * is then waited for and, now clean, dropped with POSIX_FADV_DONTNEED.
+ * Dirty data stays bounded to about two windows instead of growing until
+ * the kernel's dirty limits throttle every writer on the host, and a long
+ * wipe does not evict the page cache of other processes. Durability still
+ * comes from platform_writeback_finish().
+ *
+ * sync_file_range() consumes write errors it waits for, so they are kept
+ * in wb->failed for platform_writeback_finish() to report.
+ *
+ * @param wb Write-out state
+ * @param cursor Bytes written so far from offset 0
+ */
+void platform_writeback_advance(platform_writeback_t *wb, uint64_t cursor) {
+    if (!wb || wb->fd < 0 || cursor < wb->started + ETDK_WRITEBACK_WINDOW) {
+        return;
+    }
+
+#ifdef PLATFORM_LINUX
+    if (sync_file_range(wb->fd, (off_t)wb->started, (off_t)(cursor - wb->started), SYNC_FILE_RANGE_WRITE) != 0)
+        wb->failed = 1;
+
+    if (wb->started > wb->dropped) {
+        if (sync_file_range(wb->fd, (off_t)wb->dropped, (off_t)(wb->started - wb->dropped),
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) != 0)
+            wb->failed = 1;
+        writeback_drop(wb, wb->dropped, wb->started - wb->dropped);
+        wb->dropped = wb->started;
+    }
+#endif
+    wb->started = cursor;
+}
+
+/**
+ * @brief Make the output durable with one fdatasync() and drop the rest of its cache
+ *
+ * @param wb Write-out state
+ * @return ETDK_SUCCESS, or ETDK_ERROR_IO if the sync or an earlier write-out failed
+ */
+int platform_writeback_finish(platform_writeback_t *wb) {
+    if (!wb || wb->fd < 0) {
+        return ETDK_SUCCESS;
+    }
+
+#ifdef PLATFORM_LINUX
+    int result = (fdatasync(wb->fd) == 0 && !wb->failed) ? ETDK_SUCCESS : ETDK_ERROR_IO;
+#else
+    int result = (fsync(wb->fd) == 0 && !wb->failed) ? ETDK_SUCCESS : ETDK_ERROR_IO;
+#endif
+    writeback_drop(wb, wb->dropped, 0);
+    wb->dropped = wb->started;
+
+    return result;
+}
+
+/**
+ * @brief Release the blocks of a file range
+ *
+ * Linux: fallocate(FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE). The
+ * filesystem frees the blocks, and passes a discard to the device when
+ * mounted with -o discard (or at the next fstrim).
+ *
+ * @param fd File opened for writing
+ * @param offset Range start
+ * @param len Range length in bytes
+ * @return ETDK_SUCCESS, or ETDK_ERROR_PLATFORM if unsupported
+ */
+int platform_punch_hole(int fd, uint64_t offset, uint64_t len) {
+#if defined(PLATFORM_LINUX) && defined(FALLOC_FL_PUNCH_HOLE)
+    return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)len) == 0
+               ? ETDK_SUCCESS
+               : ETDK_ERROR_PLATFORM;
+#else
+    (void)fd;
+    (void)offset;
+    (void)len;
+    return ETDK_ERROR_PLATFORM;
+#endif
+}
+
+#ifndef PLATFORM_WINDOWS
+/**
+ * @brief Open the directory containing path
+ *
+ * @param path Path of a file in the directory
+ * @param flags Open flags added to O_DIRECTORY (O_RDONLY, O_TMPFILE | O_WRONLY)
+ * @param mode Mode for O_TMPFILE
+ * @return Descriptor, or -1 (errno set)
+ */
+static int open_parent_directory(const char *path, int flags, mode_t mode) {
+    const char *slash = strrchr(path, '/');
+    size_t len = slash ? (size_t)(slash - path) : 0;
+    char *dir = malloc(len + 2);
+    if (!dir) {
+        errno = ENOMEM;
+        return -1;
+    }
+    if (!slash)
+        strcpy(dir, ".");
+    else if (len == 0)
+        strcpy(dir, "/");
+    else {
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+    }
+
+    int fd = open(dir, flags | O_DIRECTORY | O_CLOEXEC, mode);
+    free(dir);
+    return fd;
+}
+#endif
+
+/**
+ * @brief fsync() the directory containing path
+ *
+ * A rename() or newly created file is only durable once its directory
+ * has been synced; syncing the file itself is not enough.
+ *
+ * @param path Path of a file in the directory
+ * @return ETDK_SUCCESS, or ETDK_ERROR_IO on failure
+ */
+int platform_sync_directory(const char *path) {
+    if (!path) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+#ifdef PLATFORM_WINDOWS
+    return ETDK_SUCCESS;
+#else
+    int fd = open_parent_directory(path, O_RDONLY, 0);
+    if (fd < 0) {
+        return errno == ENOMEM ? ETDK_ERROR_MEMORY : ETDK_ERROR_IO;
+    }
+
+    int result = (fsync(fd) == 0) ? ETDK_SUCCESS : ETDK_ERROR_IO;
+    close(fd);
+    return result;
+#endif
+}
+
+/**
+ * @brief Create an unnamed regular file next to path
+ *
+ * Linux O_TMPFILE: the file has no directory entry until
+ * platform_link_tmpfile() gives it one, so an interrupted run leaves
+ * nothing behind. Permissions are 0666 minus the umask, as for fopen().
+ *
+ * @param path Path of a file in the target directory
+ * @return Descriptor open for writing, or -1 (errno set)
+ */
+int platform_open_tmpfile(const char *path) {
+    if (!path) {
+        errno = EINVAL;
+        return -1;
+    }
+
+#if defined(PLATFORM_LINUX) && defined(O_TMPFILE)
+    return open_parent_directory(path, O_TMPFILE | O_WRONLY, 0666);
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+/**
+ * @brief Link a file from platform_open_tmpfile() into its directory
+ *
+ * linkat(AT_EMPTY_PATH) needs CAP_DAC_READ_SEARCH; without it the
+ * descriptor is linked through /proc/self/fd.
+ *
+ * @param fd Descriptor from platform_open_tmpfile()
+ * @param path New name in the directory the file was created in
+ * @return ETDK_SUCCESS, or ETDK_ERROR_IO (errno set, EEXIST if path exists)
+ */
+int platform_link_tmpfile(int fd, const char *path) {
+    if (!path) {
+        errno = EINVAL;
+        return ETDK_ERROR_IO;
+    }
+
+#if defined(PLATFORM_LINUX) && defined(O_TMPFILE)
+    if (linkat(fd, "", AT_FDCWD, path, AT_EMPTY_PATH) == 0)
+        return ETDK_SUCCESS;
+    if (errno != ENOENT && errno != EPERM)
+        return ETDK_ERROR_IO;
+
+    char proc[64];
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", fd);
+    return linkat(AT_FDCWD, proc, AT_FDCWD, path, AT_SYMLINK_FOLLOW) == 0 ? ETDK_SUCCESS : ETDK_ERROR_IO;
+#else
+    (void)fd;
+    errno = EOPNOTSUPP;
+    return ETDK_ERROR_IO;
+#endif
+}
+
+/**
+ * @brief Allocate a page-aligned buffer for direct I/O
+ *
+ * @param len Size in bytes
+ * @param alignment Minimum alignment (e.g. logical block size)
+ * @return Pointer to buffer, or NULL on failure
+ */
+void *platform_alloc_aligned(size_t len, size_t alignment) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (alignment < page) {
+        alignment = page;
+    }
+
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, alignment, len) != 0) {
+        return NULL;
+    }
+
+    return ptr;
+}
+
+/**
+ * @brief Free a buffer allocated with platform_alloc_aligned()
+ *
+ * @param ptr Buffer to free (may be NULL)
+ */
+void platform_free_aligned(void *ptr) {
+    free(ptr);
+}
+
+/** Huge page size tried for arenas (x86-64 and AArch64 default) */
+#define ARENA_HUGE_PAGE (2 * 1024 * 1024)
+
+/**
+ * @brief Buffer arena: one mapping cut into equal slots
+ */
+struct platform_arena {
+    unsigned char *base;     /**< First slot */
+    size_t map_size;         /**< Bytes mapped */
+    size_t slot_size;        /**< Bytes per slot (page multiple) */
+    unsigned int count;      /**< Number of slots */
+    unsigned int free_count; /**< Entries in free_list */
+    unsigned int *free_list; /**< Stack of free slot indices */
+    int locked;              /**< Non-zero if mlock() succeeded */
+    const char *backing;     /**< Page type, for platform_arena_describe() */
+    pthread_mutex_t lock;    /**< Protects free_list and free_count */
+};
+
+/**
+ * @brief Map the memory of an arena
+ *
+ * Tries MAP_HUGETLB first (needs reserved huge pages), then a normal
+ * anonymous mapping aligned to ARENA_HUGE_PAGE with MADV_HUGEPAGE so the
+ * kernel can back it with transparent huge pages. Either way the chunk
+ * buffers cost a handful of TLB entries instead of one per 4 KB page.
+ * Arenas smaller than one huge page (the batch key slab) use base pages.
+ *
+ * @param arena Arena (map_size set; base and backing filled in)
+ * @return ETDK_SUCCESS or ETDK_ERROR_MEMORY
+ */
+static int arena_map(platform_arena_t *arena) {
+#ifdef PLATFORM_WINDOWS
+    arena->base = VirtualAlloc(NULL, arena->map_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    arena->backing = "base pages";
+    return arena->base ? ETDK_SUCCESS : ETDK_ERROR_MEMORY;
+#else
+    if (arena->map_size < ARENA_HUGE_PAGE) {
+        void *small = mmap(NULL, arena->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        arena->base = small == MAP_FAILED ? NULL : small;
+        arena->backing = "base pages";
+        return arena->base ? ETDK_SUCCESS : ETDK_ERROR_MEMORY;
+    }
+
+    size_t huge_size = (arena->map_size + ARENA_HUGE_PAGE - 1) / ARENA_HUGE_PAGE * ARENA_HUGE_PAGE;
+
+#ifdef MAP_HUGETLB
+    void *addr = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (addr != MAP_FAILED) {
+        arena->base = addr;
+        arena->map_size = huge_size;
+        arena->backing = "hugetlb pages";
+        return ETDK_SUCCESS;
+    }
+#endif
+
+    // Over-allocate by one huge page and trim, so the slots start on a huge page boundary
+    size_t span = huge_size + ARENA_HUGE_PAGE;
+    unsigned char *raw = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return ETDK_ERROR_MEMORY;
+    }
+    uintptr_t mask = ARENA_HUGE_PAGE - 1;
+    unsigned char *aligned = (unsigned char *)(((uintptr_t)raw + mask) & ~mask);
+    if (aligned > raw)
+        munmap(raw, (size_t)(aligned - raw));
+    if (aligned + huge_size < raw + span)
+        munmap(aligned + huge_size, (size_t)(raw + span - (aligned + huge_size)));
+
+    arena->base = aligned;
+    arena->map_size = huge_size;
+    arena->backing = "base pages";
+#ifdef MADV_HUGEPAGE
+    if (madvise(aligned, huge_size, MADV_HUGEPAGE) == 0)
+        arena->backing = "transparent huge pages";
+#endif
+    return ETDK_SUCCESS;
+#endif
+}
+
+/**
+ * @brief Create an arena of equal, page-aligned buffers in one locked mapping
+ *
+ * The arena is mapped and locked once, so plaintext chunks never reach
+ * swap and no worker pays an allocation or mlock() per chunk or per file.
+ * It is also excluded from core dumps (MADV_DONTDUMP). If locking fails
+ * (RLIMIT_MEMLOCK) the arena is still usable; platform_arena_describe()
+ * reports it as unlocked.
+ *
+ * @param buffer_size Bytes per buffer (rounded up to the page size)
+ * @param count Number of buffers
+ * @return Arena, or NULL on failure
+ */
+platform_arena_t *platform_arena_create(size_t buffer_size, unsigned int count) {
+    if (buffer_size == 0 || count == 0) {
+        return NULL;
+    }
+
+    platform_arena_t *arena = calloc(1, sizeof(*arena));
+    if (!arena) {
+        return NULL;
+    }
+
+    size_t page = 4096;
+#ifndef PLATFORM_WINDOWS
+    page = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+    arena->slot_size = (buffer_size + page - 1) / page * page;
+    arena->count = count;
+    arena->map_size = arena->slot_size * count;
+    arena->free_list = malloc(count * sizeof(unsigned int));
+
+    if (!arena->free_list || arena_map(arena) != ETDK_SUCCESS) {
+        free(arena->free_list);
+        free(arena);
+        return NULL;
+    }
+
+#ifdef MADV_DONTDUMP
+    madvise(arena->base, arena->map_size, MADV_DONTDUMP);
+#endif
+    arena->locked = platform_lock_memory(arena->base, arena->map_size) == ETDK_SUCCESS;
+
+    // Hand out low addresses first
+    for (unsigned int i = 0; i < count; i++)
+        arena->free_list[i] = count - 1 - i;
+    arena->free_count = count;
+    pthread_mutex_init(&arena->lock, NULL);
+
+    return arena;
+}
+
+/**
+ * @brief Take a buffer from an arena
+ *
+ * @param arena Arena, or NULL
+ * @param len Bytes needed
+ * @param alignment Required alignment
+ * @return Buffer (from the arena, or from platform_alloc_aligned() as fallback), or NULL on failure
+ */
+void *platform_arena_alloc(platform_arena_t *arena, size_t len, size_t alignment) {
+    if (arena && len <= arena->slot_size && alignment <= arena->slot_size &&
+        arena->slot_size % (alignment ? alignment : 1) == 0) {
+        void *buf = NULL;
+        pthread_mutex_lock(&arena->lock);
+        if (arena->free_count > 0)
+            buf = arena->base + (size_t)arena->free_list[--arena->free_count] * arena->slot_size;
+        pthread_mutex_unlock(&arena->lock);
+        if (buf)
+            return buf;
+    }
+
+    return platform_alloc_aligned(len, alignment);
+}
+
+/**
+ * @brief Return a buffer from platform_arena_alloc()
+ *
+ * The contents are left in place: the memory is locked and is wiped
+ * when the arena is destroyed.
+ *
+ * @param arena Arena passed to platform_arena_alloc()
+ * @param ptr Buffer (may be NULL)
+ */
+void platform_arena_free(platform_arena_t *arena, void *ptr) {
+    unsigned char *p = ptr;
+
+    if (arena && p >= arena->base && p < arena->base + arena->slot_size * arena->count) {
+        pthread_mutex_lock(&arena->lock);
+        arena->free_list[arena->free_count++] = (unsigned int)((size_t)(p - arena->base) / arena->slot_size);
+        pthread_mutex_unlock(&arena->lock);
+        return;
+    }
+
+    platform_free_aligned(ptr);
+}
+
+/**
+ * @brief Check whether a buffer lies in a locked arena
+ *
+ * Slots are page-aligned and page-sized, so callers may lock a slot of an
+ * unlocked arena on its own without touching neighbouring memory.
+ *
+ * @param arena Arena, or NULL
+ * @param ptr Buffer from platform_arena_alloc()
+ * @return Non-zero if ptr is a slot of arena and arena is locked
+ */
+int platform_arena_locked(const platform_arena_t *arena, const void *ptr) {
+    const unsigned char *p = ptr;
+    return arena && arena->locked && p >= arena->base && p < arena->base + arena->slot_size * arena->count;
+}
+
+/**
+ * @brief Describe an arena for output
+ *
+ * @param arena Arena
+ * @param buf Output buffer
+ * @param len Buffer size
+ */
+void platform_arena_describe(const platform_arena_t *arena, char *buf, size_t len) {
+    if (!arena) {
+        snprintf(buf, len, "none");
+        return;
+    }
+    snprintf(buf, len, "%u x %zu KB, %s, %s", arena->count, arena->slot_size / 1024,
+             arena->locked ? "locked" : "NOT locked (RLIMIT_MEMLOCK)", arena->backing);
+}
+
+/**
+ * @brief Wipe, unlock and unmap an arena
+ *
+ * @param arena Arena (may be NULL)
+ */
+void platform_arena_destroy(platform_arena_t *arena) {
+    if (!arena) {
+        return;
+    }
+
+    // Plaintext chunks stay in the slots until here
+    volatile unsigned char *v = arena->base;
+    memset(arena->base, 0, arena->map_size);
+    v[0] = v[0];
+
+    if (arena->locked)
+        platform_unlock_memory(arena->base, arena->map_size);
+#ifdef PLATFORM_WINDOWS
+    VirtualFree(arena->base, 0, MEM_RELEASE);
+#else
+    munmap(arena->base, arena->map_size);
+#endif
+
+    pthread_mutex_destroy(&arena->lock);
+    free(arena->free_list);
+    free(arena);
+}
+
+/**
+ * @brief Map a window of a file for sequential processing
+ *
+ * The window is mapped shared, so writes through a writable mapping go
+ * straight to the file's page cache. On Linux MAP_POPULATE pre-faults the
+ * whole window in one go instead of one page fault per 4 KB, and
+ * MADV_SEQUENTIAL enables aggressive read-ahead and early reclaim.
+ *
+ * @param fd Open file descriptor
+ * @param offset Window start (must be a multiple of the page size)
+ * @param len Window length in bytes (non-zero)
+ * @param writable Non-zero to map PROT_READ|PROT_WRITE
+ * @return Mapped address, or NULL on failure
+ */
+void *platform_map_window(int fd, uint64_t offset, size_t len, int writable) {
+#ifdef PLATFORM_WINDOWS
+    (void)fd;
+    (void)offset;
+    (void)len;
+    (void)writable;
+    return NULL;
+#else
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    flags |= MAP_POPULATE;
+#endif
+    void *addr = mmap(NULL, len, PROT_READ | (writable ? PROT_WRITE : 0), flags, fd, (off_t)offset);
+    if (addr == MAP_FAILED) {
+        return NULL;
+    }
+
+    madvise(addr, len, MADV_SEQUENTIAL);
+    return addr;
+#endif
+}
+
+/**
+ * @brief Unmap a window from platform_map_window()
+ *
+ * Dirty pages of a shared mapping stay in the page cache and are written
+ * back later (or by the final fsync), so unmapping right after a window
+ * is finished keeps the resident set bounded to one window.
+ *
+ * @param addr Mapped address
+ * @param len Window length in bytes
+ * @return ETDK_SUCCESS or ETDK_ERROR_PLATFORM
+ */
+int platform_unmap_window(void *addr, size_t len) {
+#ifdef PLATFORM_WINDOWS
+    (void)addr;
+    (void)len;
+    return ETDK_ERROR_PLATFORM;
+#else
+    return (munmap(addr, len) == 0) ? ETDK_SUCCESS : ETDK_ERROR_PLATFORM;
+#endif
+}
+
+/**
+ * @brief Detect crypto-relevant CPU features
+ *
+ * - x86: __builtin_cpu_supports() (CPUID) for AES-NI, PCLMULQDQ, VAES, AVX-512F
+ * - Linux/AArch64: getauxval(AT_HWCAP) for the AES and PMULL extensions
+ * - Others: no features reported (OpenSSL still picks its best code path)
+ *
+ * @return PLATFORM_CPU_* flags
+ */
+unsigned int platform_cpu_features(void) {
+    unsigned int features = 0;
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("aes"))
+        features |= PLATFORM_CPU_AES;
+    if (__builtin_cpu_supports("pclmul"))
+        features |= PLATFORM_CPU_CLMUL;
+    if (__builtin_cpu_supports("vaes"))
+        features |= PLATFORM_CPU_VAES;
+    if (__builtin_cpu_supports("avx512f"))
+        features |= PLATFORM_CPU_AVX512;
+#elif defined(PLATFORM_LINUX) && defined(__aarch64__)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    if (hwcap & HWCAP_AES)
+        features |= PLATFORM_CPU_AES;
+    if (hwcap & HWCAP_PMULL)
+        features |= PLATFORM_CPU_CLMUL;
+#endif
+
+    return features;
+}
+
+/**
+ * @brief Describe CPU features for output
+ *
+ * @param features PLATFORM_CPU_* flags
+ * @param buf Output buffer
+ * @param len Buffer size
+ */
+void platform_cpu_describe(unsigned int features, char *buf, size_t len) {
+    if (!buf || len == 0)
+        return;
+
+    snprintf(buf, len, "%s%s%s%s", (features & PLATFORM_CPU_AES) ? "aes " : "",
+             (features & PLATFORM_CPU_CLMUL) ? "clmul " : "", (features & PLATFORM_CPU_VAES) ? "vaes " : "",
+             (features & PLATFORM_CPU_AVX512) ? "avx512 " : "");
+
+    size_t n = strlen(buf);
+    if (n == 0)
+        snprintf(buf, len, "software AES");
+    else
+        buf[n - 1] = '\0';
+}
@@ -0,0 +1,944 @@
+/*
+ * ETDK - Encrypt-then-Delete-Key
+ * Priority regions - find the metadata of a device so it is encrypted before the bulk
+ */
+
+#include "etdk.h"
+// cppcheck-suppress-begin missingIncludeSystem
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// cppcheck-suppress-end missingIncludeSystem
+
+/** Bytes read at the start of a volume to identify it (up to the btrfs superblock at 64 KB) */
+#define PROBE_SIZE (68 * 1024)
+
+/** Most partitions followed through a GPT or an MBR extended partition chain */
+#define PROBE_MAX_PARTITIONS 128
+
+/** Most extents of $MFT followed through its run list */
+#define PROBE_MAX_EXTENTS 64
+
+/** Critical regions kept before neighbours are merged; the rest of the list holds metadata */
+#define PRIORITY_MAX_CRITICAL (ETDK_PRIORITY_MAX_RANGES / 4)
+
+/** Widest gap filled to keep a tier within its share of the list */
+#define PRIORITY_MAX_GAP (1024ULL * 1024)
+
+/** Largest ext2/3/4 group count probed (128 TB with 4 KB blocks) */
+#define EXT_MAX_GROUPS (1u << 20)
+
+/** Largest ext2/3/4 group descriptor table read (EXT_MAX_GROUPS descriptors of 64 bytes) */
+#define EXT_MAX_GDT (64ULL * 1024 * 1024)
+
+/** LUKS2 header and key slot area in the default layout; LUKS1 headers end at their payload offset */
+#define LUKS_HEADER_AREA (16ULL * 1024 * 1024)
+
+/** Largest LVM2 label and metadata area before the first physical extent */
+#define LVM_MAX_HEADER (64ULL * 1024 * 1024)
+
+/** Tiers of the list: all critical regions are encrypted before the metadata regions */
+enum { TIER_CRITICAL, TIER_METADATA, TIER_COUNT };
+
+/**
+ * @brief Growable list of ranges of one tier
+ */
+typedef struct {
+    device_range_t *ranges; /**< Ranges, unsorted until normalized */
+    size_t count;           /**< Used entries */
+    size_t capacity;        /**< Allocated entries */
+} range_set_t;
+
+/**
+ * @brief State of one probe run
+ */
+typedef struct {
+    platform_io_t io;              /**< Device, buffered I/O */
+    uint64_t size;                 /**< Device size in bytes */
+    range_set_t tiers[TIER_COUNT]; /**< Collected regions */
+    int failed;                    /**< Set when memory ran out */
+    int verbose;                   /**< Non-zero prints what was found */
+} probe_t;
+
+/** @brief Little-endian 16-bit field */
+static uint16_t le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+/** @brief Little-endian 32-bit field */
+static uint32_t le32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/** @brief Little-endian 64-bit field */
+static uint64_t le64(const uint8_t *p) {
+    return (uint64_t)le32(p) | (uint64_t)le32(p + 4) << 32;
+}
+
+/** @brief Big-endian 16-bit field */
+static uint16_t be16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+/** @brief Big-endian 32-bit field */
+static uint32_t be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+/** @brief Big-endian 64-bit field */
+static uint64_t be64(const uint8_t *p) {
+    return (uint64_t)be32(p) << 32 | be32(p + 4);
+}
+
+/**
+ * @brief Record a region, widened to ETDK_CHUNK_ALIGN and clipped to the device
+ *
+ * @param p Probe state
+ * @param tier TIER_CRITICAL or TIER_METADATA
+ * @param offset First byte
+ * @param length Number of bytes
+ */
+static void add_range(probe_t *p, int tier, uint64_t offset, uint64_t length) {
+    if (length == 0 || offset >= p->size)
+        return;
+
+    const uint64_t mask = ETDK_CHUNK_ALIGN - 1;
+    uint64_t end = length > p->size - offset ? p->size : offset + length;
+    end = (end + mask) & ~mask;
+    if (end > p->size)
+        end = p->size;
+    offset &= ~mask;
+
+    range_set_t *set = &p->tiers[tier];
+    if (set->count == set->capacity) {
+        size_t capacity = set->capacity ? set->capacity * 2 : 64;
+        device_range_t *grown = realloc(set->ranges, capacity * sizeof(device_range_t));
+        if (!grown) {
+            p->failed = 1;
+            return;
+        }
+        set->ranges = grown;
+        set->capacity = capacity;
+    }
+    set->ranges[set->count].offset = offset;
+    set->ranges[set->count].length = end - offset;
+    set->count++;
+}
+
+/**
+ * @brief Read exactly len bytes of the device
+ * @return Non-zero on success
+ */
+static int read_at(const probe_t *p, void *buf, size_t len, uint64_t offset) {
+    return offset <= p->size && len <= p->size - offset &&
+           platform_pread_full(p->io.fd, buf, len, offset) == (int64_t)len;
+}
+
+/**
+ * @brief LUKS1/LUKS2: header and key slots
+ */
+static int probe_luks(probe_t *p, uint64_t base, const uint8_t *buf, char *what, size_t size) {
+    if (memcmp(buf, "LUKS\xba\xbe", 6) != 0)
+        return 0;
+
+    uint16_t version = be16(buf + 6);
+    uint64_t header = LUKS_HEADER_AREA;
+    if (version == 1 && be32(buf + 104) != 0 && (uint64_t)be32(buf + 104) * 512 < header)
+        header = (uint64_t)be32(buf + 104) * 512; // Payload offset in sectors
+    add_range(p, TIER_CRITICAL, base, header);
+    snprintf(what, size, "LUKS%u header and key slots (%llu KB)", version, (unsigned long long)(header / 1024));
+    return 1;
+}
+
+/**
+ * @brief LVM2 physical volume: label and metadata area up to the first extent
+ */
+static int probe_lvm(probe_t *p, uint64_t base, const uint8_t *buf, char *what, size_t size) {
+    for (int sector = 0; sector < 4; sector++) {
+        const uint8_t *label = buf + sector * 512;
+        if (memcmp(label, "LABELONE", 8) != 0 || memcmp(label + 24, "LVM2 001", 8) != 0)
+            continue;
+
+        // PV header: UUID, device size, then the data area list; the first data area is pe_start
+        uint64_t header = ETDK_PRIORITY_EDGE_SIZE;
+        uint32_t pv = le32(label + 20);
+        if (pv <= 512 - 56 && le64(label + pv + 40) != 0)
+            header = le64(label + pv + 40);
+        if (header > LVM_MAX_HEADER)
+            header = LVM_MAX_HEADER;
+        add_range(p, TIER_CRITICAL, base, header);
+        snprintf(what, size, "LVM2 label and metadata (%llu KB)", (unsigned long long)(header / 1024));
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief XFS: headers of every allocation group, root inode chunk and internal log
+ */
+static int probe_xfs(probe_t *p, uint64_t base, uint64_t len, const uint8_t *buf, char *what, size_t size) {
+    if (memcmp(buf, "XFSB", 4) != 0)
+        return 0;
+
+    uint64_t block = be32(buf + 4);
+    uint64_t ag_blocks = be32(buf + 84);
+    uint32_t ag_count = be32(buf + 88);
+    uint64_t sector = be16(buf + 102);
+    uint64_t inode = be16(buf + 104);
+    unsigned int inop_log = buf[123], agblk_log = buf[124];
+    if (block < 512 || block > 65536 || (block & (block - 1)) || sector < 512 || sector > block || ag_blocks == 0 ||
+        ag_count == 0 || ag_count > EXT_MAX_GROUPS || agblk_log > 31 || inop_log > 16)
+        return 0;
+
+    // Superblock, AGF, AGI and AGFL: the first four sectors of each group
+    for (uint64_t ag = 0; ag < ag_count && ag * ag_blocks * block < len; ag++)
+        add_range(p, TIER_CRITICAL, base + ag * ag_blocks * block, 4 * sector);
+
+    // Inode numbers and log start are (group << agblk_log | block) with the inode in the block below that
+    uint64_t root = be64(buf + 56) >> inop_log;
+    uint64_t root_block = (root >> agblk_log) * ag_blocks + (root & ((1ULL << agblk_log) - 1));
+    if (root_block < len / block)
+        add_range(p, TIER_METADATA, base + root_block * block, 64 * inode);
+
+    uint64_t log = be64(buf + 48);
+    uint64_t log_block = (log >> agblk_log) * ag_blocks + (log & ((1ULL << agblk_log) - 1));
+    if (log != 0 && log_block < len / block)
+        add_range(p, TIER_METADATA, base + log_block * block, (uint64_t)be32(buf + 96) * block);
+
+    snprintf(what, size, "XFS: %u allocation group headers, root inodes%s", ag_count, log ? ", log" : "");
+    return 1;
+}
+
+/**
+ * @brief btrfs: the superblock and its copies at 64 MB and 256 GB
+ */
+static int probe_btrfs(probe_t *p, uint64_t base, uint64_t len, const uint8_t *buf, char *what, size_t size) {
+    static const uint64_t copies[] = {64 * 1024ULL, 64 * 1024 * 1024ULL, 256ULL * 1024 * 1024 * 1024};
+
+    if (memcmp(buf + 64 * 1024 + 0x40, "_BHRfS_M", 8) != 0)
+        return 0;
+
+    int found = 0;
+    for (size_t i = 0; i < sizeof(copies) / sizeof(copies[0]) && copies[i] < len; i++, found++)
+        add_range(p, TIER_CRITICAL, base + copies[i], 4096);
+    snprintf(what, size, "btrfs: %d superblocks", found);
+    return 1;
+}
+
+/**
+ * @brief Does an ext2/3/4 group hold a superblock backup?
+ *
+ * With sparse_super only groups 0, 1 and powers of 3, 5 and 7 do; with
+ * sparse_super2 only the two groups named in the superblock.
+ */
+static int ext_has_super(const uint8_t *sb, uint64_t group) {
+    if (group == 0)
+        return 1;
+    if (le32(sb + 0x5C) & 0x200) // COMPAT_SPARSE_SUPER2
+        return group == le32(sb + 0x24C) || group == le32(sb + 0x250);
+    if (!(le32(sb + 0x64) & 0x1) || group == 1) // RO_COMPAT_SPARSE_SUPER
+        return 1;
+
+    static const uint64_t bases[] = {3, 5, 7};
+    for (size_t i = 0; i < 3; i++) {
+        uint64_t power = bases[i];
+        while (power < group)
+            power *= bases[i];
+        if (power == group)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief ext2/3/4: superblocks with group descriptors, then the inode table of every group
+ */
+static int probe_ext(probe_t *p, uint64_t base, uint64_t len, const uint8_t *buf, char *what, size_t size) {
+    const uint8_t *sb = buf + 1024;
+    if (le16(sb + 0x38) != 0xEF53)
+        return 0;
+
+    uint32_t log_block = le32(sb + 0x18);
+    uint32_t incompat = le32(sb + 0x60);
+    if (log_block > 6)
+        return 0;
+    uint64_t block = 1024ULL << log_block;
+    uint64_t first = le32(sb + 0x14);
+    uint64_t per_group = le32(sb + 0x20);
+    uint64_t inodes = le32(sb + 0x28);
+    uint64_t blocks = le32(sb + 0x4) | ((incompat & 0x80) ? (uint64_t)le32(sb + 0x150) << 32 : 0);
+    uint64_t inode_size = le32(sb + 0x4C) ? le16(sb + 0x58) : 128;
+    uint64_t desc_size = (incompat & 0x80) ? le16(sb + 0xFE) : 32;
+    if (per_group == 0 || blocks <= first || desc_size < 32 || desc_size > block)
+        return 0;
+    uint64_t groups = (blocks - first + per_group - 1) / per_group;
+    if (groups > EXT_MAX_GROUPS)
+        return 0;
+
+    // Superblock, group descriptor table and its reserved growth blocks open every backup group.
+    // With meta_bg the descriptors are spread over the groups and only the superblock is known here.
+    int meta_bg = (incompat & 0x10) != 0;
+    uint64_t gdt_blocks = (groups * desc_size + block - 1) / block;
+    uint64_t head = meta_bg ? 1 : 1 + gdt_blocks + le16(sb + 0xCE);
+    unsigned int backups = 0;
+    for (uint64_t g = 0; g < groups && (first + g * per_group) * block < len; g++) {
+        if (ext_has_super(sb, g)) {
+            add_range(p, TIER_CRITICAL, base + (first + g * per_group) * block, head * block);
+            backups++;
+        }
+    }
+
+    unsigned int tables = 0;
+    // The table size comes from the superblock: only read it if it is sane and lies within the volume
+    int gdt_fits = gdt_blocks * block <= EXT_MAX_GDT && (first + 1 + gdt_blocks) * block <= len;
+    uint8_t *gdt = meta_bg || !gdt_fits ? NULL : malloc(gdt_blocks * block);
+    if (gdt && read_at(p, gdt, gdt_blocks * block, base + (first + 1) * block)) {
+        for (uint64_t g = 0; g < groups; g++) {
+            const uint8_t *desc = gdt + g * desc_size;
+            uint64_t table = le32(desc + 0x8) | (desc_size >= 64 ? (uint64_t)le32(desc + 0x28) << 32 : 0);
+            if (table == 0 || table >= blocks || table >= len / block)
+                continue;
+            add_range(p, TIER_METADATA, base + table * block, inodes * inode_size);
+            tables++;
+        }
+    }
+    free(gdt);
+
+    const char *name = "ext2";
+    if (incompat & (0x40 | 0x80 | 0x200)) // extents, 64bit, flex_bg
+        name = "ext4";
+    else if (le32(sb + 0x5C) & 0x4) // has_journal
+        name = "ext3";
+    snprintf(what, size, "%s: %u superblocks, %u inode tables", name, backups, tables);
+    return 1;
+}
+
+/**
+ * @brief Follow the run list of $MFT's unnamed $DATA attribute
+ *
+ * @param p Probe state
+ * @param base Volume offset
+ * @param mft Byte offset of $MFT in the volume
+ * @param record MFT record size
+ * @param cluster Cluster size
+ * @param len Volume size
+ * @return Number of extents recorded (0 if the record could not be parsed)
+ */
+static unsigned int probe_mft(probe_t *p, uint64_t base, uint64_t mft, uint64_t record, uint64_t cluster,
+                              uint64_t len) {
+    uint8_t rec[4096];
+    if (!read_at(p, rec, record, base + mft) || memcmp(rec, "FILE", 4) != 0)
+        return 0;
+
+    // Undo the update sequence: the last two bytes of every 512-byte stride were moved into the array
+    uint64_t usa = le16(rec + 4), usa_count = le16(rec + 6);
+    if (usa_count == 0 || usa + 2 * usa_count > record || (usa_count - 1) * 512 > record)
+        return 0;
+    for (uint64_t i = 1; i < usa_count; i++) {
+        uint8_t *tail = rec + i * 512 - 2;
+        if (memcmp(tail, rec + usa, 2) != 0)
+            return 0;
+        memcpy(tail, rec + usa + 2 * i, 2);
+    }
+
+    for (uint64_t pos = le16(rec + 0x14); pos + 0x40 <= record;) {
+        const uint8_t *attr = rec + pos;
+        uint64_t attr_len = le32(attr + 4);
+        if (le32(attr) == 0xFFFFFFFF || attr_len < 0x40 || pos + attr_len > record)
+            break;
+        if (le32(attr) != 0x80 || attr[8] == 0) { // $DATA, non-resident
+            pos += attr_len;
+            continue;
+        }
+
+        // Runs: a header byte with the size of the length and offset fields, offsets relative and signed
+        unsigned int extents = 0;
+        uint64_t lcn = 0;
+        for (uint64_t at = le16(attr + 0x20); at < attr_len && attr[at] != 0 && extents < PROBE_MAX_EXTENTS;) {
+            unsigned int len_bytes = attr[at] & 0x0F, off_bytes = attr[at] >> 4;
+            if (len_bytes == 0 || len_bytes > 8 || off_bytes > 8 || at + 1 + len_bytes + off_bytes > attr_len)
+                break;
+            uint64_t count = 0, delta = 0;
+            for (unsigned int k = 0; k < len_bytes; k++)
+                count |= (uint64_t)attr[at + 1 + k] << (8 * k);
+            for (unsigned int k = 0; k < off_bytes; k++)
+                delta |= (uint64_t)attr[at + 1 + len_bytes + k] << (8 * k);
+            if (off_bytes > 0 && off_bytes < 8 && (attr[at + len_bytes + off_bytes] & 0x80))
+                delta |= ~0ULL << (8 * off_bytes);
+            at += 1 + len_bytes + off_bytes;
+            if (off_bytes == 0) // Sparse run
+                continue;
+
+            lcn += delta;
+            if (lcn >= len / cluster || count > len / cluster)
+                break;
+            add_range(p, TIER_METADATA, base + lcn * cluster, count * cluster);
+            extents++;
+        }
+        return extents;
+    }
+    return 0;
+}
+
+/**
+ * @brief NTFS: boot sector copy, $MFTMirr and the extents of $MFT
+ */
+static int probe_ntfs(probe_t *p, uint64_t base, uint64_t len, const uint8_t *buf, char *what, size_t size) {
+    if (memcmp(buf + 3, "NTFS    ", 8) != 0)
+        return 0;
+
+    uint64_t sector = le16(buf + 0x0B);
+    uint64_t per_cluster = buf[0x0D] > 0xF4 ? 1ULL << (256 - buf[0x0D]) : buf[0x0D]; // Negative: power of two
+    int8_t record_raw = (int8_t)buf[0x40];
+    if (sector < 512 || sector > 4096 || (sector & (sector - 1)) || per_cluster == 0 || per_cluster > 4096 ||
+        record_raw < -12)
+        return 0;
+    uint64_t cluster = sector * per_cluster;
+    uint64_t record = record_raw > 0 ? (uint64_t)record_raw * cluster : 1ULL << -record_raw;
+    uint64_t mft = le64(buf + 0x30), mirror = le64(buf + 0x38);
+    if (record < 512 || record > 4096 || mft >= len / cluster || mirror >= len / cluster)
+        return 0;
+
+    // The last sector of the volume holds the backup boot sector
+    if (le64(buf + 0x28) < len / sector)
+        add_range(p, TIER_CRITICAL, base + le64(buf + 0x28) * sector, sector);
+    add_range(p, TIER_CRITICAL, base + mirror * cluster, 4 * record);
+
+    unsigned int extents = probe_mft(p, base, mft * cluster, record, cluster, len);
+    if (extents == 0) // At least the system files ($MFT to $Extend)
+        add_range(p, TIER_METADATA, base + mft * cluster, 16 * record);
+    snprintf(what, size, "NTFS: boot sectors, $MFTMirr, $MFT (%u extents)", extents);
+    return 1;
+}
+
+/**
+ * @brief exFAT: main and backup boot regions, then the FATs
+ */
+static int probe_exfat(probe_t *p, uint64_t base, const uint8_t *buf, char *what, size_t size) {
+    if (memcmp(buf + 3, "EXFAT   ", 8) != 0 || buf[0x6C] < 9 || buf[0x6C] > 12)
+        return 0;
+
+    uint64_t sector = 1ULL << buf[0x6C];
+    uint64_t fats = buf[0x6E] == 2 ? 2 : 1;
+    add_range(p, TIER_CRITICAL, base, 24 * sector); // 12 sectors per boot region
+    add_range(p, TIER_METADATA, base + le32(buf + 0x50) * sector, fats * le32(buf + 0x54) * sector);
+    snprintf(what, size, "exFAT: boot regions, %llu FAT%s", (unsigned long long)fats, fats == 1 ? "" : "s");
+    return 1;
+}
+
+/**
+ * @brief FAT12/16/32: reserved sectors, then the FATs and the root directory
+ */
+static int probe_fat(probe_t *p, uint64_t base, const uint8_t *buf, char *what, size_t size) {
+    uint64_t sector = le16(buf + 0x0B);
+    uint64_t reserved = le16(buf + 0x0E);
+    uint64_t fats = buf[0x10];
+    uint64_t fat_size = le16(buf + 0x16) ? le16(buf + 0x16) : le32(buf + 0x24);
+    int fat32 = le16(buf + 0x16) == 0 && memcmp(buf + 0x52, "FAT32   ", 8) == 0;
+
+    if (buf[510] != 0x55 || buf[511] != 0xAA || (!fat32 && memcmp(buf + 0x36, "FAT", 3) != 0) || sector < 512 ||
+        sector > 4096 || (sector & (sector - 1)) || reserved == 0 || fats == 0 || fats > 2 || fat_size == 0)
+        return 0;
+
+    add_range(p, TIER_CRITICAL, base, reserved * sector); // Boot sector, FSInfo, backup boot sector
+    add_range(p, TIER_METADATA, base + reserved * sector, fats * fat_size * sector + le16(buf + 0x11) * 32ULL);
+    snprintf(what, size, "%s: boot sectors, %llu FAT%s", fat32 ? "FAT32" : "FAT12/16", (unsigned long long)fats,
+             fats == 1 ? "" : "s");
+    return 1;
+}
+
+/**
+ * @brief Identify the volume at an offset and record its metadata
+ *
+ * @param p Probe state
+ * @param base Volume offset
+ * @param len Volume size
+ * @param what Receives a description of what was found
+ * @param size Size of what
+ * @return Non-zero if a known signature was found
+ */
+static int probe_volume(probe_t *p, uint64_t base, uint64_t len, char *what, size_t size) {
+    uint8_t *buf = calloc(1, PROBE_SIZE);
+    if (!buf) {
+        p->failed = 1;
+        return 0;
+    }
+
+    size_t want = len < PROBE_SIZE ? (size_t)len : PROBE_SIZE;
+    int found = 0;
+    if (read_at(p, buf, want, base)) {
+        found = probe_luks(p, base, buf, what, size) || probe_lvm(p, base, buf, what, size) ||
+                probe_xfs(p, base, len, buf, what, size) || probe_btrfs(p, base, len, buf, what, size) ||
+                probe_ext(p, base, len, buf, what, size) || probe_ntfs(p, base, len, buf, what, size) ||
+                probe_exfat(p, base, buf, what, size) || probe_fat(p, base, buf, what, size);
+    }
+    free(buf);
+    return found;
+}
+
+/**
+ * @brief Record a partition: its head and tail, then whatever it holds
+ *
+ * The head and tail catch formats without a probe of their own (swap, md
+ * RAID superblocks, ZFS labels, BitLocker).
+ *
+ * @param p Probe state
+ * @param number Partition number
+ * @param base Partition offset
+ * @param len Partition size
+ */
+static void probe_partition(probe_t *p, unsigned int number, uint64_t base, uint64_t len) {
+    if (base >= p->size || len == 0)
+        return;
+    if (len > p->size - base)
+        len = p->size - base;
+
+    add_range(p, TIER_CRITICAL, base, ETDK_PRIORITY_EDGE_SIZE);
+    if (len > ETDK_PRIORITY_EDGE_SIZE)
+        add_range(p, TIER_CRITICAL, base + len - ETDK_PRIORITY_EDGE_SIZE, ETDK_PRIORITY_EDGE_SIZE);
+
+    char what[160];
+    if (!probe_volume(p, base, len, what, sizeof(what)))
+        snprintf(what, sizeof(what), "no known signature, head and tail only");
+    if (p->verbose)
+        printf("  partition %u at %.1f MB: %s\n", number, base / (1024.0 * 1024.0), what);
+}
+
+/**
+ * @brief GPT: both headers with their entry arrays, then every partition
+ *
+ * @param p Probe state
+ * @return Non-zero if the device has a GPT
+ */
+static int probe_gpt(probe_t *p) {
+    uint64_t lba = p->io.block_size;
+    uint8_t header[512];
+    if (!read_at(p, header, sizeof(header), lba) || memcmp(header, "EFI PART", 8) != 0)
+        return 0;
+
+    uint64_t entries = le64(header + 0x48);
+    uint64_t count = le32(header + 0x50);
+    uint64_t entry_size = le32(header + 0x54);
+    if (entry_size < 128 || entry_size > 4096 || count == 0 || count > 4096 || entries >= p->size / lba)
+        return 0;
+    uint64_t table = count * entry_size;
+
+    add_range(p, TIER_CRITICAL, 0, entries * lba + table);
+    uint64_t backup = le64(header + 0x20);
+    if (backup < p->size / lba)
+        add_range(p, TIER_CRITICAL, backup * lba > table ? backup * lba - table : 0, table + lba);
+
+    uint8_t *array = malloc(table);
+    unsigned int used = 0;
+    if (!array) {
+        p->failed = 1;
+        return 1;
+    }
+    if (read_at(p, array, table, entries * lba)) {
+        static const uint8_t unused[16];
+        for (uint64_t i = 0; i < count; i++) {
+            if (memcmp(array + i * entry_size, unused, sizeof(unused)) != 0)
+                used++;
+        }
+        if (p->verbose)
+            printf("  GPT: %u partitions\n", used);
+        for (uint64_t i = 0, seen = 0; i < count && seen < PROBE_MAX_PARTITIONS; i++) {
+            const uint8_t *entry = array + i * entry_size;
+            uint64_t first = le64(entry + 32), last = le64(entry + 40);
+            if (memcmp(entry, unused, sizeof(unused)) == 0 || last < first || first >= p->size / lba)
+                continue;
+            probe_partition(p, (unsigned int)(i + 1), first * lba, (last - first + 1) * lba);
+            seen++;
+        }
+    }
+    free(array);
+    return 1;
+}
+
+/**
+ * @brief Validate the four partition entries of an MBR or EBR
+ *
+ * @param sector Boot record (512 bytes)
+ * @return Number of used entries, or -1 if this is no partition table
+ */
+static int mbr_entries(const uint8_t *sector) {
+    if (sector[510] != 0x55 || sector[511] != 0xAA)
+        return -1;
+
+    int used = 0;
+    for (int i = 0; i < 4; i++) {
+        const uint8_t *entry = sector + 446 + 16 * i;
+        if (entry[0] != 0x00 && entry[0] != 0x80)
+            return -1;
+        if (entry[4] != 0 && le32(entry + 12) != 0)
+            used++;
+    }
+    return used;
+}
+
+/**
+ * @brief Partition types of an MBR extended partition
+ */
+static int mbr_extended(uint8_t type) {
+    return type == 0x05 || type == 0x0F || type == 0x85;
+}
+
+/**
+ * @brief MBR: primary partitions and the chain of logical partitions
+ *
+ * @param p Probe state
+ * @param mbr First sector of the device
+ * @return Non-zero if the device has an MBR partition table
+ */
+static int probe_mbr(probe_t *p, const uint8_t *mbr) {
+    uint64_t lba = p->io.block_size;
+    if (mbr_entries(mbr) <= 0)
+        return 0;
+
+    if (p->verbose)
+        printf("  MBR: %d partitions\n", mbr_entries(mbr));
+    unsigned int logical = 5;
+    for (int i = 0; i < 4; i++) {
+        const uint8_t *entry = mbr + 446 + 16 * i;
+        uint64_t start = le32(entry + 8), sectors = le32(entry + 12);
+        if (entry[4] == 0 || sectors == 0)
+            continue;
+        if (!mbr_extended(entry[4])) {
+            probe_partition(p, (unsigned int)(i + 1), start * lba, sectors * lba);
+            continue;
+        }
+
+        // Each EBR describes one logical partition (relative to the EBR) and the next EBR (relative to the first).
+        // The chain must move forward inside the extended partition, so a looping or stray link ends it.
+        uint64_t ebr = start;
+        for (unsigned int hops = 0; hops < PROBE_MAX_PARTITIONS && logical < 4 + PROBE_MAX_PARTITIONS; hops++) {
+            uint8_t sector[512];
+            if (!read_at(p, sector, sizeof(sector), ebr * lba) || mbr_entries(sector) < 0)
+                break;
+            add_range(p, TIER_CRITICAL, ebr * lba, lba);
+            const uint8_t *part = sector + 446, *next = sector + 462;
+            if (part[4] != 0 && le32(part + 12) != 0)
+                probe_partition(p, logical++, (ebr + le32(part + 8)) * lba, (uint64_t)le32(part + 12) * lba);
+            if (!mbr_extended(next[4]) || le32(next + 8) == 0)
+                break;
+            uint64_t following = start + le32(next + 8);
+            if (following <= ebr || following >= start + sectors)
+                break;
+            ebr = following;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Probe the whole device: partition table, or a volume without one
+ *
+ * @param p Probe state
+ */
+static void probe_device(probe_t *p) {
+    uint8_t mbr[512];
+    char what[160];
+
+    if (probe_gpt(p))
+        return;
+    if (probe_volume(p, 0, p->size, what, sizeof(what))) {
+        if (p->verbose)
+            printf("  whole device: %s\n", what);
+        return;
+    }
+    if (read_at(p, mbr, sizeof(mbr), 0) && probe_mbr(p, mbr))
+        return;
+    if (p->verbose)
+        printf("  no partition table or known signature\n");
+}
+
+/**
+ * @brief qsort() comparator: ranges by offset
+ */
+static int compare_range(const void *a, const void *b) {
+    const device_range_t *ra = a, *rb = b;
+    return (ra->offset > rb->offset) - (ra->offset < rb->offset);
+}
+
+/**
+ * @brief Sort a set and merge overlapping or adjacent ranges
+ */
+static void normalize(range_set_t *set) {
+    if (set->count == 0)
+        return;
+
+    qsort(set->ranges, set->count, sizeof(device_range_t), compare_range);
+    size_t out = 0;
+    for (size_t i = 1; i < set->count; i++) {
+        device_range_t *last = &set->ranges[out];
+        const device_range_t *r = &set->ranges[i];
+        if (r->offset <= last->offset + last->length) {
+            if (r->offset + r->length > last->offset + last->length)
+                last->length = r->offset + r->length - last->offset;
+        } else {
+            set->ranges[++out] = *r;
+        }
+    }
+    set->count = out + 1;
+}
+
+/**
+ * @brief Gap between a range and the next one, for reduce()
+ */
+typedef struct {
+    uint64_t gap;  /**< Bytes between the two ranges */
+    size_t index;  /**< Index of the first range */
+} range_gap_t;
+
+/**
+ * @brief qsort() comparator: gaps by size, then by position
+ */
+static int compare_gap(const void *a, const void *b) {
+    const range_gap_t *ga = a, *gb = b;
+    if (ga->gap != gb->gap)
+        return (ga->gap > gb->gap) - (ga->gap < gb->gap);
+    return (ga->index > gb->index) - (ga->index < gb->index);
+}
+
+/**
+ * @brief Bound a normalized set to max ranges
+ *
+ * The smallest gaps up to PRIORITY_MAX_GAP are filled first; the filled
+ * bytes are simply encrypted early. Filling wider gaps would turn sparse
+ * metadata (one XFS header per allocation group) into most of the
+ * device, so the ranges beyond max are dropped instead and left to the
+ * bulk pass.
+ *
+ * @param set Normalized set
+ * @param max Ranges to keep (at least 1)
+ * @return Number of dropped ranges, or -1 if memory ran out
+ */
+static long reduce(range_set_t *set, size_t max) {
+    if (set->count <= max)
+        return 0;
+
+    range_gap_t *gaps = malloc((set->count - 1) * sizeof(range_gap_t));
+    uint8_t *fill = calloc(set->count, 1);
+    if (!gaps || !fill) {
+        free(gaps);
+        free(fill);
+        return -1;
+    }
+
+    for (size_t i = 0; i + 1 < set->count; i++) {
+        gaps[i].gap = set->ranges[i + 1].offset - (set->ranges[i].offset + set->ranges[i].length);
+        gaps[i].index = i;
+    }
+    qsort(gaps, set->count - 1, sizeof(range_gap_t), compare_gap);
+    for (size_t i = 0; i < set->count - max && gaps[i].gap <= PRIORITY_MAX_GAP; i++)
+        fill[gaps[i].index] = 1;
+
+    size_t out = 0;
+    for (size_t i = 1; i < set->count; i++) {
+        const device_range_t *r = &set->ranges[i];
+        if (fill[i - 1])
+            set->ranges[out].length = r->offset + r->length - set->ranges[out].offset;
+        else
+            set->ranges[++out] = *r;
+    }
+    set->count = out + 1;
+
+    free(gaps);
+    free(fill);
+
+    long dropped = set->count > max ? (long)(set->count - max) : 0;
+    set->count -= (size_t)dropped;
+    return dropped;
+}
+
+/**
+ * @brief Ranges of from that are not covered by cut
+ *
+ * @param from Sorted, disjoint ranges
+ * @param from_count Number of from ranges
+ * @param cut Sorted, disjoint ranges to remove
+ * @param cut_count Number of cut ranges
+ * @param out Receives the result (room for from_count + cut_count ranges)
+ * @return Number of ranges written to out
+ */
+static size_t subtract_ranges(const device_range_t *from, size_t from_count, const device_range_t *cut,
+                              size_t cut_count, device_range_t *out) {
+    size_t n = 0, c = 0;
+    for (size_t i = 0; i < from_count; i++) {
+        uint64_t pos = from[i].offset, end = from[i].offset + from[i].length;
+        while (c < cut_count && cut[c].offset + cut[c].length <= pos)
+            c++;
+        for (size_t k = c; k < cut_count && cut[k].offset < end; k++) {
+            if (cut[k].offset > pos) {
+                out[n].offset = pos;
+                out[n++].length = cut[k].offset - pos;
+            }
+            if (cut[k].offset + cut[k].length > pos)
+                pos = cut[k].offset + cut[k].length;
+        }
+        if (pos < end) {
+            out[n].offset = pos;
+            out[n++].length = end - pos;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Bytes covered by ranges
+ */
+static uint64_t ranges_bytes(const device_range_t *ranges, size_t count) {
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < count; i++)
+        bytes += ranges[i].length;
+    return bytes;
+}
+
+/**
+ * @brief Turn the collected regions into the bounded, disjoint list
+ *
+ * Each tier is sorted and merged. Metadata regions are then reduced so
+ * that removing the critical regions from them (which splits at most one
+ * range per critical region) still fits in ETDK_PRIORITY_MAX_RANGES.
+ *
+ * @param p Probe state
+ * @param list List to fill
+ * @param dropped Receives the number of regions left to the bulk pass
+ * @return ETDK_SUCCESS or ETDK_ERROR_MEMORY
+ */
+static int finish_list(probe_t *p, priority_list_t *list, long *dropped) {
+    range_set_t *critical = &p->tiers[TIER_CRITICAL], *metadata = &p->tiers[TIER_METADATA];
+
+    normalize(critical);
+    normalize(metadata);
+    long critical_dropped = reduce(critical, PRIORITY_MAX_CRITICAL);
+    long metadata_dropped = reduce(metadata, ETDK_PRIORITY_MAX_RANGES - 2 * critical->count);
+    if (critical_dropped < 0 || metadata_dropped < 0)
+        return ETDK_ERROR_MEMORY;
+    *dropped = critical_dropped + metadata_dropped;
+
+    memcpy(list->ranges, critical->ranges, critical->count * sizeof(device_range_t));
+    list->critical = (uint32_t)critical->count;
+    list->count = list->critical + (uint32_t)subtract_ranges(metadata->ranges, metadata->count, critical->ranges,
+                                                             critical->count, list->ranges + critical->count);
+    return ETDK_SUCCESS;
+}
+
+/**
+ * @brief Collect the priority regions of a device
+ *
+ * The regions given with --priority=OFFSET:LENGTH and, with auto
+ * detection, the head and tail of the device, the partition tables
+ * (GPT with its backup, MBR with the extended partition chain) and per
+ * partition (or for a device without a table) its head and tail and the
+ * structures of the format it holds:
+ * - critical: LUKS1/2 header and key slots, LVM2 label and metadata, ext2/3/4
+ *   superblocks and group descriptors, XFS allocation group headers, btrfs
+ *   superblocks, NTFS boot sectors and $MFTMirr, FAT/exFAT boot sectors
+ * - metadata: ext2/3/4 inode tables, NTFS $MFT, FATs, XFS root inodes and log
+ *
+ * Only signatures are trusted, never sizes that point outside the volume.
+ * A filesystem inside LVM or LUKS is not followed (LVM's mapping is not
+ * parsed; LUKS data is ciphertext already).
+ *
+ * @param list List to fill
+ * @param device_path Device path
+ * @param device_size Device size in bytes
+ * @param ctx Crypto context (options.priority_detect, options.priority_ranges, progress)
+ * @return ETDK_SUCCESS, or error code if the device cannot be read or no region remains
+ */
+int priority_build(priority_list_t *list, const char *device_path, uint64_t device_size,
+                   const crypto_context_t *ctx) {
+    if (!list || !device_path || !ctx) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    const etdk_options_t *opts = &ctx->options;
+    probe_t p;
+    memset(&p, 0, sizeof(p));
+    memset(list, 0, sizeof(*list));
+    p.size = device_size;
+    p.verbose = !ctx->progress;
+
+    if (p.verbose)
+        printf("Priority regions:\n");
+    for (size_t i = 0; i < opts->priority_range_count; i++) {
+        const device_range_t *r = &opts->priority_ranges[i];
+        if (r->offset >= device_size)
+            fprintf(stderr, "Warning: --priority range at byte %llu is beyond the end of %s\n",
+                    (unsigned long long)r->offset, device_path);
+        add_range(&p, TIER_CRITICAL, r->offset, r->length);
+    }
+    if (p.verbose && opts->priority_range_count > 0)
+        printf("  --priority: %zu range%s\n", opts->priority_range_count, opts->priority_range_count == 1 ? "" : "s");
+
+    int result = ETDK_SUCCESS;
+    long dropped = 0;
+    if (opts->priority_detect) {
+        if (platform_io_open(&p.io, device_path, 0) != ETDK_SUCCESS) {
+            perror("Cannot open device to find its metadata");
+            result = ETDK_ERROR_IO;
+        } else {
+            add_range(&p, TIER_CRITICAL, 0, ETDK_PRIORITY_EDGE_SIZE);
+            if (device_size > ETDK_PRIORITY_EDGE_SIZE)
+                add_range(&p, TIER_CRITICAL, device_size - ETDK_PRIORITY_EDGE_SIZE, ETDK_PRIORITY_EDGE_SIZE);
+            probe_device(&p);
+            platform_io_close(&p.io);
+        }
+    }
+
+    if (result == ETDK_SUCCESS && (p.failed || finish_list(&p, list, &dropped) != ETDK_SUCCESS))
+        result = ETDK_ERROR_MEMORY;
+    if (result == ETDK_SUCCESS && list->count == 0) {
+        fprintf(stderr, "No priority regions on %s\n", device_path);
+        result = ETDK_ERROR_IO;
+    }
+    for (int t = 0; t < TIER_COUNT; t++)
+        free(p.tiers[t].ranges);
+
+    if (result == ETDK_SUCCESS && p.verbose) {
+        const double mb = 1024.0 * 1024.0;
+        printf("Priority: %u critical regions (%.1f MB), then %u metadata regions (%.1f MB), then the rest\n",
+               list->critical, ranges_bytes(list->ranges, list->critical) / mb, list->count - list->critical,
+               ranges_bytes(list->ranges + list->critical, list->count - list->critical) / mb);
+        if (dropped > 0)
+            printf("Priority: %ld more regions are left to the bulk pass (list limit %d)\n", dropped,
+                   ETDK_PRIORITY_MAX_RANGES);
+        printf("\n");
+    }
+    return result;
+}
+
+/**
+ * @brief Processing order of a run: the priority regions, then the rest of base
+ *
+ * The priority regions keep their order (critical, then metadata); the
+ * remainder of base follows by offset. Every byte is listed once, so a
+ * seekable mode produces the same ciphertext as a run in plain order.
+ *
+ * @param list Priority regions
+ * @param base Ranges the run covers otherwise, sorted and disjoint
+ * @param base_count Number of base ranges
+ * @param order Receives the ranges in processing order (free() it)
+ * @param order_count Receives the number of ranges
+ * @return ETDK_SUCCESS or ETDK_ERROR_MEMORY
+ */
+int priority_schedule(const priority_list_t *list, const device_range_t *base, size_t base_count,
+                      device_range_t **order, size_t *order_count) {
+    if (!list || !base || !order || !order_count) {
+        return ETDK_ERROR_PLATFORM;
+    }
+
+    device_range_t sorted[ETDK_PRIORITY_MAX_RANGES];
+    memcpy(sorted, list->ranges, list->count * sizeof(device_range_t));
+    qsort(sorted, list->count, sizeof(device_range_t), compare_range);
+
+    device_range_t *out = malloc((2 * list->count + base_count) * sizeof(device_range_t));
+    if (!out) {
+        return ETDK_ERROR_MEMORY;
+    }
+    memcpy(out, list->ranges, list->count * sizeof(device_range_t));
+    *order_count = list->count + subtract_ranges(base, base_count, sorted, list->count, out + list->count);
+    *order = out;
+    return ETDK_SUCCESS;
+}
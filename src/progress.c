@@ -0,0 +1,308 @@
+/*
+ * ETDK - Encrypt-then-Delete-Key
+ * Progress reporting - rate-limited terminal line, moving-average rate and ETA, event stream
+ */
+
+#include "etdk.h"
+// cppcheck-suppress-begin missingIncludeSystem
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+// cppcheck-suppress-end missingIncludeSystem
+
+/** Time constant of the moving-average rate in seconds */
+#define PROGRESS_RATE_WINDOW 5.0
+
+/**
+ * @brief Names of a phase on the terminal and in the event stream
+ */
+static const struct {
+    const char *label; /**< Terminal line prefix */
+    const char *name;  /**< "phase" of stream events */
+} phases[] = {
+    [PROGRESS_ENCRYPT] = {"Progress", "encrypt"},
+    [PROGRESS_VERIFY] = {"Verifying", "verify"},
+    [PROGRESS_DECRYPT] = {"Decrypting", "decrypt"},
+};
+
+/**
+ * @brief Reporter state of one engine run
+ */
+struct progress {
+    const crypto_context_t *ctx; /**< Hook (ctx->progress) and stream options */
+    progress_phase_t phase;      /**< What is being counted */
+    char target[512];            /**< Device path, JSON-escaped */
+    uint64_t total;              /**< Bytes of the run */
+    uint64_t done;               /**< Bytes done, stored atomically by the engines */
+    uint64_t last_done;          /**< done at the previous report */
+    double rate;                 /**< Moving-average rate in bytes/s (0 until the first interval) */
+    struct timespec start;       /**< Start of the run (CLOCK_MONOTONIC) */
+    struct timespec last;        /**< Time of the previous report */
+    int terminal;                /**< Non-zero draws the progress line on stdout */
+    int stream;                  /**< Non-zero writes events to options.progress_fd */
+    int stop;                    /**< Set by progress_finish() */
+    int running;                 /**< Non-zero while the reporter thread exists */
+    pthread_t thread;            /**< Reporter thread */
+    pthread_mutex_t lock;        /**< Protects stop */
+    pthread_cond_t wake;         /**< Signalled by progress_finish() */
+    pthread_mutex_t report_lock; /**< Serializes reports of the reporter thread and progress_event() */
+};
+
+/**
+ * @brief Seconds between two times
+ */
+static double seconds_between(const struct timespec *from, const struct timespec *to) {
+    return (double)(to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Copy a string with JSON escaping, truncating if needed
+ *
+ * @param out Destination
+ * @param size Size of out
+ * @param in Source string
+ */
+static void json_escape(char *out, size_t size, const char *in) {
+    size_t pos = 0;
+    for (; *in && pos + 7 < size; in++) {
+        unsigned char c = (unsigned char)*in;
+        if (c == '"' || c == '\\') {
+            out[pos++] = '\\';
+            out[pos++] = (char)c;
+        } else if (c < 0x20) {
+            pos += (size_t)snprintf(out + pos, size - pos, "\\u%04x", c);
+        } else {
+            out[pos++] = (char)c;
+        }
+    }
+    out[pos] = '\0';
+}
+
+/**
+ * @brief Write one event to the progress fd
+ *
+ * Each event is a single write() of less than PIPE_BUF bytes, so events
+ * of concurrent runs (multi-device mode) never interleave on a pipe. A
+ * consumer that went away stops the stream, not the run.
+ *
+ * @param p Reporter
+ * @param line Event, newline-terminated
+ * @param len Length of line
+ */
+static void stream_write(progress_t *p, const char *line, size_t len) {
+    ssize_t n;
+    if (p->ctx->options.progress_fd == STDOUT_FILENO)
+        fflush(stdout); // Keep events after the status lines printed before them
+    do {
+        n = write(p->ctx->options.progress_fd, line, len);
+    } while (n < 0 && errno == EINTR);
+
+    if (n != (ssize_t)len) {
+        fprintf(stderr, "\nWarning: progress stream on fd %d stopped: %s\n", p->ctx->options.progress_fd,
+                n < 0 ? strerror(errno) : "short write");
+        p->stream = 0;
+    }
+}
+
+/**
+ * @brief Report the current state: hook, terminal line and stream event
+ *
+ * @param p Reporter
+ * @param event Stream event name ("start", "progress", "end" or a milestone)
+ * @param status Result for the "end" event
+ */
+static void report(progress_t *p, const char *event, int status) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t done = __atomic_load_n(&p->done, __ATOMIC_RELAXED);
+    double interval = seconds_between(&p->last, &now);
+    double elapsed = seconds_between(&p->start, &now);
+
+    if (interval > 0 && done >= p->last_done) {
+        double sample = (done - p->last_done) / interval;
+        double weight = interval / (interval + PROGRESS_RATE_WINDOW);
+        p->rate = p->rate > 0 ? p->rate + weight * (sample - p->rate) : sample;
+        p->last_done = done;
+        p->last = now;
+    }
+
+    uint64_t remaining = p->total > done ? p->total - done : 0;
+    double eta = p->rate > 0 ? remaining / p->rate : -1;
+    double percent = p->total ? done * 100.0 / p->total : 100.0;
+
+    // The hook shows encryption progress; read-back passes only go to the line and the stream
+    if (p->ctx->progress && p->phase == PROGRESS_ENCRYPT)
+        p->ctx->progress(p->ctx->progress_arg, done, p->total);
+
+    if (p->terminal) {
+        const double gb = 1024.0 * 1024.0 * 1024.0;
+        printf("\r%s: %.2f GB / %.2f GB (%.1f%%)  %.1f MB/s", phases[p->phase].label, done / gb, p->total / gb,
+               percent, p->rate / (1024.0 * 1024.0));
+        if (eta >= 0 && remaining > 0)
+            printf("  ETA %u:%02u:%02u", (unsigned int)(eta / 3600), (unsigned int)eta / 60 % 60,
+                   (unsigned int)eta % 60);
+        printf("  ");
+        fflush(stdout);
+    }
+
+    if (!p->stream)
+        return;
+
+    char line[1024];
+    int len;
+    if (p->ctx->options.progress_format == ETDK_PROGRESS_JSON) {
+        len = snprintf(line, sizeof(line),
+                       "{\"event\":\"%s\",\"phase\":\"%s\",\"target\":\"%s\",\"done\":%llu,\"total\":%llu,"
+                       "\"percent\":%.1f,\"rate\":%.0f,\"eta\":%.0f,\"elapsed\":%.1f",
+                       event, phases[p->phase].name, p->target, (unsigned long long)done,
+                       (unsigned long long)p->total, percent, p->rate, eta, elapsed);
+        if (strcmp(event, "end") == 0)
+            len += snprintf(line + len, sizeof(line) - (size_t)len, ",\"status\":\"%s\"",
+                            status == ETDK_SUCCESS ? "ok" : "error");
+        len += snprintf(line + len, sizeof(line) - (size_t)len, "}\n");
+    } else {
+        len = snprintf(line, sizeof(line), "%s %s %s %llu %llu %.1f %.0f %.0f %.1f%s\n", event,
+                       phases[p->phase].name, p->target, (unsigned long long)done, (unsigned long long)p->total,
+                       percent, p->rate, eta, elapsed,
+                       strcmp(event, "end") == 0 ? (status == ETDK_SUCCESS ? " ok" : " error") : "");
+    }
+    if (len > 0 && (size_t)len < sizeof(line))
+        stream_write(p, line, (size_t)len);
+}
+
+/**
+ * @brief Reporter thread: one report every ETDK_PROGRESS_INTERVAL_MS
+ *
+ * @param arg Pointer to progress_t
+ * @return NULL
+ */
+static void *reporter(void *arg) {
+    progress_t *p = arg;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += ETDK_PROGRESS_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&p->wake, &p->lock, &deadline) == ETIMEDOUT && !p->stop) {
+            pthread_mutex_unlock(&p->lock);
+            pthread_mutex_lock(&p->report_lock);
+            report(p, "progress", ETDK_SUCCESS);
+            pthread_mutex_unlock(&p->report_lock);
+            pthread_mutex_lock(&p->lock);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+/**
+ * @brief Start reporting the progress of an engine run
+ *
+ * The engines only store their byte count with progress_update(); rate,
+ * ETA and all output are computed on a reporter thread at most every
+ * ETDK_PROGRESS_INTERVAL_MS, so fast devices do not pay for thousands of
+ * terminal writes per second. Nothing is drawn on the terminal when
+ * ctx->progress is set (the hook receives the updates instead) or when
+ * the event stream goes to stdout.
+ *
+ * @param ctx Crypto context (progress hook and stream options)
+ * @param phase What is being counted
+ * @param target Device path
+ * @param total Bytes of the run
+ * @param done Bytes already done (resumed runs)
+ * @return Reporter, or NULL if none could be started (progress_update() and progress_finish() accept NULL)
+ */
+progress_t *progress_start(const crypto_context_t *ctx, progress_phase_t phase, const char *target, uint64_t total,
+                           uint64_t done) {
+    if (!ctx || !target) {
+        return NULL;
+    }
+
+    progress_t *p = calloc(1, sizeof(progress_t));
+    if (!p) {
+        return NULL;
+    }
+
+    p->ctx = ctx;
+    p->phase = phase;
+    json_escape(p->target, sizeof(p->target), target);
+    p->total = total;
+    p->done = p->last_done = done;
+    p->stream = ctx->options.progress_format != ETDK_PROGRESS_NONE;
+    p->terminal = !ctx->progress && !(p->stream && ctx->options.progress_fd == STDOUT_FILENO);
+    clock_gettime(CLOCK_MONOTONIC, &p->start);
+    p->last = p->start;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    pthread_mutex_init(&p->report_lock, NULL);
+
+    report(p, "start", ETDK_SUCCESS);
+    p->running = pthread_create(&p->thread, NULL, reporter, p) == 0;
+    return p;
+}
+
+/**
+ * @brief Record the bytes done so far (hot path: one relaxed store)
+ *
+ * @param p Reporter, or NULL
+ * @param done Bytes done
+ */
+void progress_update(progress_t *p, uint64_t done) {
+    if (p)
+        __atomic_store_n(&p->done, done, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Report a milestone of the run (e.g. "critical" with --priority)
+ *
+ * Emitted like a progress event with the given event name, so stream
+ * consumers see when a milestone was reached and at which byte count.
+ *
+ * @param p Reporter, or NULL
+ * @param event Event name
+ */
+void progress_event(progress_t *p, const char *event) {
+    if (!p || !event)
+        return;
+
+    pthread_mutex_lock(&p->report_lock);
+    report(p, event, ETDK_SUCCESS);
+    pthread_mutex_unlock(&p->report_lock);
+}
+
+/**
+ * @brief Stop the reporter and print the final state
+ *
+ * The terminal line is left without a newline; the engine ends it.
+ *
+ * @param p Reporter, or NULL
+ * @param status Result of the run, reported in the "end" event
+ */
+void progress_finish(progress_t *p, int status) {
+    if (!p)
+        return;
+
+    if (p->running) {
+        pthread_mutex_lock(&p->lock);
+        p->stop = 1;
+        pthread_cond_signal(&p->wake);
+        pthread_mutex_unlock(&p->lock);
+        pthread_join(p->thread, NULL);
+    }
+
+    report(p, "end", status);
+    pthread_cond_destroy(&p->wake);
+    pthread_mutex_destroy(&p->lock);
+    pthread_mutex_destroy(&p->report_lock);
+    free(p);
+}
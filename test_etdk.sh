@@ -105,7 +105,271 @@ else
     exit 1
 fi
 
+# Test 6: In-place encryption (no temp file, size preserved)
+echo "TEST 6: Encrypting file in place with ETDK (--in-place)..."
+INPLACE_FILE="inplace.txt"
+echo "$TEST_DATA" > "$INPLACE_FILE"
+INPLACE_SIZE=$(stat -f%z "$INPLACE_FILE" 2>/dev/null || stat -c%s "$INPLACE_FILE" 2>/dev/null)
+echo "YES" | "$ETDK_BIN" --in-place "$INPLACE_FILE" > /tmp/etdk_output.txt 2>&1
+INPLACE_ENCRYPTED_SIZE=$(stat -f%z "$INPLACE_FILE" 2>/dev/null || stat -c%s "$INPLACE_FILE" 2>/dev/null)
+if grep -q "This is a secret" "$INPLACE_FILE" 2>/dev/null; then
+    echo "✗ FAILED: Original text still visible in file!"
+    exit 1
+elif [ "$INPLACE_SIZE" != "$INPLACE_ENCRYPTED_SIZE" ]; then
+    echo "✗ FAILED: Size changed ($INPLACE_SIZE -> $INPLACE_ENCRYPTED_SIZE bytes)"
+    exit 1
+elif [ -e "$INPLACE_FILE.tmp_encrypted" ]; then
+    echo "✗ FAILED: Temporary file left behind"
+    exit 1
+else
+    echo "✓ File encrypted in place ($INPLACE_ENCRYPTED_SIZE bytes, no temp file)"
+fi
+echo ""
+
+# Helpers for the round-trip tests: key and IV from a run's output, per-file IV
+key_of() { awk '/^Key:/ {print $2; exit}' "$1"; }
+iv_of() { awk '/^IV:/ {print $2; exit}' "$1"; }
+# --cipher name of the "Mode: AES-256-XXX" line
+mode_of() { awk '/^Mode:/ {print tolower(substr($2, 9)); exit}' "$1"; }
+# Batch mode: SHA-256(IV || path) truncated to 16 bytes
+file_iv() { { echo -n "$1" | xxd -r -p; printf '%s' "$2"; } | sha256sum | cut -c1-32; }
+fail() {
+    echo "✗ FAILED: $*"
+    exit 1
+}
+
+# Test 7: Batch mode with a sparse and a dense file on one worker
+# The sparse file is encrypted with AES-256-CTR; the dense file after it must still use the run's mode
+echo "TEST 7: Batch mode with a sparse and a dense file..."
+mkdir -p batch
+truncate -s 8M batch/sparse.img
+head -c 1M /dev/urandom | dd of=batch/sparse.img bs=1M seek=3 conv=notrunc status=none
+head -c 300000 /dev/urandom > batch/dense.bin
+cp --sparse=always batch/sparse.img sparse.orig
+cp batch/dense.bin dense.orig
+"$ETDK_BIN" --yes --threads 1 batch > /tmp/etdk_output.txt 2>&1 || fail "batch run"
+KEY=$(key_of /tmp/etdk_output.txt)
+IV=$(iv_of /tmp/etdk_output.txt)
+grep -q "^Mode: AES-256-CBC" /tmp/etdk_output.txt || fail "batch run did not report AES-256-CBC"
+"$ETDK_BIN" --decrypt --cipher ctr --key "$KEY" --iv "$(file_iv "$IV" batch/sparse.img)" \
+    batch/sparse.img sparse.out > /dev/null 2>&1 || fail "decrypting the sparse file"
+"$ETDK_BIN" --decrypt --cipher cbc --key "$KEY" --iv "$(file_iv "$IV" batch/dense.bin)" \
+    batch/dense.bin dense.out > /dev/null 2>&1 || fail "decrypting the dense file"
+cmp -s sparse.out sparse.orig || fail "sparse file does not round-trip"
+cmp -s dense.out dense.orig || fail "dense file after a sparse one does not decrypt with the displayed mode"
+echo "✓ Sparse file (CTR, holes kept) and dense file (CBC) both decrypt to the originals"
+echo ""
+
+# Test 8: Round trip of every file mode, whole file and a range
+echo "TEST 8: Round trip with each --cipher mode and an --offset/--length range..."
+head -c 1048699 /dev/urandom > modes.orig
+tail -c +65537 modes.orig | head -c 200000 > range.orig
+for MODE in cbc ctr gcm; do
+    cp modes.orig "modes.$MODE"
+    "$ETDK_BIN" --yes --cipher "$MODE" "modes.$MODE" > /tmp/etdk_output.txt 2>&1 || fail "encrypting with $MODE"
+    [ "$(mode_of /tmp/etdk_output.txt)" = "$MODE" ] || fail "--cipher $MODE reported $(mode_of /tmp/etdk_output.txt)"
+    KEY=$(key_of /tmp/etdk_output.txt)
+    IV=$(iv_of /tmp/etdk_output.txt)
+    "$ETDK_BIN" --decrypt --cipher "$MODE" --key "$KEY" --iv "$IV" "modes.$MODE" "modes.$MODE.out" > /dev/null 2>&1 ||
+        fail "decrypting $MODE"
+    cmp -s "modes.$MODE.out" modes.orig || fail "$MODE does not round-trip"
+    # CBC takes the ciphertext block before the range as its IV; CTR and GCM need --iv
+    RANGE_IV=(--iv "$IV")
+    [ "$MODE" = cbc ] && RANGE_IV=()
+    "$ETDK_BIN" --decrypt --cipher "$MODE" --key "$KEY" "${RANGE_IV[@]}" --offset 65536 --length 200000 \
+        "modes.$MODE" "range.$MODE.out" > /dev/null 2>&1 || fail "decrypting a $MODE range"
+    cmp -s "range.$MODE.out" range.orig || fail "$MODE range does not round-trip"
+done
+echo "✓ CBC, CTR and GCM decrypt to the original, whole and from byte 65536"
+echo ""
+
+# Test 9: Batch mode over a directory tree, one-step small files and regular files
+echo "TEST 9: Batch mode over a directory with per-file IVs..."
+mkdir -p tree/sub/deep
+echo "$TEST_DATA" > tree/a.txt
+head -c 100000 /dev/urandom > tree/sub/b.bin
+head -c 1048581 /dev/urandom > tree/sub/deep/c.bin
+cp -r tree tree.orig
+"$ETDK_BIN" --yes tree > /tmp/etdk_output.txt 2>&1 || fail "batch run over tree"
+KEY=$(key_of /tmp/etdk_output.txt)
+IV=$(iv_of /tmp/etdk_output.txt)
+MODE=$(mode_of /tmp/etdk_output.txt)
+for FILE in a.txt sub/b.bin sub/deep/c.bin; do
+    "$ETDK_BIN" --decrypt --cipher "$MODE" --key "$KEY" --iv "$(file_iv "$IV" "tree/$FILE")" \
+        "tree/$FILE" file.out > /dev/null 2>&1 || fail "decrypting tree/$FILE"
+    cmp -s file.out "tree.orig/$FILE" || fail "tree/$FILE does not round-trip with its per-file IV"
+    rm -f file.out
+done
+echo "✓ All files of the tree decrypt with SHA-256(IV || path) as their IV"
+echo ""
+
+# Test 10: A single sparse file keeps its holes through encryption and decryption
+echo "TEST 10: Sparse file round trip..."
+truncate -s 16M sparse1.img
+head -c 1M /dev/urandom | dd of=sparse1.img bs=1M seek=5 conv=notrunc status=none
+cp --sparse=always sparse1.img sparse1.orig
+"$ETDK_BIN" --yes sparse1.img > /tmp/etdk_output.txt 2>&1 || fail "encrypting the sparse file"
+grep -q "^Sparse:" /tmp/etdk_output.txt || fail "sparse file not detected"
+"$ETDK_BIN" --decrypt --cipher "$(mode_of /tmp/etdk_output.txt)" --key "$(key_of /tmp/etdk_output.txt)" \
+    --iv "$(iv_of /tmp/etdk_output.txt)" sparse1.img sparse1.out > /dev/null 2>&1 || fail "decrypting the sparse file"
+cmp -s sparse1.out sparse1.orig || fail "sparse file does not round-trip"
+[ "$(du -k sparse1.img | cut -f1)" -lt 4096 ] || fail "holes of the encrypted file were filled"
+[ "$(du -k sparse1.out | cut -f1)" -lt 4096 ] || fail "holes of the decrypted file were filled"
+echo "✓ Sparse file decrypts to the original, holes kept on both sides"
+echo ""
+
+# Test 11: Container round trip, then --destroy
+# A hard link keeps the inode alive, so it shows that the key slot itself was destroyed
+echo "TEST 11: Container round trip and --destroy..."
+cp modes.orig box
+"$ETDK_BIN" --yes --container box > /tmp/etdk_output.txt 2>&1 || fail "creating the container"
+KEY=$(key_of /tmp/etdk_output.txt)
+"$ETDK_BIN" --decrypt --key "$KEY" box box.out > /dev/null 2>&1 || fail "decrypting the container"
+cmp -s box.out modes.orig || fail "container does not round-trip"
+ln box box.link
+"$ETDK_BIN" --yes --destroy box > /tmp/etdk_output.txt 2>&1 || fail "destroying the container"
+[ ! -e box ] || fail "container still exists after --destroy"
+if "$ETDK_BIN" --decrypt --key "$KEY" box.link box.again > /dev/null 2>&1; then
+    fail "container still decrypts after --destroy"
+fi
+echo "✓ Container decrypts with the key and is unreadable after --destroy"
+echo ""
+
+# Test 12: libetdk from an install prefix, shared and static, decrypted with etdk --decrypt
+echo "TEST 12: libetdk stream round trip against the installed header and library..."
+LIBETDK_TESTED=""
+if ! command -v cc > /dev/null 2>&1; then
+    echo "- Skipping: no C compiler"
+else
+    cmake --install "$SCRIPT_DIR/build" --prefix "$TEST_DIR/prefix" > /dev/null || fail "installing into a prefix"
+    [ ! -e prefix/include/etdk.h ] || fail "internal etdk.h was installed"
+    cc -std=c11 -Wall -Wextra -Werror "$SCRIPT_DIR/tests/stream_roundtrip.c" -I prefix/include -L prefix/lib -letdk \
+        -o stream_shared || fail "building against libetdk.so"
+    cc -std=c11 -Wall -Wextra -Werror "$SCRIPT_DIR/tests/stream_roundtrip.c" -I prefix/include \
+        prefix/lib/libetdk.a -lcrypto -lpthread -o stream_static || fail "building against libetdk.a"
+    for MODE in cbc ctr gcm; do
+        for API in fd buffers; do
+            for LINK in shared static; do
+                LD_LIBRARY_PATH=prefix/lib "./stream_$LINK" "$MODE" "$API" < modes.orig > stream.enc \
+                    2> /tmp/etdk_output.txt || fail "$LINK library, $MODE over $API: $(cat /tmp/etdk_output.txt)"
+                "$ETDK_BIN" --decrypt --cipher "$MODE" --key "$(key_of /tmp/etdk_output.txt)" \
+                    --iv "$(iv_of /tmp/etdk_output.txt)" stream.enc stream.out > /dev/null 2>&1 ||
+                    fail "decrypting the $LINK library's $MODE output"
+                cmp -s stream.out modes.orig || fail "$LINK library, $MODE over $API does not round-trip"
+            done
+        done
+    done
+    LIBETDK_TESTED=1
+    echo "✓ Shared and static libetdk streams (fd and buffers, CBC, CTR, GCM) decrypt with etdk --decrypt"
+fi
+echo ""
+
+# Block device tests on loop devices (root only)
+LOOP=""
+RESUME_LOOP=""
+DEVICE_TESTS=""
+RESUME_TESTED=""
+cleanup_devices() {
+    if [ -n "$RESUME_LOOP" ]; then
+        losetup -d "$RESUME_LOOP"
+        RESUME_LOOP=""
+    fi
+    if mountpoint -q "$TEST_DIR/limited"; then
+        umount "$TEST_DIR/limited"
+    fi
+    if [ -n "$LOOP" ]; then
+        losetup -d "$LOOP"
+        LOOP=""
+    fi
+}
+trap cleanup_devices EXIT
+
+head -c 64M /dev/urandom > disk.orig
+cp disk.orig disk.img
+if [ "$(id -u)" -ne 0 ] || ! command -v losetup > /dev/null 2>&1 || ! LOOP=$(losetup -f --show disk.img 2> /dev/null); then
+    LOOP=""
+    echo "- Skipping block device tests 13-16 (need root and a free loop device)"
+    echo ""
+else
+    DEVICE_TESTS=1
+
+    # Test 13: XTS on a device with several workers
+    echo "TEST 13: Device round trip with AES-256-XTS..."
+    "$ETDK_BIN" --yes --cipher xts --threads 4 "$LOOP" > /tmp/etdk_output.txt 2>&1 || fail "encrypting $LOOP with xts"
+    KEY=$(key_of /tmp/etdk_output.txt)
+    "$ETDK_BIN" --decrypt --cipher xts --key "$KEY" "$LOOP" disk.out > /dev/null 2>&1 || fail "decrypting xts"
+    cmp -s disk.out disk.orig || fail "xts device does not round-trip"
+    "$ETDK_BIN" --decrypt --cipher xts --key "$KEY" --offset 8M --length 1M "$LOOP" disk.out > /dev/null 2>&1 ||
+        fail "decrypting an xts range"
+    cmp -s disk.out <(tail -c +8388609 disk.orig | head -c 1048576) || fail "xts range does not round-trip"
+    echo "✓ XTS device decrypts to the original, whole and from byte 8M"
+    echo ""
+
+    # Test 14: Priority regions are encrypted out of order but with the same keystream
+    echo "TEST 14: Device round trip with --priority..."
+    dd if=disk.orig of="$LOOP" bs=1M conv=fsync status=none
+    "$ETDK_BIN" --yes --priority=auto,16M:4M "$LOOP" > /tmp/etdk_output.txt 2>&1 || fail "encrypting with --priority"
+    grep -q "^Priority:" /tmp/etdk_output.txt || fail "no priority regions reported"
+    "$ETDK_BIN" --decrypt --cipher "$(mode_of /tmp/etdk_output.txt)" --key "$(key_of /tmp/etdk_output.txt)" \
+        --iv "$(iv_of /tmp/etdk_output.txt)" "$LOOP" disk.out > /dev/null 2>&1 || fail "decrypting after --priority"
+    cmp -s disk.out disk.orig || fail "--priority device does not round-trip"
+    echo "✓ Device encrypted priority regions first and decrypts to the original"
+    echo ""
+
+    # Test 15: Resume after a failed write
+    # The loop device sits on a sparse image in a small tmpfs: writes fail once it is full,
+    # and growing the tmpfs lets --resume finish. Only the reported double-encrypted range is lost.
+    echo "TEST 15: Interrupted device run resumed from --key-file..."
+    mkdir -p limited
+    if ! mount -t tmpfs -o size=40M tmpfs limited 2> /dev/null; then
+        echo "- Skipping: cannot mount a tmpfs"
+    else
+        truncate -s 64M limited/disk.img
+        head -c 8M disk.orig | dd of=limited/disk.img conv=notrunc status=none
+        cp --sparse=always limited/disk.img resume.orig
+        RESUME_LOOP=$(losetup -f --show limited/disk.img) || fail "no loop device for the resume test"
+        if "$ETDK_BIN" --yes --cipher cbc --key-file resume.key "$RESUME_LOOP" > /tmp/etdk_output.txt 2>&1; then
+            fail "run on the full tmpfs did not fail"
+        fi
+        [ -f resume.key ] || fail "key file removed after a failed run"
+        mount -o remount,size=128M limited
+        "$ETDK_BIN" --yes --key-file resume.key --resume "$RESUME_LOOP" > /tmp/etdk_output.txt 2>&1 ||
+            fail "resuming from the key file"
+        [ ! -e resume.key ] || fail "key file not destroyed after the resumed run"
+        KEY=$(key_of /tmp/etdk_output.txt)
+        IV=$(iv_of /tmp/etdk_output.txt)
+        SEGMENT=$(awk '/from byte/ {n++} n == 2 {sub(":", "", $3); print $3; exit}' /tmp/etdk_output.txt)
+        LOST_END=$(awk '/^    bytes / {split($2, r, "-"); print r[2] + 1; exit}' /tmp/etdk_output.txt)
+        [ -n "$SEGMENT" ] && [ -n "$LOST_END" ] || fail "resumed run did not report its segments"
+        "$ETDK_BIN" --decrypt --cipher cbc --key "$KEY" --iv "$IV" --length "$SEGMENT" "$RESUME_LOOP" resume.out \
+            > /dev/null 2>&1 || fail "decrypting the first segment"
+        cmp -s resume.out <(head -c "$SEGMENT" resume.orig) || fail "first segment does not round-trip"
+        "$ETDK_BIN" --decrypt --cipher cbc --key "$KEY" --offset "$LOST_END" "$RESUME_LOOP" resume.out \
+            > /dev/null 2>&1 || fail "decrypting the resumed segment"
+        cmp -s resume.out <(tail -c +$((LOST_END + 1)) resume.orig) || fail "resumed segment does not round-trip"
+        losetup -d "$RESUME_LOOP"
+        RESUME_LOOP=""
+        umount limited
+        RESUME_TESTED=1
+        echo "✓ Both segments decrypt to the original outside the reported range (bytes $SEGMENT-$((LOST_END - 1)))"
+    fi
+    echo ""
+
+    # Test 16: Overwrite mode shows no key and leaves no plaintext behind
+    echo "TEST 16: Device --mode overwrite..."
+    dd if=disk.orig of="$LOOP" bs=1M conv=fsync status=none
+    "$ETDK_BIN" --yes --mode overwrite --verify "$LOOP" > /tmp/etdk_output.txt 2>&1 || fail "overwriting $LOOP"
+    grep -q "^Key: not displayed" /tmp/etdk_output.txt || fail "--mode overwrite displayed a key"
+    grep -q "4096 of 4096 sampled blocks rewritten" /tmp/etdk_output.txt || fail "--verify found plaintext blocks"
+    if cmp -s <(head -c 1M "$LOOP") <(head -c 1M disk.orig); then
+        fail "first megabyte unchanged by --mode overwrite"
+    fi
+    echo "✓ Device overwritten with keystream, no key shown, sampled blocks verified"
+    echo ""
+fi
+
 # Cleanup
+cleanup_devices
 cd /
 rm -rf "$TEST_DIR"
 rm -f /tmp/etdk_output.txt
@@ -116,6 +380,18 @@ echo "=========================================="
 echo ""
 echo "Summary:"
 echo "  ✓ File encryption works correctly"
+echo "  ✓ In-place encryption keeps the file size"
+echo "  ✓ Batch mode keeps the run's mode after a sparse file"
+echo "  ✓ CBC, CTR, GCM, ranges, batch trees, sparse files and containers round-trip with --decrypt"
+if [ -n "$LIBETDK_TESTED" ]; then
+    echo "  ✓ libetdk streams built against the installed header round-trip"
+fi
+if [ -n "$DEVICE_TESTS" ]; then
+    echo "  ✓ XTS, --priority and --mode overwrite work on block devices"
+fi
+if [ -n "$RESUME_TESTED" ]; then
+    echo "  ✓ An interrupted device run resumes from its key file"
+fi
 echo "  ✓ Original content is unreadable after encryption"
 echo "  ✓ Encryption key was displayed and wiped"
 echo ""
@@ -0,0 +1,169 @@
+/*
+ * ETDK - Encrypt-then-Delete-Key
+ * stream_roundtrip - libetdk test program, built by test_etdk.sh against the installed library
+ *
+ *   stream_roundtrip cbc|ctr|gcm fd|buffers < plaintext > ciphertext
+ *
+ * Encrypts stdin to stdout with crypto_stream_fd() or begin/update/finish
+ * and prints the handed-off key as "Key:", "IV:" and "Mode:" lines on
+ * stderr, like etdk, so the script can decrypt the output with
+ * etdk --decrypt and compare it with cmp.
+ *
+ * First it also opens several streams at once and checks that aborting
+ * some of them leaves the key pages of the others locked (Linux, when
+ * /proc/self/smaps exists and locking is permitted).
+ */
+
+#include <etdk_stream.h>
+// cppcheck-suppress-begin missingIncludeSystem
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+// cppcheck-suppress-end missingIncludeSystem
+
+/** @brief Streams open at once for the locking check */
+#define OPEN_STREAMS 8
+
+/** @brief Odd piece size for the buffers mode, so CBC has to hold back partial blocks */
+#define PIECE_SIZE 1000
+
+/**
+ * @brief Print key, IV and mode of a finished stream (crypto_key_fn)
+ */
+static void print_key(void *arg, const uint8_t *key, size_t key_len, const uint8_t *iv, etdk_cipher_t mode) {
+    static const char *const names[] = {"AES-256-CBC", "AES-256-CTR", "AES-256-XTS", "AES-256-GCM"};
+    (void)arg;
+
+    fprintf(stderr, "Key: ");
+    for (size_t i = 0; i < key_len; i++)
+        fprintf(stderr, "%02x", key[i]);
+    fprintf(stderr, "\nIV: ");
+    for (size_t i = 0; i < ETDK_STREAM_IV_SIZE; i++)
+        fprintf(stderr, "%02x", iv[i]);
+    fprintf(stderr, "\nMode: %s\n", names[mode]);
+}
+
+/**
+ * @brief Locked kilobytes of the mapping that contains addr
+ *
+ * @return Locked: value from /proc/self/smaps, or -1 if unavailable
+ */
+static long locked_kb(const void *addr) {
+    FILE *f = fopen("/proc/self/smaps", "r");
+    if (!f) {
+        return -1;
+    }
+
+    char line[512];
+    unsigned long a = (unsigned long)addr;
+    int inside = 0;
+    long kb = -1;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long lo, hi;
+        if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2)
+            inside = a >= lo && a < hi;
+        else if (inside && sscanf(line, "Locked: %ld kB", &kb) == 1)
+            break;
+    }
+    fclose(f);
+    return kb;
+}
+
+/**
+ * @brief Abort every other of several open streams and check the rest stay locked
+ *
+ * @return 0 if every remaining stream is still locked (or locking cannot be measured), 1 otherwise
+ */
+static int check_locking(etdk_cipher_t mode) {
+    crypto_stream_config_t config = {mode, 0, NULL, NULL, NULL};
+    crypto_stream_t *s[OPEN_STREAMS];
+    int locked[OPEN_STREAMS];
+    int failed = 0;
+
+    for (int i = 0; i < OPEN_STREAMS; i++) {
+        if (crypto_stream_begin(&s[i], &config) != ETDK_SUCCESS) {
+            fprintf(stderr, "crypto_stream_begin failed\n");
+            while (i-- > 0)
+                crypto_stream_abort(s[i]);
+            return 1;
+        }
+    }
+    for (int i = 0; i < OPEN_STREAMS; i++)
+        locked[i] = locked_kb(s[i]) > 0;
+
+    for (int i = 1; i < OPEN_STREAMS; i += 2) {
+        crypto_stream_abort(s[i]);
+        s[i] = NULL;
+    }
+    for (int i = 0; i < OPEN_STREAMS; i += 2) {
+        if (locked[i] && locked_kb(s[i]) <= 0) {
+            fprintf(stderr, "Aborting a stream unlocked the key of stream %d\n", i);
+            failed = 1;
+        }
+    }
+
+    for (int i = 0; i < OPEN_STREAMS; i++)
+        crypto_stream_abort(s[i]);
+    return failed;
+}
+
+/**
+ * @brief Encrypt stdin to stdout with begin/update/finish in PIECE_SIZE steps
+ */
+static int encrypt_buffers(const crypto_stream_config_t *config) {
+    unsigned char in[PIECE_SIZE];
+    unsigned char out[PIECE_SIZE + ETDK_STREAM_TRAILER_MAX];
+    crypto_stream_t *s;
+    size_t outlen;
+
+    if (crypto_stream_begin(&s, config) != ETDK_SUCCESS) {
+        return ETDK_ERROR_CRYPTO;
+    }
+
+    size_t n;
+    while ((n = fread(in, 1, sizeof(in), stdin)) > 0) {
+        if (crypto_stream_update(s, in, n, out, &outlen) != ETDK_SUCCESS) {
+            crypto_stream_abort(s);
+            return ETDK_ERROR_CRYPTO;
+        }
+        if (fwrite(out, 1, outlen, stdout) != outlen) {
+            crypto_stream_abort(s);
+            return ETDK_ERROR_IO;
+        }
+    }
+
+    if (crypto_stream_finish(s, out, &outlen) != ETDK_SUCCESS) {
+        return ETDK_ERROR_CRYPTO;
+    }
+    if (fwrite(out, 1, outlen, stdout) != outlen || fflush(stdout) != 0) {
+        return ETDK_ERROR_IO;
+    }
+    return ETDK_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s cbc|ctr|gcm fd|buffers < plaintext > ciphertext\n", argv[0]);
+        return 2;
+    }
+
+    crypto_stream_config_t config = {ETDK_CIPHER_CBC, 0, NULL, print_key, NULL};
+    if (strcmp(argv[1], "ctr") == 0)
+        config.mode = ETDK_CIPHER_CTR;
+    else if (strcmp(argv[1], "gcm") == 0)
+        config.mode = ETDK_CIPHER_GCM;
+    else if (strcmp(argv[1], "cbc") != 0)
+        return 2;
+
+    if (check_locking(config.mode) != 0) {
+        return 1;
+    }
+
+    int result = strcmp(argv[2], "fd") == 0 ? crypto_stream_fd(STDIN_FILENO, STDOUT_FILENO, &config)
+                                            : encrypt_buffers(&config);
+    if (result != ETDK_SUCCESS) {
+        fprintf(stderr, "Stream encryption failed: %d\n", result);
+        return 1;
+    }
+    return 0;
+}